@@ -1,3 +1,17 @@
 #!/bin/bash
 glslangValidator -V main.vert
 glslangValidator -V main.frag
+glslangValidator -V mesh.vert -o mesh_vert.spv
+glslangValidator -V mesh.frag -o mesh_frag.spv
+glslangValidator -V material.frag -o material_frag.spv
+glslangValidator -V -DBINDLESS material.frag -o material_bindless_frag.spv
+glslangValidator -V cull.comp -o cull_comp.spv
+glslangValidator -V --target-env vulkan1.2 meshlet.task -o meshlet_task.spv
+glslangValidator -V --target-env vulkan1.2 meshlet.mesh -o meshlet_mesh.spv
+glslangValidator -V particles.comp -o particles_comp.spv
+glslangValidator -V particles_finalize.comp -o particles_finalize_comp.spv
+glslangValidator -V particles.vert -o particles_vert.spv
+glslangValidator -V particles.frag -o particles_frag.spv
+glslangValidator -V bloom_down.comp -o bloom_down_comp.spv
+glslangValidator -V bloom_up.comp -o bloom_up_comp.spv
+glslangValidator -V composite.comp -o composite_comp.spv
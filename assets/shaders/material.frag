@@ -0,0 +1,58 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+/*
+ * Fragment shader of the vertex path of the meshes.
+ *
+ * BINDLESS : one set holds every texture and material buffer, the material
+ * index comes from the push constants and the texture index from the material.
+ * Otherwise the draw binds a set with its own texture and material.
+ */
+
+struct Material
+{
+	vec4 color;
+	uint texture;		/* bindless texture index */
+	uint padding0;
+	uint padding1;
+	uint padding2;
+};
+
+layout(push_constant) uniform PushConstants {
+	mat4 viewProjection;
+	vec4 positionScale;
+	vec4 positionOffset;
+	uint material;
+} push;
+
+#ifdef BINDLESS
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+layout(set = 0, binding = 1) readonly buffer MaterialBuffer {
+	Material material;
+} materials[];
+#else
+layout(set = 0, binding = 0) uniform sampler2D materialTexture;
+layout(set = 0, binding = 1) readonly buffer MaterialBuffer {
+	Material material;
+} materialBuffer;
+#endif
+
+layout(location = 0) in vec3 v_color;
+layout(location = 1) in vec2 v_uv;
+layout(location = 0) out vec4 out_color;
+
+void main() {
+#ifdef BINDLESS
+	/* dynamically uniform : the same for the whole draw */
+	Material material = materials[push.material].material;
+	vec4 texel = texture(textures[material.texture], v_uv);
+#else
+	Material material = materialBuffer.material;
+	vec4 texel = texture(materialTexture, v_uv);
+#endif
+
+    out_color = vec4(v_color * material.color.rgb * texel.rgb, 1.0);
+}
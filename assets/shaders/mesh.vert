@@ -0,0 +1,52 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(push_constant) uniform PushConstants {
+	mat4 viewProjection;
+	vec4 positionScale;		/* w : LOD index */
+	vec4 positionOffset;
+	uint material;
+} push;
+
+layout(location = 0) in vec4 in_position;
+layout(location = 1) in vec2 in_normal;
+layout(location = 2) in vec2 in_uv;
+layout(location = 3) in mat4 in_world;		/* per instance, locations 3 to 6 */
+
+layout(location = 0) out vec3 v_color;
+layout(location = 1) out vec2 v_uv;
+
+const vec3 lodColors[8] = vec3[](
+	vec3(1.0, 1.0, 1.0),
+	vec3(0.6, 1.0, 0.6),
+	vec3(0.6, 0.6, 1.0),
+	vec3(1.0, 1.0, 0.5),
+	vec3(1.0, 0.6, 1.0),
+	vec3(0.5, 1.0, 1.0),
+	vec3(1.0, 0.7, 0.4),
+	vec3(1.0, 0.4, 0.4)
+);
+
+vec3 decodeOctahedral (vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main() {
+	vec3 position = push.positionOffset.xyz + in_position.xyz * push.positionScale.xyz;
+	gl_Position = push.viewProjection * in_world * vec4(position, 1.0);
+
+	/* uniform scale : no inverse transpose needed */
+	vec3 normal = normalize(mat3(in_world) * decodeOctahedral(in_normal));
+	float light = 0.25 + 0.75 * max(dot(normal, normalize(vec3(0.4, 0.8, 0.4))), 0.0);
+	v_color = light * lodColors[int(push.positionScale.w) & 7];
+	v_uv = in_uv;
+}
@@ -0,0 +1,36 @@
+/* Meshlet layout, push constants and culling shared by cull.comp and meshlet.task */
+
+struct Meshlet {
+	vec4 sphere;		/* center, radius */
+	vec4 cone;			/* axis, cutoff */
+	uvec4 ranges;		/* vertex offset, triangle byte offset, index offset, vertex count | triangle count << 8 */
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Meshlets {
+	Meshlet meshlets[];
+};
+
+layout(push_constant) uniform PushConstants {
+	mat4 transform;
+	vec4 positionScale;
+	vec4 positionOffset;
+	vec4 eye;			/* object space */
+	uvec4 range;		/* meshlet offset, meshlet count, command offset */
+} push;
+
+bool visible (Meshlet meshlet)
+{
+	vec3 center = meshlet.sphere.xyz;
+	float radius = meshlet.sphere.w;
+
+	/* clip space planes of the object : rows of the transform, near plane at z = 0 */
+	mat4 m = transpose(push.transform);
+	vec4 planes[5] = vec4[](m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[2]);
+
+	for (int i = 0; i < 5; i++)
+		if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz))
+			return false;
+
+	vec3 view = center - push.eye.xyz;
+	return dot(view, meshlet.cone.xyz) < meshlet.cone.w * length(view) + radius;
+}
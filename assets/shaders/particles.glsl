@@ -0,0 +1,13 @@
+/* Particle layout and push constants shared by the particle compute and vertex shaders */
+
+struct Particle {
+	vec4 position;		/* xyz, remaining life in seconds */
+	vec4 velocity;		/* xyz, lifetime in seconds */
+};
+
+layout(push_constant) uniform PushConstants {
+	mat4 viewProjection;
+	vec4 emitter;		/* position, spread */
+	vec4 time;			/* delta time, time */
+	uvec4 counts;		/* particles emitted per frame, capacity, seed */
+} push;
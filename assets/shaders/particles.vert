@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "particles.glsl"
+
+/* No vertex input : one point per particle of the simulation output */
+
+out gl_PerVertex {
+	vec4 gl_Position;
+	float gl_PointSize;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Particles {
+	Particle particles[];
+};
+
+layout(location = 0) out vec3 v_color;
+
+void main() {
+	Particle particle = particles[gl_VertexIndex];
+
+	gl_Position = push.viewProjection * vec4(particle.position.xyz, 1.0);
+	gl_PointSize = 1.0;
+
+	/* white hot when emitted, fading to red */
+	float age = clamp(particle.position.w / particle.velocity.w, 0.0, 1.0);
+	v_color = mix(vec3(0.3, 0.02, 0.0), vec3(1.0, 0.9, 0.6), age) * 0.5;
+}
@@ -0,0 +1,48 @@
+/* Bindings, push constants and helpers shared by the post processing compute shaders */
+
+#define POST_GROUP_SIZE 8
+#define POST_TILE_SIZE 16
+
+#define POST_FLAG_PREFILTER 1u
+#define POST_FLAG_ENCODE_SRGB 2u
+#define POST_FLAG_FXAA 4u
+#define POST_FLAG_BLOOM_UPSAMPLE 8u
+
+/* the scene, and every level of the bloom pyramid */
+layout(set = 0, binding = 0) uniform sampler2D hdrImage;
+layout(set = 0, binding = 1) uniform sampler2D bloomImage;
+
+layout(push_constant) uniform PushConstants {
+	vec4 texelSize;			/* 1 / target size, 1 / source size */
+	float threshold;
+	float intensity;
+	float exposure;
+	uint sourceLevel;
+	uint flags;
+	uint padding;
+	vec2 sceneScale;		/* the part of hdrImage the scene was drawn into */
+} post;
+
+/* uv over the whole screen to uv in hdrImage, kept half a texel inside what was drawn */
+vec2 sceneUv (vec2 uv, vec2 hdrTexel)
+{
+	return min(uv * post.sceneScale, post.sceneScale - 0.5 * hdrTexel);
+}
+
+/* 3x3 tent around uv, offsets of one source texel */
+vec3 tentFilter (sampler2D image, vec2 uv, vec2 texel, float lod)
+{
+	vec3 color = textureLod(image, uv, lod).rgb * 4.0;
+
+	color += textureLod(image, uv + vec2(-texel.x, 0.0), lod).rgb * 2.0;
+	color += textureLod(image, uv + vec2(texel.x, 0.0), lod).rgb * 2.0;
+	color += textureLod(image, uv + vec2(0.0, -texel.y), lod).rgb * 2.0;
+	color += textureLod(image, uv + vec2(0.0, texel.y), lod).rgb * 2.0;
+
+	color += textureLod(image, uv + vec2(-texel.x, -texel.y), lod).rgb;
+	color += textureLod(image, uv + vec2(texel.x, -texel.y), lod).rgb;
+	color += textureLod(image, uv + vec2(-texel.x, texel.y), lod).rgb;
+	color += textureLod(image, uv + vec2(texel.x, texel.y), lod).rgb;
+
+	return color * (1.0 / 16.0);
+}
@@ -0,0 +1,239 @@
+#include "allocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+
+/* Global heap counters */
+
+static std::atomic<uint64_t> g_heapAllocations(0);
+static std::atomic<uint64_t> g_heapFrees(0);
+static std::atomic<size_t> g_heapBytes(0);
+static thread_local bool t_heapUntracked = false;
+
+uint64_t heapAllocationCount ()
+{
+	return g_heapAllocations.load(std::memory_order_relaxed);
+}
+
+void untrackHeapAllocations (bool untracked)
+{
+	t_heapUntracked = untracked;
+}
+
+uint64_t heapFreeCount ()
+{
+	return g_heapFrees.load(std::memory_order_relaxed);
+}
+
+size_t heapBytesAllocated ()
+{
+	return g_heapBytes.load(std::memory_order_relaxed);
+}
+
+static void *countedMalloc (size_t size)
+{
+	if (!t_heapUntracked)
+		g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	g_heapBytes.fetch_add(size, std::memory_order_relaxed);
+
+	void *memory = std::malloc(size ? size : 1);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+
+	return memory;
+}
+
+static void countedFree (void *memory)
+{
+	if (memory == nullptr) return;
+
+	g_heapFrees.fetch_add(1, std::memory_order_relaxed);
+	std::free(memory);
+}
+
+void *operator new (size_t size) { return countedMalloc(size); }
+void *operator new[] (size_t size) { return countedMalloc(size); }
+void operator delete (void *memory) noexcept { countedFree(memory); }
+void operator delete[] (void *memory) noexcept { countedFree(memory); }
+void operator delete (void *memory, size_t) noexcept { countedFree(memory); }
+void operator delete[] (void *memory, size_t) noexcept { countedFree(memory); }
+
+void *operator new (size_t size, const std::nothrow_t&) noexcept
+{
+	try { return countedMalloc(size); }
+	catch (...) { return nullptr; }
+}
+
+void *operator new[] (size_t size, const std::nothrow_t&) noexcept
+{
+	try { return countedMalloc(size); }
+	catch (...) { return nullptr; }
+}
+
+void operator delete (void *memory, const std::nothrow_t&) noexcept { countedFree(memory); }
+void operator delete[] (void *memory, const std::nothrow_t&) noexcept { countedFree(memory); }
+
+/* Aligned host blocks : the header right before the user pointer keeps the raw block and its size */
+
+struct BlockHeader
+{
+	void *raw;
+	size_t size;
+};
+
+static void *alignedMalloc (size_t size, size_t alignment)
+{
+	if (alignment < alignof(BlockHeader))
+		alignment = alignof(BlockHeader);
+
+	char *raw = static_cast<char*>(std::malloc(size + alignment + sizeof(BlockHeader)));
+	if (raw == nullptr)
+		return nullptr;
+
+	uintptr_t address = reinterpret_cast<uintptr_t>(raw + sizeof(BlockHeader));
+	address = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+	BlockHeader *header = reinterpret_cast<BlockHeader*>(address) - 1;
+	header->raw = raw;
+	header->size = size;
+
+	return reinterpret_cast<void*>(address);
+}
+
+static BlockHeader *blockHeader (void *memory)
+{
+	return reinterpret_cast<BlockHeader*>(memory) - 1;
+}
+
+/* LinearAllocator */
+
+LinearAllocator::LinearAllocator (size_t capacity)
+	: base(static_cast<char*>(alignedMalloc(capacity, 64))), capacity(capacity), offset(0), peak(0)
+{
+	if (base == nullptr)
+		throw std::runtime_error("failed to allocate linear allocator storage!");
+}
+
+LinearAllocator::~LinearAllocator ()
+{
+	std::free(blockHeader(base)->raw);
+}
+
+void *LinearAllocator::allocate (size_t size, size_t alignment)
+{
+	size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+
+	if (aligned + size > capacity)
+		throw std::runtime_error("linear allocator out of memory!");
+
+	offset = aligned + size;
+	peak = std::max(peak, offset);
+
+	return base + aligned;
+}
+
+void LinearAllocator::reset ()
+{
+	offset = 0;
+}
+
+/* VulkanHostAllocator */
+
+VulkanHostAllocator::VulkanHostAllocator ()
+	: allocations(0), internalAllocations(0), bytesInUse(0), peakBytes(0)
+{
+	for (auto& scope : scopeBytes)
+		scope.store(0);
+
+	allocationCallbacks.pUserData = this;
+	allocationCallbacks.pfnAllocation = &VulkanHostAllocator::allocation;
+	allocationCallbacks.pfnReallocation = &VulkanHostAllocator::reallocation;
+	allocationCallbacks.pfnFree = &VulkanHostAllocator::deallocation;
+	allocationCallbacks.pfnInternalAllocation = &VulkanHostAllocator::internalAllocation;
+	allocationCallbacks.pfnInternalFree = &VulkanHostAllocator::internalFree;
+}
+
+void VulkanHostAllocator::track (size_t size, VkSystemAllocationScope scope)
+{
+	size_t current = bytesInUse.fetch_add(size, std::memory_order_relaxed) + size;
+	scopeBytes[scope].fetch_add(size, std::memory_order_relaxed);
+
+	size_t previousPeak = peakBytes.load(std::memory_order_relaxed);
+	while (current > previousPeak && !peakBytes.compare_exchange_weak(previousPeak, current, std::memory_order_relaxed));
+}
+
+void VulkanHostAllocator::untrack (size_t size, VkSystemAllocationScope scope)
+{
+	bytesInUse.fetch_sub(size, std::memory_order_relaxed);
+	scopeBytes[scope].fetch_sub(size, std::memory_order_relaxed);
+}
+
+VKAPI_ATTR void* VKAPI_CALL VulkanHostAllocator::allocation (void *userData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	VulkanHostAllocator *self = static_cast<VulkanHostAllocator*>(userData);
+
+	void *memory = alignedMalloc(size + sizeof(VkSystemAllocationScope), alignment);
+	if (memory == nullptr)
+		return nullptr;
+
+	/* the scope is stashed after the user data so free can untrack the right bucket */
+	std::memcpy(static_cast<char*>(memory) + size, &scope, sizeof(scope));
+	blockHeader(memory)->size = size;
+
+	self->allocations.fetch_add(1, std::memory_order_relaxed);
+	self->track(size, scope);
+
+	return memory;
+}
+
+VKAPI_ATTR void* VKAPI_CALL VulkanHostAllocator::reallocation (void *userData, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (original == nullptr)
+		return allocation(userData, size, alignment, scope);
+
+	if (size == 0)
+	{
+		deallocation(userData, original);
+		return nullptr;
+	}
+
+	void *memory = allocation(userData, size, alignment, scope);
+	if (memory == nullptr)
+		return nullptr;
+
+	std::memcpy(memory, original, std::min(size, blockHeader(original)->size));
+	deallocation(userData, original);
+
+	return memory;
+}
+
+VKAPI_ATTR void VKAPI_CALL VulkanHostAllocator::deallocation (void *userData, void *memory)
+{
+	if (memory == nullptr) return;
+
+	VulkanHostAllocator *self = static_cast<VulkanHostAllocator*>(userData);
+	BlockHeader *header = blockHeader(memory);
+
+	VkSystemAllocationScope scope;
+	std::memcpy(&scope, static_cast<char*>(memory) + header->size, sizeof(scope));
+
+	self->untrack(header->size, scope);
+	std::free(header->raw);
+}
+
+VKAPI_ATTR void VKAPI_CALL VulkanHostAllocator::internalAllocation (void *userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope)
+{
+	VulkanHostAllocator *self = static_cast<VulkanHostAllocator*>(userData);
+
+	self->internalAllocations.fetch_add(1, std::memory_order_relaxed);
+	self->track(size, scope);
+}
+
+VKAPI_ATTR void VKAPI_CALL VulkanHostAllocator::internalFree (void *userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope)
+{
+	VulkanHostAllocator *self = static_cast<VulkanHostAllocator*>(userData);
+
+	self->untrack(size, scope);
+}
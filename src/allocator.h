@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+/*
+ * Heap counters, fed by the operator new / delete replacements in allocator.cpp.
+ * heapAllocationCount counts every thread, the thread pool workers included,
+ * but the ones that called untrackHeapAllocations() : background threads that
+ * allocate on their own schedule (streaming, readback, shader reload) would
+ * show up in whichever frame they overlap.
+ */
+
+uint64_t heapAllocationCount ();
+uint64_t heapFreeCount ();
+size_t heapBytesAllocated ();
+
+/* the calling thread's allocations are left out of heapAllocationCount, until called with false */
+void untrackHeapAllocations (bool untracked = true);
+
+/* Linear (bump) allocator for transient CPU data, reset once per frame */
+
+class LinearAllocator
+{
+private:
+	char *base;
+	size_t capacity;
+	size_t offset;
+	size_t peak;
+
+public:
+	explicit LinearAllocator (size_t capacity);
+	~LinearAllocator ();
+
+	LinearAllocator (const LinearAllocator&) = delete;
+	LinearAllocator& operator= (const LinearAllocator&) = delete;
+
+	void *allocate (size_t size, size_t alignment = alignof(std::max_align_t));
+	void reset ();
+
+	template <typename T>
+	T *allocate (size_t count)
+	{
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	size_t used () const { return offset; }
+	size_t highWaterMark () const { return peak; }
+	size_t size () const { return capacity; }
+};
+
+/* std allocator adapter so containers can live in a LinearAllocator for one frame */
+
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	LinearAllocator *arena;
+
+	explicit ArenaAllocator (LinearAllocator *arena) : arena(arena) {}
+
+	template <typename U>
+	ArenaAllocator (const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T *allocate (size_t count) { return arena->allocate<T>(count); }
+	void deallocate (T *, size_t) {}
+
+	template <typename U>
+	bool operator== (const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template <typename U>
+	bool operator!= (const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+/* VkAllocationCallbacks that route driver host allocations through tracked malloc */
+
+class VulkanHostAllocator
+{
+private:
+	VkAllocationCallbacks allocationCallbacks;
+
+	std::atomic<uint64_t> allocations;
+	std::atomic<uint64_t> internalAllocations;
+	std::atomic<size_t> bytesInUse;
+	std::atomic<size_t> peakBytes;
+	std::atomic<size_t> scopeBytes[VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1];
+
+	static VKAPI_ATTR void* VKAPI_CALL allocation (void *userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void* VKAPI_CALL reallocation (void *userData, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL deallocation (void *userData, void *memory);
+	static VKAPI_ATTR void VKAPI_CALL internalAllocation (void *userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL internalFree (void *userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+	void track (size_t size, VkSystemAllocationScope scope);
+	void untrack (size_t size, VkSystemAllocationScope scope);
+
+public:
+	VulkanHostAllocator ();
+
+	VulkanHostAllocator (const VulkanHostAllocator&) = delete;
+	VulkanHostAllocator& operator= (const VulkanHostAllocator&) = delete;
+
+	const VkAllocationCallbacks *callbacks () const { return &allocationCallbacks; }
+
+	uint64_t allocationCount () const { return allocations.load(std::memory_order_relaxed); }
+	uint64_t internalAllocationCount () const { return internalAllocations.load(std::memory_order_relaxed); }
+	size_t bytes () const { return bytesInUse.load(std::memory_order_relaxed); }
+	size_t peak () const { return peakBytes.load(std::memory_order_relaxed); }
+	size_t bytes (VkSystemAllocationScope scope) const { return scopeBytes[scope].load(std::memory_order_relaxed); }
+};
@@ -4,24 +4,6 @@
 /* Static functions */
 
 
-static std::vector<char> readFile (const std::string& filename)
-{
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open())
-        throw std::runtime_error("failed to open file!");
-
-	size_t fileSize = (size_t) file.tellg();
-	std::vector<char> buffer(fileSize);
-
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
-
-	return buffer;
-}
-
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback (
 	    VkDebugReportFlagsEXT flags,
 	    VkDebugReportObjectTypeEXT objType,
@@ -37,24 +19,185 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback (
     return VK_FALSE;
 }
 
+static bool hasDeviceExtension (VkPhysicalDevice device, const char *name)
+{
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions)
+		if (strcmp(extension.extensionName, name) == 0)
+			return true;
+
+	return false;
+}
+
+static const char *geometryPathName (GeometryPath path)
+{
+	switch (path)
+	{
+		case GEOMETRY_PATH_COMPUTE_CULLING: return "meshlets culled in compute, multi draw indirect";
+		case GEOMETRY_PATH_MESH_SHADER: return "meshlets culled in task shaders, mesh shaders";
+		default: return "whole LODs, no cluster culling";
+	}
+}
+
 /* App class */
 
+App::App ()
+	: instanceApiVersion(VK_API_VERSION_1_0),
+	frameFence(VK_NULL_HANDLE),
+	submittedFrame(0),
+	meshPipelineLayout(VK_NULL_HANDLE),
+	meshPipeline(VK_NULL_HANDLE),
+	meshletSetLayout(VK_NULL_HANDLE),
+	meshletPipelineLayout(VK_NULL_HANDLE),
+	cullPipeline(VK_NULL_HANDLE),
+	meshletPipeline(VK_NULL_HANDLE),
+	requestedSamples(MSAA_SAMPLES),
+	msaaSamples(VK_SAMPLE_COUNT_1_BIT),
+	transientMemoryProperties(0),
+	dynamicRenderingRequested(true),
+	dynamicRenderingEnabled(false),
+#ifdef VK_KHR_dynamic_rendering
+	cmdBeginRendering(nullptr),
+	cmdEndRendering(nullptr),
+#endif
+	framebuffersCreated(0),
+	resizeCount(0),
+	resizeMilliseconds(0.0),
+	resizePeakMilliseconds(0.0),
+	frameAllocator(FRAME_ALLOCATOR_SIZE),
+	warmupFramesLeft(STEADY_STATE_WARMUP_FRAMES),
+	steadyStateFrames(0),
+	steadyStateHeapAllocations(0),
+	steadyStateVulkanAllocations(0),
+	frameIndex(0),
+	memoryBudgetEnabled(false),
+	memoryCap(0),
+	textureHeap(0),
+	textureBudget(TEXTURE_MEMORY_BUDGET),
+	lastMemoryRefresh(0.0),
+	lastMemoryReport(0.0),
+	pipelineWarmupVariants(0),
+	meshGridSpacing(1.0f),
+	cameraFar(1.0f),
+	frameAlpha(0.0f),
+	frameTime(0.0),
+	lastFrameTime(0.0),
+	rendering(false),
+	framebufferResized(false),
+	windowWidth(WIDTH),
+	windowHeight(HEIGHT),
+	renderFrames(0),
+	staleFrames(0),
+	renderMilliseconds(0.0),
+	renderPeakMilliseconds(0.0),
+	visibleInstanceCount(0),
+	geometryPath(GEOMETRY_PATH_LOD),
+	meshShaderEnabled(false),
+	meshletStages(VK_SHADER_STAGE_COMPUTE_BIT),
+#ifdef VK_EXT_mesh_shader
+	cmdDrawMeshTasks(nullptr),
+#endif
+	meshletDescriptorPool(VK_NULL_HANDLE),
+	drawCommandBuffer(VK_NULL_HANDLE),
+	drawCommandMemory(VK_NULL_HANDLE),
+	cullStatsBuffer(VK_NULL_HANDLE),
+	cullStatsMemory(VK_NULL_HANDLE),
+	cullStats(nullptr),
+	bindlessRequested(true),
+	bindlessEnabled(false),
+	materialSetLayout(VK_NULL_HANDLE),
+	materialDescriptorPool(VK_NULL_HANDLE),
+	materialBuffer(VK_NULL_HANDLE),
+	materialMemory(VK_NULL_HANDLE),
+	meshStatFrames(0),
+	submittedTriangles(0),
+	fullDetailTriangles(0),
+	visibleTriangles(0),
+	lodSwitches(0),
+	culledInstances(0),
+	cullMilliseconds(0.0),
+	drawStatFrames(0),
+	queuedDraws(0),
+	drawRecordMilliseconds(0.0),
+	readbackFormat(READBACK_PNG),
+	readbackInterval(1),
+	gpuBudget(0.0),
+	renderExtent({0, 0}),
+	lastResolutionLog(0.0),
+	firstFrameMilliseconds(0.0),
+	hotReload(false),
+	shaderReloads(0),
+	meshBenchmark(false),
+	frameSubmitted(false),
+	replaySkippedFrames(0),
+	replayDrawMismatches(0),
+	replayUploadMismatches(0),
+	firstDrawMismatch(0)
+{
+}
+
 void App::run ()
 {
-	initWindow();
+	startupOrigin = std::chrono::steady_clock::now();
+
+	/* the capture picked the sample count and the material path : the replay draws the same way */
+	if (!replayPath.empty())
+	{
+		replay.open(replayPath);
+		requestedSamples = replay.header().samples;
+		bindlessRequested = replay.header().bindless != 0;
+	}
+
 	initVulkan();
-	mainLoop();
+
+	simulation.init(SIMULATION_TICK_RATE, meshRows.size());
+
+	updateMemoryBudget();
+	if (!memoryReportPath.empty())
+	{
+		memoryReport.open(memoryReportPath, std::ios::app);
+		if (!memoryReport.is_open())
+			throw std::runtime_error("failed to open memory report " + memoryReportPath + "!");
+		memoryTracker.writeJson(memoryReport, glfwGetTime());
+	}
+
+	if (!capturePath.empty())
+		capture.open(capturePath, captureHeader());
+	if (replay.isOpen())
+		checkReplayHeader();
+
+	/* the loads were timed by createMeshes : nothing to draw */
+	if (meshBenchmark)
+		vkDeviceWaitIdle(device);
+	else
+		mainLoop();
 	cleanup();
 }
 
+/* glfwInit() is a step of its own : the instance only needs it, not the window */
 void App::initWindow ()
 {
-	glfwInit();
-
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
-	window = glfwCreateWindow(WIDTH, HEIGHT, (!enableValidationLayers) ? "Vulkan" :  "[DEBUG] Vulkan", nullptr, nullptr);
+	/* a replay still needs a swap chain : the window is there, not shown */
+	int width = WIDTH;
+	int height = HEIGHT;
+	if (replay.isOpen())
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		width = static_cast<int>(replay.header().width);
+		height = static_cast<int>(replay.header().height);
+	}
+
+	windowWidth = width;
+	windowHeight = height;
+	window = glfwCreateWindow(width, height, (!enableValidationLayers) ? "Vulkan" :  "[DEBUG] Vulkan", nullptr, nullptr);
 
 	glfwSetWindowSizeLimits(window, 50, 50, 1920, 1080);
 
@@ -62,56 +205,320 @@ void App::initWindow ()
 	glfwSetWindowSizeCallback(window, App::onWindowResized);
 }
 
+/*
+ * The window and every creation step as a graph : the swap chain, the
+ * pipelines and the asset uploads only need the device, so they run side by
+ * side once it is there. The window system calls stay on this thread.
+ */
 void App::initVulkan ()
 {
-	createInstance();
-	setupDebugCallback();
-	createSurface();
-	pickPhysicalDevice();
-	createLogicalDevice();
-	createSwapChain();
-	createImageViews();
-	createRenderPass();
-	createGraphicsPipeline();
-	createFramebuffers();
-	createCommandPool();
-	createVertexBuffer();
-	createCommandBuffers();
-	createSemaphores();
+	uint32_t glfwStep = startup.add("glfw", [] { glfwInit(); }, {}, true);
+	uint32_t windowStep = startup.add("window", [this] { initWindow(); }, {glfwStep}, true);
+
+	uint32_t instanceStep = startup.add("instance", [this] { createInstance(); setupDebugCallback(); }, {glfwStep});
+	uint32_t surfaceStep = startup.add("surface", [this] { createSurface(); }, {instanceStep, windowStep});
+	uint32_t deviceStep = startup.add("device", [this] { pickPhysicalDevice(); createLogicalDevice(); }, {surfaceStep});
+
+	uint32_t swapChainStep = startup.add("swap chain", [this] { createSwapChain(); createImageViews(); }, {deviceStep});
+
+	/* the render target format comes from the post processing */
+	uint32_t postProcessStep = startup.add("post process", [this] { createPostProcess(); }, {deviceStep});
+	uint32_t renderPassStep = startup.add("render pass", [this] { createRenderPass(); }, {postProcessStep});
+	uint32_t layoutsStep = startup.add("pipeline layouts", [this] { createMeshletSetLayout(); createPipelineLayouts(); }, {deviceStep});
+	uint32_t pipelinesStep = startup.add("pipelines", [this] { createPipelines(); }, {renderPassStep, layoutsStep});
+
+	uint32_t attachmentsStep = startup.add("attachments", [this] { createDepthResources(); createColorResources(); },
+			{swapChainStep, renderPassStep});
+	uint32_t postTargetsStep = startup.add("post targets", [this] { createPostTargets(); }, {swapChainStep, pipelinesStep});
+	startup.add("framebuffers", [this] { createFramebuffers(); }, {attachmentsStep, postTargetsStep});
+
+	uint32_t commandPoolStep = startup.add("command pool", [this] { createCommandPool(); }, {deviceStep});
+	startup.add("command buffers", [this] { createCommandBuffers(); }, {commandPoolStep, swapChainStep});
+	startup.add("semaphores", [this] { createSemaphores(); }, {deviceStep});
+
+	/* uploads : each subsystem has its command pool, the queue is shared under the context's lock */
+	startup.add("vertex buffer", [this] { createVertexBuffer(); }, {deviceStep});
+	uint32_t texturesStep = startup.add("textures", [this] { createTextures(); }, {deviceStep});
+	uint32_t meshesStep = startup.add("meshes", [this] { createMeshes(); }, {deviceStep});
+
+	/* the geometry path and the materials depend on which pipelines could be created */
+	startup.add("meshlet culling", [this] { createMeshletCulling(); }, {pipelinesStep, meshesStep});
+	startup.add("materials", [this] { createMaterials(); }, {pipelinesStep, texturesStep, meshesStep});
+	startup.add("particles", [this] { createParticles(); }, {pipelinesStep});
+
+	startup.run(std::min(std::thread::hardware_concurrency(), STARTUP_MAX_THREADS), startupOrigin);
 }
 
 void App::mainLoop ()
 {
-	while (!glfwWindowShouldClose(window))
+	if (replay.isOpen())
+		replayFrames();
+	else
 	{
-        glfwPollEvents();
-		drawFrame();
-    }
+		/* this thread polls the input and ticks the simulation, the render thread draws */
+		simulation.start(glfwGetTime());
+		if (hotReload && !shaderWatcher.start(pipelines, "assets/shaders", "compile.sh"))
+			std::cerr << "shader hot reload is not available" << std::endl;
+
+		rendering = true;
+		renderThread = std::thread(&App::renderLoop, this);
+
+		/* ticks overlap the frames at random : the simulation is timed on its own, not counted in drawFrame */
+		untrackHeapAllocations();
+
+		while (rendering && !glfwWindowShouldClose(window))
+		{
+			glfwPollEvents();
+
+			double nextTick = simulation.advance(glfwGetTime(), SIMULATION_MAX_CATCHUP_TICKS);
+			pollMemory(glfwGetTime());
+			pollResolution(glfwGetTime());
+
+			double wait = nextTick - glfwGetTime();
+			if (wait > 0.0)
+				std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+		}
+
+		rendering = false;
+		renderThread.join();
+		shaderWatcher.stop();
+		untrackHeapAllocations(false);
+
+		if (renderException)
+			std::rethrow_exception(renderException);
+	}
 
 	vkDeviceWaitIdle(device);
+	readback.flush();
+
+	printFrameAllocationStats();
+	printMeshStats();
+	printDrawStats();
+	printParticleStats();
+	printPostStats();
+	printAttachmentStats();
+	printResizeStats();
+	printResolutionStats();
+	printThreadStats();
+	printMemoryStats();
+	printReadbackStats();
+	printShaderReloadStats();
+	printStartupStats();
+
+	std::cout << "deletion queue: " << deletionQueue.retired() << " handles destroyed after their frame, "
+		<< deletionQueue.peak() << " pending at most" << std::endl;
+
+	if (capture.isOpen())
+	{
+		capture.close();
+		std::cout << "capture: " << capture.frameCount() << " frames, " << capture.byteCount() << " bytes ("
+			<< (capture.frameCount() > 0 ? capture.byteCount() / capture.frameCount() : 0) << " per frame) written to "
+			<< capturePath << std::endl;
+	}
+
+	if (replay.isOpen())
+		printReplayStats();
+}
+
+/* frames as fast as the GPU takes them, each showing the newest simulation snapshot */
+void App::renderLoop ()
+{
+	try
+	{
+		while (rendering)
+		{
+			if (framebufferResized.exchange(false))
+				recreateSwapChain();
+			if (pipelines.hasReplacements())
+				applyShaderReload();
+
+			bool steadyState = warmupFramesLeft == 0;
+			auto start = std::chrono::steady_clock::now();
+
+			bool fresh;
+			const FrameSnapshot& snapshot = simulation.latest(fresh);
+			frameAlpha = simulation.alpha(snapshot, glfwGetTime());
+			Simulation::interpolate(snapshot, frameAlpha, frameState);
+			frameTime = frameState.time;
+
+			drawFrame();
+
+			if (!steadyState)
+				continue;
+
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			renderFrames++;
+			staleFrames += fresh ? 0 : 1;
+			renderMilliseconds += milliseconds;
+			renderPeakMilliseconds = std::max(renderPeakMilliseconds, milliseconds);
+		}
+	}
+	catch (...)
+	{
+		/* rethrown on the main thread once it joined this one */
+		renderException = std::current_exception();
+		rendering = false;
+	}
+}
+
+/* every recorded frame with its time and extent, timed on the CPU, its draws and uploads checked against the capture */
+void App::replayFrames ()
+{
+	replayMilliseconds.reserve(replay.frameCount());
+	VkExtent2D replayExtent = swapChainExtent;
+
+	while (replay.read(replayFrame))
+	{
+		glfwPollEvents();
+		pollMemory(glfwGetTime());
+
+		/* a resize in the capture : the swap chain follows the window */
+		if (replayFrame.width != replayExtent.width || replayFrame.height != replayExtent.height)
+		{
+			replayExtent.width = replayFrame.width;
+			replayExtent.height = replayFrame.height;
+			windowWidth = static_cast<int>(replayExtent.width);
+			windowHeight = static_cast<int>(replayExtent.height);
+			glfwSetWindowSize(window, static_cast<int>(replayExtent.width), static_cast<int>(replayExtent.height));
+
+			/* the copy of the previous frame would be lost with the old readback buffer : every run writes the same frames */
+			if (readback.active())
+			{
+				vkWaitForFences(device, 1, &frameFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+				readback.collect();
+			}
+			recreateSwapChain();
+		}
+
+		/* the two ticks the frame was drawn between, evaluated instead of simulated */
+		simulation.evaluate(replayFrame.tick > 0 ? replayFrame.tick - 1 : 0, replaySnapshot.previous);
+		simulation.evaluate(replayFrame.tick, replaySnapshot.current);
+		frameAlpha = replayFrame.alpha;
+		Simulation::interpolate(replaySnapshot, frameAlpha, frameState);
+		frameTime = frameState.time;
+
+		/* an out of date swap chain drops the frame before it records : run it again on the new one */
+		auto start = std::chrono::steady_clock::now();
+		drawFrame();
+		for (int attempt = 0; !frameSubmitted && attempt < 2; attempt++)
+			drawFrame();
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (!frameSubmitted)
+		{
+			replaySkippedFrames++;
+			continue;
+		}
+
+		replayMilliseconds.push_back(milliseconds);
+		uint64_t frame = replayMilliseconds.size();
+
+		bool drawsMatch = drawQueue.size() == replayFrame.draws.size();
+		for (size_t i = 0; drawsMatch && i < replayFrame.draws.size(); i++)
+			drawsMatch = drawQueue.begin()[i].key == replayFrame.draws[i].key && drawQueue.begin()[i].index == replayFrame.draws[i].index;
+
+		if (!drawsMatch && replayDrawMismatches++ == 0)
+			firstDrawMismatch = frame;
+
+		const std::vector<TextureUploadEvent>& uploads = textures.frameUploads();
+		bool uploadsMatch = uploads.size() == replayFrame.uploads.size();
+		for (size_t i = 0; uploadsMatch && i < uploads.size(); i++)
+			uploadsMatch = uploads[i].texture == replayFrame.uploads[i].texture &&
+					uploads[i].residentLevel == replayFrame.uploads[i].residentLevel && uploads[i].bytes == replayFrame.uploads[i].bytes;
+
+		if (!uploadsMatch)
+			replayUploadMismatches++;
+	}
+}
+
+CaptureHeader App::captureHeader ()
+{
+	CaptureHeader header = {};
+	header.magic = CAPTURE_MAGIC;
+	header.version = CAPTURE_VERSION;
+	header.width = swapChainExtent.width;
+	header.height = swapChainExtent.height;
+	header.samples = static_cast<uint32_t>(msaaSamples);
+	header.bindless = bindlessEnabled ? 1 : 0;
+	header.geometryPath = static_cast<uint32_t>(geometryPath);
+	header.textureCount = static_cast<uint32_t>(textureHandles.size());
+	header.meshCount = static_cast<uint32_t>(meshHandles.size());
+	header.tickRate = SIMULATION_TICK_RATE;
+	return header;
+}
+
+/* a replay on another device or with other assets runs, but its draws are not expected to match */
+void App::checkReplayHeader ()
+{
+	const CaptureHeader& recorded = replay.header();
+	CaptureHeader current = captureHeader();
+
+	std::cout << "replay: " << replay.frameCount() << " frames from " << replayPath << std::endl;
+
+	if (current.samples != recorded.samples)
+		std::cout << "  warning: " << current.samples << " samples, captured with " << recorded.samples << std::endl;
+	if (current.bindless != recorded.bindless)
+		std::cout << "  warning: bindless materials " << (current.bindless ? "on" : "off") << ", captured "
+			<< (recorded.bindless ? "on" : "off") << std::endl;
+	if (current.geometryPath != recorded.geometryPath)
+		std::cout << "  warning: geometry path " << geometryPathName(geometryPath) << ", captured with "
+			<< geometryPathName(static_cast<GeometryPath>(recorded.geometryPath)) << std::endl;
+	if (current.tickRate != recorded.tickRate)
+		std::cout << "  warning: " << current.tickRate << " simulation ticks per second, captured with " << recorded.tickRate << std::endl;
+	if (current.textureCount != recorded.textureCount || current.meshCount != recorded.meshCount)
+		std::cout << "  warning: " << current.textureCount << " textures and " << current.meshCount << " meshes, captured with "
+			<< recorded.textureCount << " and " << recorded.meshCount << std::endl;
 }
 
 void App::cleanup ()
 {
 	cleanupSwapChain();
+	swapChain.reset();
 
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
+	textures.destroy();
+	meshes.destroy();
 
-	vkDestroyPipeline(device, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
+	vertexBuffer.reset();
+	vertexBufferMemory.reset();
 
-	vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-	vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
+	/* deferred pipelines the pool may still be creating */
+	threadPool.wait();
 
-	vkDestroyCommandPool(device, commandPool, nullptr);
+	particles.destroy();
+	postProcess.destroy();
+	resolution.destroy();
+	readback.destroy();
+	pipelines.destroy();
+	vkDestroyPipelineLayout(device, pipelineLayout, hostAllocator.callbacks());
+	vkDestroyPipelineLayout(device, meshPipelineLayout, hostAllocator.callbacks());
 
-	vkDestroyDevice(device, nullptr);
-	DestroyDebugReportCallbackEXT(instance, callback, nullptr);
+	vkDestroyDescriptorPool(device, meshletDescriptorPool, hostAllocator.callbacks());
+	bindless.destroy();
+	vkDestroyDescriptorPool(device, materialDescriptorPool, hostAllocator.callbacks());
+	vkDestroyDescriptorSetLayout(device, materialSetLayout, hostAllocator.callbacks());
+	context.destroyBuffer(materialBuffer, materialMemory);
+	context.destroyBuffer(drawCommandBuffer, drawCommandMemory);
+	for (size_t i = 0; i < instanceBuffers.size(); i++)
+		context.destroyBuffer(instanceBuffers[i], instanceBufferMemory[i]);
+	context.destroyBuffer(cullStatsBuffer, cullStatsMemory);
+	vkDestroyPipelineLayout(device, meshletPipelineLayout, hostAllocator.callbacks());
+	vkDestroyDescriptorSetLayout(device, meshletSetLayout, hostAllocator.callbacks());
+	renderPasses.destroy();
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);
-	vkDestroyInstance(instance, nullptr);
+	renderFinishedSemaphore.reset();
+	imageAvailableSemaphore.reset();
+	vkDestroyFence(device, frameFence, hostAllocator.callbacks());
+
+	/* the device is idle : everything retired so far, in retirement order */
+	deletionQueue.flush();
+
+	vkDestroyCommandPool(device, commandPool, hostAllocator.callbacks());
+
+	vkDestroyDevice(device, hostAllocator.callbacks());
+	DestroyDebugReportCallbackEXT(instance, callback, hostAllocator.callbacks());
+
+	vkDestroySurfaceKHR(instance, surface, hostAllocator.callbacks());
+	vkDestroyInstance(instance, hostAllocator.callbacks());
 
 	glfwDestroyWindow(window);
     glfwTerminate();
@@ -119,6 +526,26 @@ void App::cleanup ()
 
 void App::drawFrame ()
 {
+	uint64_t heapAllocationsBefore = heapAllocationCount();
+	uint64_t vulkanAllocationsBefore = hostAllocator.allocationCount();
+
+	frameAllocator.reset();
+	frameIndex++;
+	frameSubmitted = false;
+
+	/*
+	 * One frame in flight : the previous one must be done before its command
+	 * buffer, readbacks and retired handles are reused, and before the texture
+	 * manager replaces images it may still sample.
+	 */
+	vkWaitForFences(device, 1, &frameFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	deletionQueue.collect(submittedFrame);
+	readback.collect();
+	resolution.update();
+
+	textures.setBudget(textureBudget);
+	textures.update(frameIndex);
+
 	uint32_t imageIndex;
     VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
 
@@ -130,11 +557,15 @@ void App::drawFrame ()
 	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
 	    throw std::runtime_error("failed to acquire swap chain image!");
 
+	/* the previous frame is idle (frameFence above), its command buffer can be recorded again */
+	recordCommandBuffer(imageIndex);
+
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 	VkSemaphore waitSemaphores[] = {imageAvailableSemaphore};
-	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+	/* the swap chain image is first written by the post processing, in compute or by a blit */
+	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT};
 	submitInfo.waitSemaphoreCount = 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
@@ -146,9 +577,19 @@ void App::drawFrame ()
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	vkResetFences(device, 1, &frameFence);
+	if (context.submit(submitInfo, frameFence) != VK_SUCCESS)
     	throw std::runtime_error("failed to submit draw command buffer!");
 
+	/* handles retired from now on may be used by this frame */
+	submittedFrame = frameIndex;
+	deletionQueue.submit(submittedFrame);
+	frameSubmitted = true;
+
+	if (capture.isOpen())
+		capture.write(frameState.tick, frameAlpha, swapChainExtent.width, swapChainExtent.height, drawQueue.begin(), drawQueue.size(),
+				textures.frameUploads());
+
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
@@ -162,7 +603,299 @@ void App::drawFrame ()
 	presentInfo.pResults = nullptr;
 
 	vkQueuePresentKHR(presentQueue, &presentInfo);
-	vkQueueWaitIdle(presentQueue);
+
+	if (firstFrameMilliseconds == 0.0)
+		firstFrameMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupOrigin).count();
+
+	uint64_t heapAllocations = heapAllocationCount() - heapAllocationsBefore;
+	uint64_t vulkanAllocations = hostAllocator.allocationCount() - vulkanAllocationsBefore;
+
+	if (warmupFramesLeft > 0)
+	{
+		warmupFramesLeft--;
+		return;
+	}
+
+	steadyStateFrames++;
+	steadyStateHeapAllocations += heapAllocations;
+	steadyStateVulkanAllocations += vulkanAllocations;
+
+	assert(heapAllocations == 0 && "drawFrame allocated from the heap in steady state");
+}
+
+void App::printFrameAllocationStats ()
+{
+	std::cout << "drawFrame: " << steadyStateFrames << " steady state frames, "
+		<< steadyStateHeapAllocations << " heap allocations, "
+		<< steadyStateVulkanAllocations << " vulkan host allocations, "
+		<< frameAllocator.highWaterMark() << " / " << frameAllocator.size() << " frame allocator bytes peak" << std::endl;
+
+	if (steadyStateFrames > 0)
+		std::cout << "drawFrame: " << (double) steadyStateHeapAllocations / steadyStateFrames << " heap allocations per frame" << std::endl;
+
+	std::cout << "vulkan host memory: " << hostAllocator.bytes() << " bytes in use, " << hostAllocator.peak() << " bytes peak" << std::endl;
+}
+
+void App::printMeshStats ()
+{
+	if (meshStatFrames == 0 || meshInstances.empty())
+		return;
+
+	double submitted = (double) submittedTriangles / meshStatFrames;
+	double fullDetail = (double) fullDetailTriangles / meshStatFrames;
+
+	std::cout << "meshes: " << meshInstances.size() << " instances, " << (uint64_t) submitted << " triangles per frame, "
+		<< (uint64_t) fullDetail << " without LODs (" << 100.0 * submitted / fullDetail << "%), "
+		<< lodSwitches << " LOD switches" << std::endl;
+
+	std::cout << "frustum culling: " << (double) culledInstances / meshStatFrames << " instances culled per frame, "
+		<< cullMilliseconds / meshStatFrames << " ms per frame" << std::endl;
+
+	if (geometryPath != GEOMETRY_PATH_LOD)
+	{
+		double visible = (double) visibleTriangles / meshStatFrames;
+		std::cout << "meshlets: " << (uint64_t) visible << " triangles per frame after cluster culling ("
+			<< 100.0 * visible / submitted << "% of the LOD triangles)" << std::endl;
+	}
+}
+
+void App::printDrawStats ()
+{
+	if (drawStatFrames == 0)
+		return;
+
+	double binds = (double) commandState.binds / drawStatFrames;
+	double skipped = (double) commandState.skippedBinds / drawStatFrames;
+
+	std::cout << "draw queue: " << (double) queuedDraws / drawStatFrames << " draws per frame, " << binds << " binds, "
+		<< skipped << " redundant binds skipped (" << 100.0 * skipped / (binds + skipped) << "%)" << std::endl;
+
+	std::cout << "descriptors: " << (bindlessEnabled ? "bindless, " : "per draw material sets, ")
+		<< (double) commandState.setBinds / drawStatFrames << " set binds per frame, "
+		<< drawRecordMilliseconds / drawStatFrames << " ms recording draws per frame" << std::endl;
+}
+
+void App::printParticleStats ()
+{
+	if (!particles.enabled())
+		return;
+
+	double simulated = particles.averageParticles();
+	double milliseconds = particles.averageMilliseconds();
+
+	std::cout << "particles: " << (uint64_t) simulated << " simulated per frame of " << particles.capacity() << ", ";
+	if (milliseconds > 0.0)
+		std::cout << milliseconds << " GPU ms per frame, " << (uint64_t) (simulated / milliseconds) << " particles per ms" << std::endl;
+	else
+		std::cout << "no GPU timestamps" << std::endl;
+}
+
+void App::printPostStats ()
+{
+	static const char *pathNames[] = {"compute into the swap chain", "compute then blit", "blit only"};
+
+	std::cout << "post: " << (postProcess.format() == VK_FORMAT_B10G11R11_UFLOAT_PACK32 ? "B10G11R11" : "RGBA16F") << " target, "
+		<< pathNames[postProcess.path()] << ", " << postProcess.dispatches() << " dispatches per frame" << std::endl;
+
+	if (!postProcess.timed())
+		return;
+
+	std::cout << "post GPU ms per frame: bloom down " << postProcess.averageMilliseconds(POST_TIMESTAMP_BLOOM_DOWN)
+		<< ", bloom up " << postProcess.averageMilliseconds(POST_TIMESTAMP_BLOOM_UP)
+		<< ", composite " << postProcess.averageMilliseconds(POST_TIMESTAMP_COMPOSITE)
+		<< ", copy " << postProcess.averageMilliseconds(POST_TIMESTAMP_COPY) << std::endl;
+}
+
+/*
+ * The multisampled attachments are cleared on load and dropped on store : on a
+ * tiler they never leave tile memory, and lazily allocated memory is not even
+ * backed. The bytes below are what storing them would have written per frame.
+ */
+void App::printAttachmentStats ()
+{
+	VkDeviceSize transientBytes = 0;
+	VkDeviceSize committedBytes = 0;
+	VkImage images[2] = {depthImage, msaaColorImage};
+	VkDeviceMemory memories[2] = {depthImageMemory, msaaColorMemory};
+
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		if (images[i] == VK_NULL_HANDLE)
+			continue;
+
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, images[i], &requirements);
+		transientBytes += requirements.size;
+
+		VkDeviceSize committed = requirements.size;
+		if (transientMemoryProperties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+			vkGetDeviceMemoryCommitment(device, memories[i], &committed);
+		committedBytes += committed;
+	}
+
+	double megabytes = 1.0 / (1024.0 * 1024.0);
+	std::cout << "attachments: " << msaaSamples << "x MSAA, " << transientBytes * megabytes << " MB of transient color and depth, "
+		<< committedBytes * megabytes << " MB committed ("
+		<< ((transientMemoryProperties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? "lazily allocated" : "no lazily allocated memory")
+		<< "), " << transientBytes * megabytes << " MB per frame not stored" << std::endl;
+}
+
+/* the time from a resize to the new targets, CPU side : compare with --render-pass */
+void App::printResizeStats ()
+{
+	std::cout << "render targets: " << (dynamicRenderingEnabled ? "dynamic rendering, no render pass or framebuffer"
+			: "render pass and framebuffer") << ", " << renderPasses.size() << " render passes created, " << renderPasses.hits()
+		<< " cache hits, " << framebuffersCreated << " framebuffers created" << std::endl;
+
+	if (resizeCount > 0)
+		std::cout << "resize: " << resizeCount << " swap chain recreations, " << resizeMilliseconds / resizeCount << " ms average, "
+			<< resizePeakMilliseconds << " ms peak" << std::endl;
+}
+
+void App::printResolutionStats ()
+{
+	if (!resolution.enabled())
+		return;
+
+	std::cout << "resolution: " << resolution.budget() << " ms GPU budget, " << resolution.averageMilliseconds() << " ms average over "
+		<< resolution.frames() << " frames, " << resolution.framesOverBudget() << " over it" << std::endl;
+	std::cout << "  scale " << resolution.averageScale() << " average, " << resolution.lowest() << " lowest, "
+		<< resolution.scale() << " last, " << resolution.changes() << " changes" << std::endl;
+}
+
+/* textures get what the device local heap has left under its budget, once everything else in it is counted */
+void App::updateMemoryBudget ()
+{
+	memoryTracker.refresh();
+
+	int64_t heapBudget = (int64_t) (memoryTracker.heapBudget(textureHeap) * (double) MEMORY_BUDGET_FRACTION);
+	int64_t others = (int64_t) memoryTracker.heapUsage(textureHeap) - (int64_t) memoryTracker.bytes(MEMORY_CATEGORY_TEXTURE);
+	int64_t available = std::min<int64_t>(heapBudget - others, (int64_t) TEXTURE_MEMORY_BUDGET);
+
+	textureBudget = (uint64_t) std::max<int64_t>(available, 0);
+}
+
+/* not on the render thread : the budget query and the report file stay out of drawFrame */
+void App::pollMemory (double now)
+{
+	if (now - lastMemoryRefresh >= MEMORY_REFRESH_SECONDS)
+	{
+		lastMemoryRefresh = now;
+		updateMemoryBudget();
+	}
+
+	if (memoryReport.is_open() && now - lastMemoryReport >= MEMORY_REPORT_SECONDS)
+	{
+		lastMemoryReport = now;
+		memoryTracker.writeJson(memoryReport, now);
+		memoryReport.flush();
+	}
+}
+
+void App::pollResolution (double now)
+{
+	if (!resolution.enabled() || now - lastResolutionLog < RESOLUTION_LOG_SECONDS)
+		return;
+
+	/* the render thread owns the swap chain extent : only the atomics are read here */
+	lastResolutionLog = now;
+	std::cout << "resolution: scale " << resolution.scale() << ", GPU " << resolution.milliseconds() << " ms for a "
+		<< resolution.budget() << " ms budget" << std::endl;
+}
+
+void App::printMemoryStats ()
+{
+	if (memoryReport.is_open())
+	{
+		memoryTracker.writeJson(memoryReport, glfwGetTime());
+		memoryReport.close();
+	}
+
+	memoryTracker.print(std::cout);
+
+	double megabytes = 1.0 / (1024.0 * 1024.0);
+	std::cout << "  textures: " << textures.getResidentBytes() * megabytes << " / " << textures.getBudget() * megabytes
+		<< " MB resident / budget, " << textures.getBudgetEvictions() << " evictions to stay under it, "
+		<< textures.getFailedUploads() << " uploads out of memory, " << textures.getFailedReads() << " textures stopped on a read error" << std::endl;
+}
+
+/* the readback cost is in the render thread and replay times : compare them with a run without --readback */
+void App::printReadbackStats ()
+{
+	if (!readback.enabled())
+		return;
+
+	std::cout << "readback: " << readback.written() << " of " << readback.requested() << " frames written to " << readbackPath
+		<< ", " << readback.dropped() << " dropped with the worker behind, " << readback.bytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+	std::cout << "  worker ms per frame: convert " << readback.averageConvertMilliseconds() << ", encode and write "
+		<< readback.averageEncodeMilliseconds() << std::endl;
+}
+
+void App::printShaderReloadStats ()
+{
+	if (!hotReload)
+		return;
+
+	std::cout << "shader reload: " << shaderWatcher.reloads() << " reloads swapped in " << shaderReloads << " times, "
+		<< shaderWatcher.rebuiltPipelines() << " pipelines rebuilt, " << shaderWatcher.compileFailures() << " compile and "
+		<< shaderWatcher.pipelineFailures() << " pipeline failures kept the previous shaders" << std::endl;
+	std::cout << "  watcher ms per reload: compile " << shaderWatcher.averageCompileMilliseconds() << ", pipelines "
+		<< shaderWatcher.averagePipelineMilliseconds() << std::endl;
+}
+
+/* the time to the first frame, and what it waited on : write the trace with --startup-trace */
+void App::printStartupStats ()
+{
+	startup.print(std::cout);
+	std::cout << "startup: " << firstFrameMilliseconds << " ms to the first frame" << std::endl;
+
+	if (startupTracePath.empty())
+		return;
+
+	std::ofstream trace(startupTracePath);
+	if (!trace.is_open())
+	{
+		std::cerr << "failed to open startup trace " << startupTracePath << std::endl;
+		return;
+	}
+	startup.writeTrace(trace, firstFrameMilliseconds);
+}
+
+/* the render thread should not feel the simulation : compare with and without --sim-spike */
+void App::printThreadStats ()
+{
+	std::cout << "simulation: " << simulation.tickCount() << " ticks at " << SIMULATION_TICK_RATE << " Hz, "
+		<< simulation.averageTickMilliseconds() << " ms average, " << simulation.peakMilliseconds() << " ms peak, "
+		<< simulation.dropped() << " dropped" << std::endl;
+
+	if (renderFrames > 0)
+		std::cout << "render thread: " << renderFrames << " steady state frames, " << renderMilliseconds / renderFrames << " ms average, "
+			<< renderPeakMilliseconds << " ms peak, " << staleFrames << " without a new snapshot" << std::endl;
+}
+
+/* the numbers to compare between two builds replaying the same capture */
+void App::printReplayStats ()
+{
+	std::vector<double> sorted = replayMilliseconds;
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+	for (double milliseconds : sorted)
+		total += milliseconds;
+
+	std::cout << "replay: " << sorted.size() << " frames in " << total << " ms";
+	if (!sorted.empty())
+		std::cout << " (" << sorted.size() * 1000.0 / total << " fps), CPU frame " << sorted.front() << " / "
+			<< sorted[sorted.size() / 2] << " / " << sorted.back() << " ms min / median / max";
+	std::cout << ", " << replaySkippedFrames << " skipped" << std::endl;
+
+	if (replayDrawMismatches == 0)
+		std::cout << "  draws match the capture in every frame" << std::endl;
+	else
+		std::cout << "  draws differ from the capture in " << replayDrawMismatches << " frames, first at frame " << firstDrawMismatch << std::endl;
+
+	/* streaming reads files on its own thread : uploads may land a frame earlier or later than captured */
+	std::cout << "  texture uploads differ from the capture in " << replayUploadMismatches << " frames" << std::endl;
 }
 
 /* VK methods */
@@ -180,6 +913,18 @@ void App::createInstance ()
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.apiVersion = VK_API_VERSION_1_0;
 
+#ifdef VK_VERSION_1_2
+	/* mesh shaders need Vulkan 1.2, a 1.0 loader does not have vkEnumerateInstanceVersion */
+	PFN_vkEnumerateInstanceVersion enumerateInstanceVersion =
+		(PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+
+	uint32_t loaderVersion = VK_API_VERSION_1_0;
+	if (enumerateInstanceVersion != nullptr && enumerateInstanceVersion(&loaderVersion) == VK_SUCCESS &&
+			loaderVersion >= VK_API_VERSION_1_2)
+		appInfo.apiVersion = VK_API_VERSION_1_2;
+#endif
+	instanceApiVersion = appInfo.apiVersion;
+
 	VkInstanceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	createInfo.pApplicationInfo = &appInfo;
@@ -201,7 +946,7 @@ void App::createInstance ()
 	    createInfo.ppEnabledLayerNames = validationLayers.data();
 	}
 
-	if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS)
+	if (vkCreateInstance(&createInfo, hostAllocator.callbacks(), &instance) != VK_SUCCESS)
 	    throw std::runtime_error("failed to create instance!");
 }
 
@@ -259,7 +1004,7 @@ void App::setupDebugCallback ()
 	createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
 	createInfo.pfnCallback = debugCallback;
 
-	if (CreateDebugReportCallbackEXT(instance, &createInfo, nullptr, &callback) != VK_SUCCESS)
+	if (CreateDebugReportCallbackEXT(instance, &createInfo, hostAllocator.callbacks(), &callback) != VK_SUCCESS)
 	    throw std::runtime_error("failed to set up debug callback!");
 }
 
@@ -311,15 +1056,124 @@ void App::createLogicalDevice ()
 	    queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+	deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+	deviceFeatures.samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	deviceFeatures.shaderStorageImageWriteWithoutFormat = supportedFeatures.shaderStorageImageWriteWithoutFormat;
+
+	std::vector<const char*> extensions = deviceExtensions;
+	void *next = nullptr;
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+#ifdef VK_VERSION_1_2
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+
+	/* descriptor indexing is core in 1.2, its features are optional */
+	if (bindlessRequested && instanceApiVersion >= VK_API_VERSION_1_2 && deviceProperties.apiVersion >= VK_API_VERSION_1_2)
+	{
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &indexingFeatures;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+		if (BindlessTable::supported(supportedFeatures, indexingFeatures))
+		{
+			/* only what the bindless set and material.frag use */
+			indexingFeatures = {};
+			indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+			indexingFeatures.pNext = next;
+			indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+			indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+			indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+			indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+			indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+			next = &indexingFeatures;
+
+			deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+			deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+			bindlessEnabled = true;
+		}
+	}
+#endif
+
+#if defined(VK_VERSION_1_1) && defined(VK_EXT_memory_budget)
+	/* heap budgets that account for the other processes, through vkGetPhysicalDeviceMemoryProperties2 */
+	if (instanceApiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+			hasDeviceExtension(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+	{
+		extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		memoryBudgetEnabled = true;
+	}
+#endif
+
+#ifdef VK_EXT_mesh_shader
+	VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures = {};
+	meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+
+	if (instanceApiVersion >= VK_API_VERSION_1_2 && deviceProperties.apiVersion >= VK_API_VERSION_1_2 &&
+			hasDeviceExtension(physicalDevice, VK_EXT_MESH_SHADER_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &meshShaderFeatures;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+		if (meshShaderFeatures.taskShader && meshShaderFeatures.meshShader)
+		{
+			/* only what meshlet.task / meshlet.mesh use */
+			VkBool32 taskShader = meshShaderFeatures.taskShader, meshShader = meshShaderFeatures.meshShader;
+			meshShaderFeatures = {};
+			meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+			meshShaderFeatures.taskShader = taskShader;
+			meshShaderFeatures.meshShader = meshShader;
+			meshShaderFeatures.pNext = next;
+
+			extensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+			next = &meshShaderFeatures;
+			meshShaderEnabled = true;
+		}
+	}
+#endif
+
+#ifdef VK_KHR_dynamic_rendering
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+	dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+	/* the extension needs depth stencil resolve, core in 1.2 */
+	if (dynamicRenderingRequested && instanceApiVersion >= VK_API_VERSION_1_2 && deviceProperties.apiVersion >= VK_API_VERSION_1_2 &&
+			hasDeviceExtension(physicalDevice, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME))
+	{
+		VkPhysicalDeviceFeatures2 features = {};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &dynamicRenderingFeatures;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+
+		if (dynamicRenderingFeatures.dynamicRendering)
+		{
+			dynamicRenderingFeatures.pNext = next;
+			extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+			next = &dynamicRenderingFeatures;
+			dynamicRenderingEnabled = true;
+		}
+	}
+#endif
 
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = next;
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 	createInfo.enabledLayerCount = 0;
 
 	if (enableValidationLayers)
@@ -328,16 +1182,47 @@ void App::createLogicalDevice ()
 	    createInfo.ppEnabledLayerNames = validationLayers.data();
 	}
 
-	if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS)
+	if (vkCreateDevice(physicalDevice, &createInfo, hostAllocator.callbacks(), &device) != VK_SUCCESS)
     	throw std::runtime_error("failed to create logical device!");
 
 	vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+
+#ifdef VK_EXT_mesh_shader
+	if (meshShaderEnabled)
+	{
+		cmdDrawMeshTasks = (PFN_vkCmdDrawMeshTasksEXT) vkGetDeviceProcAddr(device, "vkCmdDrawMeshTasksEXT");
+		meshletStages |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+	}
+#endif
+
+#ifdef VK_KHR_dynamic_rendering
+	if (dynamicRenderingEnabled)
+	{
+		cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+		cmdEndRendering = (PFN_vkCmdEndRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+	}
+#endif
+
+	context.physicalDevice = physicalDevice;
+	context.device = device;
+	context.graphicsQueue = graphicsQueue;
+	context.graphicsFamily = indices.graphicsFamily;
+	context.allocator = hostAllocator.callbacks();
+	context.enabledFeatures = deviceFeatures;
+	vkGetPhysicalDeviceProperties(physicalDevice, &context.properties);
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &context.memoryProperties);
+
+	memoryTracker.init(physicalDevice, context.memoryProperties, memoryBudgetEnabled, memoryCap, MEMORY_TRACKED_ALLOCATIONS);
+	context.memoryTracker = &memoryTracker;
+	textureHeap = context.memoryProperties.memoryTypes[context.findMemoryType(~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)].heapIndex;
+
+	deletionQueue.init(context);
 }
 
 void App::createSurface ()
 {
-	if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+	if (glfwCreateWindowSurface(instance, window, hostAllocator.callbacks(), &surface) != VK_SUCCESS)
         throw std::runtime_error("failed to create window surface!");
 }
 
@@ -362,7 +1247,18 @@ void App::createSwapChain ()
 	createInfo.imageColorSpace = surfaceFormat.colorSpace;
 	createInfo.imageExtent = extent;
 	createInfo.imageArrayLayers = 1;
-	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	/* nothing renders to it : the post processing writes it as a storage image, or blits to it */
+	swapChainUsage = swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	if (context.formatSupports(surfaceFormat.format, VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+		swapChainUsage |= swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT;
+	if (swapChainUsage == 0)
+		throw std::runtime_error("failed to find a swap chain usage the post processing can write!");
+
+	/* only when reading frames back : transfers from the image may cost it its compression */
+	if (!readbackPath.empty())
+		swapChainUsage |= swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	createInfo.imageUsage = swapChainUsage;
 
 	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 	uint32_t queueFamilyIndices[] = {(uint32_t) indices.graphicsFamily, (uint32_t) indices.presentFamily};
@@ -386,11 +1282,15 @@ void App::createSwapChain ()
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
 
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	/* the old swap chain may still be presenting : retired, not destroyed */
+	createInfo.oldSwapchain = swapChain;
 
-	if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
+	VkSwapchainKHR newSwapChain;
+	if (vkCreateSwapchainKHR(device, &createInfo, hostAllocator.callbacks(), &newSwapChain) != VK_SUCCESS)
 		throw std::runtime_error("failed to create swap chain!");
 
+	swapChain = Unique<VkSwapchainKHR>(deletionQueue, newSwapChain);
+
 	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
 	swapChainImages.resize(imageCount);
 	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
@@ -401,6 +1301,7 @@ void App::createSwapChain ()
 
 void App::createImageViews ()
 {
+	swapChainImageViews.clear();
 	swapChainImageViews.resize(swapChainImages.size());
 
 	for (size_t i = 0; i < swapChainImages.size(); i++)
@@ -423,217 +1324,387 @@ void App::createImageViews ()
 		createInfo.subresourceRange.baseArrayLayer = 0;
 		createInfo.subresourceRange.layerCount = 1;
 
-		if (vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS)
+		VkImageView view;
+		if (vkCreateImageView(device, &createInfo, hostAllocator.callbacks(), &view) != VK_SUCCESS)
     		throw std::runtime_error("failed to create image views!");
+
+		swapChainImageViews[i] = Unique<VkImageView>(deletionQueue, view);
 	}
 }
 
-void App::createGraphicsPipeline ()
+void App::createPipelineLayouts ()
 {
-	std::vector<char> vertShaderCode = readFile("assets/shaders/vert.spv");
-    std::vector<char> fragShaderCode = readFile("assets/shaders/frag.spv");
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 0;
+	pipelineLayoutInfo.pSetLayouts = nullptr;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = 0;
 
-	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, hostAllocator.callbacks(), &pipelineLayout) != VK_SUCCESS)
+	    throw std::runtime_error("failed to create pipeline layout!");
 
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertShaderModule;
-	vertShaderStageInfo.pName = "main";
+	/* materials : the bindless set, or a set with the material's texture and parameters */
+	VkDescriptorSetLayout materialLayout;
+	if (bindlessEnabled)
+	{
+		bindless.init(context, MAX_TEXTURES + 1, MAX_MATERIALS);
+		materialLayout = bindless.layout();
+	}
+	else
+	{
+		std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+		bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[0].descriptorCount = 1;
+		bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		bindings[1].binding = BINDLESS_BUFFER_BINDING;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[1].descriptorCount = 1;
+		bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings = bindings.data();
+
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, hostAllocator.callbacks(), &materialSetLayout) != VK_SUCCESS)
+			throw std::runtime_error("failed to create material descriptor set layout!");
+		materialLayout = materialSetLayout;
+	}
 
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragShaderModule;
-	fragShaderStageInfo.pName = "main";
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(MeshPushConstants);
 
-	VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &materialLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-	/* begin : Because hard coded */
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, hostAllocator.callbacks(), &meshPipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create mesh pipeline layout!");
+}
 
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-	/* end : Because hard coded */
+/*
+ * Every pipeline of the app in one batch. The SPIR-V is built by compile.sh :
+ * without the mesh shaders meshes are loaded but not drawn, the other ones
+ * only turn their path off.
+ */
+void App::createPipelines ()
+{
+	pipelines.init(context, PIPELINE_CACHE_FILE);
+
+	std::vector<PipelineState> states;
+
+	/* the render pass has a depth buffer for the meshes, the 2D geometry ignores it */
+	PipelineState triangle;
+	triangle.addStage(VK_SHADER_STAGE_VERTEX_BIT, pipelines.loadShader("assets/shaders/vert.spv"));
+	triangle.addStage(VK_SHADER_STAGE_FRAGMENT_BIT, pipelines.loadShader("assets/shaders/frag.spv"));
+	if (triangle.modules[0] == VK_NULL_HANDLE || triangle.modules[1] == VK_NULL_HANDLE)
+		throw std::runtime_error("failed to open file!");
+
+	VkVertexInputBindingDescription binding = Vertex::getBindingDescription();
+	triangle.addBinding(binding.binding, binding.stride, binding.inputRate);
+	for (const VkVertexInputAttributeDescription& attribute : Vertex::getAttributeDescriptions())
+		triangle.addAttribute(attribute.location, attribute.binding, attribute.format, attribute.offset);
+
+	triangle.layout = pipelineLayout;
+	triangle.setTarget(renderTarget);
+	triangle.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	states.push_back(triangle);
+
+	VkShaderModule meshVertex = pipelines.loadShader("assets/shaders/mesh_vert.spv");
+	VkShaderModule meshFragment = pipelines.loadShader("assets/shaders/mesh_frag.spv");
+	VkShaderModule materialFragment = pipelines.loadShader(bindlessEnabled
+			? "assets/shaders/material_bindless_frag.spv" : "assets/shaders/material_frag.spv");
+	if (meshVertex == VK_NULL_HANDLE || materialFragment == VK_NULL_HANDLE)
+		std::cerr << "mesh shaders not compiled, meshes will not be drawn" << std::endl;
+	else
+		states.push_back(meshPipelineState());
 
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
+#ifdef VK_EXT_mesh_shader
+	/* same state with task / mesh stages in place of the vertex input */
+	VkShaderModule meshletTask = meshShaderEnabled ? pipelines.loadShader("assets/shaders/meshlet_task.spv") : VK_NULL_HANDLE;
+	VkShaderModule meshletMesh = meshShaderEnabled ? pipelines.loadShader("assets/shaders/meshlet_mesh.spv") : VK_NULL_HANDLE;
+	if (states.size() == 2 && meshletTask != VK_NULL_HANDLE && meshletMesh != VK_NULL_HANDLE && meshFragment != VK_NULL_HANDLE)
+	{
+		PipelineState meshlet = states[1];
+		meshlet.stageCount = 0;
+		meshlet.addStage(VK_SHADER_STAGE_TASK_BIT_EXT, meshletTask);
+		meshlet.addStage(VK_SHADER_STAGE_MESH_BIT_EXT, meshletMesh);
+		meshlet.addStage(VK_SHADER_STAGE_FRAGMENT_BIT, meshFragment);
+		meshlet.layout = meshletPipelineLayout;
+		states.push_back(meshlet);
+	}
+#endif
+
+	PipelineState cull;
+	cull.bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+	cull.addStage(VK_SHADER_STAGE_COMPUTE_BIT, pipelines.loadShader("assets/shaders/cull_comp.spv"));
+	cull.layout = meshletPipelineLayout;
+	if (cull.modules[0] != VK_NULL_HANDLE)
+		states.push_back(cull);
+	else
+		std::cerr << "meshlet culling shader not compiled, meshes are drawn without cluster culling" << std::endl;
 
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float) swapChainExtent.width;
-	viewport.height = (float) swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+	auto start = std::chrono::steady_clock::now();
 
-	VkRect2D scissor = {};
-	scissor.offset = {0, 0};
-	scissor.extent = swapChainExtent;
-
-	VkPipelineViewportStateCreateInfo viewportState = {};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
-
-	VkPipelineRasterizationStateCreateInfo rasterizer = {};
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE;
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterizer.depthBiasEnable = VK_FALSE;
-	rasterizer.depthBiasConstantFactor = 0.0f;
-	rasterizer.depthBiasClamp = 0.0f;
-	rasterizer.depthBiasSlopeFactor = 0.0f;
-
-	VkPipelineMultisampleStateCreateInfo multisampling = {};
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-	multisampling.minSampleShading = 1.0f;
-	multisampling.pSampleMask = nullptr;
-	multisampling.alphaToCoverageEnable = VK_FALSE;
-	multisampling.alphaToOneEnable = VK_FALSE;
-
-	VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_FALSE;
-
-	VkPipelineColorBlendStateCreateInfo colorBlending = {};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY;
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f;
-	colorBlending.blendConstants[1] = 0.0f;
-	colorBlending.blendConstants[2] = 0.0f;
-	colorBlending.blendConstants[3] = 0.0f;
-
-	VkDynamicState dynamicStates[] =
-	{
-	    VK_DYNAMIC_STATE_VIEWPORT,
-	    VK_DYNAMIC_STATE_SCISSOR
-	};
+	std::vector<VkPipeline> created(states.size());
+	pipelines.createBatch(states, threadPool, created.data());
+
+	std::cout << "pipelines: " << states.size() << " created in " << pipelines.calls() << " calls, "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+	for (size_t i = 0; i < states.size(); i++)
+	{
+		if (states[i].bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE)
+			cullPipeline = created[i];
+		else if (states[i].layout == pipelineLayout)
+			graphicsPipeline = created[i];
+		else if (states[i].layout == meshPipelineLayout)
+			meshPipeline = created[i];
+		else
+			meshletPipeline = created[i];
+	}
 
-	VkPipelineDynamicStateCreateInfo dynamicState = {};
-	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicState.dynamicStateCount = 2;
-	dynamicState.pDynamicStates = dynamicStates;
+	/* without its shaders the post processing falls back to a blit */
+	postProcess.createPipelines(pipelines);
+
+	if (pipelineWarmupVariants > 0 && meshPipeline != VK_NULL_HANDLE)
+		warmUpPipelines();
+}
+
+/* vertex path of the meshes : packed vertices, and the world matrix per instance at binding 1 */
+PipelineState App::meshPipelineState ()
+{
+	PipelineState state;
+	state.addStage(VK_SHADER_STAGE_VERTEX_BIT, pipelines.loadShader("assets/shaders/mesh_vert.spv"));
+	state.addStage(VK_SHADER_STAGE_FRAGMENT_BIT, pipelines.loadShader(bindlessEnabled
+			? "assets/shaders/material_bindless_frag.spv" : "assets/shaders/material_frag.spv"));
+
+	VkVertexInputBindingDescription binding = PackedVertex::getBindingDescription();
+	state.addBinding(binding.binding, binding.stride, binding.inputRate);
+	state.addBinding(1, sizeof(glm::mat4), VK_VERTEX_INPUT_RATE_INSTANCE);
+
+	auto vertexAttributes = PackedVertex::getAttributeDescriptions();
+	for (const VkVertexInputAttributeDescription& attribute : vertexAttributes)
+		state.addAttribute(attribute.location, attribute.binding, attribute.format, attribute.offset);
+
+	/* one vec4 column per location */
+	for (uint32_t column = 0; column < 4; column++)
+		state.addAttribute(static_cast<uint32_t>(vertexAttributes.size()) + column, 1, VK_FORMAT_R32G32B32A32_SFLOAT,
+				column * sizeof(glm::vec4));
+
+	/* counter clockwise : the projection flips Y */
+	state.layout = meshPipelineLayout;
+	state.setTarget(renderTarget);
+	state.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	state.depthTest = VK_TRUE;
+	state.depthWrite = VK_TRUE;
+	state.depthCompare = VK_COMPARE_OP_LESS;
+	return state;
+}
+
+/*
+ * --pipeline-warmup : variants of the mesh pipeline as a material system would
+ * ask for them, half created on one thread and half on the pool.
+ */
+void App::warmUpPipelines ()
+{
+	const VkCullModeFlags cullModes[] = { VK_CULL_MODE_NONE, VK_CULL_MODE_FRONT_BIT, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_AND_BACK };
+
+	std::vector<PipelineState> variants(pipelineWarmupVariants, meshPipelineState());
+	for (uint32_t i = 0; i < pipelineWarmupVariants; i++)
+	{
+		PipelineState& state = variants[i];
+		state.cullMode = cullModes[i % 4];
+		state.frontFace = (i / 4) % 2 ? VK_FRONT_FACE_CLOCKWISE : VK_FRONT_FACE_COUNTER_CLOCKWISE;
+		state.depthCompare = static_cast<VkCompareOp>((i / 8) % 8);
+		state.blend = (i / 64) % 2;
+		state.depthWrite = (i / 128) % 2;
+		state.topology = (i / 256) % 2 ? VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		state.colorWriteMask = 0xF - (i / 512) % 15;
+	}
+
+	size_t half = variants.size() / 2;
+	std::vector<PipelineState> singleThreaded(variants.begin(), variants.begin() + half);
+	std::vector<PipelineState> parallel(variants.begin() + half, variants.end());
+	std::vector<VkPipeline> created(variants.size());
+
+	ThreadPool single(1);
+	auto start = std::chrono::steady_clock::now();
+	pipelines.createBatch(singleThreaded, single, created.data());
+	double singleMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	pipelines.createBatch(parallel, threadPool, created.data() + half);
+	double parallelMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "pipeline warm-up: " << variants.size() << " variants, " << singleMilliseconds / std::max<size_t>(half, 1)
+		<< " ms each on 1 thread, " << parallelMilliseconds / std::max<size_t>(parallel.size(), 1) << " ms each on "
+		<< threadPool.concurrency() << " threads, " << pipelines.derived() << " derivatives, " << pipelines.size() << " pipelines cached" << std::endl;
+}
+
+/*
+ * One set per mesh : meshlets, indirect commands, culling counters, meshlet vertices,
+ * meshlet triangles and vertices. Shared by cull.comp and the task / mesh shaders.
+ */
+void App::createMeshletSetLayout ()
+{
+	std::array<VkDescriptorSetLayoutBinding, 6> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = meshletStages;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, hostAllocator.callbacks(), &meshletSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create meshlet descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = meshletStages;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(MeshletPushConstants);
 
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0;
-	pipelineLayoutInfo.pSetLayouts = nullptr;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = 0;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &meshletSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
-	    throw std::runtime_error("failed to create pipeline layout!");
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, hostAllocator.callbacks(), &meshletPipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create meshlet pipeline layout!");
+}
 
-	VkGraphicsPipelineCreateInfo pipelineInfo = {};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStages;
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pDepthStencilState = nullptr;
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = &dynamicState;
-	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = renderPass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-	pipelineInfo.basePipelineIndex = -1;
-
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
-    	throw std::runtime_error("failed to create graphics pipeline!");
-
-	vkDestroyShaderModule(device, vertShaderModule, nullptr);
-	vkDestroyShaderModule(device, fragShaderModule, nullptr);
+void App::createPostProcess ()
+{
+	PostSettings settings;
+	settings.exposure = POST_EXPOSURE;
+	settings.bloomThreshold = BLOOM_THRESHOLD;
+	settings.bloomIntensity = BLOOM_INTENSITY;
+	settings.bloomLevels = BLOOM_LEVELS;
+	settings.fxaa = POST_FXAA;
+
+	postProcess.init(context, deletionQueue, settings);
+
+	if (!readbackPath.empty())
+		readback.init(context, deletionQueue, readbackPath, readbackFormat, readbackInterval, READBACK_SLOTS);
+
+	/* a replay draws at full resolution : the LODs depend on it */
+	if (gpuBudget > 0.0 && !replay.isOpen())
+	{
+		resolution.init(context, gpuBudget, RESOLUTION_MIN_SCALE, RESOLUTION_MAX_SCALE);
+		if (!resolution.enabled())
+			std::cerr << "no GPU timestamps, the resolution stays fixed" << std::endl;
+	}
 }
 
 void App::createRenderPass ()
 {
-	VkAttachmentDescription colorAttachment = {};
-    colorAttachment.format = swapChainImageFormat;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	VkAttachmentReference colorAttachmentRef = {};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-	VkSubpassDescription subpass = {};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentRef;
-
-	VkSubpassDependency dependency = {};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-	VkRenderPassCreateInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
-
-	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
-	    throw std::runtime_error("failed to create render pass!");
+	msaaSamples = chooseSampleCount();
+	depthFormat = findDepthFormat();
+
+	renderPasses.init(context);
+	renderPass = dynamicRenderingEnabled ? VK_NULL_HANDLE : renderPasses.get(postProcess.format(), depthFormat, msaaSamples);
+
+	renderTarget.renderPass = renderPass;
+	renderTarget.colorFormat = postProcess.format();
+	renderTarget.depthFormat = depthFormat;
+	renderTarget.samples = msaaSamples;
+}
+
+/* the highest count up to the requested one that color and depth attachments both support */
+VkSampleCountFlagBits App::chooseSampleCount ()
+{
+	VkSampleCountFlags supported = context.properties.limits.framebufferColorSampleCounts &
+			context.properties.limits.framebufferDepthSampleCounts;
+
+	for (uint32_t count = VK_SAMPLE_COUNT_64_BIT; count > VK_SAMPLE_COUNT_1_BIT; count >>= 1)
+		if (count <= requestedSamples && (supported & count))
+			return static_cast<VkSampleCountFlagBits>(count);
+
+	return VK_SAMPLE_COUNT_1_BIT;
+}
+
+/* depth only lives inside the render pass : transient, on tile memory where the device has it */
+void App::createDepthResources ()
+{
+	VkImage image;
+	VkDeviceMemory memory;
+	transientMemoryProperties = context.createImage(swapChainExtent.width, swapChainExtent.height, depthFormat,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, image, memory, 1, msaaSamples, MEMORY_CATEGORY_RENDER_TARGET);
+
+	depthImage = Unique<VkImage>(deletionQueue, image);
+	depthImageMemory = Unique<VkDeviceMemory>(deletionQueue, memory);
+	depthImageView = Unique<VkImageView>(deletionQueue, context.createImageView(image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1));
+}
+
+/* the multisampled color target, resolved then dropped by the render pass */
+void App::createColorResources ()
+{
+	if (msaaSamples == VK_SAMPLE_COUNT_1_BIT)
+		return;
+
+	VkImage image;
+	VkDeviceMemory memory;
+	context.createImage(swapChainExtent.width, swapChainExtent.height, postProcess.format(),
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, image, memory, 1, msaaSamples, MEMORY_CATEGORY_RENDER_TARGET);
+
+	msaaColorImage = Unique<VkImage>(deletionQueue, image);
+	msaaColorMemory = Unique<VkDeviceMemory>(deletionQueue, memory);
+	msaaColorView = Unique<VkImageView>(deletionQueue, context.createImageView(image, postProcess.format(), VK_IMAGE_ASPECT_COLOR_BIT, 1));
+}
+
+void App::createPostTargets ()
+{
+	std::vector<VkImageView> views(swapChainImageViews.begin(), swapChainImageViews.end());
+	postProcess.resize(swapChainExtent, swapChainImages, views, swapChainImageFormat, swapChainUsage);
+
+	if (readback.enabled() && !readback.resize(swapChainExtent, swapChainImageFormat, swapChainUsage))
+		std::cout << "readback: the swap chain is not 8 bit RGBA or BGRA, or cannot be copied from : no frames are written" << std::endl;
 }
 
+/* one framebuffer : every frame renders to the same HDR target. None with dynamic rendering */
 void App::createFramebuffers ()
 {
-	swapChainFramebuffers.resize(swapChainImageViews.size());
+	if (dynamicRenderingEnabled)
+		return;
 
-	for (size_t i = 0; i < swapChainImageViews.size(); i++)
+	bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+	VkImageView attachments[] =
 	{
-	    VkImageView attachments[] =
-		{
-	        swapChainImageViews[i]
-	    };
-
-	    VkFramebufferCreateInfo framebufferInfo = {};
-	    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	    framebufferInfo.renderPass = renderPass;
-	    framebufferInfo.attachmentCount = 1;
-	    framebufferInfo.pAttachments = attachments;
-	    framebufferInfo.width = swapChainExtent.width;
-	    framebufferInfo.height = swapChainExtent.height;
-	    framebufferInfo.layers = 1;
+		multisampled ? msaaColorView.get() : postProcess.view(),
+		depthImageView,
+		postProcess.view()
+	};
 
-	    if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
-	        throw std::runtime_error("failed to create framebuffer!");
-	}
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = renderPass;
+	framebufferInfo.attachmentCount = multisampled ? 3 : 2;
+	framebufferInfo.pAttachments = attachments;
+	framebufferInfo.width = swapChainExtent.width;
+	framebufferInfo.height = swapChainExtent.height;
+	framebufferInfo.layers = 1;
+
+	VkFramebuffer created;
+	if (vkCreateFramebuffer(device, &framebufferInfo, hostAllocator.callbacks(), &created) != VK_SUCCESS)
+		throw std::runtime_error("failed to create framebuffer!");
+
+	framebuffer = Unique<VkFramebuffer>(deletionQueue, created);
+	framebuffersCreated++;
 }
 
 void App::createCommandPool ()
@@ -643,72 +1714,455 @@ void App::createCommandPool ()
 	VkCommandPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-	poolInfo.flags = 0;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+	if (vkCreateCommandPool(device, &poolInfo, hostAllocator.callbacks(), &commandPool) != VK_SUCCESS)
     	throw std::runtime_error("failed to create command pool!");
 }
 
+/* recorded from scratch every frame, so kept across resizes : only a swap chain with more images allocates more */
 void App::createCommandBuffers ()
 {
-	commandBuffers.resize(swapChainFramebuffers.size());
+	size_t first = commandBuffers.size();
+	if (first >= swapChainImages.size())
+		return;
+
+	commandBuffers.resize(swapChainImages.size());
 
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = commandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+	allocInfo.commandBufferCount = (uint32_t) (commandBuffers.size() - first);
 
-	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data() + first) != VK_SUCCESS)
 	    throw std::runtime_error("failed to allocate command buffers!");
+}
 
-	for (size_t i = 0; i < commandBuffers.size(); i++)
-	{
-	    VkCommandBufferBeginInfo beginInfo = {};
-	    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-	    beginInfo.pInheritanceInfo = nullptr;
+/* recorded every frame : LOD selection changes the draws */
+void App::recordCommandBuffer (uint32_t imageIndex)
+{
+	VkCommandBuffer commandBuffer = commandBuffers[imageIndex];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	/* the scale picked from the previous frames, for the whole of this one */
+	renderExtent = resolution.extent(swapChainExtent);
+
+	/* every draw of the frame goes through the queue, sorted by state then front to back */
+	commandState.reset();
+	drawQueue.clear();
+	drawQueue.push(makeSortKey(DRAW_PASS_OPAQUE, DRAW_PIPELINE_TRIANGLE, 0, 0, 0), DRAW_TRIANGLE);
+
+	updateCamera();
+	prepareMeshes();
+	updateMaterialTextures();
+
+	if (particles.ready())
+		drawQueue.push(makeSortKey(DRAW_PASS_TRANSPARENT, DRAW_PIPELINE_PARTICLES, 0, 0, 0), DRAW_PARTICLES);
+
+	drawQueue.sort(threadPool);
+	queuedDraws += drawQueue.size();
+	drawStatFrames++;
+
+	cullMeshlets(commandBuffer);
+
+	/* the fountain stands in the middle of the grid */
+	float deltaTime = lastFrameTime > 0.0 ? (float) std::min(frameTime - lastFrameTime, 0.1) : 0.0f;
+	lastFrameTime = frameTime;
+	particles.simulate(commandBuffer, deltaTime, (float) frameTime, glm::vec3(0.0f, 0.0f, meshGridSpacing * MESH_INSTANCE_GRID * 0.5f));
+
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float) renderExtent.width;
+	viewport.height = (float) renderExtent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, (uint32_t)0, (uint32_t)1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.offset = {0, 0};
+	scissor.extent = renderExtent;
+	vkCmdSetScissor(commandBuffer, (uint32_t)0, (uint32_t)1, &scissor);
+
+	/* the scene and the bloom, what the scale changes : not the culling before, nor the passes writing the swap chain */
+	resolution.begin(commandBuffer);
+	beginScene(commandBuffer);
+
+	auto recordStart = std::chrono::steady_clock::now();
+	recordDraws(commandBuffer);
+	drawRecordMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
 
-	    vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+	endScene(commandBuffer);
+
+	postProcess.recordBloom(commandBuffer, renderExtent);
+	resolution.end(commandBuffer);
+	postProcess.recordOutput(commandBuffer, imageIndex, renderExtent);
+	readback.record(commandBuffer, swapChainImages[imageIndex], frameIndex);
+
+#ifdef VK_EXT_mesh_shader
+	/* the task shaders counted the visible meshlets, read back at the next frame */
+	if (geometryPath == GEOMETRY_PATH_MESH_SHADER)
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+#endif
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record command buffer!");
+}
+
+/*
+ * The render pass, or with dynamic rendering the same attachments without
+ * one : the barriers stand in for its layout transitions and dependencies.
+ */
+void App::beginScene (VkCommandBuffer commandBuffer)
+{
+	VkClearValue colorClear = {};
+	colorClear.color = {0.0f, 0.0f, 0.0f, 1.0f};
+	VkClearValue depthClear = {};
+	depthClear.depthStencil = {1.0f, 0};
+
+	if (!dynamicRenderingEnabled)
+	{
+		std::array<VkClearValue, 2> clearValues = {colorClear, depthClear};
 
 		VkRenderPassBeginInfo renderPassInfo = {};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+		renderPassInfo.framebuffer = framebuffer;
 		renderPassInfo.renderArea.offset = {0, 0};
-		renderPassInfo.renderArea.extent = swapChainExtent;
+		renderPassInfo.renderArea.extent = renderExtent;
+		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		renderPassInfo.pClearValues = clearValues.data();
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		return;
+	}
+
+#ifdef VK_KHR_dynamic_rendering
+	bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+	bool stencil = depthFormat != VK_FORMAT_D32_SFLOAT;
+
+	/* every attachment from UNDEFINED : after the previous frame's post processing read the target */
+	std::array<VkImageMemoryBarrier, 3> barriers = {};
+	VkImage images[3] = {postProcess.image(), depthImage, msaaColorImage};
+	for (uint32_t i = 0; i < barriers.size(); i++)
+	{
+		barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barriers[i].newLayout = i == 1 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		barriers[i].srcAccessMask = 0;
+		barriers[i].dstAccessMask = i == 1 ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+			: VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].image = images[i];
+		barriers[i].subresourceRange.aspectMask = i == 1
+			? VK_IMAGE_ASPECT_DEPTH_BIT | (stencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0) : VK_IMAGE_ASPECT_COLOR_BIT;
+		barriers[i].subresourceRange.levelCount = 1;
+		barriers[i].subresourceRange.layerCount = 1;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+			0, 0, nullptr, 0, nullptr, multisampled ? 3 : 2, barriers.data());
+
+	/* multisampled : the transient color is resolved into the HDR target, and dropped */
+	VkRenderingAttachmentInfoKHR colorAttachment = {};
+	colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	colorAttachment.imageView = multisampled ? msaaColorView.get() : postProcess.view();
+	colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.resolveMode = multisampled ? VK_RESOLVE_MODE_AVERAGE_BIT_KHR : VK_RESOLVE_MODE_NONE_KHR;
+	colorAttachment.resolveImageView = multisampled ? postProcess.view() : VK_NULL_HANDLE;
+	colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.clearValue = colorClear;
+
+	VkRenderingAttachmentInfoKHR depthAttachment = {};
+	depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	depthAttachment.imageView = depthImageView;
+	depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.clearValue = depthClear;
+
+	VkRenderingInfoKHR renderingInfo = {};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+	renderingInfo.renderArea.offset = {0, 0};
+	renderingInfo.renderArea.extent = renderExtent;
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorAttachment;
+	renderingInfo.pDepthAttachment = &depthAttachment;
+
+	cmdBeginRendering(commandBuffer, &renderingInfo);
+#endif
+}
+
+void App::endScene (VkCommandBuffer commandBuffer)
+{
+	if (!dynamicRenderingEnabled)
+	{
+		vkCmdEndRenderPass(commandBuffer);
+		return;
+	}
+
+#ifdef VK_KHR_dynamic_rendering
+	cmdEndRendering(commandBuffer);
+
+	/* the render pass final layout, and its dependency on the post processing */
+	imageBarrier(commandBuffer, postProcess.image(), 0, 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT);
+#endif
+}
+
+/* the camera flies back and forth over the instance grid */
+void App::updateCamera ()
+{
+	float gridDepth = meshGridSpacing * MESH_INSTANCE_GRID;
+	float travel = frameState.cameraTravel;
+	cameraEye = glm::vec3(0.0f, meshGridSpacing, -meshGridSpacing - travel * gridDepth * 8.0f);
+	glm::vec3 target(0.0f, 0.0f, gridDepth * 0.5f);
+	cameraFar = gridDepth * 20.0f;
+
+	float aspect = swapChainExtent.width / (float) swapChainExtent.height;
+	glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV), aspect, meshGridSpacing * 0.01f, cameraFar);
+	projection[1][1] *= -1.0f;
+	cameraViewProjection = projection * glm::lookAt(cameraEye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+/* scene update, frustum culling and LOD selection, then the visible instances go to the draw queue */
+void App::prepareMeshes ()
+{
+	if (meshPipeline == VK_NULL_HANDLE || meshInstances.empty())
+		return;
+
+	/* the previous frame is idle : its culling counters are final */
+	if (cullStats != nullptr)
+	{
+		visibleTriangles += cullStats[1];
+		cullStats[0] = 0;
+		cullStats[1] = 0;
+	}
+
+	const glm::vec3& eye = cameraEye;
+	const glm::mat4& viewProjection = cameraViewProjection;
+
+	/* pixels covered by one unit at distance one : fewer at a lower resolution, coarser LODs with them */
+	float projectionScale = renderExtent.height / (2.0f * std::tan(glm::radians(CAMERA_FOV) * 0.5f));
+
+	/* the rows the simulation moves, the rest of the scene stays clean */
+	for (size_t row = 1; row < meshRows.size(); row += 2)
+		scene.setPosition(meshRows[row], glm::vec3(0.0f, frameState.rowHeights[row] * meshGridSpacing, row * meshGridSpacing));
+
+	scene.update(threadPool, instanceData[frameIndex % INSTANCE_BUFFER_FRAMES]);
+
+	/* only the moved instances touch the BVH, then the frustum picks what gets LODs, culling and draws */
+	auto cullStart = std::chrono::steady_clock::now();
+
+	for (uint32_t i = 0; i < meshInstances.size(); i++)
+		if (scene.changed(meshInstances[i].node))
+			meshBvh.setBounds(i, scene.worldCenter(meshInstances[i].node), glm::vec3(scene.worldRadius(meshInstances[i].node)));
+	meshBvh.refit();
+
+	/* from the frame allocator : gone with its reset at the start of the next frame */
+	std::vector<uint32_t, ArenaAllocator<uint32_t>> visibleInstances(meshInstances.size(), 0, ArenaAllocator<uint32_t>(&frameAllocator));
+	visibleInstanceCount = meshBvh.cull(Frustum::fromMatrix(viewProjection), threadPool, visibleInstances.data());
+
+	cullMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+	culledInstances += meshInstances.size() - visibleInstanceCount;
+
+	for (size_t v = 0; v < visibleInstanceCount; v++)
+	{
+		uint32_t i = visibleInstances[v];
+		MeshInstance& instance = meshInstances[i];
+		const Mesh& mesh = meshes.get(instance.mesh);
+
+		float radius = scene.worldRadius(instance.node);
+		float scale = mesh.radius > 0.0f ? radius / mesh.radius : 1.0f;
+		float distance = std::max(glm::length(scene.worldCenter(instance.node) - eye) - radius, meshGridSpacing * 0.01f);
+
+		uint32_t lod = selectLod(mesh, projectionScale * scale / distance, instance.lod, LOD_MAX_PIXEL_ERROR, LOD_HYSTERESIS);
+		if (lod != instance.lod)
+			lodSwitches++;
+		instance.lod = lod;
+
+		const MeshLod& range = mesh.lods[lod];
+
+		MeshletPushConstants& constants = meshletConstants[i];
+		constants.transform = viewProjection * scene.world(instance.node);
+		constants.positionScale = glm::vec4(mesh.positionScale[0], mesh.positionScale[1], mesh.positionScale[2], (float) lod);
+		constants.positionOffset = glm::vec4(mesh.positionOffset[0], mesh.positionOffset[1], mesh.positionOffset[2], 0.0f);
+		constants.eye = glm::vec4(scene.toLocal(instance.node, eye), 1.0f);
+		constants.meshletOffset = range.meshletOffset;
+		constants.meshletCount = range.meshletCount;
+		constants.commandOffset = instance.commandOffset;
+		constants.padding = 0;
+
+		/* only what is drawn stays recent : the residency budget evicts the textures of culled materials first */
+		if (instance.mesh < materialTextures.size() && materialTextures[instance.mesh] != INVALID_TEXTURE)
+			textures.touch(textureHandles[materialTextures[instance.mesh]], frameIndex);
+
+		submittedTriangles += range.indexCount / 3;
+		fullDetailTriangles += mesh.lods[0].indexCount / 3;
+
+		/* the mesh shaders and per draw materials bind a set per mesh, bindless materials only change buffers */
+		uint32_t depth = sortKeyDepth(distance, cameraFar);
+		if (geometryPath == GEOMETRY_PATH_MESH_SHADER)
+			drawQueue.push(makeSortKey(DRAW_PASS_OPAQUE, DRAW_PIPELINE_MESHLET, instance.mesh + 1, instance.mesh + 1, depth), i);
+		else if (bindlessEnabled)
+			drawQueue.push(makeSortKey(DRAW_PASS_OPAQUE, DRAW_PIPELINE_MESH, 0, instance.mesh + 1, depth), i);
+		else
+			drawQueue.push(makeSortKey(DRAW_PASS_OPAQUE, DRAW_PIPELINE_MESH, instance.mesh + 1, instance.mesh + 1, depth), i);
+	}
+
+	meshStatFrames++;
+}
+
+/* the previous frame is idle : descriptors of textures that were streamed in or out can be rewritten */
+void App::updateMaterialTextures ()
+{
+	if (textureVersions.empty())
+		return;
+
+	for (uint32_t index = 0; index < textureVersions.size(); index++)
+	{
+		const Texture& texture = textures.get(textureHandles[index]);
+		if (texture.version == textureVersions[index] || texture.view == VK_NULL_HANDLE)
+			continue;
+
+		textureVersions[index] = texture.version;
+
+		if (bindlessEnabled)
+		{
+			bindless.setTexture(bindlessTextures[index], texture.view, textures.getSampler());
+			continue;
+		}
+
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.sampler = textures.getSampler();
+		imageInfo.imageView = texture.view;
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-		VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
+		for (size_t i = 0; i < materialSets.size(); i++)
+		{
+			if (materialTextures[i] != index)
+				continue;
+
+			VkWriteDescriptorSet write = {};
+			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write.dstSet = materialSets[i];
+			write.dstBinding = BINDLESS_TEXTURE_BINDING;
+			write.descriptorCount = 1;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			write.pImageInfo = &imageInfo;
+			vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+		}
+	}
+}
 
-		VkViewport viewport = {};
-		viewport.x = 0.0f;
-		viewport.y = 0.0f;
-		viewport.width = (float) swapChainExtent.width;
-		viewport.height = (float) swapChainExtent.height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-		vkCmdSetViewport(commandBuffers[i], (uint32_t)0, (uint32_t)1, &viewport);
+/* outside the render pass : per meshlet draw commands of the queued instances */
+void App::cullMeshlets (VkCommandBuffer commandBuffer)
+{
+	if (geometryPath != GEOMETRY_PATH_COMPUTE_CULLING)
+		return;
+
+	commandState.bindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+
+	for (const DrawItem& item : drawQueue)
+	{
+		if (item.index == DRAW_TRIANGLE || item.index == DRAW_PARTICLES)
+			continue;
+
+		const MeshInstance& instance = meshInstances[item.index];
+		commandState.bindDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletPipelineLayout, meshletSets[instance.mesh]);
+
+		const MeshletPushConstants& constants = meshletConstants[item.index];
+		vkCmdPushConstants(commandBuffer, meshletPipelineLayout, meshletStages, 0, sizeof(constants), &constants);
+		dispatchGroups(commandBuffer, constants.meshletCount, MESHLET_CULL_GROUP_SIZE);
+	}
+
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT);
+}
 
-		VkRect2D scissor = {};
-		scissor.offset = {0, 0};
-		scissor.extent = swapChainExtent;
-		vkCmdSetScissor(commandBuffers[i], (uint32_t)0, (uint32_t)1, &scissor);
+void App::recordDraws (VkCommandBuffer commandBuffer)
+{
+	for (const DrawItem& item : drawQueue)
+	{
+		if (item.index == DRAW_PARTICLES)
+		{
+			particles.draw(commandBuffer, commandState, cameraViewProjection);
+			continue;
+		}
 
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		if (item.index != DRAW_TRIANGLE)
+		{
+			drawMesh(commandBuffer, item.index);
+			continue;
+		}
 
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+		commandState.bindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+		commandState.bindVertexBuffer(commandBuffer, vertexBuffer, 0);
+		vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+	}
+}
 
-		VkBuffer vertexBuffers[] = {vertexBuffer};
-		VkDeviceSize offsets[] = {0};
-		vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-		vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+void App::drawMesh (VkCommandBuffer commandBuffer, uint32_t instanceIndex)
+{
+	const MeshInstance& instance = meshInstances[instanceIndex];
+	const MeshletPushConstants& meshletConstant = meshletConstants[instanceIndex];
 
-		vkCmdEndRenderPass(commandBuffers[i]);
+#ifdef VK_EXT_mesh_shader
+	if (geometryPath == GEOMETRY_PATH_MESH_SHADER)
+	{
+		commandState.bindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipeline);
+		commandState.bindDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipelineLayout, meshletSets[instance.mesh]);
 
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
-    		throw std::runtime_error("failed to record command buffer!");
+		vkCmdPushConstants(commandBuffer, meshletPipelineLayout, meshletStages, 0, sizeof(meshletConstant), &meshletConstant);
+		cmdDrawMeshTasks(commandBuffer, (meshletConstant.meshletCount + MESHLET_TASK_GROUP_SIZE - 1) / MESHLET_TASK_GROUP_SIZE, 1, 1);
+		return;
+	}
+#endif
+
+	const Mesh& mesh = meshes.get(instance.mesh);
+
+	commandState.bindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+	commandState.bindDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipelineLayout,
+			bindlessEnabled ? bindless.descriptorSet() : materialSets[instance.mesh]);
+	commandState.bindVertexBuffer(commandBuffer, mesh.buffer, 0);
+	commandState.bindIndexBuffer(commandBuffer, mesh.buffer, mesh.indexOffset, mesh.indexType);
+
+	/* the world matrix is the only per instance attribute : offset instead of firstInstance, indirect draws leave it 0 */
+	VkDeviceSize instanceOffset = instanceIndex * sizeof(glm::mat4);
+	vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceBuffers[frameIndex % INSTANCE_BUFFER_FRAMES], &instanceOffset);
+
+	MeshPushConstants constants;
+	constants.viewProjection = cameraViewProjection;
+	constants.positionScale = meshletConstant.positionScale;
+	constants.positionOffset = meshletConstant.positionOffset;
+	constants.material = instance.mesh;
+	constants.padding[0] = constants.padding[1] = constants.padding[2] = 0;
+	vkCmdPushConstants(commandBuffer, meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+
+	/* culled meshlets have empty commands */
+	if (geometryPath == GEOMETRY_PATH_COMPUTE_CULLING)
+		vkCmdDrawIndexedIndirect(commandBuffer, drawCommandBuffer, instance.commandOffset * sizeof(VkDrawIndexedIndirectCommand),
+				meshletConstant.meshletCount, sizeof(VkDrawIndexedIndirectCommand));
+	else
+	{
+		const MeshLod& range = mesh.lods[instance.lod];
+		vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, range.indexOffset, 0, 0);
 	}
 }
 
@@ -717,24 +2171,26 @@ void App::createSemaphores ()
 	VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS)
+	VkSemaphore semaphores[2];
+	if (vkCreateSemaphore(device, &semaphoreInfo, hostAllocator.callbacks(), &semaphores[0]) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, hostAllocator.callbacks(), &semaphores[1]) != VK_SUCCESS)
     	throw std::runtime_error("failed to create semaphores!");
+
+	imageAvailableSemaphore = Unique<VkSemaphore>(deletionQueue, semaphores[0]);
+	renderFinishedSemaphore = Unique<VkSemaphore>(deletionQueue, semaphores[1]);
+
+	/* signaled : the first frame has nothing to wait for */
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	if (vkCreateFence(device, &fenceInfo, hostAllocator.callbacks(), &frameFence) != VK_SUCCESS)
+		throw std::runtime_error("failed to create frame fence!");
 }
 
 uint32_t App::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-	{
-	    if (typeFilter & (1 << i) &&
-				(memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-	        return i;
-	}
-
-	throw std::runtime_error("failed to find suitable memory type!");
+	return context.findMemoryType(typeFilter, properties);
 }
 
 void App::createVertexBuffer ()
@@ -745,20 +2201,22 @@ void App::createVertexBuffer ()
 	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	if (vkCreateBuffer(device, &bufferInfo, nullptr, &vertexBuffer) != VK_SUCCESS)
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &bufferInfo, hostAllocator.callbacks(), &buffer) != VK_SUCCESS)
         throw std::runtime_error("failed to create vertex buffer!");
 
+	vertexBuffer = Unique<VkBuffer>(deletionQueue, buffer);
+
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, vertexBuffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &vertexBufferMemory) != VK_SUCCESS)
+	VkDeviceMemory memory;
+	if (context.allocateMemory(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			MEMORY_CATEGORY_GEOMETRY, memory) != VK_SUCCESS)
     	throw std::runtime_error("failed to allocate vertex buffer memory!");
 
+	vertexBufferMemory = Unique<VkDeviceMemory>(deletionQueue, memory);
+
 	vkBindBufferMemory(device, vertexBuffer, vertexBufferMemory, 0);
 
 	void* data;
@@ -767,26 +2225,422 @@ void App::createVertexBuffer ()
 	vkUnmapMemory(device, vertexBufferMemory);
 }
 
+void App::createTextures ()
+{
+	textures.init(context, TEXTURE_MEMORY_BUDGET, TEXTURE_STAGING_SLOT_SIZE, TEXTURE_STAGING_SLOTS, MAX_TEXTURES);
+
+	for (const std::string& file : texturePaths)
+		textureHandles.push_back(textures.load(file));
+}
+
+void App::createMeshes ()
+{
+	meshes.init(context, threadPool);
+
+	for (const std::string& file : meshPaths)
+	{
+		if (!meshBenchmark)
+		{
+			meshHandles.push_back(meshes.load(file));
+			continue;
+		}
+
+		/* the whole load both times : the import or the up to date check, the cache validation and the upload */
+		auto start = std::chrono::steady_clock::now();
+		meshes.load(file, true);
+		double cold = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		meshHandles.push_back(meshes.load(file));
+		double cached = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << file << ": imported and uploaded in " << cold << " ms (cold), loaded from cache and uploaded in "
+			<< cached << " ms, " << (cached > 0.0 ? cold / cached : 0.0) << " times faster" << std::endl;
+	}
+
+	if (meshHandles.empty())
+	{
+		ImportedMesh sphere = generateSphere(BENCHMARK_SPHERE_RINGS, BENCHMARK_SPHERE_SEGMENTS);
+		meshHandles.push_back(meshes.generate(BENCHMARK_SPHERE, sphere));
+	}
+
+	for (MeshHandle handle : meshHandles)
+	{
+		const Mesh& mesh = meshes.get(handle);
+		std::cout << mesh.path << ": " << mesh.vertexCount << " vertices, " << mesh.indexCount / 3 << " triangles, "
+			<< mesh.cacheBytes / (1024 * 1024) << " MB cache" << std::endl;
+
+		if (mesh.importMilliseconds > 0.0)
+			std::cout << "  imported in " << mesh.importMilliseconds << " ms (cold), cached reload "
+				<< mesh.cachedMilliseconds << " ms" << std::endl;
+		else
+			std::cout << "  loaded from cache in " << mesh.cachedMilliseconds << " ms" << std::endl;
+
+		std::cout << "  " << mesh.lods.size() << " LODs :";
+		for (const MeshLod& lod : mesh.lods)
+			std::cout << " " << lod.indexCount / 3 << " (" << lod.error << ")";
+		std::cout << std::endl;
+	}
+
+	/* root -> one node per grid row -> instances normalized to a unit radius, each grid cell cycles through the meshes */
+	meshGridSpacing = 3.0f;
+	scene.setInstanceFrames(INSTANCE_BUFFER_FRAMES);
+
+	NodeHandle root = scene.create(NO_NODE);
+	for (uint32_t z = 0; z < MESH_INSTANCE_GRID; z++)
+	{
+		NodeHandle row = scene.create(root);
+		scene.setPosition(row, glm::vec3(0.0f, 0.0f, z * meshGridSpacing));
+		meshRows.push_back(row);
+
+		for (uint32_t x = 0; x < MESH_INSTANCE_GRID; x++)
+		{
+			MeshHandle handle = meshHandles[(z * MESH_INSTANCE_GRID + x) % meshHandles.size()];
+			const Mesh& mesh = meshes.get(handle);
+
+			float scale = mesh.radius > 0.0f ? 1.0f / mesh.radius : 1.0f;
+			glm::vec3 center(mesh.center[0], mesh.center[1], mesh.center[2]);
+
+			MeshInstance instance;
+			instance.mesh = handle;
+			instance.node = scene.create(row);
+			instance.lod = 0;
+			instance.commandOffset = 0;
+			scene.setPosition(instance.node, glm::vec3(((float) x - (MESH_INSTANCE_GRID - 1) * 0.5f) * meshGridSpacing, 0.0f, 0.0f) - center * scale);
+			scene.setScale(instance.node, scale);
+			scene.setBounds(instance.node, center, mesh.radius);
+			meshInstances.push_back(instance);
+		}
+	}
+
+	/* fewer vertex / index buffer binds */
+	std::stable_sort(meshInstances.begin(), meshInstances.end(), [] (const MeshInstance& a, const MeshInstance& b) {
+		return a.mesh < b.mesh;
+	});
+
+	for (uint32_t i = 0; i < meshInstances.size(); i++)
+		scene.setInstance(meshInstances[i].node, i);
+
+	/* persistently mapped, the scene update writes world matrices straight into them */
+	instanceBuffers.resize(INSTANCE_BUFFER_FRAMES);
+	instanceBufferMemory.resize(INSTANCE_BUFFER_FRAMES);
+	instanceData.resize(INSTANCE_BUFFER_FRAMES);
+	for (uint32_t i = 0; i < INSTANCE_BUFFER_FRAMES; i++)
+	{
+		VkDeviceSize size = meshInstances.size() * sizeof(glm::mat4);
+		context.createBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				instanceBuffers[i], instanceBufferMemory[i], MEMORY_CATEGORY_BUFFER);
+
+		void *data;
+		vkMapMemory(device, instanceBufferMemory[i], 0, size, 0, &data);
+		instanceData[i] = static_cast<glm::mat4*>(data);
+	}
+
+	/* world bounds of the initial layout, every instance is a sphere in a box */
+	scene.update(threadPool, nullptr);
+
+	meshBvh.resize(meshInstances.size());
+	for (uint32_t i = 0; i < meshInstances.size(); i++)
+		meshBvh.setBounds(i, scene.worldCenter(meshInstances[i].node), glm::vec3(scene.worldRadius(meshInstances[i].node)));
+	meshBvh.build();
+
+	drawQueue.reserve(meshInstances.size() + 1);
+
+	std::cout << "scene: " << scene.size() << " nodes, " << meshBvh.nodeCount() << " BVH nodes" << std::endl;
+}
+
+void App::createMeshletCulling ()
+{
+	if (meshPipeline == VK_NULL_HANDLE || meshInstances.empty())
+		return;
+
+	meshletConstants.resize(meshInstances.size());
+
+	/* every instance owns command slots for its largest LOD */
+	uint32_t commandCount = 0;
+	uint32_t largestLod = 0;
+	for (MeshInstance& instance : meshInstances)
+	{
+		uint32_t meshletCount = 0;
+		for (const MeshLod& lod : meshes.get(instance.mesh).lods)
+			meshletCount = std::max(meshletCount, lod.meshletCount);
+
+		instance.commandOffset = commandCount;
+		commandCount += meshletCount;
+		largestLod = std::max(largestLod, meshletCount);
+	}
+
+	if (meshletPipeline != VK_NULL_HANDLE)
+		geometryPath = GEOMETRY_PATH_MESH_SHADER;
+	else if (cullPipeline != VK_NULL_HANDLE && context.enabledFeatures.multiDrawIndirect &&
+			largestLod <= context.properties.limits.maxDrawIndirectCount)
+		geometryPath = GEOMETRY_PATH_COMPUTE_CULLING;
+
+	std::cout << "geometry: " << geometryPathName(geometryPath) << std::endl;
+
+	if (geometryPath == GEOMETRY_PATH_LOD)
+		return;
+
+	context.createBuffer(std::max<uint32_t>(commandCount, 1) * sizeof(VkDrawIndexedIndirectCommand),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			drawCommandBuffer, drawCommandMemory, MEMORY_CATEGORY_BUFFER);
+
+	/* visible meshlets, visible triangles */
+	context.createBuffer(2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cullStatsBuffer, cullStatsMemory,
+			MEMORY_CATEGORY_BUFFER);
+
+	void *data;
+	vkMapMemory(device, cullStatsMemory, 0, 2 * sizeof(uint32_t), 0, &data);
+	cullStats = static_cast<uint32_t*>(data);
+	cullStats[0] = 0;
+	cullStats[1] = 0;
+
+	uint32_t setCount = static_cast<uint32_t>(meshes.count());
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = setCount * 6;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = setCount;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, hostAllocator.callbacks(), &meshletDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create meshlet descriptor pool!");
+
+	std::vector<VkDescriptorSetLayout> layouts(setCount, meshletSetLayout);
+	meshletSets.resize(setCount);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = meshletDescriptorPool;
+	allocInfo.descriptorSetCount = setCount;
+	allocInfo.pSetLayouts = layouts.data();
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, meshletSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate meshlet descriptor sets!");
+
+	for (uint32_t i = 0; i < setCount; i++)
+	{
+		const Mesh& mesh = meshes.get(i);
+
+		std::array<VkDescriptorBufferInfo, 6> buffers = {};
+		buffers[0] = {mesh.buffer, mesh.meshletData.offset, mesh.meshletData.size};
+		buffers[1] = {drawCommandBuffer, 0, VK_WHOLE_SIZE};
+		buffers[2] = {cullStatsBuffer, 0, VK_WHOLE_SIZE};
+		buffers[3] = {mesh.buffer, mesh.meshletVertexData.offset, mesh.meshletVertexData.size};
+		buffers[4] = {mesh.buffer, mesh.meshletTriangleData.offset, mesh.meshletTriangleData.size};
+		buffers[5] = {mesh.buffer, mesh.vertexData.offset, mesh.vertexData.size};
+
+		std::array<VkWriteDescriptorSet, 6> writes = {};
+		for (uint32_t binding = 0; binding < writes.size(); binding++)
+		{
+			writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[binding].dstSet = meshletSets[i];
+			writes[binding].dstBinding = binding;
+			writes[binding].descriptorCount = 1;
+			writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			writes[binding].pBufferInfo = &buffers[binding];
+		}
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	}
+}
+
+/* one material per mesh : a tint and one of the textures, white until it is resident */
+void App::createMaterials ()
+{
+	if (meshPipeline == VK_NULL_HANDLE || meshHandles.empty())
+		return;
+
+	uint32_t materialCount = static_cast<uint32_t>(meshHandles.size());
+	if (materialCount > MAX_MATERIALS)
+		throw std::runtime_error("too many materials!");
+
+	VkSampler sampler = textures.getSampler();
+	VkImageView defaultView = textures.getDefaultView();
+
+	/* bindless texture 0 is the default one, then one slot per texture */
+	if (bindlessEnabled)
+	{
+		bindless.addTexture(defaultView, sampler);
+		for (size_t i = 0; i < textureHandles.size(); i++)
+			bindlessTextures.push_back(bindless.addTexture(defaultView, sampler));
+	}
+	textureVersions.assign(textureHandles.size(), 0);
+
+	/* every material at its own offset : bound as a range per material, or one array element each */
+	VkDeviceSize alignment = std::max<VkDeviceSize>(context.properties.limits.minStorageBufferOffsetAlignment, 1);
+	VkDeviceSize stride = (sizeof(MaterialData) + alignment - 1) / alignment * alignment;
+
+	context.createBuffer(materialCount * stride, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, materialBuffer, materialMemory,
+			MEMORY_CATEGORY_BUFFER);
+
+	void *data;
+	vkMapMemory(device, materialMemory, 0, materialCount * stride, 0, &data);
+
+	const glm::vec4 tints[4] = {
+		glm::vec4(1.0f, 1.0f, 1.0f, 1.0f),
+		glm::vec4(1.0f, 0.85f, 0.7f, 1.0f),
+		glm::vec4(0.7f, 0.85f, 1.0f, 1.0f),
+		glm::vec4(0.8f, 1.0f, 0.8f, 1.0f)
+	};
+
+	for (uint32_t i = 0; i < materialCount; i++)
+	{
+		materialTextures.push_back(textureHandles.empty() ? INVALID_TEXTURE : static_cast<uint32_t>(i % textureHandles.size()));
+
+		MaterialData material = {};
+		material.color = tints[i % 4];
+		material.texture = bindlessEnabled && materialTextures[i] != INVALID_TEXTURE ? bindlessTextures[materialTextures[i]] : 0;
+		memcpy(static_cast<char*>(data) + i * stride, &material, sizeof(material));
+	}
+
+	vkUnmapMemory(device, materialMemory);
+
+	if (bindlessEnabled)
+	{
+		/* material i is buffer i : the mesh handle is the material index */
+		for (uint32_t i = 0; i < materialCount; i++)
+			bindless.addBuffer(materialBuffer, i * stride, sizeof(MaterialData));
+
+		std::cout << "materials: " << materialCount << " in the bindless set with " << bindless.textures() << " textures" << std::endl;
+		return;
+	}
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = materialCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = materialCount;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = materialCount;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, hostAllocator.callbacks(), &materialDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create material descriptor pool!");
+
+	std::vector<VkDescriptorSetLayout> layouts(materialCount, materialSetLayout);
+	materialSets.resize(materialCount);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = materialDescriptorPool;
+	allocInfo.descriptorSetCount = materialCount;
+	allocInfo.pSetLayouts = layouts.data();
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, materialSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate material descriptor sets!");
+
+	for (uint32_t i = 0; i < materialCount; i++)
+	{
+		VkDescriptorImageInfo imageInfo = {};
+		imageInfo.sampler = sampler;
+		imageInfo.imageView = defaultView;
+		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = materialBuffer;
+		bufferInfo.offset = i * stride;
+		bufferInfo.range = sizeof(MaterialData);
+
+		std::array<VkWriteDescriptorSet, 2> writes = {};
+		writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[0].dstSet = materialSets[i];
+		writes[0].dstBinding = BINDLESS_TEXTURE_BINDING;
+		writes[0].descriptorCount = 1;
+		writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		writes[0].pImageInfo = &imageInfo;
+		writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[1].dstSet = materialSets[i];
+		writes[1].dstBinding = BINDLESS_BUFFER_BINDING;
+		writes[1].descriptorCount = 1;
+		writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[1].pBufferInfo = &bufferInfo;
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	}
+
+	std::cout << "materials: " << materialCount << " sets bound per draw" << std::endl;
+}
+
+void App::createParticles ()
+{
+	if (!particles.init(context, pipelines, threadPool, renderTarget, PARTICLE_CAPACITY, PARTICLES_EMITTED_PER_FRAME))
+	{
+		std::cerr << "particles: shaders not compiled, disabled" << std::endl;
+		return;
+	}
+
+	/* a capture and its replay must queue the same draws from the first frame on */
+	if (!capturePath.empty() || replay.isOpen())
+		particles.ready(true);
+
+	std::cout << "particles: " << PARTICLE_CAPACITY << " capacity, " << PARTICLES_EMITTED_PER_FRAME << " emitted per frame" << std::endl;
+}
+
 void App::recreateSwapChain ()
 {
+	warmupFramesLeft = STEADY_STATE_WARMUP_FRAMES;
+	auto start = std::chrono::steady_clock::now();
+
+	/* no wait on the device : the frame in flight keeps the retired handles alive until its fence */
 	cleanupSwapChain();
 
 	createSwapChain();
 	createImageViews();
+	createDepthResources();
+	createColorResources();
+	createPostTargets();
 	createFramebuffers();
 	createCommandBuffers();
+
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	resizeCount++;
+	resizeMilliseconds += milliseconds;
+	resizePeakMilliseconds = std::max(resizePeakMilliseconds, milliseconds);
+}
+
+/* between two frames : nothing recorded uses the old pipelines, the frame in flight keeps them until its fence */
+void App::applyShaderReload ()
+{
+	warmupFramesLeft = STEADY_STATE_WARMUP_FRAMES;
+
+	pipelines.swap(graphicsPipeline);
+	pipelines.swap(meshPipeline);
+	pipelines.swap(meshletPipeline);
+	pipelines.swap(cullPipeline);
+	particles.swapPipelines(pipelines);
+	postProcess.swapPipelines(pipelines);
+
+	std::vector<VkPipeline> retired;
+	pipelines.commitReplacements(retired);
+	for (VkPipeline pipeline : retired)
+		deletionQueue.retire(pipeline);
+
+	shaderReloads++;
 }
 
 void App::cleanupSwapChain ()
 {
-	for(size_t i = 0; i < swapChainFramebuffers.size(); i++)
-		vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+	framebuffer.reset();
 
-	vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-	for(size_t i = 0; i < swapChainImageViews.size(); i++)
-		vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+	swapChainImageViews.clear();
 
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
+	depthImageView.reset();
+	depthImage.reset();
+	depthImageMemory.reset();
+
+	msaaColorView.reset();
+	msaaColorImage.reset();
+	msaaColorMemory.reset();
 }
 
 /* VK validation layers methods */
@@ -929,10 +2783,14 @@ VkSurfaceFormatKHR App::chooseSwapSurfaceFormat (const std::vector<VkSurfaceForm
 	return availableFormats[0];
 }
 
-VkPresentModeKHR App::chooseSwapPresentMode (const std::vector<VkPresentModeKHR> availablePresentModes)
+VkPresentModeKHR App::chooseSwapPresentMode (const std::vector<VkPresentModeKHR>& availablePresentModes)
 {
 	VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
 
+	/* a replay is not paced by the display */
+	if (replay.isOpen() && std::find(availablePresentModes.begin(), availablePresentModes.end(), VK_PRESENT_MODE_IMMEDIATE_KHR) != availablePresentModes.end())
+		return VK_PRESENT_MODE_IMMEDIATE_KHR;
+
     for (const auto& availablePresentMode : availablePresentModes)
 	{
         if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
@@ -956,8 +2814,9 @@ VkExtent2D App::chooseSwapExtent (const VkSurfaceCapabilitiesKHR& capabilities)
     }
 	else
 	{
-		int width, height;
-		glfwGetWindowSize(window, &width, &height);
+		/* glfwGetWindowSize is main thread only : the size the resize callback saw */
+		int width = windowWidth;
+		int height = windowHeight;
 
         VkExtent2D actualExtent = {(uint32_t) width, (uint32_t) height};
 
@@ -970,16 +2829,13 @@ VkExtent2D App::chooseSwapExtent (const VkSurfaceCapabilitiesKHR& capabilities)
 
 /* Graphics Pipeline methods */
 
-VkShaderModule App::createShaderModule(const std::vector<char>& code)
+VkFormat App::findDepthFormat ()
 {
-	VkShaderModuleCreateInfo createInfo = {};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT};
 
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
-	    throw std::runtime_error("failed to create shader module!");
+	for (VkFormat format : candidates)
+		if (context.formatSupports(format, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT))
+			return format;
 
-	return shaderModule;
+	throw std::runtime_error("failed to find a depth format!");
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #define GLFW_INCLUDE_VULKAN
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
 
@@ -14,12 +16,140 @@
 #include <algorithm>
 #include <fstream>
 #include <array>
+#include <cassert>
+#include <limits>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <exception>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "allocator.h"
+#include "device.h"
+#include "lifetime.h"
+#include "texture.h"
+#include "thread_pool.h"
+#include "mesh.h"
+#include "scene.h"
+#include "bvh.h"
+#include "draw_queue.h"
+#include "pipeline.h"
+#include "bindless.h"
+#include "particles.h"
+#include "postprocess.h"
+#include "capture.h"
+#include "simulation.h"
+#include "readback.h"
+#include "render_pass.h"
+#include "shader_watch.h"
+#include "resolution.h"
+#include "startup.h"
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
 
+const size_t FRAME_ALLOCATOR_SIZE = 4 * 1024 * 1024;
+const uint32_t STEADY_STATE_WARMUP_FRAMES = 8;
+
+const VkDeviceSize TEXTURE_MEMORY_BUDGET = 256 * 1024 * 1024;
+const VkDeviceSize TEXTURE_STAGING_SLOT_SIZE = 32 * 1024 * 1024;
+const uint32_t TEXTURE_STAGING_SLOTS = 4;
+const uint32_t MAX_TEXTURES = 4096;
+
+/*
+ * Device memory : textures get what the device local heap has left under this
+ * share of its budget, budgets are read that often, a JSON report line is
+ * written that often when a report file is set.
+ */
+const float MEMORY_BUDGET_FRACTION = 0.9f;
+const double MEMORY_REFRESH_SECONDS = 0.5;
+const double MEMORY_REPORT_SECONDS = 10.0;
+const size_t MEMORY_TRACKED_ALLOCATIONS = 4096;
+
+/* frames the readback worker may be behind before frames are skipped */
+const uint32_t READBACK_SLOTS = 3;
+
+/*
+ * Dynamic resolution : with a GPU budget set, the scene is drawn at this
+ * share of the swap chain at least, at most, and the scale and GPU time are
+ * logged that often.
+ */
+const float RESOLUTION_MIN_SCALE = 0.5f;
+const float RESOLUTION_MAX_SCALE = 1.0f;
+const double RESOLUTION_LOG_SECONDS = 2.0;
+
+/*
+ * Startup : the creation steps run on up to that many threads, and the
+ * pipeline cache is kept in that file between runs.
+ */
+const unsigned STARTUP_MAX_THREADS = 4;
+const char *const PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+
+/* one material per mesh, in the bindless set or in a set of its own */
+const uint32_t MAX_MATERIALS = 1024;
+
+const float CAMERA_FOV = 60.0f;
+
+/* LODs are picked per object so the simplification error stays under a pixel */
+const float LOD_MAX_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS = 0.25f;
+
+/* every mesh is laid out on a grid of GRID x GRID instances the camera flies away from */
+const uint32_t MESH_INSTANCE_GRID = 8;
+
+/* without --mesh the grid is of this sphere, 256k triangles for the LODs to work on */
+const char *const BENCHMARK_SPHERE = "benchmark_sphere";
+const uint32_t BENCHMARK_SPHERE_RINGS = 256;
+const uint32_t BENCHMARK_SPHERE_SEGMENTS = 512;
+
+/* mesh instance world matrices, written by Scene::update into one of these per frame */
+const uint32_t INSTANCE_BUFFER_FRAMES = 2;
+
+/* GPU particle fountain, simulated and compacted in compute every frame */
+const uint32_t PARTICLE_CAPACITY = 2 * 1024 * 1024;
+const uint32_t PARTICLES_EMITTED_PER_FRAME = 16384;
+
+/* the scene renders to an HDR target : exposure and tonemap, bloom above the threshold, FXAA */
+const float POST_EXPOSURE = 1.0f;
+const float BLOOM_THRESHOLD = 1.0f;
+const float BLOOM_INTENSITY = 0.5f;
+const uint32_t BLOOM_LEVELS = 6;
+const bool POST_FXAA = true;
+
+/* samples per pixel of the scene, lowered to what the device supports : 1 disables MSAA */
+const uint32_t MSAA_SAMPLES = 4;
+
+/* the scene logic ticks on the main thread, frames are drawn on their own thread between the last two ticks */
+const uint32_t SIMULATION_TICK_RATE = 60;
+const uint32_t SIMULATION_MAX_CATCHUP_TICKS = 4;
+const uint32_t SIMULATION_SPIKE_INTERVAL = 60;
+
+/* draw queue key fields, pipelines in bind order, and the index of the triangle draw */
+enum DrawPass
+{
+	DRAW_PASS_OPAQUE,
+	DRAW_PASS_TRANSPARENT
+};
+
+enum DrawPipeline
+{
+	DRAW_PIPELINE_TRIANGLE,
+	DRAW_PIPELINE_MESH,
+	DRAW_PIPELINE_MESHLET,
+	DRAW_PIPELINE_PARTICLES
+};
+
+const uint32_t DRAW_TRIANGLE = ~0u;
+const uint32_t DRAW_PARTICLES = ~0u - 1;
+
+/* workgroup sizes of cull.comp and meshlet.task */
+const uint32_t MESHLET_CULL_GROUP_SIZE = 64;
+const uint32_t MESHLET_TASK_GROUP_SIZE = 32;
+
 const std::vector<const char *> validationLayers = {
 	"VK_LAYER_LUNARG_standard_validation"
 };
@@ -93,42 +223,344 @@ const std::vector<Vertex> vertices = {
     {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
 };
 
+/*
+ * LOD only : one indexed draw per instance.
+ * Compute culling : cull.comp writes one indirect command per meshlet, drawn with a multi draw indirect.
+ * Mesh shader : meshlet.task culls, meshlet.mesh emits the visible meshlets.
+ */
+enum GeometryPath
+{
+	GEOMETRY_PATH_LOD,
+	GEOMETRY_PATH_COMPUTE_CULLING,
+	GEOMETRY_PATH_MESH_SHADER
+};
+
+struct MeshInstance
+{
+	MeshHandle mesh;
+	NodeHandle node;
+	uint32_t lod;
+	uint32_t commandOffset;		/* first indirect command of the instance */
+};
+
+/* mesh.vert : the world matrix comes from the instance buffer */
+struct MeshPushConstants
+{
+	glm::mat4 viewProjection;
+	glm::vec4 positionScale;
+	glm::vec4 positionOffset;
+	uint32_t material;
+	uint32_t padding[3];
+};
+
+/* material.frag */
+struct MaterialData
+{
+	glm::vec4 color;
+	uint32_t texture;			/* bindless texture index */
+	uint32_t padding[3];
+};
+
+/* cull.comp and the task / mesh shaders : transform goes from the mesh to clip space */
+struct MeshletPushConstants
+{
+	glm::mat4 transform;
+	glm::vec4 positionScale;
+	glm::vec4 positionOffset;
+	glm::vec4 eye;				/* object space */
+	uint32_t meshletOffset;
+	uint32_t meshletCount;
+	uint32_t commandOffset;
+	uint32_t padding;
+};
+
 class App
 {
 private:
 	GLFWwindow *window;
 	VkInstance instance;
+	uint32_t instanceApiVersion;
 	VkDebugReportCallbackEXT callback;
 	VkPhysicalDevice physicalDevice;
 	VkDevice device;
 	VkSurfaceKHR surface;
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
-	VkSwapchainKHR swapChain;
+
+	/* declared before the handles it outlives : they are retired here, destroyed once the GPU is done */
+	DeletionQueue deletionQueue;
+	VkFence frameFence;
+	uint64_t submittedFrame;
+
+	Unique<VkSwapchainKHR> swapChain;
 	std::vector<VkImage> swapChainImages;
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
-	std::vector<VkImageView> swapChainImageViews;
+	VkImageUsageFlags swapChainUsage;
+	std::vector<Unique<VkImageView>> swapChainImageViews;
 	VkRenderPass renderPass;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
-	std::vector<VkFramebuffer> swapChainFramebuffers;
+	VkPipelineLayout meshPipelineLayout;
+	VkPipeline meshPipeline;
+	VkDescriptorSetLayout meshletSetLayout;
+	VkPipelineLayout meshletPipelineLayout;
+	VkPipeline cullPipeline;
+	VkPipeline meshletPipeline;
+	Unique<VkFramebuffer> framebuffer;
 	VkCommandPool commandPool;
 	std::vector<VkCommandBuffer> commandBuffers;
-	VkSemaphore imageAvailableSemaphore;
-	VkSemaphore renderFinishedSemaphore;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	Unique<VkSemaphore> imageAvailableSemaphore;
+	Unique<VkSemaphore> renderFinishedSemaphore;
+	Unique<VkBuffer> vertexBuffer;
+	Unique<VkDeviceMemory> vertexBufferMemory;
+	VkFormat depthFormat;
+	Unique<VkImage> depthImage;
+	Unique<VkDeviceMemory> depthImageMemory;
+	Unique<VkImageView> depthImageView;
+
+	/* multisampled color, resolved into the HDR target at the end of the render pass */
+	uint32_t requestedSamples;
+	VkSampleCountFlagBits msaaSamples;
+	Unique<VkImage> msaaColorImage;
+	Unique<VkDeviceMemory> msaaColorMemory;
+	Unique<VkImageView> msaaColorView;
+	VkMemoryPropertyFlags transientMemoryProperties;
+
+	/*
+	 * With dynamic rendering there is no render pass and no framebuffer : a
+	 * resize only recreates the images. Otherwise the render pass comes from
+	 * the cache and the framebuffer follows the images.
+	 */
+	RenderPassCache renderPasses;
+	RenderTarget renderTarget;
+	bool dynamicRenderingRequested;
+	bool dynamicRenderingEnabled;
+#ifdef VK_KHR_dynamic_rendering
+	PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+	PFN_vkCmdEndRenderingKHR cmdEndRendering;
+#endif
+	uint32_t framebuffersCreated;
+	uint32_t resizeCount;
+	double resizeMilliseconds;
+	double resizePeakMilliseconds;
+
+	VulkanHostAllocator hostAllocator;
+	LinearAllocator frameAllocator;
+	uint32_t warmupFramesLeft;
+	uint64_t steadyStateFrames;
+	uint64_t steadyStateHeapAllocations;
+	uint64_t steadyStateVulkanAllocations;
+	uint64_t frameIndex;
+
+	DeviceContext context;
+
+	/* bytes per heap, type and category, the texture budget follows the device local heap */
+	MemoryTracker memoryTracker;
+	bool memoryBudgetEnabled;
+	VkDeviceSize memoryCap;
+	uint32_t textureHeap;
+	std::atomic<uint64_t> textureBudget;
+	std::string memoryReportPath;
+	std::ofstream memoryReport;
+	double lastMemoryRefresh;
+	double lastMemoryReport;
+
+	TextureManager textures;
+	std::vector<std::string> texturePaths;
+	std::vector<TextureHandle> textureHandles;
+
+	ThreadPool threadPool;
+	PipelineFactory pipelines;
+	uint32_t pipelineWarmupVariants;
+	MeshManager meshes;
+	std::vector<std::string> meshPaths;
+	std::vector<MeshHandle> meshHandles;
+	std::vector<MeshInstance> meshInstances;
+	float meshGridSpacing;
+
+	Scene scene;
+	std::vector<NodeHandle> meshRows;
+	std::vector<VkBuffer> instanceBuffers;
+	std::vector<VkDeviceMemory> instanceBufferMemory;
+	std::vector<glm::mat4*> instanceData;
+
+	glm::vec3 cameraEye;
+	glm::mat4 cameraViewProjection;
+	float cameraFar;
+
+	/* the simulation between two ticks, the only clock a frame reads : frameTime is its time in seconds */
+	Simulation simulation;
+	SimulationState frameState;
+	float frameAlpha;
+	double frameTime;
+	double lastFrameTime;
+
+	/* the render thread owns the swap chain : resizes reach it through these */
+	std::thread renderThread;
+	std::atomic<bool> rendering;
+	std::exception_ptr renderException;
+	std::atomic<bool> framebufferResized;
+	std::atomic<int> windowWidth;
+	std::atomic<int> windowHeight;
+	uint64_t renderFrames;
+	uint64_t staleFrames;
+	double renderMilliseconds;
+	double renderPeakMilliseconds;
+
+	/* instance bounds, culled against the camera frustum every frame */
+	Bvh meshBvh;
+	size_t visibleInstanceCount;
+
+	GeometryPath geometryPath;
+	bool meshShaderEnabled;
+	VkShaderStageFlags meshletStages;
+#ifdef VK_EXT_mesh_shader
+	PFN_vkCmdDrawMeshTasksEXT cmdDrawMeshTasks;
+#endif
+	VkDescriptorPool meshletDescriptorPool;
+	std::vector<VkDescriptorSet> meshletSets;
+	std::vector<MeshletPushConstants> meshletConstants;
+	VkBuffer drawCommandBuffer;
+	VkDeviceMemory drawCommandMemory;
+	VkBuffer cullStatsBuffer;
+	VkDeviceMemory cullStatsMemory;
+	uint32_t *cullStats;
+
+	/* materials of the vertex path : indices into the bindless set, or one set per material bound per draw */
+	bool bindlessRequested;
+	bool bindlessEnabled;
+	BindlessTable bindless;
+	VkDescriptorSetLayout materialSetLayout;
+	VkDescriptorPool materialDescriptorPool;
+	std::vector<VkDescriptorSet> materialSets;
+	std::vector<uint32_t> materialTextures;		/* index in textureHandles, INVALID_TEXTURE for none */
+	std::vector<uint32_t> bindlessTextures;		/* per textureHandles entry, with the version written */
+	std::vector<uint32_t> textureVersions;
+	VkBuffer materialBuffer;
+	VkDeviceMemory materialMemory;
+
+	uint64_t meshStatFrames;
+	uint64_t submittedTriangles;
+	uint64_t fullDetailTriangles;
+	uint64_t visibleTriangles;
+	uint64_t lodSwitches;
+	uint64_t culledInstances;
+	double cullMilliseconds;
+
+	DrawQueue drawQueue;
+	CommandState commandState;
+	uint64_t drawStatFrames;
+	uint64_t queuedDraws;
+	double drawRecordMilliseconds;
+
+	ParticleSystem particles;
+	PostProcess postProcess;
+
+	/* the presented frames copied to files, when a directory is set */
+	FrameReadback readback;
+	std::string readbackPath;
+	ReadbackFormat readbackFormat;
+	uint32_t readbackInterval;
+
+	/* the scene drawn into renderExtent of the targets, scaled to keep the GPU under gpuBudget */
+	ResolutionController resolution;
+	double gpuBudget;
+	VkExtent2D renderExtent;
+	double lastResolutionLog;
+
+	/* creation steps in parallel, timed from run() to the first present */
+	StartupSchedule startup;
+	std::chrono::steady_clock::time_point startupOrigin;
+	double firstFrameMilliseconds;
+	std::string startupTracePath;
+
+	/* shaders compiled again when their sources change, the pipelines swapped in between two frames */
+	bool hotReload;
+	ShaderWatcher shaderWatcher;
+	uint32_t shaderReloads;
+
+	/* every mesh loaded twice by createMeshes, imported again then from its cache, and no frame drawn */
+	bool meshBenchmark;
+
+	/* frame capture, and its replay : same inputs, the draws and uploads compared with the recorded ones */
+	std::string capturePath;
+	std::string replayPath;
+	CaptureWriter capture;
+	CaptureReader replay;
+	CaptureFrame replayFrame;
+	FrameSnapshot replaySnapshot;
+	bool frameSubmitted;
+	std::vector<double> replayMilliseconds;
+	uint64_t replaySkippedFrames;
+	uint64_t replayDrawMismatches;
+	uint64_t replayUploadMismatches;
+	uint64_t firstDrawMismatch;
 
 	inline static void onWindowResized (GLFWwindow *window, int width, int height)
 	{
 		if(width == 0 || height == 0) return;
 
 		App* app = reinterpret_cast<App*>(glfwGetWindowUserPointer(window));
-		app->recreateSwapChain();
+		app->windowWidth = width;
+		app->windowHeight = height;
+		app->framebufferResized = true;
 	}
 
 public:
+	App ();
+
+	/* a KTX2 file streamed in : the materials cycle through them */
+	void addTexture (const std::string& path) { texturePaths.push_back(path); }
+
+	/* .obj, .gltf or .glb, converted once to <file>.meshcache : the grid cycles through them */
+	void addMesh (const std::string& path) { meshPaths.push_back(path); }
+
+	/* create that many mesh pipeline variants at startup and print the timings */
+	void setPipelineWarmup (uint32_t variants) { pipelineWarmupVariants = variants; }
+
+	/* bind one set per material and draw instead of the bindless set, to compare the two */
+	void setBindless (bool enabled) { bindlessRequested = enabled; }
+
+	/* MSAA samples per pixel, 1 for none */
+	void setSamples (uint32_t samples) { requestedSamples = samples; }
+
+	/* a render pass and a framebuffer even where dynamic rendering is available, to compare resize times */
+	void setDynamicRendering (bool enabled) { dynamicRenderingRequested = enabled; }
+
+	/* record every frame to a capture file, or run one back in a hidden window as fast as it goes */
+	void setCapture (const std::string& path) { capturePath = path; }
+	void setReplay (const std::string& path) { replayPath = path; }
+
+	/* cap every device local heap below what the driver allows, to see the budgets work */
+	void setMemoryBudget (VkDeviceSize megabytes) { memoryCap = megabytes * 1024 * 1024; }
+
+	/* append a JSON line of memory telemetry every MEMORY_REPORT_SECONDS */
+	void setMemoryReport (const std::string& path) { memoryReportPath = path; }
+
+	/* write every interval-th presented frame to directory, the swap chain then allows transfers from it */
+	void setReadback (const std::string& directory, ReadbackFormat format, uint32_t interval)
+	{
+		readbackPath = directory;
+		readbackFormat = format;
+		readbackInterval = interval;
+	}
+
+	/* lower the scene resolution when a frame takes the GPU longer than that, 0 for a fixed resolution */
+	void setGpuBudget (double milliseconds) { gpuBudget = milliseconds; }
+
+	/* watch the shader sources, recompile them and swap the pipelines using them while running */
+	void setHotReload (bool enabled) { hotReload = enabled; }
+
+	/* time a cold import against a load from the cache, both through the upload, then exit */
+	void setMeshBenchmark (bool enabled) { meshBenchmark = enabled; }
+
+	/* save the timeline of the startup steps as a Chrome trace */
+	void setStartupTrace (const std::string& path) { startupTracePath = path; }
+
+	/* stall the simulation that long every SIMULATION_SPIKE_INTERVAL ticks, the frame times should not move */
+	void setSimulationSpike (double milliseconds) { simulation.setSpike(milliseconds, SIMULATION_SPIKE_INTERVAL); }
+
 	void run ();
 
 private:
@@ -137,6 +569,37 @@ private:
 	void mainLoop ();
 	void cleanup ();
 	void drawFrame ();
+	void renderLoop ();
+	void replayFrames ();
+	CaptureHeader captureHeader ();
+	void checkReplayHeader ();
+	void printFrameAllocationStats ();
+	void printMeshStats ();
+	void printDrawStats ();
+	void printParticleStats ();
+	void printPostStats ();
+	void printAttachmentStats ();
+	void printResizeStats ();
+	void printReplayStats ();
+	void printThreadStats ();
+	void printMemoryStats ();
+	void printReadbackStats ();
+	void printShaderReloadStats ();
+	void printStartupStats ();
+	void applyShaderReload ();
+	void updateMemoryBudget ();
+	void pollMemory (double now);
+	void pollResolution (double now);
+	void printResolutionStats ();
+	void recordCommandBuffer (uint32_t imageIndex);
+	void beginScene (VkCommandBuffer commandBuffer);
+	void endScene (VkCommandBuffer commandBuffer);
+	void updateCamera ();
+	void prepareMeshes ();
+	void updateMaterialTextures ();
+	void cullMeshlets (VkCommandBuffer commandBuffer);
+	void recordDraws (VkCommandBuffer commandBuffer);
+	void drawMesh (VkCommandBuffer commandBuffer, uint32_t instanceIndex);
 
 	/* VK methods */
 	void createInstance ();
@@ -147,13 +610,27 @@ private:
 	void createSurface ();
 	void createSwapChain ();
 	void createImageViews ();
-	void createGraphicsPipeline ();
+	void createPipelineLayouts ();
+	void createPipelines ();
+	PipelineState meshPipelineState ();
+	void warmUpPipelines ();
+	void createMeshletSetLayout ();
+	void createPostProcess ();
 	void createRenderPass ();
+	VkSampleCountFlagBits chooseSampleCount ();
+	void createDepthResources ();
+	void createColorResources ();
+	void createPostTargets ();
 	void createFramebuffers ();
 	void createCommandPool ();
 	void createCommandBuffers ();
     void createSemaphores ();
 	void createVertexBuffer ();
+	void createTextures ();
+	void createMeshes ();
+	void createMeshletCulling ();
+	void createMaterials ();
+	void createParticles ();
 
 	void cleanupSwapChain ();
 	void recreateSwapChain ();
@@ -180,9 +657,9 @@ private:
 	bool checkDeviceExtensionSupport (VkPhysicalDevice device);
 	SwapChainSupportDetails querySwapChainSupport (VkPhysicalDevice device);
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat (const std::vector<VkSurfaceFormatKHR>& availableFormats);
-	VkPresentModeKHR chooseSwapPresentMode (const std::vector<VkPresentModeKHR> availablePresentModes);
+	VkPresentModeKHR chooseSwapPresentMode (const std::vector<VkPresentModeKHR>& availablePresentModes);
 	VkExtent2D chooseSwapExtent (const VkSurfaceCapabilitiesKHR& capabilities);
+	VkFormat findDepthFormat ();
 
 	/* Graphics Pipeline methods */
-	VkShaderModule createShaderModule (const std::vector<char>& code);
 };
@@ -0,0 +1,146 @@
+#include "bindless.h"
+
+#include <array>
+
+/* BindlessTable */
+
+#ifdef VK_VERSION_1_2
+bool BindlessTable::supported (const VkPhysicalDeviceFeatures& features, const VkPhysicalDeviceDescriptorIndexingFeatures& indexing)
+{
+	/* the indices come from push constants and buffers : dynamically uniform, no non uniform indexing */
+	return features.shaderSampledImageArrayDynamicIndexing && features.shaderStorageBufferArrayDynamicIndexing &&
+			indexing.runtimeDescriptorArray && indexing.descriptorBindingPartiallyBound &&
+			indexing.descriptorBindingSampledImageUpdateAfterBind && indexing.descriptorBindingStorageBufferUpdateAfterBind &&
+			indexing.descriptorBindingUpdateUnusedWhilePending;
+}
+#endif
+
+void BindlessTable::init (const DeviceContext& deviceContext, uint32_t maxTextures, uint32_t maxBuffers)
+{
+#ifdef VK_VERSION_1_2
+	context = &deviceContext;
+	textureCapacity = maxTextures;
+	bufferCapacity = maxBuffers;
+
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+	bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = maxTextures;
+	bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+	bindings[1].binding = BINDLESS_BUFFER_BINDING;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = maxBuffers;
+	bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+	VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+			VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	VkDescriptorBindingFlags bindingFlags[2] = { flags, flags };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {};
+	flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	flagsInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	flagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &flagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(context->device, &layoutInfo, context->allocator, &setLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create bindless descriptor set layout!");
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = maxTextures;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = maxBuffers;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = 1;
+
+	if (vkCreateDescriptorPool(context->device, &poolInfo, context->allocator, &descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create bindless descriptor pool!");
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &setLayout;
+
+	if (vkAllocateDescriptorSets(context->device, &allocInfo, &set) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate bindless descriptor set!");
+#else
+	(void) deviceContext;
+	(void) maxTextures;
+	(void) maxBuffers;
+	throw std::runtime_error("bindless descriptors need Vulkan 1.2 headers!");
+#endif
+}
+
+void BindlessTable::destroy ()
+{
+	if (context == nullptr)
+		return;
+
+	vkDestroyDescriptorPool(context->device, descriptorPool, context->allocator);
+	vkDestroyDescriptorSetLayout(context->device, setLayout, context->allocator);
+	context = nullptr;
+}
+
+uint32_t BindlessTable::addTexture (VkImageView view, VkSampler sampler)
+{
+	if (textureCount == textureCapacity)
+		throw std::runtime_error("too many bindless textures!");
+
+	setTexture(textureCount, view, sampler);
+	return textureCount++;
+}
+
+uint32_t BindlessTable::addBuffer (VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	if (bufferCount == bufferCapacity)
+		throw std::runtime_error("too many bindless buffers!");
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = offset;
+	bufferInfo.range = range;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = set;
+	write.dstBinding = BINDLESS_BUFFER_BINDING;
+	write.dstArrayElement = bufferCount;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(context->device, 1, &write, 0, nullptr);
+	writes++;
+
+	return bufferCount++;
+}
+
+void BindlessTable::setTexture (uint32_t index, VkImageView view, VkSampler sampler)
+{
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = view;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = set;
+	write.dstBinding = BINDLESS_TEXTURE_BINDING;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(context->device, 1, &write, 0, nullptr);
+	writes++;
+}
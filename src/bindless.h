@@ -0,0 +1,56 @@
+#pragma once
+
+#include "device.h"
+
+#include <vector>
+
+/* bindings of the bindless set, and of the per draw material sets that mirror it */
+const uint32_t BINDLESS_TEXTURE_BINDING = 0;
+const uint32_t BINDLESS_BUFFER_BINDING = 1;
+
+/*
+ * Every texture and storage buffer in one descriptor set, bound once per frame
+ * (descriptor indexing, core in Vulkan 1.2). Both bindings are large, partially
+ * bound arrays : slots are written once when a resource is added and rewritten
+ * when it changes, and shaders index them with values from push constants or
+ * buffers. The set is update after bind, so a slot the pending frame does not
+ * use may change while the set is bound.
+ */
+
+class BindlessTable
+{
+private:
+	const DeviceContext *context = nullptr;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+
+	uint32_t textureCapacity = 0;
+	uint32_t bufferCapacity = 0;
+	uint32_t textureCount = 0;
+	uint32_t bufferCount = 0;
+	uint64_t writes = 0;
+
+public:
+#ifdef VK_VERSION_1_2
+	/* the device features init and the shaders need */
+	static bool supported (const VkPhysicalDeviceFeatures& features, const VkPhysicalDeviceDescriptorIndexingFeatures& indexing);
+#endif
+
+	void init (const DeviceContext& context, uint32_t maxTextures, uint32_t maxBuffers);
+	void destroy ();
+
+	VkDescriptorSetLayout layout () const { return setLayout; }
+	VkDescriptorSet descriptorSet () const { return set; }
+
+	/* the slot index shaders use */
+	uint32_t addTexture (VkImageView view, VkSampler sampler);
+	uint32_t addBuffer (VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+
+	void setTexture (uint32_t index, VkImageView view, VkSampler sampler);
+
+	uint32_t textures () const { return textureCount; }
+	uint32_t buffers () const { return bufferCount; }
+	uint64_t descriptorWrites () const { return writes; }
+};
@@ -0,0 +1,432 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define BVH_SSE 1
+#endif
+
+
+/* extent of unused children and padding lanes : outside of every plane */
+static const float EMPTY_EXTENT = -1e30f;
+
+/* Static functions */
+
+/*
+ * Four boxes against the frustum. A box is outside when it is entirely behind
+ * one plane, inside when it is entirely in front of all of them.
+ */
+static void testBoxes (const Frustum& frustum, const float *cx, const float *cy, const float *cz,
+		const float *ex, const float *ey, const float *ez, int& outsideMask, int& insideMask)
+{
+#ifdef BVH_SSE
+	__m128 centerX = _mm_loadu_ps(cx), centerY = _mm_loadu_ps(cy), centerZ = _mm_loadu_ps(cz);
+	__m128 extentX = _mm_loadu_ps(ex), extentY = _mm_loadu_ps(ey), extentZ = _mm_loadu_ps(ez);
+	__m128 zero = _mm_setzero_ps();
+	__m128 outside = zero;
+	__m128 crossing = zero;
+
+	for (int p = 0; p < 6; p++)
+	{
+		const float *plane = frustum.planes[p];
+
+		/* signed distance of the center and projected radius of the box on the plane normal */
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane[0])), _mm_mul_ps(centerY, _mm_set1_ps(plane[1]))),
+				_mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+		__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(std::fabs(plane[0]))), _mm_mul_ps(extentY, _mm_set1_ps(std::fabs(plane[1])))),
+				_mm_mul_ps(extentZ, _mm_set1_ps(std::fabs(plane[2]))));
+
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		crossing = _mm_or_ps(crossing, _mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+	}
+
+	outsideMask = _mm_movemask_ps(outside);
+	insideMask = ~(outsideMask | _mm_movemask_ps(crossing)) & 0xF;
+#else
+	outsideMask = 0;
+	insideMask = 0;
+
+	for (int k = 0; k < 4; k++)
+	{
+		bool outside = false, crossing = false;
+		for (int p = 0; p < 6; p++)
+		{
+			const float *plane = frustum.planes[p];
+			float distance = cx[k] * plane[0] + cy[k] * plane[1] + cz[k] * plane[2] + plane[3];
+			float radius = ex[k] * std::fabs(plane[0]) + ey[k] * std::fabs(plane[1]) + ez[k] * std::fabs(plane[2]);
+			outside = outside || distance + radius < 0.0f;
+			crossing = crossing || distance - radius < 0.0f;
+		}
+
+		outsideMask |= outside ? 1 << k : 0;
+		insideMask |= !outside && !crossing ? 1 << k : 0;
+	}
+#endif
+}
+
+/* Frustum */
+
+Frustum Frustum::fromMatrix (const glm::mat4& viewProjection)
+{
+	/* rows of the matrix, depth in [0, 1] so the near plane is the third row alone */
+	float rows[4][4];
+	for (int row = 0; row < 4; row++)
+		for (int column = 0; column < 4; column++)
+			rows[row][column] = viewProjection[column][row];
+
+	Frustum frustum;
+	for (int i = 0; i < 4; i++)
+	{
+		frustum.planes[0][i] = rows[3][i] + rows[0][i];
+		frustum.planes[1][i] = rows[3][i] - rows[0][i];
+		frustum.planes[2][i] = rows[3][i] + rows[1][i];
+		frustum.planes[3][i] = rows[3][i] - rows[1][i];
+		frustum.planes[4][i] = rows[2][i];
+		frustum.planes[5][i] = rows[3][i] - rows[2][i];
+	}
+
+	for (auto& plane : frustum.planes)
+	{
+		float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		for (float& value : plane)
+			value /= length;
+	}
+
+	return frustum;
+}
+
+/* Bvh */
+
+const uint32_t Bvh::LEAF;
+
+void Bvh::resize (size_t objectCount)
+{
+	centerX.assign(objectCount, 0.0f);
+	centerY.assign(objectCount, 0.0f);
+	centerZ.assign(objectCount, 0.0f);
+	extentX.assign(objectCount, 0.0f);
+	extentY.assign(objectCount, 0.0f);
+	extentZ.assign(objectCount, 0.0f);
+	leaves.assign(objectCount, LEAF);
+
+	objects.resize(objectCount);
+	slots.resize(objectCount);
+	for (uint32_t i = 0; i < objectCount; i++)
+		objects[i] = slots[i] = i;
+
+	nodes.clear();
+	nodeDirty.clear();
+	dirty = false;
+}
+
+void Bvh::setBounds (uint32_t object, const glm::vec3& center, const glm::vec3& extent)
+{
+	uint32_t slot = slots[object];
+	centerX[slot] = center.x;
+	centerY[slot] = center.y;
+	centerZ[slot] = center.z;
+	extentX[slot] = extent.x;
+	extentY[slot] = extent.y;
+	extentZ[slot] = extent.z;
+
+	/* mark the path to the root, up to the first node already marked */
+	for (uint32_t node = leaves[slot]; node != LEAF && !nodeDirty[node]; node = nodes[node].parent)
+	{
+		nodeDirty[node] = 1;
+		dirty = true;
+	}
+}
+
+/* splits objects[first, first + count) in four at the centroid medians, children are built after their parent */
+uint32_t Bvh::buildNode (uint32_t parent, uint32_t first, uint32_t count)
+{
+	uint32_t index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(Node());
+	nodes[index].parent = parent;
+
+	auto split = [&] (uint32_t begin, uint32_t end) {
+		float minimum[3] = { 1e30f, 1e30f, 1e30f }, maximum[3] = { -1e30f, -1e30f, -1e30f };
+		for (uint32_t i = begin; i < end; i++)
+		{
+			uint32_t slot = slots[objects[i]];
+			float center[3] = { centerX[slot], centerY[slot], centerZ[slot] };
+			for (int k = 0; k < 3; k++)
+			{
+				minimum[k] = std::min(minimum[k], center[k]);
+				maximum[k] = std::max(maximum[k], center[k]);
+			}
+		}
+
+		int axis = 0;
+		for (int k = 1; k < 3; k++)
+			if (maximum[k] - minimum[k] > maximum[axis] - minimum[axis])
+				axis = k;
+
+		const std::vector<float>& centers = axis == 0 ? centerX : axis == 1 ? centerY : centerZ;
+		uint32_t middle = begin + (end - begin) / 2;
+		std::nth_element(objects.begin() + begin, objects.begin() + middle, objects.begin() + end, [&] (uint32_t a, uint32_t b) {
+			return centers[slots[a]] < centers[slots[b]];
+		});
+
+		return middle;
+	};
+
+	uint32_t bounds[5];
+	bounds[0] = first;
+	bounds[2] = split(first, first + count);
+	bounds[4] = first + count;
+	bounds[1] = split(bounds[0], bounds[2]);
+	bounds[3] = split(bounds[2], bounds[4]);
+
+	for (int k = 0; k < 4; k++)
+	{
+		uint32_t childFirst = bounds[k], childCount = bounds[k + 1] - bounds[k];
+		uint32_t child = childCount > BVH_LEAF_SIZE ? buildNode(index, childFirst, childCount) : LEAF;
+
+		nodes[index].child[k] = child;
+		nodes[index].first[k] = childFirst;
+		nodes[index].count[k] = childCount;
+	}
+
+	return index;
+}
+
+void Bvh::build ()
+{
+	nodes.clear();
+	if (objects.empty())
+		return;
+
+	buildNode(LEAF, 0, static_cast<uint32_t>(objects.size()));
+
+	/* move the bounds to leaf order */
+	std::vector<float> *arrays[6] = { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ };
+	for (std::vector<float> *values : arrays)
+	{
+		std::vector<float> sorted(values->size());
+		for (size_t i = 0; i < objects.size(); i++)
+			sorted[i] = (*values)[slots[objects[i]]];
+		values->swap(sorted);
+	}
+
+	for (uint32_t i = 0; i < objects.size(); i++)
+		slots[objects[i]] = i;
+
+	for (uint32_t i = 0; i < nodes.size(); i++)
+		for (int k = 0; k < 4; k++)
+			if (nodes[i].child[k] == LEAF)
+				for (uint32_t slot = nodes[i].first[k]; slot < nodes[i].first[k] + nodes[i].count[k]; slot++)
+					leaves[slot] = i;
+
+	/* at most every child of the top levels, so cull never allocates */
+	size_t maxSegments = 0;
+	for (uint32_t depth = 0, children = 4; depth < BVH_CULL_SPLIT_DEPTH; depth++, children *= 4)
+		maxSegments += children;
+	segments.reserve(maxSegments);
+
+	nodeDirty.assign(nodes.size(), 1);
+	dirty = true;
+	refit();
+}
+
+void Bvh::refitNode (uint32_t index)
+{
+	Node& node = nodes[index];
+
+	for (int k = 0; k < 4; k++)
+	{
+		float minimum[3] = { 1e30f, 1e30f, 1e30f }, maximum[3] = { -1e30f, -1e30f, -1e30f };
+
+		auto merge = [&] (float x, float y, float z, float ex, float ey, float ez) {
+			if (ex < 0.0f)
+				return;
+
+			minimum[0] = std::min(minimum[0], x - ex);
+			minimum[1] = std::min(minimum[1], y - ey);
+			minimum[2] = std::min(minimum[2], z - ez);
+			maximum[0] = std::max(maximum[0], x + ex);
+			maximum[1] = std::max(maximum[1], y + ey);
+			maximum[2] = std::max(maximum[2], z + ez);
+		};
+
+		if (node.child[k] == LEAF)
+		{
+			for (uint32_t slot = node.first[k]; slot < node.first[k] + node.count[k]; slot++)
+				merge(centerX[slot], centerY[slot], centerZ[slot], extentX[slot], extentY[slot], extentZ[slot]);
+		}
+		else
+		{
+			const Node& child = nodes[node.child[k]];
+			for (int c = 0; c < 4; c++)
+				merge(child.centerX[c], child.centerY[c], child.centerZ[c], child.extentX[c], child.extentY[c], child.extentZ[c]);
+		}
+
+		if (node.count[k] == 0 || minimum[0] > maximum[0])
+		{
+			node.centerX[k] = node.centerY[k] = node.centerZ[k] = 0.0f;
+			node.extentX[k] = node.extentY[k] = node.extentZ[k] = EMPTY_EXTENT;
+			continue;
+		}
+
+		node.centerX[k] = (minimum[0] + maximum[0]) * 0.5f;
+		node.centerY[k] = (minimum[1] + maximum[1]) * 0.5f;
+		node.centerZ[k] = (minimum[2] + maximum[2]) * 0.5f;
+		node.extentX[k] = (maximum[0] - minimum[0]) * 0.5f;
+		node.extentY[k] = (maximum[1] - minimum[1]) * 0.5f;
+		node.extentZ[k] = (maximum[2] - minimum[2]) * 0.5f;
+	}
+}
+
+/* children always come after their parent : reverse order is bottom up */
+void Bvh::refit ()
+{
+	if (!dirty)
+		return;
+
+	for (size_t i = nodes.size(); i-- > 0; )
+	{
+		if (!nodeDirty[i])
+			continue;
+
+		refitNode(static_cast<uint32_t>(i));
+		nodeDirty[i] = 0;
+	}
+
+	dirty = false;
+}
+
+uint32_t Bvh::testObjects (const Frustum& frustum, uint32_t first, uint32_t count, uint32_t *visible) const
+{
+	uint32_t visibleCount = 0;
+
+	for (uint32_t slot = first; slot < first + count; slot += 4)
+	{
+		uint32_t lanes = std::min<uint32_t>(4, first + count - slot);
+		int outside, inside;
+
+		if (slot + 4 <= objects.size())
+			testBoxes(frustum, &centerX[slot], &centerY[slot], &centerZ[slot], &extentX[slot], &extentY[slot], &extentZ[slot], outside, inside);
+		else
+		{
+			/* end of the arrays : padded copy */
+			float padded[6][4];
+			for (uint32_t k = 0; k < 4; k++)
+			{
+				bool used = slot + k < objects.size();
+				padded[0][k] = used ? centerX[slot + k] : 0.0f;
+				padded[1][k] = used ? centerY[slot + k] : 0.0f;
+				padded[2][k] = used ? centerZ[slot + k] : 0.0f;
+				padded[3][k] = used ? extentX[slot + k] : EMPTY_EXTENT;
+				padded[4][k] = used ? extentY[slot + k] : EMPTY_EXTENT;
+				padded[5][k] = used ? extentZ[slot + k] : EMPTY_EXTENT;
+			}
+			testBoxes(frustum, padded[0], padded[1], padded[2], padded[3], padded[4], padded[5], outside, inside);
+		}
+
+		for (uint32_t k = 0; k < lanes; k++)
+			if (!(outside & (1 << k)))
+				visible[visibleCount++] = objects[slot + k];
+	}
+
+	return visibleCount;
+}
+
+uint32_t Bvh::traverse (const Frustum& frustum, uint32_t index, uint32_t *visible) const
+{
+	const Node& node = nodes[index];
+
+	int outside, inside;
+	testBoxes(frustum, node.centerX, node.centerY, node.centerZ, node.extentX, node.extentY, node.extentZ, outside, inside);
+
+	uint32_t visibleCount = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		if (node.count[k] == 0 || (outside & (1 << k)))
+			continue;
+
+		if (inside & (1 << k))
+		{
+			memcpy(visible + visibleCount, &objects[node.first[k]], node.count[k] * sizeof(uint32_t));
+			visibleCount += node.count[k];
+		}
+		else if (node.child[k] == LEAF)
+			visibleCount += testObjects(frustum, node.first[k], node.count[k], visible + visibleCount);
+		else
+			visibleCount += traverse(frustum, node.child[k], visible + visibleCount);
+	}
+
+	return visibleCount;
+}
+
+/* the top BVH_CULL_SPLIT_DEPTH levels : every segment writes in its own object range of visible */
+void Bvh::collect (const Frustum& frustum, uint32_t index, uint32_t depth, uint32_t *visible)
+{
+	const Node& node = nodes[index];
+
+	int outside, inside;
+	testBoxes(frustum, node.centerX, node.centerY, node.centerZ, node.extentX, node.extentY, node.extentZ, outside, inside);
+
+	for (int k = 0; k < 4; k++)
+	{
+		if (node.count[k] == 0 || (outside & (1 << k)))
+			continue;
+
+		Segment segment;
+		segment.node = LEAF;
+		segment.first = node.first[k];
+
+		if (inside & (1 << k))
+		{
+			memcpy(visible + segment.first, &objects[segment.first], node.count[k] * sizeof(uint32_t));
+			segment.count = node.count[k];
+		}
+		else if (node.child[k] == LEAF)
+			segment.count = testObjects(frustum, segment.first, node.count[k], visible + segment.first);
+		else if (depth + 1 < BVH_CULL_SPLIT_DEPTH)
+		{
+			collect(frustum, node.child[k], depth + 1, visible);
+			continue;
+		}
+		else
+		{
+			segment.node = node.child[k];
+			segment.count = 0;
+		}
+
+		segments.push_back(segment);
+	}
+}
+
+size_t Bvh::cull (const Frustum& frustum, ThreadPool& pool, uint32_t *visible)
+{
+	if (nodes.empty())
+		return 0;
+
+	segments.clear();
+	collect(frustum, 0, 0, visible);
+
+	pool.parallelFor(segments.size(), 1, [&] (size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+			if (segments[i].node != LEAF)
+				segments[i].count = traverse(frustum, segments[i].node, visible + segments[i].first);
+	});
+
+	/* segments were collected depth first : already in object range order, close the gaps */
+	size_t visibleCount = 0;
+	for (const Segment& segment : segments)
+	{
+		memmove(visible + visibleCount, visible + segment.first, segment.count * sizeof(uint32_t));
+		visibleCount += segment.count;
+	}
+
+	return visibleCount;
+}
+
+size_t Bvh::cull (const Frustum& frustum, ThreadPool& pool, std::vector<uint32_t>& visible)
+{
+	visible.resize(objects.size());
+	return cull(frustum, pool, visible.data());
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+/* normalized planes facing inwards, a point p is inside when dot(n, p) + d >= 0 for all six */
+struct Frustum
+{
+	float planes[6][4];
+
+	static Frustum fromMatrix (const glm::mat4& viewProjection);
+};
+
+/* objects per leaf, and the depth down to which cull splits the tree into parallel tasks */
+const uint32_t BVH_LEAF_SIZE = 8;
+const uint32_t BVH_CULL_SPLIT_DEPTH = 3;
+
+/*
+ * 4-wide bounding volume hierarchy over axis aligned boxes (center / extent).
+ * Every node keeps its four child boxes as structure of arrays, so one SSE
+ * plane test covers four children, and objects are stored in leaf order so
+ * leaves are tested four objects at a time too. A subtree covers a contiguous
+ * range of that order : a child fully inside the frustum is output without
+ * going further down.
+ *
+ * setBounds on a built tree only marks the path to the root, refit then
+ * recomputes the marked nodes bottom up. The topology is kept, build again
+ * when objects are added or after large moves.
+ */
+
+class Bvh
+{
+private:
+	static const uint32_t LEAF = ~0u;
+
+	struct Node
+	{
+		float centerX[4], centerY[4], centerZ[4];
+		float extentX[4], extentY[4], extentZ[4];
+		uint32_t child[4];		/* node index, LEAF for a leaf */
+		uint32_t first[4];		/* object range in leaf order */
+		uint32_t count[4];		/* 0 for an unused child */
+		uint32_t parent;
+	};
+
+	/* top of the tree walked by the calling thread, the rest is parallel */
+	struct Segment
+	{
+		uint32_t node;			/* LEAF when already output */
+		uint32_t first;
+		uint32_t count;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint8_t> nodeDirty;
+	bool dirty = false;
+
+	/* per object, in leaf order */
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<uint32_t> objects;
+	std::vector<uint32_t> leaves;
+
+	/* object -> position in leaf order */
+	std::vector<uint32_t> slots;
+
+	std::vector<Segment> segments;
+
+	uint32_t buildNode (uint32_t parent, uint32_t first, uint32_t count);
+	void refitNode (uint32_t index);
+	void collect (const Frustum& frustum, uint32_t node, uint32_t depth, uint32_t *visible);
+	uint32_t traverse (const Frustum& frustum, uint32_t node, uint32_t *visible) const;
+	uint32_t testObjects (const Frustum& frustum, uint32_t first, uint32_t count, uint32_t *visible) const;
+
+public:
+	void resize (size_t objectCount);
+	void setBounds (uint32_t object, const glm::vec3& center, const glm::vec3& extent);
+
+	void build ();
+	void refit ();
+
+	/* writes the visible object indices to visible, room for one per object, returns how many */
+	size_t cull (const Frustum& frustum, ThreadPool& pool, uint32_t *visible);
+
+	/* the same, visible resized to the object count */
+	size_t cull (const Frustum& frustum, ThreadPool& pool, std::vector<uint32_t>& visible);
+
+	size_t size () const { return objects.size(); }
+	size_t nodeCount () const { return nodes.size(); }
+};
@@ -0,0 +1,212 @@
+#include "capture.h"
+
+#include <cstring>
+#include <stdexcept>
+
+/* Static functions */
+
+/* at most 10 bytes for 64 bits */
+static size_t encodeVarint (uint8_t *out, uint64_t value)
+{
+	size_t size = 0;
+	while (value >= 0x80)
+	{
+		out[size++] = static_cast<uint8_t>(value) | 0x80;
+		value >>= 7;
+	}
+	out[size++] = static_cast<uint8_t>(value);
+	return size;
+}
+
+static void putVarint (std::vector<uint8_t>& out, uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t size = encodeVarint(bytes, value);
+	out.insert(out.end(), bytes, bytes + size);
+}
+
+static uint64_t getVarint (const std::vector<uint8_t>& in, size_t& cursor, size_t end)
+{
+	uint64_t value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (cursor >= end)
+			throw std::runtime_error("truncated capture frame!");
+
+		uint8_t byte = in[cursor++];
+		value |= uint64_t(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return value;
+	}
+
+	throw std::runtime_error("corrupt capture varint!");
+}
+
+/* CaptureWriter */
+
+void CaptureWriter::open (const std::string& path, const CaptureHeader& header)
+{
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		throw std::runtime_error("failed to open capture file " + path + "!");
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	bytes = sizeof(header);
+	frames = 0;
+
+	/* a few thousand draws without growing */
+	buffer.reserve(64 * 1024);
+}
+
+void CaptureWriter::close ()
+{
+	if (file.is_open())
+		file.close();
+}
+
+void CaptureWriter::write (uint64_t tick, float alpha, uint32_t width, uint32_t height, const DrawItem *draws, size_t drawCount,
+		const std::vector<TextureUploadEvent>& uploads)
+{
+	buffer.clear();
+
+	putVarint(buffer, tick);
+
+	uint32_t alphaBits;
+	std::memcpy(&alphaBits, &alpha, sizeof(alphaBits));
+	for (int i = 0; i < 4; i++)
+		buffer.push_back(static_cast<uint8_t>(alphaBits >> (i * 8)));
+
+	putVarint(buffer, width);
+	putVarint(buffer, height);
+
+	/* sorted : the keys only grow, the deltas are small */
+	putVarint(buffer, drawCount);
+	uint64_t previousKey = 0;
+	for (size_t i = 0; i < drawCount; i++)
+	{
+		putVarint(buffer, draws[i].key - previousKey);
+		putVarint(buffer, draws[i].index);
+		previousKey = draws[i].key;
+	}
+
+	putVarint(buffer, uploads.size());
+	for (const TextureUploadEvent& upload : uploads)
+	{
+		putVarint(buffer, upload.texture);
+		putVarint(buffer, upload.residentLevel);
+		putVarint(buffer, upload.bytes);
+	}
+
+	/* the size prefix lets a reader skip or bound the record */
+	uint8_t prefix[10];
+	size_t prefixSize = encodeVarint(prefix, buffer.size());
+
+	file.write(reinterpret_cast<const char*>(prefix), prefixSize);
+	file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	if (!file)
+		throw std::runtime_error("failed to write capture frame!");
+
+	bytes += prefixSize + buffer.size();
+	frames++;
+}
+
+/* CaptureReader */
+
+void CaptureReader::open (const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		throw std::runtime_error("failed to open capture file " + path + "!");
+
+	size_t size = static_cast<size_t>(file.tellg());
+	if (size < sizeof(CaptureHeader))
+		throw std::runtime_error("capture file " + path + " is too short!");
+
+	data.resize(size);
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(data.data()), size);
+	if (!file)
+		throw std::runtime_error("failed to read capture file " + path + "!");
+
+	std::memcpy(&fileHeader, data.data(), sizeof(fileHeader));
+	if (fileHeader.magic != CAPTURE_MAGIC)
+		throw std::runtime_error(path + " is not a frame capture!");
+	if (fileHeader.version != CAPTURE_VERSION)
+		throw std::runtime_error("unsupported frame capture version in " + path + "!");
+
+	/* walk the size prefixes once : a truncated last frame is dropped */
+	frames = 0;
+	for (cursor = sizeof(CaptureHeader); cursor < data.size();)
+	{
+		uint64_t recordSize = getVarint(data, cursor, data.size());
+		if (recordSize > data.size() - cursor)
+			break;
+
+		cursor += recordSize;
+		frames++;
+	}
+
+	rewind();
+}
+
+void CaptureReader::rewind ()
+{
+	cursor = sizeof(CaptureHeader);
+}
+
+bool CaptureReader::read (CaptureFrame& frame)
+{
+	if (cursor >= data.size())
+		return false;
+
+	size_t recordCursor = cursor;
+	uint64_t recordSize = getVarint(data, recordCursor, data.size());
+	if (recordSize > data.size() - recordCursor)
+		return false;
+
+	size_t end = recordCursor + recordSize;
+	cursor = recordCursor;
+
+	frame.tick = getVarint(data, cursor, end);
+
+	if (end - cursor < 4)
+		throw std::runtime_error("truncated capture frame!");
+
+	uint32_t alphaBits = 0;
+	for (int i = 0; i < 4; i++)
+		alphaBits |= uint32_t(data[cursor++]) << (i * 8);
+	std::memcpy(&frame.alpha, &alphaBits, sizeof(frame.alpha));
+
+	frame.width = static_cast<uint32_t>(getVarint(data, cursor, end));
+	frame.height = static_cast<uint32_t>(getVarint(data, cursor, end));
+
+	size_t drawCount = static_cast<size_t>(getVarint(data, cursor, end));
+	if (drawCount > recordSize)
+		throw std::runtime_error("corrupt capture frame!");
+
+	frame.draws.resize(drawCount);
+	uint64_t key = 0;
+	for (DrawItem& draw : frame.draws)
+	{
+		key += getVarint(data, cursor, end);
+		draw.key = key;
+		draw.index = static_cast<uint32_t>(getVarint(data, cursor, end));
+		draw.padding = 0;
+	}
+
+	size_t uploadCount = static_cast<size_t>(getVarint(data, cursor, end));
+	if (uploadCount > recordSize)
+		throw std::runtime_error("corrupt capture frame!");
+
+	frame.uploads.resize(uploadCount);
+	for (TextureUploadEvent& upload : frame.uploads)
+	{
+		upload.texture = static_cast<TextureHandle>(getVarint(data, cursor, end));
+		upload.residentLevel = static_cast<uint32_t>(getVarint(data, cursor, end));
+		upload.bytes = getVarint(data, cursor, end);
+	}
+
+	cursor = end;
+	return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "draw_queue.h"
+#include "texture.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+const uint32_t CAPTURE_MAGIC = 0x50435246;		/* "FRCP" */
+const uint32_t CAPTURE_VERSION = 2;
+
+/* what a replay has to match for its draws to be comparable */
+struct CaptureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t samples;
+	uint32_t bindless;
+	uint32_t geometryPath;
+	uint32_t textureCount;
+	uint32_t meshCount;
+	uint32_t tickRate;
+};
+
+/* the inputs of a frame, and what the renderer did with them */
+struct CaptureFrame
+{
+	uint64_t tick;						/* the simulation tick shown, the scene state is a function of it */
+	float alpha;						/* how far the frame is from the previous tick to this one */
+	uint32_t width;
+	uint32_t height;
+	std::vector<DrawItem> draws;		/* the sorted draw queue */
+	std::vector<TextureUploadEvent> uploads;
+};
+
+/*
+ * The capture stream : the header, then one record per frame, each prefixed
+ * with its size. Integers are LEB128 varints, the sorted draw keys are
+ * delta encoded, the interpolation factor is stored as is so a replay sees the
+ * exact same floats. A recorded frame is a few bytes per draw.
+ *
+ * Both sides reuse their buffers : writing or reading a frame does not
+ * allocate once the largest frame went through.
+ */
+
+class CaptureWriter
+{
+private:
+	std::ofstream file;
+	std::vector<uint8_t> buffer;
+	uint64_t frames = 0;
+	uint64_t bytes = 0;
+
+public:
+	void open (const std::string& path, const CaptureHeader& header);
+	void close ();
+
+	bool isOpen () const { return file.is_open(); }
+
+	void write (uint64_t tick, float alpha, uint32_t width, uint32_t height, const DrawItem *draws, size_t drawCount,
+			const std::vector<TextureUploadEvent>& uploads);
+
+	uint64_t frameCount () const { return frames; }
+	uint64_t byteCount () const { return bytes; }
+};
+
+class CaptureReader
+{
+private:
+	std::vector<uint8_t> data;
+	size_t cursor = 0;
+	CaptureHeader fileHeader = {};
+	uint64_t frames = 0;
+
+public:
+	/* reads the whole stream, and counts its frames */
+	void open (const std::string& path);
+
+	bool isOpen () const { return !data.empty(); }
+	const CaptureHeader& header () const { return fileHeader; }
+	uint64_t frameCount () const { return frames; }
+
+	/* false past the last frame */
+	bool read (CaptureFrame& frame);
+	void rewind ();
+};
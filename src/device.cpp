@@ -0,0 +1,225 @@
+#include "device.h"
+
+
+uint32_t DeviceContext::findMemoryType (uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+	    if (typeFilter & (1 << i) &&
+				(memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+	        return i;
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool DeviceContext::hasMemoryType (uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+		if (typeFilter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return true;
+
+	return false;
+}
+
+VkResult DeviceContext::allocateMemory (const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties,
+		MemoryCategory category, VkDeviceMemory& memory, uint32_t *memoryType) const
+{
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = requirements.size;
+	allocInfo.memoryTypeIndex = memoryTracker != nullptr
+		? memoryTracker->chooseType(requirements.memoryTypeBits, properties, requirements.size)
+		: findMemoryType(requirements.memoryTypeBits, properties);
+
+	VkResult result = vkAllocateMemory(device, &allocInfo, allocator, &memory);
+
+	if (memoryTracker != nullptr)
+	{
+		if (result == VK_SUCCESS)
+			memoryTracker->add(memory, requirements.size, allocInfo.memoryTypeIndex, category);
+		else
+			memoryTracker->failed();
+	}
+
+	if (memoryType != nullptr)
+		*memoryType = allocInfo.memoryTypeIndex;
+
+	return result;
+}
+
+void DeviceContext::freeMemory (VkDeviceMemory memory) const
+{
+	if (memoryTracker != nullptr)
+		memoryTracker->remove(memory);
+
+	vkFreeMemory(device, memory, allocator);
+}
+
+void DeviceContext::createBuffer (VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+		VkBuffer& buffer, VkDeviceMemory& memory, MemoryCategory category) const
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, allocator, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to create buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	if (allocateMemory(memRequirements, properties, category, memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate buffer memory!");
+
+	vkBindBufferMemory(device, buffer, memory, 0);
+}
+
+void DeviceContext::destroyBuffer (VkBuffer buffer, VkDeviceMemory memory) const
+{
+	vkDestroyBuffer(device, buffer, allocator);
+	freeMemory(memory);
+}
+
+VkMemoryPropertyFlags DeviceContext::createImage (uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage,
+		VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& memory, uint32_t mipLevels, VkSampleCountFlagBits samples,
+		MemoryCategory category) const
+{
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = width;
+	imageInfo.extent.height = height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = usage;
+	imageInfo.samples = samples;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateImage(device, &imageInfo, allocator, &image) != VK_SUCCESS)
+		throw std::runtime_error("failed to create image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+	/* lazily allocated memory only backs transient attachments : fall back to device local */
+	if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !hasMemoryType(memRequirements.memoryTypeBits, properties))
+		properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+	uint32_t memoryType;
+	if (allocateMemory(memRequirements, properties, category, memory, &memoryType) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate image memory!");
+
+	vkBindImageMemory(device, image, memory, 0);
+	return memoryProperties.memoryTypes[memoryType].propertyFlags;
+}
+
+void DeviceContext::destroyImage (VkImage image, VkDeviceMemory memory) const
+{
+	vkDestroyImage(device, image, allocator);
+	freeMemory(memory);
+}
+
+VkImageView DeviceContext::createImageView (VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t mipLevels, uint32_t baseLevel) const
+{
+	VkImageViewCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	createInfo.image = image;
+	createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	createInfo.format = format;
+
+	createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+	createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+	createInfo.subresourceRange.aspectMask = aspect;
+	createInfo.subresourceRange.baseMipLevel = baseLevel;
+	createInfo.subresourceRange.levelCount = mipLevels;
+	createInfo.subresourceRange.baseArrayLayer = 0;
+	createInfo.subresourceRange.layerCount = 1;
+
+	VkImageView view;
+	if (vkCreateImageView(device, &createInfo, allocator, &view) != VK_SUCCESS)
+		throw std::runtime_error("failed to create image view!");
+
+	return view;
+}
+
+bool DeviceContext::formatSupports (VkFormat format, VkFormatFeatureFlags features) const
+{
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+
+	return (formatProperties.optimalTilingFeatures & features) == features;
+}
+
+VkResult DeviceContext::submit (const VkSubmitInfo& submitInfo, VkFence fence) const
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	return vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+}
+
+VkResult DeviceContext::submitAndWait (const VkSubmitInfo& submitInfo) const
+{
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	VkResult result = vkCreateFence(device, &fenceInfo, allocator, &fence);
+	if (result != VK_SUCCESS)
+		return result;
+
+	result = submit(submitInfo, fence);
+	if (result == VK_SUCCESS)
+		result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+	vkDestroyFence(device, fence, allocator);
+	return result;
+}
+
+/* Command helpers */
+
+void dispatchGroups (VkCommandBuffer commandBuffer, uint32_t count, uint32_t groupSize)
+{
+	if (count > 0)
+		vkCmdDispatch(commandBuffer, (count + groupSize - 1) / groupSize, 1, 1);
+}
+
+void memoryBarrier (VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess,
+		VkPipelineStageFlags dstStages, VkAccessFlags dstAccess)
+{
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void imageBarrier (VkCommandBuffer commandBuffer, VkImage image, uint32_t baseLevel, uint32_t levelCount,
+		VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+		VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = baseLevel;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+
+	vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
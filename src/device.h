@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "memory.h"
+
+#include <mutex>
+#include <stdexcept>
+
+/* Device handles and helpers shared by the subsystems that live outside App */
+
+struct DeviceContext
+{
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueue graphicsQueue = VK_NULL_HANDLE;
+	uint32_t graphicsFamily = 0;
+	const VkAllocationCallbacks *allocator = nullptr;
+
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceFeatures enabledFeatures;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+
+	/* counts every allocation below when set, and steers them away from full heaps */
+	MemoryTracker *memoryTracker = nullptr;
+
+	/* the startup steps upload from several threads : the graphics queue is only submitted to under it */
+	mutable std::mutex queueMutex;
+
+	uint32_t findMemoryType (uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+	bool hasMemoryType (uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	/* the result of vkAllocateMemory : the caller decides whether running out is fatal */
+	VkResult allocateMemory (const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, MemoryCategory category,
+			VkDeviceMemory& memory, uint32_t *memoryType = nullptr) const;
+	void freeMemory (VkDeviceMemory memory) const;
+
+	void createBuffer (VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+			VkBuffer& buffer, VkDeviceMemory& memory, MemoryCategory category = MEMORY_CATEGORY_OTHER) const;
+	void destroyBuffer (VkBuffer buffer, VkDeviceMemory memory) const;
+
+	/*
+	 * Returns the properties of the memory it got : LAZILY_ALLOCATED is only
+	 * honoured for transient attachments on devices that have such memory.
+	 */
+	VkMemoryPropertyFlags createImage (uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage,
+			VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& memory, uint32_t mipLevels = 1,
+			VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, MemoryCategory category = MEMORY_CATEGORY_OTHER) const;
+	void destroyImage (VkImage image, VkDeviceMemory memory) const;
+
+	VkImageView createImageView (VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t mipLevels, uint32_t baseLevel = 0) const;
+
+	bool formatSupports (VkFormat format, VkFormatFeatureFlags features) const;
+
+	VkResult submit (const VkSubmitInfo& submitInfo, VkFence fence) const;
+	/* one-off uploads : waits on a fence of its own, other threads keep the queue meanwhile */
+	VkResult submitAndWait (const VkSubmitInfo& submitInfo) const;
+};
+
+/* Command helpers */
+
+/* enough workgroups of groupSize invocations for count items, along x */
+void dispatchGroups (VkCommandBuffer commandBuffer, uint32_t count, uint32_t groupSize);
+
+/* global memory barrier, e.g. compute writes read by the next dispatch or by indirect draws */
+void memoryBarrier (VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStages, VkAccessFlags srcAccess,
+		VkPipelineStageFlags dstStages, VkAccessFlags dstAccess);
+
+/* layout transition of color mip levels, with the access it orders */
+void imageBarrier (VkCommandBuffer commandBuffer, VkImage image, uint32_t baseLevel, uint32_t levelCount,
+		VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+		VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage);
@@ -0,0 +1,189 @@
+#include "draw_queue.h"
+
+#include <algorithm>
+
+/* Static functions */
+
+static size_t bindPointSlot (VkPipelineBindPoint bindPoint)
+{
+	return bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE ? 1 : 0;
+}
+
+/* Sort keys */
+
+uint32_t sortKeyDepth (float distance, float farDistance)
+{
+	const uint32_t maximum = (1u << SORT_KEY_DEPTH_BITS) - 1;
+
+	if (!(distance > 0.0f) || farDistance <= 0.0f)
+		return 0;
+	if (distance >= farDistance)
+		return maximum;
+
+	return static_cast<uint32_t>(distance / farDistance * maximum);
+}
+
+/* DrawQueue */
+
+void DrawQueue::reserve (size_t drawCount)
+{
+	items.reserve(drawCount);
+	scratch.reserve(drawCount);
+	histograms.resize(DRAW_SORT_MAX_CHUNKS * 256);
+}
+
+void DrawQueue::push (uint64_t key, uint32_t index)
+{
+	DrawItem item;
+	item.key = key;
+	item.index = index;
+	item.padding = 0;
+	items.push_back(item);
+}
+
+void DrawQueue::sort (ThreadPool& pool)
+{
+	size_t count = items.size();
+	if (count < 2)
+		return;
+
+	if (histograms.empty())
+		histograms.resize(DRAW_SORT_MAX_CHUNKS * 256);
+	scratch.resize(count);
+
+	/* bits that differ between any key and the first one : the other bytes are already sorted */
+	uint64_t varying = 0;
+	for (const DrawItem& item : items)
+		varying |= item.key ^ items[0].key;
+
+	size_t chunkCount = count < DRAW_SORT_PARALLEL_MIN ? 1 : std::min<size_t>(DRAW_SORT_MAX_CHUNKS, pool.concurrency());
+	size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		if (((varying >> shift) & 0xFF) == 0)
+			continue;
+
+		auto histogram = [&] (size_t first, size_t last) {
+			for (size_t chunk = first; chunk < last; chunk++)
+			{
+				uint32_t *counts = &histograms[chunk * 256];
+				std::fill(counts, counts + 256, 0);
+
+				size_t end = std::min(count, (chunk + 1) * chunkSize);
+				for (size_t i = chunk * chunkSize; i < end; i++)
+					counts[(items[i].key >> shift) & 0xFF]++;
+			}
+		};
+
+		/* per chunk counts become the chunk's first output position of every digit */
+		auto scatter = [&] (size_t first, size_t last) {
+			for (size_t chunk = first; chunk < last; chunk++)
+			{
+				uint32_t *offsets = &histograms[chunk * 256];
+
+				size_t end = std::min(count, (chunk + 1) * chunkSize);
+				for (size_t i = chunk * chunkSize; i < end; i++)
+					scratch[offsets[(items[i].key >> shift) & 0xFF]++] = items[i];
+			}
+		};
+
+		if (chunkCount == 1)
+			histogram(0, 1);
+		else
+			pool.parallelFor(chunkCount, 1, histogram);
+
+		uint32_t offset = 0;
+		for (size_t digit = 0; digit < 256; digit++)
+			for (size_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				uint32_t digitCount = histograms[chunk * 256 + digit];
+				histograms[chunk * 256 + digit] = offset;
+				offset += digitCount;
+			}
+
+		if (chunkCount == 1)
+			scatter(0, 1);
+		else
+			pool.parallelFor(chunkCount, 1, scatter);
+
+		items.swap(scratch);
+	}
+}
+
+/* CommandState */
+
+void CommandState::reset ()
+{
+	for (size_t i = 0; i < 2; i++)
+	{
+		pipelines[i] = VK_NULL_HANDLE;
+		layouts[i] = VK_NULL_HANDLE;
+		sets[i] = VK_NULL_HANDLE;
+	}
+
+	vertexBuffer = VK_NULL_HANDLE;
+	vertexOffset = 0;
+	indexBuffer = VK_NULL_HANDLE;
+	indexOffset = 0;
+	indexType = VK_INDEX_TYPE_UINT16;
+}
+
+void CommandState::bindPipeline (VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipeline pipeline)
+{
+	size_t slot = bindPointSlot(bindPoint);
+	if (pipelines[slot] == pipeline)
+	{
+		skippedBinds++;
+		return;
+	}
+
+	vkCmdBindPipeline(commandBuffer, bindPoint, pipeline);
+	pipelines[slot] = pipeline;
+	binds++;
+}
+
+void CommandState::bindDescriptorSet (VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, VkDescriptorSet set)
+{
+	size_t slot = bindPointSlot(bindPoint);
+	if (layouts[slot] == layout && sets[slot] == set)
+	{
+		skippedBinds++;
+		return;
+	}
+
+	vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, 0, 1, &set, 0, nullptr);
+	layouts[slot] = layout;
+	sets[slot] = set;
+	binds++;
+	setBinds++;
+}
+
+void CommandState::bindVertexBuffer (VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset)
+{
+	if (vertexBuffer == buffer && vertexOffset == offset)
+	{
+		skippedBinds++;
+		return;
+	}
+
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &buffer, &offset);
+	vertexBuffer = buffer;
+	vertexOffset = offset;
+	binds++;
+}
+
+void CommandState::bindIndexBuffer (VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkIndexType type)
+{
+	if (indexBuffer == buffer && indexOffset == offset && indexType == type)
+	{
+		skippedBinds++;
+		return;
+	}
+
+	vkCmdBindIndexBuffer(commandBuffer, buffer, offset, type);
+	indexBuffer = buffer;
+	indexOffset = offset;
+	indexType = type;
+	binds++;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * 64-bit draw sort key, most significant field first :
+ *
+ *   pass (4) | pipeline (8) | descriptor set (12) | material (16) | depth (24)
+ *
+ * Sorting the keys groups the draws of a pass by state, the most expensive
+ * bind first, and orders every group front to back.
+ */
+const uint32_t SORT_KEY_PASS_BITS = 4;
+const uint32_t SORT_KEY_PIPELINE_BITS = 8;
+const uint32_t SORT_KEY_SET_BITS = 12;
+const uint32_t SORT_KEY_MATERIAL_BITS = 16;
+const uint32_t SORT_KEY_DEPTH_BITS = 24;
+
+inline uint64_t makeSortKey (uint32_t pass, uint32_t pipeline, uint32_t descriptorSet, uint32_t material, uint32_t depth)
+{
+	uint64_t key = pass & ((1u << SORT_KEY_PASS_BITS) - 1);
+	key = key << SORT_KEY_PIPELINE_BITS | (pipeline & ((1u << SORT_KEY_PIPELINE_BITS) - 1));
+	key = key << SORT_KEY_SET_BITS | (descriptorSet & ((1u << SORT_KEY_SET_BITS) - 1));
+	key = key << SORT_KEY_MATERIAL_BITS | (material & ((1u << SORT_KEY_MATERIAL_BITS) - 1));
+	key = key << SORT_KEY_DEPTH_BITS | (depth & ((1u << SORT_KEY_DEPTH_BITS) - 1));
+	return key;
+}
+
+/* view distance in [0, farDistance] to the depth field, clamped */
+uint32_t sortKeyDepth (float distance, float farDistance);
+
+/* below that many draws the sort runs on the calling thread */
+const size_t DRAW_SORT_PARALLEL_MIN = 4096;
+const uint32_t DRAW_SORT_MAX_CHUNKS = 16;
+
+struct DrawItem
+{
+	uint64_t key;
+	uint32_t index;			/* what to draw, meaning is up to the recorder */
+	uint32_t padding;
+};
+
+/*
+ * Draws of a frame, sorted by key with a least significant digit radix sort
+ * (8 bits per pass). Bytes where every key is the same are skipped, each pass
+ * histograms and scatters contiguous chunks of the items in parallel. Stable,
+ * and does not allocate once reserve covered the frame.
+ */
+
+class DrawQueue
+{
+private:
+	std::vector<DrawItem> items;
+	std::vector<DrawItem> scratch;
+	std::vector<uint32_t> histograms;	/* 256 per chunk */
+
+public:
+	void reserve (size_t drawCount);
+
+	void clear () { items.clear(); }
+	void push (uint64_t key, uint32_t index);
+	void sort (ThreadPool& pool);
+
+	size_t size () const { return items.size(); }
+	const DrawItem *begin () const { return items.data(); }
+	const DrawItem *end () const { return items.data() + items.size(); }
+};
+
+/*
+ * What is bound on a command buffer, so binds of the state already there are
+ * skipped. Vertex buffers are only tracked for binding 0.
+ */
+
+class CommandState
+{
+private:
+	VkPipeline pipelines[2];
+	VkPipelineLayout layouts[2];
+	VkDescriptorSet sets[2];
+	VkBuffer vertexBuffer;
+	VkDeviceSize vertexOffset;
+	VkBuffer indexBuffer;
+	VkDeviceSize indexOffset;
+	VkIndexType indexType;
+
+public:
+	uint64_t binds = 0;
+	uint64_t skippedBinds = 0;
+	uint64_t setBinds = 0;			/* the descriptor set part of binds */
+
+	CommandState () { reset(); }
+
+	/* at the start of every command buffer */
+	void reset ();
+
+	void bindPipeline (VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipeline pipeline);
+	void bindDescriptorSet (VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, VkDescriptorSet set);
+	void bindVertexBuffer (VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset);
+	void bindIndexBuffer (VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkIndexType type);
+};
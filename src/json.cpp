@@ -0,0 +1,234 @@
+#include "json.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+
+/* Static functions */
+
+static const JsonValue& nullValue ()
+{
+	static const JsonValue value;
+	return value;
+}
+
+struct JsonParser
+{
+	const char *cursor;
+	const char *end;
+
+	void skipWhitespace ()
+	{
+		while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r'))
+			cursor++;
+	}
+
+	void expect (char c)
+	{
+		skipWhitespace();
+		if (cursor >= end || *cursor != c)
+			throw std::runtime_error("malformed JSON document!");
+		cursor++;
+	}
+
+	bool consume (const char *word)
+	{
+		size_t length = strlen(word);
+		if ((size_t) (end - cursor) < length || strncmp(cursor, word, length) != 0)
+			return false;
+
+		cursor += length;
+		return true;
+	}
+
+	static void appendUtf8 (std::string& out, unsigned codepoint)
+	{
+		if (codepoint < 0x80)
+			out += (char) codepoint;
+		else if (codepoint < 0x800)
+		{
+			out += (char) (0xC0 | (codepoint >> 6));
+			out += (char) (0x80 | (codepoint & 0x3F));
+		}
+		else
+		{
+			out += (char) (0xE0 | (codepoint >> 12));
+			out += (char) (0x80 | ((codepoint >> 6) & 0x3F));
+			out += (char) (0x80 | (codepoint & 0x3F));
+		}
+	}
+
+	std::string parseString ()
+	{
+		expect('"');
+
+		std::string out;
+		while (cursor < end && *cursor != '"')
+		{
+			char c = *cursor++;
+			if (c != '\\')
+			{
+				out += c;
+				continue;
+			}
+
+			if (cursor >= end)
+				break;
+
+			char escaped = *cursor++;
+			switch (escaped)
+			{
+				case 'n': out += '\n'; break;
+				case 't': out += '\t'; break;
+				case 'r': out += '\r'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u':
+					if (end - cursor < 4)
+						throw std::runtime_error("malformed JSON escape!");
+					appendUtf8(out, (unsigned) strtoul(std::string(cursor, 4).c_str(), nullptr, 16));
+					cursor += 4;
+					break;
+				default: out += escaped; break;
+			}
+		}
+
+		expect('"');
+		return out;
+	}
+
+	JsonValue parseValue ()
+	{
+		skipWhitespace();
+		if (cursor >= end)
+			throw std::runtime_error("unexpected end of JSON document!");
+
+		JsonValue value;
+
+		if (*cursor == '{')
+		{
+			cursor++;
+			value.type = JsonValue::OBJECT;
+
+			skipWhitespace();
+			if (cursor < end && *cursor == '}')
+			{
+				cursor++;
+				return value;
+			}
+
+			while (true)
+			{
+				std::string key = parseString();
+				expect(':');
+				value.object.push_back(std::make_pair(key, parseValue()));
+
+				skipWhitespace();
+				if (cursor >= end || *cursor != ',')
+					break;
+				cursor++;
+			}
+
+			expect('}');
+		}
+		else if (*cursor == '[')
+		{
+			cursor++;
+			value.type = JsonValue::ARRAY;
+
+			skipWhitespace();
+			if (cursor < end && *cursor == ']')
+			{
+				cursor++;
+				return value;
+			}
+
+			while (true)
+			{
+				value.array.push_back(parseValue());
+
+				skipWhitespace();
+				if (cursor >= end || *cursor != ',')
+					break;
+				cursor++;
+			}
+
+			expect(']');
+		}
+		else if (*cursor == '"')
+		{
+			value.type = JsonValue::STRING;
+			value.string = parseString();
+		}
+		else if (consume("true"))
+		{
+			value.type = JsonValue::BOOLEAN;
+			value.boolean = true;
+		}
+		else if (consume("false"))
+		{
+			value.type = JsonValue::BOOLEAN;
+		}
+		else if (consume("null"))
+		{
+			value.type = JsonValue::NULL_VALUE;
+		}
+		else
+		{
+			/* strtod needs a terminated buffer, numbers are short */
+			char buffer[64];
+			size_t length = 0;
+			while (cursor < end && length < sizeof(buffer) - 1 && strchr("+-0123456789.eE", *cursor))
+				buffer[length++] = *cursor++;
+			buffer[length] = '\0';
+
+			if (length == 0)
+				throw std::runtime_error("malformed JSON value!");
+
+			value.type = JsonValue::NUMBER;
+			value.number = strtod(buffer, nullptr);
+		}
+
+		return value;
+	}
+};
+
+/* JsonValue */
+
+JsonValue JsonValue::parse (const char *data, size_t size)
+{
+	JsonParser parser;
+	parser.cursor = data;
+	parser.end = data + size;
+
+	return parser.parseValue();
+}
+
+bool JsonValue::has (const char *key) const
+{
+	for (const auto& member : object)
+		if (member.first == key)
+			return true;
+
+	return false;
+}
+
+const JsonValue& JsonValue::operator[] (const char *key) const
+{
+	for (const auto& member : object)
+		if (member.first == key)
+			return member.second;
+
+	return nullValue();
+}
+
+const JsonValue& JsonValue::operator[] (size_t index) const
+{
+	return index < array.size() ? array[index] : nullValue();
+}
+
+size_t JsonValue::size () const
+{
+	return type == OBJECT ? object.size() : array.size();
+}
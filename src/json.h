@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Minimal read-only JSON document, enough for glTF */
+
+class JsonValue
+{
+public:
+	enum Type
+	{
+		NULL_VALUE,
+		BOOLEAN,
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT
+	};
+
+	Type type = NULL_VALUE;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> array;
+	std::vector<std::pair<std::string, JsonValue>> object;
+
+	static JsonValue parse (const char *data, size_t size);
+
+	bool has (const char *key) const;
+	const JsonValue& operator[] (const char *key) const;
+	const JsonValue& operator[] (size_t index) const;
+	size_t size () const;
+
+	double asNumber (double fallback = 0.0) const { return type == NUMBER ? number : fallback; }
+	int asInt (int fallback = 0) const { return type == NUMBER ? static_cast<int>(number) : fallback; }
+	const std::string& asString () const { return string; }
+};
@@ -0,0 +1,92 @@
+#include "lifetime.h"
+
+#include <algorithm>
+
+/* DeletionQueue */
+
+void DeletionQueue::init (const DeviceContext& deviceContext)
+{
+	context = &deviceContext;
+
+	/* a swap chain recreation retires about twenty handles : no allocation on resize */
+	entries.reserve(256);
+}
+
+void DeletionQueue::flush ()
+{
+	for (size_t i = first; i < entries.size(); i++)
+		destroy(entries[i]);
+
+	entries.clear();
+	first = 0;
+}
+
+void DeletionQueue::collect (uint64_t value)
+{
+	/* values only grow : the completed entries are a prefix */
+	while (first < entries.size() && entries[first].value <= value)
+		destroy(entries[first++]);
+
+	if (first == entries.size())
+	{
+		entries.clear();
+		first = 0;
+	}
+}
+
+void DeletionQueue::push (ResourceType type, uint64_t handle, uint64_t owner)
+{
+	Entry entry;
+	entry.value = submitted;
+	entry.type = type;
+	entry.handle = handle;
+	entry.owner = owner;
+	entries.push_back(entry);
+
+	peakPending = std::max(peakPending, pending());
+}
+
+void DeletionQueue::destroy (const Entry& entry)
+{
+	VkDevice device = context->device;
+	const VkAllocationCallbacks *allocator = context->allocator;
+
+	switch (entry.type)
+	{
+		case RESOURCE_BUFFER:
+			vkDestroyBuffer(device, (VkBuffer) entry.handle, allocator);
+			break;
+		case RESOURCE_IMAGE:
+			vkDestroyImage(device, (VkImage) entry.handle, allocator);
+			break;
+		case RESOURCE_IMAGE_VIEW:
+			vkDestroyImageView(device, (VkImageView) entry.handle, allocator);
+			break;
+		case RESOURCE_MEMORY:
+			context->freeMemory((VkDeviceMemory) entry.handle);
+			break;
+		case RESOURCE_FRAMEBUFFER:
+			vkDestroyFramebuffer(device, (VkFramebuffer) entry.handle, allocator);
+			break;
+		case RESOURCE_SWAPCHAIN:
+			vkDestroySwapchainKHR(device, (VkSwapchainKHR) entry.handle, allocator);
+			break;
+		case RESOURCE_SEMAPHORE:
+			vkDestroySemaphore(device, (VkSemaphore) entry.handle, allocator);
+			break;
+		case RESOURCE_COMMAND_BUFFER:
+		{
+			VkCommandBuffer commandBuffer = (VkCommandBuffer) entry.handle;
+			vkFreeCommandBuffers(device, (VkCommandPool) entry.owner, 1, &commandBuffer);
+			break;
+		}
+		case RESOURCE_DESCRIPTOR_POOL:
+			vkDestroyDescriptorPool(device, (VkDescriptorPool) entry.handle, allocator);
+			break;
+		case RESOURCE_PIPELINE:
+			vkDestroyPipeline(device, (VkPipeline) entry.handle, allocator);
+			break;
+	}
+
+	retiredCount++;
+}
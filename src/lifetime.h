@@ -0,0 +1,132 @@
+#pragma once
+
+#include "device.h"
+
+#include <cstdint>
+#include <vector>
+
+/* handles a DeletionQueue knows how to destroy */
+enum ResourceType
+{
+	RESOURCE_BUFFER,
+	RESOURCE_IMAGE,
+	RESOURCE_IMAGE_VIEW,
+	RESOURCE_MEMORY,
+	RESOURCE_FRAMEBUFFER,
+	RESOURCE_SWAPCHAIN,
+	RESOURCE_SEMAPHORE,
+	RESOURCE_COMMAND_BUFFER,
+	RESOURCE_DESCRIPTOR_POOL,
+	RESOURCE_PIPELINE
+};
+
+/*
+ * Handles that may still be used by submitted work, destroyed once the GPU
+ * retired it. Every submission has a value, increasing (a frame index or a
+ * timeline semaphore value) : submit() records the value of the latest one,
+ * retire() tags a handle with it, and collect() destroys the handles of every
+ * value the caller knows completed, oldest first. Nothing waits on the device.
+ *
+ * Not thread safe, owned by the thread that submits.
+ */
+
+class DeletionQueue
+{
+private:
+	struct Entry
+	{
+		uint64_t value;
+		ResourceType type;
+		uint64_t handle;
+		uint64_t owner;			/* pool of a command buffer */
+	};
+
+	const DeviceContext *context = nullptr;
+	std::vector<Entry> entries;
+	size_t first = 0;
+
+	uint64_t submitted = 0;
+	uint64_t retiredCount = 0;
+	size_t peakPending = 0;
+
+	void push (ResourceType type, uint64_t handle, uint64_t owner);
+	void destroy (const Entry& entry);
+
+public:
+	void init (const DeviceContext& context);
+
+	/* destroys everything, the device must be idle */
+	void flush ();
+
+	/* work up to value was submitted : handles retired from now on wait for it */
+	void submit (uint64_t value) { submitted = value; }
+
+	/* work up to value completed */
+	void collect (uint64_t value);
+
+	void retire (VkBuffer buffer) { push(RESOURCE_BUFFER, (uint64_t) buffer, 0); }
+	void retire (VkImage image) { push(RESOURCE_IMAGE, (uint64_t) image, 0); }
+	void retire (VkImageView view) { push(RESOURCE_IMAGE_VIEW, (uint64_t) view, 0); }
+	void retire (VkDeviceMemory memory) { push(RESOURCE_MEMORY, (uint64_t) memory, 0); }
+	void retire (VkFramebuffer framebuffer) { push(RESOURCE_FRAMEBUFFER, (uint64_t) framebuffer, 0); }
+	void retire (VkSwapchainKHR swapchain) { push(RESOURCE_SWAPCHAIN, (uint64_t) swapchain, 0); }
+	void retire (VkSemaphore semaphore) { push(RESOURCE_SEMAPHORE, (uint64_t) semaphore, 0); }
+	void retire (VkDescriptorPool pool) { push(RESOURCE_DESCRIPTOR_POOL, (uint64_t) pool, 0); }
+	void retire (VkPipeline pipeline) { push(RESOURCE_PIPELINE, (uint64_t) pipeline, 0); }
+	void retire (VkCommandPool pool, VkCommandBuffer commandBuffer) { push(RESOURCE_COMMAND_BUFFER, (uint64_t) commandBuffer, (uint64_t) pool); }
+
+	size_t pending () const { return entries.size() - first; }
+	size_t peak () const { return peakPending; }
+	uint64_t retired () const { return retiredCount; }
+};
+
+/*
+ * Owning handle : moved, never copied, retired to its queue when reset,
+ * reassigned or destroyed. The retire() overloads need distinct handle types,
+ * which Vulkan only has on 64 bit builds.
+ */
+
+template <typename T>
+class Unique
+{
+private:
+	DeletionQueue *queue;
+	T handle;
+
+public:
+	Unique () : queue(nullptr), handle(VK_NULL_HANDLE) {}
+	Unique (DeletionQueue& queue, T handle) : queue(&queue), handle(handle) {}
+	~Unique () { reset(); }
+
+	Unique (const Unique&) = delete;
+	Unique& operator= (const Unique&) = delete;
+
+	Unique (Unique&& other) : queue(other.queue), handle(other.release()) {}
+
+	Unique& operator= (Unique&& other)
+	{
+		if (this != &other)
+		{
+			reset();
+			queue = other.queue;
+			handle = other.release();
+		}
+		return *this;
+	}
+
+	T get () const { return handle; }
+	operator T () const { return handle; }
+
+	T release ()
+	{
+		T released = handle;
+		handle = VK_NULL_HANDLE;
+		return released;
+	}
+
+	void reset ()
+	{
+		if (handle != VK_NULL_HANDLE)
+			queue->retire(release());
+	}
+};
@@ -1,12 +1,360 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <cctype>
+#include <chrono>
+#include <random>
 
 #include "app.h"
 
-int main()
+/* vk_project --bake <meshes...> : rebuild the mesh caches offline, without a window */
+static int bakeMeshes (int argc, char **argv)
 {
+	ThreadPool pool;
+
+	for (int i = 2; i < argc; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		bakeMeshCache(argv[i], pool, true);
+
+		std::cout << argv[i] << ": baked in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+	}
+
+	return 0;
+}
+
+/* vk_project --scene-benchmark [nodes] : times Scene::update on an 8-ary tree, without a window */
+static int benchmarkScene (int argc, char **argv)
+{
+	size_t nodeCount = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000000;
+	const int iterations = 20;
+
+	ThreadPool pool;
+	Scene scene;
+	std::vector<glm::mat4> instances(nodeCount);
+
+	for (size_t i = 0; i < nodeCount; i++)
+	{
+		NodeHandle node = scene.create(i == 0 ? NO_NODE : static_cast<NodeHandle>((i - 1) / 8));
+		scene.setPosition(node, glm::vec3(1.0f, 0.5f, 0.0f));
+		scene.setRotation(node, glm::vec3(0.0f, 1.0f, 0.0f), 0.01f * (i % 64));
+		scene.setScale(node, 0.99f);
+		scene.setBounds(node, glm::vec3(0.0f), 1.0f);
+		scene.setInstance(node, static_cast<uint32_t>(i));
+	}
+
+	/* every dirtyStride-th local from firstDirty on is touched before each update */
+	auto run = [&] (const char *name, ThreadPool& threads, size_t firstDirty, size_t dirtyStride) {
+		double total = 0.0;
+		size_t updated = 0;
+
+		for (int i = 0; i < iterations; i++)
+		{
+			for (size_t node = firstDirty; dirtyStride != 0 && node < nodeCount; node += dirtyStride)
+				scene.setScale(static_cast<NodeHandle>(node), 0.99f);
+
+			auto start = std::chrono::steady_clock::now();
+			scene.update(threads, instances.data());
+			total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			updated = scene.lastUpdatedNodes();
+		}
+
+		std::cout << "  " << name << ": " << total / iterations << " ms, " << updated << " nodes updated" << std::endl;
+	};
+
+	scene.update(pool, instances.data());
+
+	std::cout << nodeCount << " nodes, " << scene.levelCount() << " levels, " << pool.concurrency() << " threads" << std::endl;
+
+	/* nodes past nodeCount / 8 are leaves */
+	ThreadPool single(1);
+	run("all dirty, 1 thread", single, 0, 1);
+	run("all dirty", pool, 0, 1);
+	run("1 leaf in 1000 dirty", pool, nodeCount / 8 + 1, 1000);
+	run("clean", pool, 0, 0);
+
+	return 0;
+}
+
+/* vk_project --cull-benchmark [objects] : times the BVH against a linear frustum test, without a window */
+static int benchmarkCulling (int argc, char **argv)
+{
+	size_t objectCount = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+	const int iterations = 20;
+	const float worldSize = 1000.0f;
+
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-worldSize * 0.5f, worldSize * 0.5f);
+	std::uniform_real_distribution<float> size(0.5f, 2.0f);
+
+	std::vector<glm::vec3> centers(objectCount), extents(objectCount);
+	for (size_t i = 0; i < objectCount; i++)
+	{
+		centers[i] = glm::vec3(position(random), position(random), position(random));
+		extents[i] = glm::vec3(size(random), size(random), size(random));
+	}
+
+	ThreadPool pool;
+	ThreadPool single(1);
+	Bvh bvh;
+	std::vector<uint32_t> visible;
+
+	auto start = std::chrono::steady_clock::now();
+	bvh.resize(objectCount);
+	for (uint32_t i = 0; i < objectCount; i++)
+		bvh.setBounds(i, centers[i], extents[i]);
+	bvh.build();
+	double buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	/* a quarter turn of the camera over the iterations, from the middle of the objects */
+	auto frustum = [&] (int i) {
+		float angle = 1.5707963f * i / iterations;
+		glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV), 16.0f / 9.0f, 0.1f, worldSize * 0.5f);
+		glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(std::sin(angle), 0.0f, std::cos(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+		return Frustum::fromMatrix(projection * view);
+	};
+
+	double refitMilliseconds = 0.0;
+	for (int i = 0; i < iterations; i++)
+	{
+		for (size_t object = i % 10; object < objectCount; object += 10)
+		{
+			centers[object].y += 1.0f;
+			bvh.setBounds(static_cast<uint32_t>(object), centers[object], extents[object]);
+		}
+
+		start = std::chrono::steady_clock::now();
+		bvh.refit();
+		refitMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double per100k = 100000.0 / objectCount;
+	std::cout << objectCount << " objects, " << bvh.nodeCount() << " nodes, " << pool.concurrency() << " threads" << std::endl;
+	std::cout << "  build: " << buildMilliseconds << " ms" << std::endl;
+	std::cout << "  refit, 10% moved: " << refitMilliseconds / iterations << " ms" << std::endl;
+
+	auto run = [&] (const char *name, ThreadPool& threads) {
+		double total = 0.0;
+		size_t visibleCount = 0;
+
+		for (int i = 0; i < iterations; i++)
+		{
+			Frustum planes = frustum(i);
+			start = std::chrono::steady_clock::now();
+			visibleCount = bvh.cull(planes, threads, visible);
+			total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		std::cout << "  " << name << ": " << total / iterations * per100k << " ms per 100k objects, "
+			<< visibleCount << " visible" << std::endl;
+	};
+
+	run("BVH cull, 1 thread", single);
+	run("BVH cull", pool);
+
+	/* every box against every plane */
+	double linear = 0.0;
+	size_t linearCount = 0;
+	for (int i = 0; i < iterations; i++)
+	{
+		Frustum planes = frustum(i);
+		start = std::chrono::steady_clock::now();
+
+		linearCount = 0;
+		for (size_t object = 0; object < objectCount; object++)
+		{
+			const glm::vec3& center = centers[object];
+			bool inside = true;
+			for (const float *plane : planes.planes)
+				inside = inside && center.x * plane[0] + center.y * plane[1] + center.z * plane[2] + plane[3] +
+						extents[object].x * std::fabs(plane[0]) + extents[object].y * std::fabs(plane[1]) + extents[object].z * std::fabs(plane[2]) >= 0.0f;
+			linearCount += inside ? 1 : 0;
+		}
+
+		linear += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::cout << "  linear test, 1 thread: " << linear / iterations * per100k << " ms per 100k objects, " << linearCount << " visible" << std::endl;
+
+	return 0;
+}
+
+/* vk_project --sort-benchmark [draws] : times the draw queue sort and counts the state changes it saves, without a window */
+static int benchmarkDrawSort (int argc, char **argv)
+{
+	size_t drawCount = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+	const int iterations = 20;
+
+	std::mt19937 random(1);
+	std::vector<uint64_t> keys(drawCount);
+	for (uint64_t& key : keys)
+		key = makeSortKey(random() % 2, random() % 8, random() % 64, random() % 512, random() % (1u << SORT_KEY_DEPTH_BITS));
+
+	/* a bind for every pipeline, set or material that differs from the previous draw */
+	auto stateChanges = [] (const uint64_t *sorted, size_t count, size_t stride) {
+		const uint64_t stateMask = ~((uint64_t(1) << SORT_KEY_DEPTH_BITS) - 1);
+		const int shifts[3] = { SORT_KEY_DEPTH_BITS + SORT_KEY_MATERIAL_BITS + SORT_KEY_SET_BITS,
+				SORT_KEY_DEPTH_BITS + SORT_KEY_MATERIAL_BITS, SORT_KEY_DEPTH_BITS };
+		const uint64_t widths[3] = { (1u << (SORT_KEY_PASS_BITS + SORT_KEY_PIPELINE_BITS)) - 1, (1u << SORT_KEY_SET_BITS) - 1, (1u << SORT_KEY_MATERIAL_BITS) - 1 };
+
+		size_t changes = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t key = sorted[i * stride] & stateMask;
+			for (int field = 0; field < 3; field++)
+				if (i == 0 || ((key >> shifts[field]) & widths[field]) != ((sorted[(i - 1) * stride] >> shifts[field]) & widths[field]))
+					changes++;
+		}
+		return changes;
+	};
+
+	ThreadPool pool;
+	ThreadPool single(1);
+	DrawQueue queue;
+	queue.reserve(drawCount);
+
+	auto run = [&] (const char *name, ThreadPool& threads) {
+		double total = 0.0;
+		for (int i = 0; i < iterations; i++)
+		{
+			queue.clear();
+			for (size_t draw = 0; draw < drawCount; draw++)
+				queue.push(keys[draw], static_cast<uint32_t>(draw));
+
+			auto start = std::chrono::steady_clock::now();
+			queue.sort(threads);
+			total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		std::cout << "  " << name << ": " << total / iterations << " ms" << std::endl;
+	};
+
+	std::cout << drawCount << " draws, " << pool.concurrency() << " threads" << std::endl;
+
+	run("radix sort, 1 thread", single);
+	run("radix sort", pool);
+
+	double total = 0.0;
+	std::vector<uint64_t> sorted(drawCount);
+	for (int i = 0; i < iterations; i++)
+	{
+		sorted = keys;
+		auto start = std::chrono::steady_clock::now();
+		std::sort(sorted.begin(), sorted.end());
+		total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	std::cout << "  std::sort of the keys alone: " << total / iterations << " ms" << std::endl;
+
+	size_t unsortedChanges = stateChanges(keys.data(), drawCount, 1);
+	size_t sortedChanges = stateChanges(&queue.begin()->key, drawCount, sizeof(DrawItem) / sizeof(uint64_t));
+	std::cout << "  state changes: " << unsortedChanges << " in submission order, " << sortedChanges << " sorted ("
+		<< unsortedChanges - sortedChanges << " avoided)" << std::endl;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && strcmp(argv[1], "--bake") == 0)
+	{
+		try
+		{
+			return bakeMeshes(argc, argv);
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (argc > 1 && strcmp(argv[1], "--scene-benchmark") == 0)
+		return benchmarkScene(argc, argv);
+
+	if (argc > 1 && strcmp(argv[1], "--cull-benchmark") == 0)
+		return benchmarkCulling(argc, argv);
+
+	if (argc > 1 && strcmp(argv[1], "--sort-benchmark") == 0)
+		return benchmarkDrawSort(argc, argv);
+
 	App application;
+	int firstOption = 1;
+
+	/* vk_project --mesh-benchmark <meshes...> : times a cold import against a load from the cache, both through the upload */
+	if (argc > 1 && strcmp(argv[1], "--mesh-benchmark") == 0)
+	{
+		application.setMeshBenchmark(true);
+		for (int i = 2; i < argc; i++)
+			application.addMesh(argv[i]);
+		firstOption = argc;
+	}
+
+	/* options combine in any order : each takes the values that follow it */
+	for (int i = firstOption; i < argc; i++)
+	{
+		const char *option = argv[i];
+		bool value = i + 1 < argc;
+
+		/* each one adds to the grid or the materials, repeat them for more */
+		if (value && strcmp(option, "--mesh") == 0)
+			application.addMesh(argv[++i]);
+
+		else if (value && strcmp(option, "--texture") == 0)
+			application.addTexture(argv[++i]);
+
+		else if (value && strcmp(option, "--pipeline-warmup") == 0)
+			application.setPipelineWarmup(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+
+		else if (strcmp(option, "--per-draw-descriptors") == 0)
+			application.setBindless(false);
+
+		else if (value && strcmp(option, "--msaa") == 0)
+			application.setSamples(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)));
+
+		else if (strcmp(option, "--render-pass") == 0)
+			application.setDynamicRendering(false);
+
+		else if (value && strcmp(option, "--capture") == 0)
+			application.setCapture(argv[++i]);
+
+		else if (value && strcmp(option, "--replay") == 0)
+			application.setReplay(argv[++i]);
+
+		else if (value && strcmp(option, "--sim-spike") == 0)
+			application.setSimulationSpike(strtod(argv[++i], nullptr));
+
+		else if (value && strcmp(option, "--memory-budget") == 0)
+			application.setMemoryBudget(strtoull(argv[++i], nullptr, 10));
+
+		else if (value && strcmp(option, "--memory-report") == 0)
+			application.setMemoryReport(argv[++i]);
+
+		/* a GPU frame time in milliseconds the scene resolution adapts to */
+		else if (value && strcmp(option, "--gpu-budget") == 0)
+			application.setGpuBudget(strtod(argv[++i], nullptr));
+
+		/* the startup steps on a timeline, for chrome://tracing or Perfetto */
+		else if (value && strcmp(option, "--startup-trace") == 0)
+			application.setStartupTrace(argv[++i]);
+
+		/* edit assets/shaders while it runs : compile.sh is run again for the changed sources only */
+		else if (strcmp(option, "--hot-reload") == 0)
+			application.setHotReload(true);
+
+		/* a directory, and optionally every how many frames : a number right after the directory */
+		else if (value && (strcmp(option, "--readback") == 0 || strcmp(option, "--readback-raw") == 0))
+		{
+			const char *directory = argv[++i];
+			uint32_t interval = 1;
+			if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+				interval = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+			application.setReadback(directory, strcmp(option, "--readback") == 0 ? READBACK_PNG : READBACK_RAW, interval);
+		}
+
+		else
+			std::cerr << "ignored option " << option << (value ? "" : ", or its value is missing") << std::endl;
+	}
 
 	try
 	{
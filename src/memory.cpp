@@ -0,0 +1,243 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+/* Static functions */
+
+const char *memoryCategoryName (MemoryCategory category)
+{
+	switch (category)
+	{
+		case MEMORY_CATEGORY_TEXTURE: return "texture";
+		case MEMORY_CATEGORY_GEOMETRY: return "geometry";
+		case MEMORY_CATEGORY_RENDER_TARGET: return "render_target";
+		case MEMORY_CATEGORY_BUFFER: return "buffer";
+		case MEMORY_CATEGORY_STAGING: return "staging";
+		default: return "other";
+	}
+}
+
+static void atomicMax (std::atomic<uint64_t>& target, uint64_t value)
+{
+	uint64_t current = target.load();
+	while (current < value && !target.compare_exchange_weak(current, value));
+}
+
+/* MemoryTracker */
+
+void MemoryTracker::init (VkPhysicalDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, bool extension,
+		VkDeviceSize cap, size_t capacity)
+{
+	physicalDevice = device;
+	properties = memoryProperties;
+	budgetExtension = extension;
+	deviceLocalCap = cap;
+
+	/* a power of two, at most half full */
+	size_t size = 16;
+	while (size < capacity * 2)
+		size *= 2;
+	table.assign(size, Allocation());
+	liveCount = 0;
+
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++)
+	{
+		heapBytes[i] = 0;
+		heapBudgets[i] = 0;
+		heapUsages[i] = 0;
+	}
+	for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+	{
+		typeBytes[i] = 0;
+		typeAllocations[i] = 0;
+	}
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+	{
+		categoryBytes[i] = 0;
+		categoryPeaks[i] = 0;
+	}
+	allocationCount = 0;
+	freeCount = 0;
+	failureCount = 0;
+
+	refresh();
+}
+
+size_t MemoryTracker::slot (VkDeviceMemory memory) const
+{
+	/* Fibonacci hashing of the handle */
+	uint64_t hash = (uint64_t) memory * 0x9E3779B97F4A7C15ull;
+	return static_cast<size_t>(hash >> 32) & (table.size() - 1);
+}
+
+uint32_t MemoryTracker::chooseType (uint32_t typeFilter, VkMemoryPropertyFlags required, VkDeviceSize size) const
+{
+	uint32_t first = VK_MAX_MEMORY_TYPES;
+
+	for (uint32_t i = 0; i < properties.memoryTypeCount; i++)
+	{
+		if (!(typeFilter & (1 << i)) || (properties.memoryTypes[i].propertyFlags & required) != required)
+			continue;
+
+		uint32_t heap = properties.memoryTypes[i].heapIndex;
+		if (heapUsage(heap) + size <= heapBudget(heap))
+			return i;
+
+		first = std::min(first, i);
+	}
+
+	if (first == VK_MAX_MEMORY_TYPES)
+		throw std::runtime_error("failed to find suitable memory type!");
+
+	return first;
+}
+
+void MemoryTracker::add (VkDeviceMemory memory, VkDeviceSize size, uint32_t type, MemoryCategory category)
+{
+	std::lock_guard<std::mutex> lock(tableMutex);
+
+	if (liveCount * 2 >= table.size())
+		throw std::runtime_error("too many device memory allocations to track!");
+
+	size_t mask = table.size() - 1;
+	size_t i = slot(memory);
+	while (table[i].memory != VK_NULL_HANDLE)
+		i = (i + 1) & mask;
+
+	table[i].memory = memory;
+	table[i].size = size;
+	table[i].type = type;
+	table[i].category = category;
+	liveCount++;
+
+	uint32_t heap = properties.memoryTypes[type].heapIndex;
+	heapBytes[heap] += size;
+	typeBytes[type] += size;
+	typeAllocations[type]++;
+	atomicMax(categoryPeaks[category], categoryBytes[category] += size);
+	allocationCount++;
+}
+
+void MemoryTracker::remove (VkDeviceMemory memory)
+{
+	if (memory == VK_NULL_HANDLE || table.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(tableMutex);
+
+	size_t mask = table.size() - 1;
+	size_t i = slot(memory);
+	while (table[i].memory != memory)
+	{
+		/* allocated before the tracker : nothing to count */
+		if (table[i].memory == VK_NULL_HANDLE)
+			return;
+		i = (i + 1) & mask;
+	}
+
+	const Allocation& allocation = table[i];
+	heapBytes[properties.memoryTypes[allocation.type].heapIndex] -= allocation.size;
+	typeBytes[allocation.type] -= allocation.size;
+	typeAllocations[allocation.type]--;
+	categoryBytes[allocation.category] -= allocation.size;
+	freeCount++;
+	liveCount--;
+
+	/* backward shift : the entries after the hole that may not sit before their home slot move into it */
+	for (size_t j = (i + 1) & mask; table[j].memory != VK_NULL_HANDLE; j = (j + 1) & mask)
+	{
+		size_t home = slot(table[j].memory);
+		bool stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+		if (stays)
+			continue;
+
+		table[i] = table[j];
+		i = j;
+	}
+
+	table[i].memory = VK_NULL_HANDLE;
+}
+
+void MemoryTracker::refresh ()
+{
+	VkDeviceSize budgets[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize usages[VK_MAX_MEMORY_HEAPS];
+
+	for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+	{
+		budgets[i] = properties.memoryHeaps[i].size;
+		usages[i] = heapBytes[i];
+	}
+
+#if defined(VK_VERSION_1_1) && defined(VK_EXT_memory_budget)
+	if (budgetExtension)
+	{
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+		budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+		VkPhysicalDeviceMemoryProperties2 memoryProperties = {};
+		memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+		memoryProperties.pNext = &budget;
+		vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties);
+
+		for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+		{
+			budgets[i] = budget.heapBudget[i];
+			usages[i] = budget.heapUsage[i];
+		}
+	}
+#endif
+
+	for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+	{
+		if (deviceLocalCap != 0 && (properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+			budgets[i] = std::min(budgets[i], deviceLocalCap);
+
+		heapBudgets[i] = budgets[i];
+		heapUsages[i] = usages[i];
+	}
+}
+
+void MemoryTracker::writeJson (std::ostream& out, double time) const
+{
+	out << "{\"time\":" << time << ",\"budgetExtension\":" << (budgetExtension ? "true" : "false") << ",\"heaps\":[";
+
+	for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+		out << (i > 0 ? "," : "") << "{\"index\":" << i
+			<< ",\"deviceLocal\":" << ((properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false")
+			<< ",\"size\":" << properties.memoryHeaps[i].size << ",\"budget\":" << heapBudget(i)
+			<< ",\"usage\":" << heapUsage(i) << ",\"tracked\":" << heapBytes[i] << "}";
+
+	out << "],\"types\":[";
+	for (uint32_t i = 0; i < properties.memoryTypeCount; i++)
+		out << (i > 0 ? "," : "") << "{\"index\":" << i << ",\"heap\":" << properties.memoryTypes[i].heapIndex
+			<< ",\"flags\":" << properties.memoryTypes[i].propertyFlags << ",\"bytes\":" << typeBytes[i]
+			<< ",\"allocations\":" << typeAllocations[i] << "}";
+
+	out << "],\"categories\":{";
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+		out << (i > 0 ? "," : "") << "\"" << memoryCategoryName(static_cast<MemoryCategory>(i)) << "\":{\"bytes\":"
+			<< categoryBytes[i] << ",\"peak\":" << categoryPeaks[i] << "}";
+
+	out << "},\"allocations\":" << allocationCount << ",\"frees\":" << freeCount << ",\"failures\":" << failureCount << "}\n";
+}
+
+void MemoryTracker::print (std::ostream& out) const
+{
+	double megabytes = 1.0 / (1024.0 * 1024.0);
+
+	out << "memory: " << allocationCount << " allocations, " << freeCount << " frees, " << failureCount << " failed, budgets from "
+		<< (budgetExtension ? "VK_EXT_memory_budget" : "heap sizes") << std::endl;
+
+	for (uint32_t i = 0; i < properties.memoryHeapCount; i++)
+		out << "  heap " << i << ((properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "")
+			<< ": " << heapBytes[i] * megabytes << " MB tracked, " << heapUsage(i) * megabytes << " / "
+			<< heapBudget(i) * megabytes << " MB used / budget" << std::endl;
+
+	out << " ";
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+		out << " " << memoryCategoryName(static_cast<MemoryCategory>(i)) << " " << categoryBytes[i] * megabytes
+			<< " MB (peak " << categoryPeaks[i] * megabytes << ")";
+	out << std::endl;
+}
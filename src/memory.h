@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/* what an allocation is for, counted separately */
+enum MemoryCategory
+{
+	MEMORY_CATEGORY_OTHER,
+	MEMORY_CATEGORY_TEXTURE,
+	MEMORY_CATEGORY_GEOMETRY,
+	MEMORY_CATEGORY_RENDER_TARGET,
+	MEMORY_CATEGORY_BUFFER,
+	MEMORY_CATEGORY_STAGING,
+	MEMORY_CATEGORY_COUNT
+};
+
+const char *memoryCategoryName (MemoryCategory category);
+
+/*
+ * Device memory telemetry : every vkAllocateMemory / vkFreeMemory of the
+ * DeviceContext goes through add() and remove(), which keep bytes per heap,
+ * per memory type and per category. refresh() reads the budget and usage of
+ * every heap from VK_EXT_memory_budget when the device has it, or takes the
+ * heap size and the bytes counted here otherwise : the budget includes what
+ * other processes use, the fallback does not.
+ *
+ * add() and remove() may come from any thread, the startup steps allocate
+ * concurrently. They do not allocate (a fixed open addressing table of the
+ * live allocations, under a mutex). The counters and the budgets are atomics :
+ * another thread may refresh, read and report them.
+ */
+
+class MemoryTracker
+{
+private:
+	struct Allocation
+	{
+		VkDeviceMemory memory;
+		VkDeviceSize size;
+		uint32_t type;
+		MemoryCategory category;
+	};
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties properties;
+	bool budgetExtension = false;
+	VkDeviceSize deviceLocalCap = 0;
+
+	std::vector<Allocation> table;
+	size_t liveCount = 0;
+	std::mutex tableMutex;
+
+	std::atomic<uint64_t> heapBytes[VK_MAX_MEMORY_HEAPS];
+	std::atomic<uint64_t> heapBudgets[VK_MAX_MEMORY_HEAPS];
+	std::atomic<uint64_t> heapUsages[VK_MAX_MEMORY_HEAPS];
+	std::atomic<uint64_t> typeBytes[VK_MAX_MEMORY_TYPES];
+	std::atomic<uint32_t> typeAllocations[VK_MAX_MEMORY_TYPES];
+	std::atomic<uint64_t> categoryBytes[MEMORY_CATEGORY_COUNT];
+	std::atomic<uint64_t> categoryPeaks[MEMORY_CATEGORY_COUNT];
+	std::atomic<uint64_t> allocationCount;
+	std::atomic<uint64_t> freeCount;
+	std::atomic<uint64_t> failureCount;
+
+	size_t slot (VkDeviceMemory memory) const;
+
+public:
+	/* cap : a budget for every device local heap, below what the driver allows, 0 for none */
+	void init (VkPhysicalDevice physicalDevice, const VkPhysicalDeviceMemoryProperties& properties, bool budgetExtension,
+			VkDeviceSize cap, size_t capacity);
+
+	/* the first type that fits the heap budget, the first type that matches if none does */
+	uint32_t chooseType (uint32_t typeFilter, VkMemoryPropertyFlags required, VkDeviceSize size) const;
+
+	void add (VkDeviceMemory memory, VkDeviceSize size, uint32_t type, MemoryCategory category);
+	void remove (VkDeviceMemory memory);
+	void failed () { failureCount++; }
+
+	void refresh ();
+
+	bool hasBudgetExtension () const { return budgetExtension; }
+	uint32_t heapCount () const { return properties.memoryHeapCount; }
+	uint32_t heapOf (uint32_t type) const { return properties.memoryTypes[type].heapIndex; }
+	VkDeviceSize heapBudget (uint32_t heap) const { return heapBudgets[heap]; }
+	VkDeviceSize heapUsage (uint32_t heap) const { return budgetExtension ? heapUsages[heap].load() : heapBytes[heap].load(); }
+	VkDeviceSize bytes (MemoryCategory category) const { return categoryBytes[category]; }
+	VkDeviceSize peak (MemoryCategory category) const { return categoryPeaks[category]; }
+	uint64_t failures () const { return failureCount; }
+
+	/* one JSON object on one line : a report file is a sequence of them */
+	void writeJson (std::ostream& out, double time) const;
+	void print (std::ostream& out) const;
+};
@@ -0,0 +1,2033 @@
+#include "mesh.h"
+#include "json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MESH_CACHE_MAGIC[4] = { 'V', 'K', 'M', 'C' };
+static const uint32_t VERTEX_CACHE_SIZE = 16;
+static const size_t OBJ_CHUNKS_PER_THREAD = 4;
+
+
+/* Static functions */
+
+static double millisecondsSince (std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool endsWith (const std::string& value, const char *suffix)
+{
+	size_t length = strlen(suffix);
+	return value.size() >= length && value.compare(value.size() - length, length, suffix) == 0;
+}
+
+static std::string directoryOf (const std::string& path)
+{
+	size_t slash = path.find_last_of('/');
+	return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+static uint16_t floatToHalf (float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t) ((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+			return (uint16_t) sign;
+
+		/* denormal, round to nearest */
+		mantissa |= 0x800000;
+		uint32_t shift = (uint32_t) (14 - exponent);
+		return (uint16_t) (sign | ((mantissa + (1u << (shift - 1))) >> shift));
+	}
+
+	if (exponent >= 31)
+		return (uint16_t) (sign | 0x7C00);
+
+	/* the rounding carry may bump the exponent, which is still the right answer */
+	return (uint16_t) (sign | (((uint32_t) exponent << 10) + ((mantissa + 0x1000) >> 13)));
+}
+
+static int16_t toSnorm16 (float value)
+{
+	value = std::max(-1.0f, std::min(1.0f, value));
+	return (int16_t) std::lround(value * 32767.0f);
+}
+
+static void encodeOctahedral (const float *normal, int16_t *out)
+{
+	float x = normal[0], y = normal[1], z = normal[2];
+	float length = std::fabs(x) + std::fabs(y) + std::fabs(z);
+	if (length == 0.0f)
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+
+	x /= length;
+	y /= length;
+
+	if (z < 0.0f)
+	{
+		float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	out[0] = toSnorm16(x);
+	out[1] = toSnorm16(y);
+}
+
+static bool statFile (const std::string& path, uint64_t& size, int64_t& time)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return false;
+
+	size = (uint64_t) info.st_size;
+	time = (int64_t) info.st_mtime;
+	return true;
+}
+
+/* OBJ parsing */
+
+static bool isSpace (char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skipSpaces (const char *cursor, const char *end)
+{
+	while (cursor < end && isSpace(*cursor))
+		cursor++;
+	return cursor;
+}
+
+/* strtof is locale dependent and slow, OBJ only needs plain decimal numbers */
+static const char *parseFloat (const char *cursor, const char *end, float& out)
+{
+	cursor = skipSpaces(cursor, end);
+
+	bool negative = false;
+	if (cursor < end && (*cursor == '-' || *cursor == '+'))
+		negative = *cursor++ == '-';
+
+	double value = 0.0;
+	while (cursor < end && *cursor >= '0' && *cursor <= '9')
+		value = value * 10.0 + (*cursor++ - '0');
+
+	if (cursor < end && *cursor == '.')
+	{
+		cursor++;
+		double scale = 0.1;
+		while (cursor < end && *cursor >= '0' && *cursor <= '9')
+		{
+			value += (*cursor++ - '0') * scale;
+			scale *= 0.1;
+		}
+	}
+
+	if (cursor < end && (*cursor == 'e' || *cursor == 'E'))
+	{
+		cursor++;
+		bool negativeExponent = false;
+		if (cursor < end && (*cursor == '-' || *cursor == '+'))
+			negativeExponent = *cursor++ == '-';
+
+		int exponent = 0;
+		while (cursor < end && *cursor >= '0' && *cursor <= '9')
+			exponent = exponent * 10 + (*cursor++ - '0');
+
+		value *= std::pow(10.0, negativeExponent ? -exponent : exponent);
+	}
+
+	out = (float) (negative ? -value : value);
+	return cursor;
+}
+
+static const char *parseInt (const char *cursor, const char *end, int64_t& out)
+{
+	bool negative = false;
+	if (cursor < end && (*cursor == '-' || *cursor == '+'))
+		negative = *cursor++ == '-';
+
+	int64_t value = 0;
+	while (cursor < end && *cursor >= '0' && *cursor <= '9')
+		value = value * 10 + (*cursor++ - '0');
+
+	out = negative ? -value : value;
+	return cursor;
+}
+
+/*
+ * Face corner while parsing a chunk : positive OBJ indices are global already,
+ * negative ones are relative to the element count seen so far, which is only
+ * known once the chunks before this one were counted.
+ */
+struct ObjCorner
+{
+	int64_t index[3];
+	uint8_t relative;
+};
+
+struct ObjChunk
+{
+	const char *begin;
+	const char *end;
+
+	std::vector<float> positions;
+	std::vector<float> uvs;
+	std::vector<float> normals;
+	std::vector<ObjCorner> corners;
+
+	size_t positionBase;
+	size_t uvBase;
+	size_t normalBase;
+	size_t cornerBase;
+};
+
+static const int64_t OBJ_MISSING = -1;
+
+static const char *parseCorner (const char *cursor, const char *end, const ObjChunk& chunk, ObjCorner& corner)
+{
+	size_t counts[3] = { chunk.positions.size() / 3, chunk.uvs.size() / 2, chunk.normals.size() / 3 };
+
+	corner.relative = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		corner.index[i] = OBJ_MISSING;
+
+		if (i > 0)
+		{
+			if (cursor >= end || *cursor != '/')
+				continue;
+			cursor++;
+		}
+
+		if (cursor >= end || *cursor == '/' || isSpace(*cursor) || *cursor == '\n')
+			continue;
+
+		int64_t value;
+		cursor = parseInt(cursor, end, value);
+
+		if (value > 0)
+			corner.index[i] = value - 1;
+		else if (value < 0)
+		{
+			corner.index[i] = (int64_t) counts[i] + value;
+			corner.relative |= 1 << i;
+		}
+	}
+
+	return cursor;
+}
+
+static void parseObjChunk (ObjChunk& chunk)
+{
+	const char *cursor = chunk.begin;
+	const char *end = chunk.end;
+	ObjCorner polygon[64];
+
+	while (cursor < end)
+	{
+		const char *lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+		if (lineEnd == nullptr)
+			lineEnd = end;
+
+		cursor = skipSpaces(cursor, lineEnd);
+
+		if (lineEnd - cursor > 2 && cursor[0] == 'v' && isSpace(cursor[1]))
+		{
+			float value[3];
+			const char *field = cursor + 2;
+			for (int i = 0; i < 3; i++)
+				field = parseFloat(field, lineEnd, value[i]);
+			chunk.positions.insert(chunk.positions.end(), value, value + 3);
+		}
+		else if (lineEnd - cursor > 3 && cursor[0] == 'v' && cursor[1] == 't' && isSpace(cursor[2]))
+		{
+			float value[2];
+			const char *field = cursor + 3;
+			for (int i = 0; i < 2; i++)
+				field = parseFloat(field, lineEnd, value[i]);
+			chunk.uvs.insert(chunk.uvs.end(), value, value + 2);
+		}
+		else if (lineEnd - cursor > 3 && cursor[0] == 'v' && cursor[1] == 'n' && isSpace(cursor[2]))
+		{
+			float value[3];
+			const char *field = cursor + 3;
+			for (int i = 0; i < 3; i++)
+				field = parseFloat(field, lineEnd, value[i]);
+			chunk.normals.insert(chunk.normals.end(), value, value + 3);
+		}
+		else if (lineEnd - cursor > 2 && cursor[0] == 'f' && isSpace(cursor[1]))
+		{
+			size_t cornerCount = 0;
+			const char *field = skipSpaces(cursor + 2, lineEnd);
+			while (field < lineEnd && cornerCount < 64)
+			{
+				field = parseCorner(field, lineEnd, chunk, polygon[cornerCount++]);
+				field = skipSpaces(field, lineEnd);
+			}
+
+			/* polygons become triangle fans */
+			for (size_t i = 2; i < cornerCount; i++)
+			{
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i - 1]);
+				chunk.corners.push_back(polygon[i]);
+			}
+		}
+
+		cursor = lineEnd + 1;
+	}
+}
+
+struct CornerKey
+{
+	uint32_t index[3];
+
+	bool operator== (const CornerKey& other) const
+	{
+		return index[0] == other.index[0] && index[1] == other.index[1] && index[2] == other.index[2];
+	}
+};
+
+struct CornerKeyHash
+{
+	size_t operator() (const CornerKey& key) const
+	{
+		uint64_t hash = key.index[0] * 0x9E3779B97F4A7C15ull;
+		hash ^= (key.index[1] + 0x632BE59BD9B4E019ull + (hash << 6) + (hash >> 2));
+		hash ^= (key.index[2] + 0x85EBCA77C2B2AE63ull + (hash << 6) + (hash >> 2));
+		return (size_t) hash;
+	}
+};
+
+/* glTF parsing */
+
+static const int GLTF_BYTE = 5120;
+static const int GLTF_UNSIGNED_BYTE = 5121;
+static const int GLTF_SHORT = 5122;
+static const int GLTF_UNSIGNED_SHORT = 5123;
+static const int GLTF_UNSIGNED_INT = 5125;
+static const int GLTF_FLOAT = 5126;
+static const int GLTF_TRIANGLES = 4;
+
+static std::vector<char> decodeBase64 (const char *data, size_t size)
+{
+	std::vector<char> out;
+	out.reserve(size / 4 * 3);
+
+	uint32_t accumulator = 0;
+	int bits = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		char c = data[i];
+		int value;
+		if (c >= 'A' && c <= 'Z') value = c - 'A';
+		else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') value = c - '0' + 52;
+		else if (c == '+') value = 62;
+		else if (c == '/') value = 63;
+		else break;
+
+		accumulator = (accumulator << 6) | (uint32_t) value;
+		bits += 6;
+		if (bits >= 8)
+		{
+			bits -= 8;
+			out.push_back((char) ((accumulator >> bits) & 0xFF));
+		}
+	}
+
+	return out;
+}
+
+static std::vector<char> readFile (const std::string& path)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+		throw std::runtime_error("failed to open " + path + "!");
+
+	size_t size = (size_t) file.tellg();
+	std::vector<char> buffer(size);
+	file.seekg(0);
+	file.read(buffer.data(), size);
+
+	return buffer;
+}
+
+struct GltfAccessor
+{
+	const char *data = nullptr;
+	size_t count = 0;
+	size_t stride = 0;
+	int componentType = GLTF_FLOAT;
+	int components = 1;
+	bool normalized = false;
+
+	float read (size_t element, int component) const
+	{
+		const char *source = data + element * stride;
+		switch (componentType)
+		{
+			case GLTF_FLOAT:
+			{
+				float value;
+				memcpy(&value, source + component * 4, 4);
+				return value;
+			}
+			case GLTF_UNSIGNED_SHORT:
+			{
+				uint16_t value;
+				memcpy(&value, source + component * 2, 2);
+				return normalized ? value / 65535.0f : value;
+			}
+			case GLTF_SHORT:
+			{
+				int16_t value;
+				memcpy(&value, source + component * 2, 2);
+				return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+			}
+			case GLTF_UNSIGNED_BYTE:
+				return normalized ? (uint8_t) source[component] / 255.0f : (uint8_t) source[component];
+			case GLTF_BYTE:
+				return normalized ? std::max((int8_t) source[component] / 127.0f, -1.0f) : (int8_t) source[component];
+		}
+		return 0.0f;
+	}
+
+	uint32_t readIndex (size_t element) const
+	{
+		const char *source = data + element * stride;
+		switch (componentType)
+		{
+			case GLTF_UNSIGNED_INT:
+			{
+				uint32_t value;
+				memcpy(&value, source, 4);
+				return value;
+			}
+			case GLTF_UNSIGNED_SHORT:
+			{
+				uint16_t value;
+				memcpy(&value, source, 2);
+				return value;
+			}
+			case GLTF_UNSIGNED_BYTE:
+				return (uint8_t) *source;
+		}
+		return 0;
+	}
+};
+
+static int componentSize (int componentType)
+{
+	switch (componentType)
+	{
+		case GLTF_BYTE:
+		case GLTF_UNSIGNED_BYTE: return 1;
+		case GLTF_SHORT:
+		case GLTF_UNSIGNED_SHORT: return 2;
+		case GLTF_UNSIGNED_INT:
+		case GLTF_FLOAT: return 4;
+	}
+	throw std::runtime_error("unsupported glTF component type!");
+}
+
+static int componentCount (const std::string& type)
+{
+	if (type == "SCALAR") return 1;
+	if (type == "VEC2") return 2;
+	if (type == "VEC3") return 3;
+	if (type == "VEC4") return 4;
+	throw std::runtime_error("unsupported glTF accessor type!");
+}
+
+struct GltfDocument
+{
+	JsonValue json;
+	std::vector<std::vector<char>> buffers;
+
+	GltfAccessor accessor (int index) const
+	{
+		const JsonValue& source = json["accessors"][(size_t) index];
+		const JsonValue& view = json["bufferViews"][(size_t) source["bufferView"].asInt()];
+		const std::vector<char>& buffer = buffers.at((size_t) view["buffer"].asInt());
+
+		GltfAccessor result;
+		result.componentType = source["componentType"].asInt();
+		result.components = componentCount(source["type"].asString());
+		result.normalized = source["normalized"].boolean;
+		result.count = (size_t) source["count"].asNumber();
+		result.stride = (size_t) view["byteStride"].asNumber(componentSize(result.componentType) * result.components);
+
+		size_t offset = (size_t) view["byteOffset"].asNumber() + (size_t) source["byteOffset"].asNumber();
+		size_t length = result.count == 0 ? 0 : (result.count - 1) * result.stride + componentSize(result.componentType) * result.components;
+		if (offset + length > buffer.size())
+			throw std::runtime_error("glTF accessor out of bounds!");
+
+		result.data = buffer.data() + offset;
+		return result;
+	}
+};
+
+/* column major 4x4 */
+static void multiply (const float *a, const float *b, float *out)
+{
+	float result[16];
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 4; row++)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < 4; k++)
+				sum += a[k * 4 + row] * b[column * 4 + k];
+			result[column * 4 + row] = sum;
+		}
+
+	memcpy(out, result, sizeof(result));
+}
+
+static void nodeTransform (const JsonValue& node, float *out)
+{
+	static const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	memcpy(out, identity, sizeof(identity));
+
+	if (node.has("matrix"))
+	{
+		for (size_t i = 0; i < 16; i++)
+			out[i] = (float) node["matrix"][i].asNumber();
+		return;
+	}
+
+	float t[3] = { 0.0f, 0.0f, 0.0f };
+	float r[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	float s[3] = { 1.0f, 1.0f, 1.0f };
+	for (size_t i = 0; i < 3; i++)
+	{
+		t[i] = (float) node["translation"][i].asNumber(t[i]);
+		s[i] = (float) node["scale"][i].asNumber(s[i]);
+	}
+	for (size_t i = 0; i < 4; i++)
+		r[i] = (float) node["rotation"][i].asNumber(r[i]);
+
+	float x = r[0], y = r[1], z = r[2], w = r[3];
+	out[0] = (1 - 2 * (y * y + z * z)) * s[0];
+	out[1] = (2 * (x * y + z * w)) * s[0];
+	out[2] = (2 * (x * z - y * w)) * s[0];
+	out[4] = (2 * (x * y - z * w)) * s[1];
+	out[5] = (1 - 2 * (x * x + z * z)) * s[1];
+	out[6] = (2 * (y * z + x * w)) * s[1];
+	out[8] = (2 * (x * z + y * w)) * s[2];
+	out[9] = (2 * (y * z - x * w)) * s[2];
+	out[10] = (1 - 2 * (x * x + y * y)) * s[2];
+	out[12] = t[0];
+	out[13] = t[1];
+	out[14] = t[2];
+}
+
+/* one mesh primitive placed by one node, decoded into its own slice of the output */
+struct GltfDraw
+{
+	const JsonValue *primitive;
+	float transform[16];
+	size_t vertexOffset;
+	size_t vertexCount;
+	size_t indexOffset;
+	size_t indexCount;
+};
+
+static void collectDraws (const GltfDocument& document, size_t nodeIndex, const float *parent, std::vector<GltfDraw>& draws, int depth)
+{
+	if (depth > 64)
+		throw std::runtime_error("glTF node hierarchy too deep!");
+
+	const JsonValue& node = document.json["nodes"][nodeIndex];
+
+	float local[16];
+	float world[16];
+	nodeTransform(node, local);
+	multiply(parent, local, world);
+
+	if (node.has("mesh"))
+	{
+		const JsonValue& primitives = document.json["meshes"][(size_t) node["mesh"].asInt()]["primitives"];
+		for (size_t i = 0; i < primitives.size(); i++)
+		{
+			if (primitives[i]["mode"].asInt(GLTF_TRIANGLES) != GLTF_TRIANGLES || !primitives[i]["attributes"].has("POSITION"))
+				continue;
+
+			GltfDraw draw = {};
+			draw.primitive = &primitives[i];
+			memcpy(draw.transform, world, sizeof(world));
+			draws.push_back(draw);
+		}
+	}
+
+	const JsonValue& children = node["children"];
+	for (size_t i = 0; i < children.size(); i++)
+		collectDraws(document, (size_t) children[i].asInt(), world, draws, depth + 1);
+}
+
+static void decodeDraw (const GltfDocument& document, const GltfDraw& draw, ImportedMesh& mesh)
+{
+	const JsonValue& attributes = (*draw.primitive)["attributes"];
+	const float *m = draw.transform;
+
+	/* cofactors of the upper 3x3 : the inverse transpose up to scale, normalized below */
+	float normalMatrix[9] = {
+		m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+		m[9] * m[2] - m[10] * m[1], m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+		m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4]
+	};
+
+	GltfAccessor positions = document.accessor(attributes["POSITION"].asInt());
+	for (size_t i = 0; i < draw.vertexCount; i++)
+	{
+		float p[3] = { positions.read(i, 0), positions.read(i, 1), positions.read(i, 2) };
+		float *out = &mesh.positions[(draw.vertexOffset + i) * 3];
+		for (int row = 0; row < 3; row++)
+			out[row] = m[row] * p[0] + m[4 + row] * p[1] + m[8 + row] * p[2] + m[12 + row];
+	}
+
+	if (attributes.has("NORMAL"))
+	{
+		GltfAccessor normals = document.accessor(attributes["NORMAL"].asInt());
+		for (size_t i = 0; i < draw.vertexCount; i++)
+		{
+			float n[3] = { normals.read(i, 0), normals.read(i, 1), normals.read(i, 2) };
+			float *out = &mesh.normals[(draw.vertexOffset + i) * 3];
+			for (int row = 0; row < 3; row++)
+				out[row] = normalMatrix[row * 3] * n[0] + normalMatrix[row * 3 + 1] * n[1] + normalMatrix[row * 3 + 2] * n[2];
+
+			float length = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+			if (length > 0.0f)
+				for (int row = 0; row < 3; row++)
+					out[row] /= length;
+		}
+	}
+
+	if (attributes.has("TEXCOORD_0"))
+	{
+		GltfAccessor uvs = document.accessor(attributes["TEXCOORD_0"].asInt());
+		for (size_t i = 0; i < draw.vertexCount; i++)
+		{
+			mesh.uvs[(draw.vertexOffset + i) * 2] = uvs.read(i, 0);
+			mesh.uvs[(draw.vertexOffset + i) * 2 + 1] = uvs.read(i, 1);
+		}
+	}
+
+	uint32_t base = (uint32_t) draw.vertexOffset;
+	if ((*draw.primitive).has("indices"))
+	{
+		GltfAccessor indices = document.accessor((*draw.primitive)["indices"].asInt());
+		for (size_t i = 0; i < draw.indexCount; i++)
+		{
+			uint32_t index = indices.readIndex(i);
+			if (index >= draw.vertexCount)
+				index = 0;
+			mesh.indices[draw.indexOffset + i] = base + index;
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < draw.indexCount; i++)
+			mesh.indices[draw.indexOffset + i] = base + (uint32_t) i;
+	}
+}
+
+/* Mesh optimization */
+
+static void computeMissingNormals (ImportedMesh& mesh)
+{
+	size_t vertexCount = mesh.positions.size() / 3;
+	std::vector<uint8_t> missing(vertexCount, 0);
+	bool anyMissing = false;
+
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		const float *n = &mesh.normals[i * 3];
+		if (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f)
+		{
+			missing[i] = 1;
+			anyMissing = true;
+		}
+	}
+
+	if (!anyMissing)
+		return;
+
+	/* area weighted face normals, the cross product length is twice the area */
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		const float *a = &mesh.positions[mesh.indices[i] * 3];
+		const float *b = &mesh.positions[mesh.indices[i + 1] * 3];
+		const float *c = &mesh.positions[mesh.indices[i + 2] * 3];
+
+		float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float face[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t vertex = mesh.indices[i + k];
+			if (!missing[vertex])
+				continue;
+			for (int j = 0; j < 3; j++)
+				mesh.normals[vertex * 3 + j] += face[j];
+		}
+	}
+
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		float *n = &mesh.normals[i * 3];
+		float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (missing[i] && length > 0.0f)
+			for (int j = 0; j < 3; j++)
+				n[j] /= length;
+	}
+}
+
+/*
+ * Tipsify (Sander, Nehab, Barczak 2007) : fan around a vertex, then continue
+ * with the adjacent vertex that will still be in a cache of VERTEX_CACHE_SIZE
+ * entries, linear time and close to the quality of the slower greedy methods.
+ */
+static std::vector<uint32_t> optimizeVertexCache (const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (uint32_t index : indices)
+		liveTriangles[index]++;
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < vertexCount; i++)
+		adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		adjacency[cursor[indices[i]]++] = (uint32_t) (i / 3);
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	deadEnd.reserve(indices.size());
+
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	size_t scan = 0;
+	int64_t fanning = vertexCount > 0 ? 0 : -1;
+
+	while (fanning >= 0)
+	{
+		candidates.clear();
+
+		for (uint32_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++)
+		{
+			uint32_t triangle = adjacency[a];
+			if (emitted[triangle])
+				continue;
+			emitted[triangle] = 1;
+
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t vertex = indices[triangle * 3 + k];
+				output.push_back(vertex);
+				deadEnd.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+
+				if (time - cacheTime[vertex] > VERTEX_CACHE_SIZE)
+					cacheTime[vertex] = time++;
+			}
+		}
+
+		/* next fanning vertex : the candidate that stays cached the longest */
+		fanning = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+				continue;
+
+			int64_t priority = 0;
+			if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= VERTEX_CACHE_SIZE)
+				priority = time - cacheTime[vertex];
+
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanning = vertex;
+			}
+		}
+
+		while (fanning < 0 && !deadEnd.empty())
+		{
+			uint32_t vertex = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[vertex] > 0)
+				fanning = vertex;
+		}
+
+		while (fanning < 0 && scan < vertexCount)
+		{
+			if (liveTriangles[scan] > 0)
+				fanning = (int64_t) scan;
+			scan++;
+		}
+	}
+
+	return output;
+}
+
+/* Simplification */
+
+struct Quadric
+{
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double planes;
+
+	void addPlane (double a, double b, double c, double d)
+	{
+		planes += 1.0;
+		a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+		b2 += b * b; bc += b * c; bd += b * d;
+		c2 += c * c; cd += c * d;
+		d2 += d * d;
+	}
+
+	void add (const Quadric& other)
+	{
+		a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+		b2 += other.b2; bc += other.bc; bd += other.bd;
+		c2 += other.c2; cd += other.cd;
+		d2 += other.d2;
+		planes += other.planes;
+	}
+
+	/*
+	 * Mean squared distance from p to the accumulated planes : the plain sum grows
+	 * with the number of planes merged in and would not read as a distance.
+	 */
+	double evaluate (const float *p) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double result = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z
+			+ d2;
+		return planes > 0.0 ? std::max(result, 0.0) / planes : 0.0;
+	}
+};
+
+struct Collapse
+{
+	uint32_t from;
+	uint32_t to;
+	double cost;
+
+	bool operator< (const Collapse& other) const { return cost < other.cost; }
+};
+
+static void triangleNormal (const float *a, const float *b, const float *c, double *normal)
+{
+	double e1[3] = { (double) b[0] - a[0], (double) b[1] - a[1], (double) b[2] - a[2] };
+	double e2[3] = { (double) c[0] - a[0], (double) c[1] - a[1], (double) c[2] - a[2] };
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/* collapsing from onto to must not turn any remaining triangle around from upside down */
+static bool collapseFlips (const float *positions, const std::vector<uint32_t>& indices,
+		const std::vector<uint32_t>& adjacencyOffsets, const std::vector<uint32_t>& adjacency, uint32_t from, uint32_t to)
+{
+	for (uint32_t a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++)
+	{
+		const uint32_t *triangle = &indices[adjacency[a] * 3];
+		if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			continue;
+
+		const float *corners[3];
+		const float *moved[3];
+		for (int k = 0; k < 3; k++)
+		{
+			corners[k] = &positions[triangle[k] * 3];
+			moved[k] = triangle[k] == from ? &positions[to * 3] : corners[k];
+		}
+
+		double before[3], after[3];
+		triangleNormal(corners[0], corners[1], corners[2], before);
+		triangleNormal(moved[0], moved[1], moved[2], after);
+
+		if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0)
+			return true;
+	}
+
+	return false;
+}
+
+std::vector<uint32_t> simplifyMesh (const float *positions, size_t vertexCount, const std::vector<uint32_t>& indices,
+		size_t targetIndexCount, float& error)
+{
+	std::vector<uint32_t> result(indices);
+	error = 0.0f;
+
+	/* vertices sharing a position (attribute seams) are one corner of the surface */
+	std::vector<uint32_t> canonical(vertexCount);
+	std::vector<uint32_t> wedgeCount(vertexCount, 0);
+	{
+		std::unordered_map<CornerKey, uint32_t, CornerKeyHash> unique;
+		unique.reserve(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			CornerKey key;
+			memcpy(key.index, &positions[i * 3], sizeof(key.index));
+			canonical[i] = unique.insert(std::make_pair(key, (uint32_t) i)).first->second;
+			wedgeCount[canonical[i]]++;
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount, Quadric());
+	for (size_t i = 0; i + 2 < result.size(); i += 3)
+	{
+		const float *a = &positions[result[i] * 3];
+		double normal[3];
+		triangleNormal(a, &positions[result[i + 1] * 3], &positions[result[i + 2] * 3], normal);
+
+		double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length == 0.0)
+			continue;
+
+		for (int k = 0; k < 3; k++)
+			normal[k] /= length;
+		double d = -(normal[0] * a[0] + normal[1] * a[1] + normal[2] * a[2]);
+
+		for (int k = 0; k < 3; k++)
+			quadrics[canonical[result[i + k]]].addPlane(normal[0], normal[1], normal[2], d);
+	}
+
+	/* open borders, counted on positions so seams do not look like borders */
+	std::vector<uint8_t> locked(vertexCount, 0);
+	{
+		std::unordered_map<uint64_t, int> edges;
+		edges.reserve(result.size());
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			uint32_t a = canonical[result[i]];
+			uint32_t b = canonical[result[i - i % 3 + (i + 1) % 3]];
+			uint64_t key = a < b ? ((uint64_t) a << 32) | b : ((uint64_t) b << 32) | a;
+			edges[key]++;
+		}
+
+		for (const auto& edge : edges)
+			if (edge.second == 1)
+			{
+				locked[edge.first >> 32] = 1;
+				locked[edge.first & 0xFFFFFFFF] = 1;
+			}
+	}
+
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint8_t> touched(vertexCount);
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+
+	/* passes of independent collapses, cheapest first, until the target or nothing is left to collapse */
+	while (result.size() > targetIndexCount)
+	{
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (uint32_t index : result)
+			adjacencyOffsets[index + 1]++;
+		for (size_t i = 0; i < vertexCount; i++)
+			adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+
+		adjacency.resize(result.size());
+		std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+			adjacency[cursor[result[i]]++] = (uint32_t) (i / 3);
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			uint32_t from = result[i];
+			uint32_t to = result[i - i % 3 + (i + 1) % 3];
+			uint32_t canonicalFrom = canonical[from];
+			uint32_t canonicalTo = canonical[to];
+
+			if (canonicalFrom == canonicalTo || locked[canonicalFrom] || wedgeCount[canonicalFrom] > 1)
+				continue;
+
+			Quadric quadric = quadrics[canonicalFrom];
+			quadric.add(quadrics[canonicalTo]);
+
+			Collapse collapse;
+			collapse.from = from;
+			collapse.to = to;
+			collapse.cost = quadric.evaluate(&positions[to * 3]);
+			collapses.push_back(collapse);
+		}
+
+		if (collapses.empty())
+			break;
+
+		std::sort(collapses.begin(), collapses.end());
+
+		/* each collapse removes about two triangles */
+		size_t collapseBudget = (result.size() - targetIndexCount) / 6 + 1;
+		size_t collapsed = 0;
+
+		for (size_t i = 0; i < vertexCount; i++)
+			remap[i] = (uint32_t) i;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapsed >= collapseBudget)
+				break;
+
+			uint32_t canonicalFrom = canonical[collapse.from];
+			uint32_t canonicalTo = canonical[collapse.to];
+			if (touched[canonicalFrom] || touched[canonicalTo])
+				continue;
+
+			if (collapseFlips(positions, result, adjacencyOffsets, adjacency, collapse.from, collapse.to))
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[canonicalTo].add(quadrics[canonicalFrom]);
+			error = std::max(error, (float) std::sqrt(collapse.cost));
+			collapsed++;
+
+			/* the neighbourhood changed, its other collapses wait for the next pass */
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++)
+				for (int k = 0; k < 3; k++)
+					touched[canonical[result[adjacency[a] * 3 + k]]] = 1;
+		}
+
+		if (collapsed == 0)
+			break;
+
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	return result;
+}
+
+/* Meshlets */
+
+static void finishMeshlet (Meshlet& meshlet, const float *positions, const std::vector<uint32_t>& meshletVertices,
+		const std::vector<uint8_t>& meshletTriangles, uint32_t triangleCount)
+{
+	uint32_t vertexCount = meshlet.counts;
+	const uint32_t *vertices = &meshletVertices[meshlet.vertexOffset];
+	const uint8_t *triangles = &meshletTriangles[meshlet.triangleOffset];
+
+	/* bounding sphere around the box center, cheap and tight enough for culling */
+	float minimum[3], maximum[3];
+	for (int k = 0; k < 3; k++)
+		minimum[k] = maximum[k] = positions[vertices[0] * 3 + k];
+	for (uint32_t i = 1; i < vertexCount; i++)
+		for (int k = 0; k < 3; k++)
+		{
+			minimum[k] = std::min(minimum[k], positions[vertices[i] * 3 + k]);
+			maximum[k] = std::max(maximum[k], positions[vertices[i] * 3 + k]);
+		}
+
+	float radius = 0.0f;
+	for (int k = 0; k < 3; k++)
+		meshlet.center[k] = (minimum[k] + maximum[k]) * 0.5f;
+	for (uint32_t i = 0; i < vertexCount; i++)
+	{
+		const float *p = &positions[vertices[i] * 3];
+		float dx = p[0] - meshlet.center[0], dy = p[1] - meshlet.center[1], dz = p[2] - meshlet.center[2];
+		radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+	}
+	meshlet.radius = std::sqrt(radius);
+
+	/* normal cone : average of the unit face normals, opened to the widest one */
+	double axis[3] = { 0.0, 0.0, 0.0 };
+	std::vector<double> normals(triangleCount * 3, 0.0);
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		double *normal = &normals[t * 3];
+		triangleNormal(&positions[vertices[triangles[t * 3]] * 3], &positions[vertices[triangles[t * 3 + 1]] * 3],
+				&positions[vertices[triangles[t * 3 + 2]] * 3], normal);
+
+		double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length == 0.0)
+			continue;
+
+		for (int k = 0; k < 3; k++)
+		{
+			normal[k] /= length;
+			axis[k] += normal[k];
+		}
+	}
+
+	double axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	double minimumDot = 1.0;
+	if (axisLength > 0.0)
+	{
+		for (int k = 0; k < 3; k++)
+			axis[k] /= axisLength;
+
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			const double *normal = &normals[t * 3];
+			if (normal[0] != 0.0 || normal[1] != 0.0 || normal[2] != 0.0)
+				minimumDot = std::min(minimumDot, normal[0] * axis[0] + normal[1] * axis[1] + normal[2] * axis[2]);
+		}
+	}
+
+	for (int k = 0; k < 3; k++)
+		meshlet.coneAxis[k] = (float) axis[k];
+
+	/* a cone wider than a half space can never be entirely back facing : a cutoff of 1 never culls */
+	meshlet.coneCutoff = axisLength > 0.0 && minimumDot > 0.0 ? (float) std::sqrt(1.0 - minimumDot * minimumDot) : 1.0f;
+	meshlet.counts = vertexCount | (triangleCount << 8);
+}
+
+/* greedy scan in index order : keeps each meshlet a contiguous index range */
+static void buildMeshlets (MeshData& data, MeshLod& lod, const float *positions, size_t vertexCount)
+{
+	std::vector<uint8_t> localIndex(vertexCount, 0xFF);
+
+	lod.meshletOffset = (uint32_t) data.meshlets.size();
+
+	Meshlet meshlet = {};
+	uint32_t triangleCount = 0;
+
+	auto flush = [&] () {
+		if (triangleCount == 0)
+			return;
+
+		finishMeshlet(meshlet, positions, data.meshletVertices, data.meshletTriangles, triangleCount);
+		data.meshlets.push_back(meshlet);
+
+		for (uint32_t i = 0; i < (meshlet.counts & 0xFF); i++)
+			localIndex[data.meshletVertices[meshlet.vertexOffset + i]] = 0xFF;
+
+		/* triangle lists start on 4 bytes, shaders read them as uints */
+		while (data.meshletTriangles.size() % 4 != 0)
+			data.meshletTriangles.push_back(0);
+
+		meshlet = {};
+		triangleCount = 0;
+	};
+
+	for (uint32_t i = lod.indexOffset; i < lod.indexOffset + lod.indexCount; i += 3)
+	{
+		uint32_t newVertices = 0;
+		for (int k = 0; k < 3; k++)
+			if (localIndex[data.indices[i + k]] == 0xFF)
+				newVertices++;
+
+		if (meshlet.counts + newVertices > MESHLET_MAX_VERTICES || triangleCount + 1 > MESHLET_MAX_TRIANGLES)
+			flush();
+
+		if (triangleCount == 0)
+		{
+			meshlet.vertexOffset = (uint32_t) data.meshletVertices.size();
+			meshlet.triangleOffset = (uint32_t) data.meshletTriangles.size();
+			meshlet.indexOffset = i;
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t vertex = data.indices[i + k];
+			if (localIndex[vertex] == 0xFF)
+			{
+				localIndex[vertex] = (uint8_t) meshlet.counts++;
+				data.meshletVertices.push_back(vertex);
+			}
+			data.meshletTriangles.push_back(localIndex[vertex]);
+		}
+		triangleCount++;
+	}
+
+	flush();
+
+	lod.meshletCount = (uint32_t) data.meshlets.size() - lod.meshletOffset;
+}
+
+uint32_t selectLod (const Mesh& mesh, float pixelsPerUnit, uint32_t current, float maxPixelError, float hysteresis)
+{
+	uint32_t lodCount = (uint32_t) mesh.lods.size();
+	if (lodCount == 0)
+		return 0;
+
+	current = std::min(current, lodCount - 1);
+
+	/* errors grow with the LOD index */
+	uint32_t coarser = current;
+	while (coarser + 1 < lodCount && mesh.lods[coarser + 1].error * pixelsPerUnit <= maxPixelError * (1.0f - hysteresis))
+		coarser++;
+
+	if (coarser != current)
+		return coarser;
+
+	uint32_t finer = current;
+	while (finer > 0 && mesh.lods[finer].error * pixelsPerUnit > maxPixelError * (1.0f + hysteresis))
+		finer--;
+
+	return finer;
+}
+
+/* Cache file */
+
+template <typename T>
+static void writeSection (std::ofstream& file, const std::vector<T>& values)
+{
+	file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+static uint64_t alignUp (uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static void padTo (std::ofstream& file, uint64_t offset)
+{
+	static const char zeros[MESH_CACHE_GPU_ALIGNMENT] = {};
+	file.write(zeros, offset - (uint64_t) file.tellp());
+}
+
+/* count elements of elementSize from offset on, inside a file of fileSize bytes : no overflow on hostile values */
+static bool sectionFits (uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize)
+{
+	return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+/*
+ * The upload copies the sections as they are and the GPU indexes them : a
+ * stale or corrupt cache has to fail here, to be rebuilt, not read out of
+ * the mapping or the buffer later.
+ */
+static bool validCache (const MappedFile& file, uint64_t sourceSize, int64_t sourceTime)
+{
+	if (file.size < sizeof(MeshCacheHeader))
+		return false;
+
+	const MeshCacheHeader *header = reinterpret_cast<const MeshCacheHeader*>(file.data);
+	if (memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION)
+		return false;
+
+	if (header->sourceSize != sourceSize || header->sourceTime != sourceTime || header->fileSize != file.size)
+		return false;
+
+	if ((header->indexSize != 2 && header->indexSize != 4) || header->lodCount == 0 || header->lodCount > MAX_MESH_LODS)
+		return false;
+
+	/* in file order, the uploaded range running from the vertices to the padded meshlet triangles */
+	if (header->vertexOffset < sizeof(MeshCacheHeader) || header->indexOffset < header->vertexOffset ||
+			header->meshletOffset < header->indexOffset || header->meshletVertexOffset < header->meshletOffset ||
+			header->meshletTriangleOffset < header->meshletVertexOffset)
+		return false;
+
+	if (!sectionFits(header->vertexOffset, header->vertexCount, sizeof(PackedVertex), file.size) ||
+			!sectionFits(header->indexOffset, header->indexCount, header->indexSize, file.size) ||
+			!sectionFits(header->meshletOffset, header->meshletCount, sizeof(Meshlet), file.size) ||
+			!sectionFits(header->meshletVertexOffset, header->meshletVertexCount, sizeof(uint32_t), file.size) ||
+			!sectionFits(header->meshletTriangleOffset, alignUp(header->meshletTriangleBytes, 4), 1, file.size) ||
+			!sectionFits(header->lodOffset, header->lodCount, sizeof(MeshLod), file.size))
+		return false;
+
+	const MeshLod *lods = reinterpret_cast<const MeshLod*>(file.data + header->lodOffset);
+	for (uint32_t i = 0; i < header->lodCount; i++)
+		if (lods[i].indexOffset > header->indexCount || lods[i].indexCount > header->indexCount - lods[i].indexOffset ||
+				lods[i].meshletOffset > header->meshletCount || lods[i].meshletCount > header->meshletCount - lods[i].meshletOffset)
+			return false;
+
+	const Meshlet *meshlets = reinterpret_cast<const Meshlet*>(file.data + header->meshletOffset);
+	for (uint32_t i = 0; i < header->meshletCount; i++)
+	{
+		uint32_t vertexCount = meshlets[i].counts & 0xFF;
+		uint32_t triangleCount = meshlets[i].counts >> 8;
+
+		if (vertexCount > MESHLET_MAX_VERTICES || triangleCount > MESHLET_MAX_TRIANGLES ||
+				meshlets[i].vertexOffset > header->meshletVertexCount || vertexCount > header->meshletVertexCount - meshlets[i].vertexOffset ||
+				meshlets[i].triangleOffset > header->meshletTriangleBytes || triangleCount * 3 > header->meshletTriangleBytes - meshlets[i].triangleOffset ||
+				meshlets[i].indexOffset > header->indexCount || triangleCount * 3 > header->indexCount - meshlets[i].indexOffset)
+			return false;
+
+		const uint8_t *triangles = reinterpret_cast<const uint8_t*>(file.data + header->meshletTriangleOffset + meshlets[i].triangleOffset);
+		for (uint32_t k = 0; k < triangleCount * 3; k++)
+			if (triangles[k] >= vertexCount)
+				return false;
+	}
+
+	/* every vertex the index buffer or a meshlet names is in the vertex buffer */
+	const char *indices = file.data + header->indexOffset;
+	for (uint32_t i = 0; i < header->indexCount; i++)
+	{
+		uint32_t index;
+		if (header->indexSize == 2)
+		{
+			uint16_t shortIndex;
+			memcpy(&shortIndex, indices + (size_t) i * 2, 2);
+			index = shortIndex;
+		}
+		else
+			memcpy(&index, indices + (size_t) i * 4, 4);
+
+		if (index >= header->vertexCount)
+			return false;
+	}
+
+	const uint32_t *meshletVertices = reinterpret_cast<const uint32_t*>(file.data + header->meshletVertexOffset);
+	for (uint32_t i = 0; i < header->meshletVertexCount; i++)
+		if (meshletVertices[i] >= header->vertexCount)
+			return false;
+
+	return true;
+}
+
+/* Importers */
+
+ImportedMesh importObj (const std::string& path, ThreadPool& pool)
+{
+	MappedFile file;
+	if (!file.open(path))
+		throw std::runtime_error("failed to open " + path + "!");
+
+	/* chunks split at line starts, parsed independently then stitched */
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.concurrency() * OBJ_CHUNKS_PER_THREAD, file.size / 65536 + 1));
+	std::vector<ObjChunk> chunks(chunkCount);
+
+	const char *begin = file.data;
+	const char *end = file.data + file.size;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const char *split = begin + file.size * (i + 1) / chunkCount;
+		if (i + 1 < chunkCount)
+		{
+			const char *newline = static_cast<const char*>(memchr(split, '\n', end - split));
+			split = newline != nullptr ? newline + 1 : end;
+		}
+		else
+			split = end;
+
+		chunks[i].begin = i == 0 ? begin : chunks[i - 1].end;
+		chunks[i].end = std::max(split, chunks[i].begin);
+	}
+
+	pool.parallelFor(chunkCount, 1, [&] (size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+			parseObjChunk(chunks[i]);
+	});
+
+	size_t positionCount = 0, uvCount = 0, normalCount = 0, cornerCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.positionBase = positionCount;
+		chunk.uvBase = uvCount;
+		chunk.normalBase = normalCount;
+		chunk.cornerBase = cornerCount;
+
+		positionCount += chunk.positions.size() / 3;
+		uvCount += chunk.uvs.size() / 2;
+		normalCount += chunk.normals.size() / 3;
+		cornerCount += chunk.corners.size();
+	}
+
+	std::vector<float> positions(positionCount * 3);
+	std::vector<float> uvs(uvCount * 2);
+	std::vector<float> normals(normalCount * 3);
+	std::vector<CornerKey> corners(cornerCount);
+
+	pool.parallelFor(chunkCount, 1, [&] (size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+		{
+			ObjChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase * 3);
+			std::copy(chunk.uvs.begin(), chunk.uvs.end(), uvs.begin() + chunk.uvBase * 2);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase * 3);
+
+			size_t bases[3] = { chunk.positionBase, chunk.uvBase, chunk.normalBase };
+			size_t counts[3] = { positionCount, uvCount, normalCount };
+
+			for (size_t c = 0; c < chunk.corners.size(); c++)
+			{
+				const ObjCorner& corner = chunk.corners[c];
+				CornerKey& key = corners[chunk.cornerBase + c];
+
+				for (int k = 0; k < 3; k++)
+				{
+					int64_t index = corner.index[k];
+					if (corner.relative & (1 << k))
+						index += (int64_t) bases[k];
+
+					key.index[k] = index >= 0 && (size_t) index < counts[k] ? (uint32_t) index : ~0u;
+				}
+			}
+
+			std::vector<float>().swap(chunk.positions);
+			std::vector<float>().swap(chunk.uvs);
+			std::vector<float>().swap(chunk.normals);
+			std::vector<ObjCorner>().swap(chunk.corners);
+		}
+	});
+
+	file.close();
+
+	ImportedMesh mesh;
+	mesh.indices.resize(cornerCount);
+
+	std::unordered_map<CornerKey, uint32_t, CornerKeyHash> unique;
+	unique.reserve(positionCount * 2);
+
+	for (size_t i = 0; i < cornerCount; i++)
+	{
+		const CornerKey& key = corners[i];
+		if (key.index[0] == ~0u)
+			throw std::runtime_error("OBJ face references a missing vertex in " + path + "!");
+
+		auto inserted = unique.insert(std::make_pair(key, (uint32_t) (mesh.positions.size() / 3)));
+		if (inserted.second)
+		{
+			const float *p = &positions[key.index[0] * 3];
+			mesh.positions.insert(mesh.positions.end(), p, p + 3);
+
+			if (key.index[1] != ~0u)
+				mesh.uvs.insert(mesh.uvs.end(), &uvs[key.index[1] * 2], &uvs[key.index[1] * 2] + 2);
+			else
+				mesh.uvs.insert(mesh.uvs.end(), 2, 0.0f);
+
+			if (key.index[2] != ~0u)
+				mesh.normals.insert(mesh.normals.end(), &normals[key.index[2] * 3], &normals[key.index[2] * 3] + 3);
+			else
+				mesh.normals.insert(mesh.normals.end(), 3, 0.0f);
+		}
+
+		mesh.indices[i] = inserted.first->second;
+	}
+
+	return mesh;
+}
+
+ImportedMesh importGltf (const std::string& path, ThreadPool& pool)
+{
+	std::vector<char> file = readFile(path);
+
+	GltfDocument document;
+	const char *jsonData = file.data();
+	size_t jsonSize = file.size();
+	std::vector<char> binaryChunk;
+
+	/* GLB : 12 byte header, then a JSON chunk and an optional BIN chunk */
+	if (file.size() >= 20 && memcmp(file.data(), "glTF", 4) == 0)
+	{
+		uint32_t chunkLength;
+		memcpy(&chunkLength, file.data() + 12, 4);
+		if (20 + (size_t) chunkLength > file.size())
+			throw std::runtime_error("truncated GLB file!");
+
+		jsonData = file.data() + 20;
+		jsonSize = chunkLength;
+
+		size_t binaryStart = 20 + alignUp(chunkLength, 4);
+		if (binaryStart + 8 <= file.size())
+		{
+			uint32_t binaryLength;
+			memcpy(&binaryLength, file.data() + binaryStart, 4);
+			if (binaryStart + 8 + binaryLength > file.size())
+				throw std::runtime_error("truncated GLB file!");
+
+			binaryChunk.assign(file.data() + binaryStart + 8, file.data() + binaryStart + 8 + binaryLength);
+		}
+	}
+
+	document.json = JsonValue::parse(jsonData, jsonSize);
+
+	const JsonValue& buffers = document.json["buffers"];
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		if (!buffers[i].has("uri"))
+			document.buffers.push_back(std::move(binaryChunk));
+		else
+		{
+			const std::string& uri = buffers[i]["uri"].asString();
+			size_t comma = uri.find(',');
+			if (uri.compare(0, 5, "data:") == 0 && comma != std::string::npos)
+				document.buffers.push_back(decodeBase64(uri.data() + comma + 1, uri.size() - comma - 1));
+			else
+				document.buffers.push_back(readFile(directoryOf(path) + uri));
+		}
+	}
+
+	static const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	std::vector<GltfDraw> draws;
+
+	const JsonValue& scenes = document.json["scenes"];
+	if (scenes.size() > 0)
+	{
+		const JsonValue& roots = scenes[(size_t) document.json["scene"].asInt()]["nodes"];
+		for (size_t i = 0; i < roots.size(); i++)
+			collectDraws(document, (size_t) roots[i].asInt(), identity, draws, 0);
+	}
+	else
+	{
+		/* no scene : every mesh once, untransformed */
+		const JsonValue& meshes = document.json["meshes"];
+		for (size_t m = 0; m < meshes.size(); m++)
+			for (size_t i = 0; i < meshes[m]["primitives"].size(); i++)
+			{
+				const JsonValue& primitive = meshes[m]["primitives"][i];
+				if (primitive["mode"].asInt(GLTF_TRIANGLES) != GLTF_TRIANGLES || !primitive["attributes"].has("POSITION"))
+					continue;
+
+				GltfDraw draw = {};
+				draw.primitive = &primitive;
+				memcpy(draw.transform, identity, sizeof(identity));
+				draws.push_back(draw);
+			}
+	}
+
+	size_t vertexCount = 0, indexCount = 0;
+	for (GltfDraw& draw : draws)
+	{
+		/* decodeDraw reads vertexCount elements of every attribute, and that many components */
+		const JsonValue& attributes = (*draw.primitive)["attributes"];
+		GltfAccessor positions = document.accessor(attributes["POSITION"].asInt());
+		if (positions.components < 3)
+			throw std::runtime_error("glTF POSITION accessor is not a VEC3!");
+
+		if (attributes.has("NORMAL"))
+		{
+			GltfAccessor normals = document.accessor(attributes["NORMAL"].asInt());
+			if (normals.count != positions.count || normals.components < 3)
+				throw std::runtime_error("glTF NORMAL accessor does not match POSITION!");
+		}
+
+		if (attributes.has("TEXCOORD_0"))
+		{
+			GltfAccessor uvs = document.accessor(attributes["TEXCOORD_0"].asInt());
+			if (uvs.count != positions.count || uvs.components < 2)
+				throw std::runtime_error("glTF TEXCOORD_0 accessor does not match POSITION!");
+		}
+
+		draw.vertexOffset = vertexCount;
+		draw.vertexCount = positions.count;
+		draw.indexOffset = indexCount;
+		draw.indexCount = (*draw.primitive).has("indices") ?
+			document.accessor((*draw.primitive)["indices"].asInt()).count : draw.vertexCount;
+
+		vertexCount += draw.vertexCount;
+		indexCount += draw.indexCount - draw.indexCount % 3;
+		draw.indexCount -= draw.indexCount % 3;
+	}
+
+	if (vertexCount > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("glTF scene has too many vertices!");
+
+	ImportedMesh mesh;
+	mesh.positions.resize(vertexCount * 3);
+	mesh.normals.resize(vertexCount * 3, 0.0f);
+	mesh.uvs.resize(vertexCount * 2, 0.0f);
+	mesh.indices.resize(indexCount);
+
+	pool.parallelFor(draws.size(), 1, [&] (size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+			decodeDraw(document, draws[i], mesh);
+	});
+
+	return mesh;
+}
+
+/* Generators */
+
+ImportedMesh generateSphere (uint32_t rings, uint32_t segments)
+{
+	rings = std::max(rings, 2u);
+	segments = std::max(segments, 3u);
+
+	/* one row of segments + 1 vertices per ring boundary : the seam column and the poles repeat with their own uvs */
+	ImportedMesh mesh;
+	size_t vertexCount = (size_t) (rings + 1) * (segments + 1);
+	mesh.positions.reserve(vertexCount * 3);
+	mesh.normals.reserve(vertexCount * 3);
+	mesh.uvs.reserve(vertexCount * 2);
+
+	for (uint32_t ring = 0; ring <= rings; ring++)
+	{
+		float v = (float) ring / rings;
+		float polar = v * 3.14159265f;
+
+		for (uint32_t segment = 0; segment <= segments; segment++)
+		{
+			float u = (float) segment / segments;
+			float azimuth = u * 2.0f * 3.14159265f;
+
+			float normal[3] = { std::sin(polar) * std::cos(azimuth), std::cos(polar), std::sin(polar) * std::sin(azimuth) };
+			mesh.positions.insert(mesh.positions.end(), normal, normal + 3);
+			mesh.normals.insert(mesh.normals.end(), normal, normal + 3);
+			mesh.uvs.push_back(u);
+			mesh.uvs.push_back(v);
+		}
+	}
+
+	/* counter-clockwise from outside, the quads touching a pole are a single triangle */
+	mesh.indices.reserve((size_t) rings * segments * 6);
+	for (uint32_t ring = 0; ring < rings; ring++)
+	{
+		for (uint32_t segment = 0; segment < segments; segment++)
+		{
+			uint32_t a = ring * (segments + 1) + segment;
+			uint32_t b = a + segments + 1;
+
+			if (ring > 0)
+				mesh.indices.insert(mesh.indices.end(), { a, a + 1, b });
+			if (ring + 1 < rings)
+				mesh.indices.insert(mesh.indices.end(), { a + 1, b + 1, b });
+		}
+	}
+
+	return mesh;
+}
+
+/* Optimization */
+
+MeshData buildMesh (ImportedMesh& mesh, ThreadPool& pool)
+{
+	size_t vertexCount = mesh.positions.size() / 3;
+	mesh.normals.resize(vertexCount * 3, 0.0f);
+	mesh.uvs.resize(vertexCount * 2, 0.0f);
+
+	computeMissingNormals(mesh);
+
+	MeshData data;
+	data.indices = optimizeVertexCache(mesh.indices, vertexCount);
+
+	/* vertex fetch order : vertices in the order the index buffer first reads them */
+	std::vector<uint32_t> remap(vertexCount, ~0u);
+	std::vector<uint32_t> order;
+	order.reserve(vertexCount);
+	for (uint32_t& index : data.indices)
+	{
+		if (remap[index] == ~0u)
+		{
+			remap[index] = (uint32_t) order.size();
+			order.push_back(index);
+		}
+		index = remap[index];
+	}
+
+	float minimum[3] = { 0.0f, 0.0f, 0.0f };
+	float maximum[3] = { 0.0f, 0.0f, 0.0f };
+	for (size_t i = 0; i < order.size(); i++)
+		for (int k = 0; k < 3; k++)
+		{
+			float value = mesh.positions[order[i] * 3 + k];
+			minimum[k] = i == 0 ? value : std::min(minimum[k], value);
+			maximum[k] = i == 0 ? value : std::max(maximum[k], value);
+		}
+
+	for (int k = 0; k < 3; k++)
+	{
+		data.positionOffset[k] = minimum[k];
+		data.positionScale[k] = maximum[k] - minimum[k];
+		data.center[k] = (minimum[k] + maximum[k]) * 0.5f;
+	}
+
+	data.vertices.resize(order.size());
+	pool.parallelFor(order.size(), 16384, [&] (size_t first, size_t last) {
+		for (size_t i = first; i < last; i++)
+		{
+			uint32_t source = order[i];
+			PackedVertex& vertex = data.vertices[i];
+
+			for (int k = 0; k < 3; k++)
+			{
+				float range = data.positionScale[k];
+				float normalized = range > 0.0f ? (mesh.positions[source * 3 + k] - data.positionOffset[k]) / range : 0.0f;
+				vertex.position[k] = (uint16_t) std::lround(std::max(0.0f, std::min(1.0f, normalized)) * 65535.0f);
+			}
+			vertex.position[3] = 65535;
+
+			encodeOctahedral(&mesh.normals[source * 3], vertex.normal);
+			vertex.uv[0] = floatToHalf(mesh.uvs[source * 2]);
+			vertex.uv[1] = floatToHalf(mesh.uvs[source * 2 + 1]);
+		}
+	});
+
+	data.radius = 0.0f;
+	for (uint32_t source : order)
+	{
+		const float *p = &mesh.positions[source * 3];
+		float dx = p[0] - data.center[0], dy = p[1] - data.center[1], dz = p[2] - data.center[2];
+		data.radius = std::max(data.radius, dx * dx + dy * dy + dz * dz);
+	}
+	data.radius = std::sqrt(data.radius);
+
+	MeshLod lod = {};
+	lod.indexCount = (uint32_t) data.indices.size();
+	data.lods.push_back(lod);
+
+	/* LOD chain on the reordered vertices, every level simplified from the previous one */
+	std::vector<float> orderedPositions(order.size() * 3);
+	for (size_t i = 0; i < order.size(); i++)
+		memcpy(&orderedPositions[i * 3], &mesh.positions[order[i] * 3], 3 * sizeof(float));
+
+	std::vector<uint32_t> previous(data.indices);
+	float error = 0.0f;
+
+	while (data.lods.size() < MAX_MESH_LODS)
+	{
+		size_t target = (size_t) (previous.size() / 3 * MESH_LOD_REDUCTION) * 3;
+		if (target < MESH_LOD_MIN_TRIANGLES * 3)
+			break;
+
+		float levelError;
+		std::vector<uint32_t> simplified = simplifyMesh(orderedPositions.data(), order.size(), previous, target, levelError);
+
+		/* stuck on locked borders, seams or flips : more levels would cost memory for nothing */
+		if (simplified.empty() || simplified.size() > previous.size() * 0.85)
+			break;
+
+		error += levelError;
+
+		lod.indexOffset = (uint32_t) data.indices.size();
+		lod.indexCount = (uint32_t) simplified.size();
+		lod.error = error;
+		data.lods.push_back(lod);
+
+		std::vector<uint32_t> optimized = optimizeVertexCache(simplified, order.size());
+		data.indices.insert(data.indices.end(), optimized.begin(), optimized.end());
+		previous.swap(simplified);
+	}
+
+	for (MeshLod& level : data.lods)
+		buildMeshlets(data, level, orderedPositions.data(), order.size());
+
+	return data;
+}
+
+void writeMeshCache (const std::string& path, const MeshData& mesh, uint64_t sourceSize, int64_t sourceTime)
+{
+	MeshCacheHeader header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+	header.version = MESH_CACHE_VERSION;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+	memcpy(header.positionScale, mesh.positionScale, sizeof(header.positionScale));
+	memcpy(header.positionOffset, mesh.positionOffset, sizeof(header.positionOffset));
+	memcpy(header.center, mesh.center, sizeof(header.center));
+	header.radius = mesh.radius;
+
+	header.vertexCount = (uint32_t) mesh.vertices.size();
+	header.indexCount = (uint32_t) mesh.indices.size();
+	header.indexSize = mesh.vertices.size() <= 65536 ? 2 : 4;
+	header.lodCount = (uint32_t) mesh.lods.size();
+	header.meshletCount = (uint32_t) mesh.meshlets.size();
+	header.meshletVertexCount = (uint32_t) mesh.meshletVertices.size();
+	header.meshletTriangleBytes = (uint32_t) mesh.meshletTriangles.size();
+
+	header.vertexOffset = alignUp(sizeof(MeshCacheHeader), MESH_CACHE_GPU_ALIGNMENT);
+	header.indexOffset = alignUp(header.vertexOffset + header.vertexCount * sizeof(PackedVertex), MESH_CACHE_GPU_ALIGNMENT);
+	header.meshletOffset = alignUp(header.indexOffset + (uint64_t) header.indexCount * header.indexSize, MESH_CACHE_GPU_ALIGNMENT);
+	header.meshletVertexOffset = alignUp(header.meshletOffset + header.meshletCount * sizeof(Meshlet), MESH_CACHE_GPU_ALIGNMENT);
+	header.meshletTriangleOffset = alignUp(header.meshletVertexOffset + header.meshletVertexCount * sizeof(uint32_t), MESH_CACHE_GPU_ALIGNMENT);
+	header.lodOffset = alignUp(header.meshletTriangleOffset + header.meshletTriangleBytes, 16);
+	header.fileSize = header.lodOffset + header.lodCount * sizeof(MeshLod);
+
+	/* written beside the target and renamed, a crash never leaves a half cache behind */
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			throw std::runtime_error("failed to write mesh cache " + path + "!");
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		padTo(file, header.vertexOffset);
+		writeSection(file, mesh.vertices);
+
+		padTo(file, header.indexOffset);
+		if (header.indexSize == 2)
+		{
+			std::vector<uint16_t> shortIndices(mesh.indices.begin(), mesh.indices.end());
+			writeSection(file, shortIndices);
+		}
+		else
+			writeSection(file, mesh.indices);
+
+		padTo(file, header.meshletOffset);
+		writeSection(file, mesh.meshlets);
+		padTo(file, header.meshletVertexOffset);
+		writeSection(file, mesh.meshletVertices);
+		padTo(file, header.meshletTriangleOffset);
+		writeSection(file, mesh.meshletTriangles);
+
+		padTo(file, header.lodOffset);
+		writeSection(file, mesh.lods);
+
+		if (!file.good())
+			throw std::runtime_error("failed to write mesh cache " + path + "!");
+	}
+
+	if (rename(temporary.c_str(), path.c_str()) != 0)
+		throw std::runtime_error("failed to write mesh cache " + path + "!");
+}
+
+bool bakeMeshCache (const std::string& path, ThreadPool& pool, bool force)
+{
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!statFile(path, sourceSize, sourceTime))
+		throw std::runtime_error("failed to open " + path + "!");
+
+	std::string cachePath = path + ".meshcache";
+
+	if (!force)
+	{
+		MappedFile cache;
+		bool upToDate = cache.open(cachePath) && validCache(cache, sourceSize, sourceTime);
+		cache.close();
+
+		if (upToDate)
+			return false;
+	}
+
+	ImportedMesh imported = endsWith(path, ".obj") ? importObj(path, pool) : importGltf(path, pool);
+	if (imported.indices.empty())
+		throw std::runtime_error("mesh " + path + " has no triangles!");
+
+	MeshData data = buildMesh(imported, pool);
+	writeMeshCache(cachePath, data, sourceSize, sourceTime);
+
+	return true;
+}
+
+/* MappedFile */
+
+bool MappedFile::open (const std::string& path)
+{
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(descriptor, &info) != 0 || info.st_size == 0)
+	{
+		::close(descriptor);
+		return false;
+	}
+
+	void *mapping = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	::close(descriptor);
+
+	if (mapping == MAP_FAILED)
+		return false;
+
+	data = static_cast<const char*>(mapping);
+	size = (size_t) info.st_size;
+	return true;
+}
+
+void MappedFile::close ()
+{
+	if (data != nullptr)
+		munmap(const_cast<char*>(data), size);
+
+	data = nullptr;
+	size = 0;
+}
+
+/* MeshManager */
+
+void MeshManager::init (const DeviceContext& context, ThreadPool& pool)
+{
+	this->context = &context;
+	this->pool = &pool;
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = context.graphicsFamily;
+
+	if (vkCreateCommandPool(context.device, &poolInfo, context.allocator, &commandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create mesh command pool!");
+}
+
+void MeshManager::destroy ()
+{
+	if (context == nullptr)
+		return;
+
+	for (Mesh& mesh : meshes)
+		context->destroyBuffer(mesh.buffer, mesh.memory);
+	meshes.clear();
+
+	vkDestroyCommandPool(context->device, commandPool, context->allocator);
+	context = nullptr;
+}
+
+MeshHandle MeshManager::load (const std::string& path, bool force)
+{
+	Mesh mesh;
+	mesh.path = path;
+
+	auto start = std::chrono::steady_clock::now();
+	if (bakeMeshCache(path, *pool, force))
+		mesh.importMilliseconds = millisecondsSince(start);
+
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	statFile(path, sourceSize, sourceTime);
+
+	return add(mesh, path + ".meshcache", sourceSize, sourceTime);
+}
+
+MeshHandle MeshManager::generate (const std::string& name, ImportedMesh& source)
+{
+	Mesh mesh;
+	mesh.path = name;
+
+	/* the index count stands for the source size : a cache of another tessellation is built again */
+	uint64_t sourceSize = source.indices.size();
+	std::string cachePath = name + ".meshcache";
+
+	auto start = std::chrono::steady_clock::now();
+	MappedFile cache;
+	bool upToDate = cache.open(cachePath) && validCache(cache, sourceSize, 0);
+	cache.close();
+
+	if (!upToDate)
+	{
+		MeshData data = buildMesh(source, *pool);
+		writeMeshCache(cachePath, data, sourceSize, 0);
+		mesh.importMilliseconds = millisecondsSince(start);
+	}
+
+	return add(mesh, cachePath, sourceSize, 0);
+}
+
+MeshHandle MeshManager::add (Mesh& mesh, const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime)
+{
+	MappedFile cache;
+
+	auto start = std::chrono::steady_clock::now();
+	if (!cache.open(cachePath) || !validCache(cache, sourceSize, sourceTime))
+		throw std::runtime_error("failed to read mesh cache " + cachePath + "!");
+
+	upload(mesh, cache);
+	mesh.cachedMilliseconds = millisecondsSince(start);
+	mesh.cacheBytes = cache.size;
+
+	cache.close();
+
+	meshes.push_back(std::move(mesh));
+	return (MeshHandle) (meshes.size() - 1);
+}
+
+void MeshManager::upload (Mesh& mesh, const MappedFile& cache)
+{
+	const MeshCacheHeader *header = reinterpret_cast<const MeshCacheHeader*>(cache.data);
+
+	mesh.vertexCount = header->vertexCount;
+	mesh.indexCount = header->indexCount;
+	mesh.indexType = header->indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	mesh.indexOffset = header->indexOffset - header->vertexOffset;
+	memcpy(mesh.positionScale, header->positionScale, sizeof(mesh.positionScale));
+	memcpy(mesh.positionOffset, header->positionOffset, sizeof(mesh.positionOffset));
+	memcpy(mesh.center, header->center, sizeof(mesh.center));
+	mesh.radius = header->radius;
+
+	const MeshLod *lods = reinterpret_cast<const MeshLod*>(cache.data + header->lodOffset);
+	mesh.lods.assign(lods, lods + header->lodCount);
+
+	mesh.vertexData.size = (VkDeviceSize) header->vertexCount * sizeof(PackedVertex);
+	mesh.meshletCount = header->meshletCount;
+	mesh.meshletData.offset = header->meshletOffset - header->vertexOffset;
+	mesh.meshletData.size = (VkDeviceSize) header->meshletCount * sizeof(Meshlet);
+	mesh.meshletVertexData.offset = header->meshletVertexOffset - header->vertexOffset;
+	mesh.meshletVertexData.size = (VkDeviceSize) header->meshletVertexCount * sizeof(uint32_t);
+	mesh.meshletTriangleData.offset = header->meshletTriangleOffset - header->vertexOffset;
+	mesh.meshletTriangleData.size = alignUp(header->meshletTriangleBytes, 4);
+
+	/* every GPU section sits back to back in the file : one copy into one buffer */
+	VkDeviceSize size = mesh.meshletTriangleData.offset + mesh.meshletTriangleData.size;
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingMemory;
+	context->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory,
+			MEMORY_CATEGORY_STAGING);
+
+	void *data;
+	vkMapMemory(context->device, stagingMemory, 0, size, 0, &data);
+	memcpy(data, cache.data + header->vertexOffset, (size_t) size);
+	vkUnmapMemory(context->device, stagingMemory);
+
+	context->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.buffer, mesh.memory, MEMORY_CATEGORY_GEOMETRY);
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	vkAllocateCommandBuffers(context->device, &allocInfo, &commandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	VkBufferCopy region = {};
+	region.size = size;
+	vkCmdCopyBuffer(commandBuffer, stagingBuffer, mesh.buffer, 1, &region);
+
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	if (context->submitAndWait(submitInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit mesh upload!");
+
+	vkFreeCommandBuffers(context->device, commandPool, 1, &commandBuffer);
+	context->destroyBuffer(stagingBuffer, stagingMemory);
+}
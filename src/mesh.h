@@ -0,0 +1,263 @@
+#pragma once
+
+#include "device.h"
+#include "thread_pool.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+typedef uint32_t MeshHandle;
+
+/*
+ * 16 bytes per vertex : position as unorm16 inside the mesh bounds (the shader
+ * rebuilds it with positionOffset + position * positionScale), octahedral snorm16
+ * normal and half float texture coordinates.
+ */
+
+struct PackedVertex
+{
+	uint16_t position[4];
+	int16_t normal[2];
+	uint16_t uv[2];
+
+	static VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(PackedVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attributeDescriptions[0].offset = offsetof(PackedVertex, position);
+
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[1].offset = offsetof(PackedVertex, normal);
+
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(PackedVertex, uv);
+
+		return attributeDescriptions;
+	}
+};
+
+struct MeshLod
+{
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	uint32_t meshletOffset;
+	uint32_t meshletCount;
+	float error;
+	uint32_t padding;
+};
+
+/*
+ * Cluster of up to MESHLET_MAX_VERTICES vertices / MESHLET_MAX_TRIANGLES triangles,
+ * laid out for std430 reads. Its triangles are also a contiguous range of the
+ * index buffer (indexOffset), so the vertex pipeline can draw meshlets one by one.
+ * The cone culls the whole meshlet when the camera sees every triangle from
+ * behind : dot(center - eye, axis) >= cutoff * |center - eye| + radius.
+ */
+
+const uint32_t MESHLET_MAX_VERTICES = 64;
+const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+struct Meshlet
+{
+	float center[3];
+	float radius;
+	float coneAxis[3];
+	float coneCutoff;
+
+	uint32_t vertexOffset;		/* into the meshlet vertex indices */
+	uint32_t triangleOffset;	/* byte offset of the uint8 local triangle indices */
+	uint32_t indexOffset;
+	uint32_t counts;			/* vertex count | triangle count << 8 */
+};
+
+/* Source data after import : one unique vertex per position / uv / normal triple */
+
+struct ImportedMesh
+{
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<float> uvs;
+	std::vector<uint32_t> indices;
+};
+
+ImportedMesh importObj (const std::string& path, ThreadPool& pool);
+ImportedMesh importGltf (const std::string& path, ThreadPool& pool);
+
+/* unit UV sphere of rings x segments quads, for a benchmark that needs no asset */
+ImportedMesh generateSphere (uint32_t rings, uint32_t segments);
+
+/* Optimized, quantized mesh as stored in the cache */
+
+struct MeshData
+{
+	std::vector<PackedVertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> meshletVertices;
+	std::vector<uint8_t> meshletTriangles;
+	float positionScale[3];
+	float positionOffset[3];
+	float center[3];
+	float radius;
+};
+
+MeshData buildMesh (ImportedMesh& mesh, ThreadPool& pool);
+
+/*
+ * Quadric error metric edge collapse down to targetIndexCount indices. Vertices
+ * only ever collapse onto existing ones, so every LOD shares the vertex buffer.
+ * Open borders and attribute seams are locked. error receives the geometric
+ * error of the result in mesh units.
+ */
+std::vector<uint32_t> simplifyMesh (const float *positions, size_t vertexCount, const std::vector<uint32_t>& indices,
+		size_t targetIndexCount, float& error);
+
+/* import, optimize and write <path>.meshcache unless an up to date one exists, returns false when it did */
+bool bakeMeshCache (const std::string& path, ThreadPool& pool, bool force);
+
+/*
+ * <source>.meshcache : header, vertices, indices (16 bit when they fit), meshlets
+ * and their vertex / triangle lists, each aligned for storage buffer binding,
+ * then the LODs. Everything up to the LODs is uploaded as one buffer.
+ * The source size and modification time are stamped in so an edited source is
+ * imported again, a version bump invalidates every cache.
+ */
+
+const uint32_t MESH_CACHE_VERSION = 3;
+const uint64_t MESH_CACHE_GPU_ALIGNMENT = 256;
+
+/* each LOD aims for half the triangles of the previous one */
+const uint32_t MAX_MESH_LODS = 8;
+const float MESH_LOD_REDUCTION = 0.5f;
+const uint32_t MESH_LOD_MIN_TRIANGLES = 64;
+
+struct MeshCacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+
+	float positionScale[3];
+	float positionOffset[3];
+	float center[3];
+	float radius;
+
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t indexSize;
+	uint32_t lodCount;
+	uint32_t meshletCount;
+	uint32_t meshletVertexCount;
+	uint32_t meshletTriangleBytes;
+	uint32_t padding;
+
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t meshletOffset;
+	uint64_t meshletVertexOffset;
+	uint64_t meshletTriangleOffset;
+	uint64_t lodOffset;
+	uint64_t fileSize;
+};
+
+void writeMeshCache (const std::string& path, const MeshData& mesh, uint64_t sourceSize, int64_t sourceTime);
+
+/* Read-only memory mapping of a whole file */
+
+struct MappedFile
+{
+	const char *data = nullptr;
+	size_t size = 0;
+
+	bool open (const std::string& path);
+	void close ();
+};
+
+/* byte range of one section inside Mesh::buffer */
+struct MeshSection
+{
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+};
+
+struct Mesh
+{
+	std::string path;
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize indexOffset = 0;
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;
+	std::vector<MeshLod> lods;
+
+	MeshSection vertexData;
+	MeshSection meshletData;
+	MeshSection meshletVertexData;
+	MeshSection meshletTriangleData;
+	uint32_t meshletCount = 0;
+
+	float positionScale[3];
+	float positionOffset[3];
+	float center[3];
+	float radius;
+
+	/* importMilliseconds stays 0 when the cache was up to date */
+	double importMilliseconds = 0.0;
+	double cachedMilliseconds = 0.0;
+	uint64_t cacheBytes = 0;
+};
+
+/*
+ * Coarsest LOD whose error, projected to pixelsPerUnit, stays under maxPixelError.
+ * Moving to a coarser LOD needs the error to be (1 - hysteresis) under the limit,
+ * moving back to a finer one needs it to be (1 + hysteresis) over, so objects
+ * near a threshold do not flicker between two LODs.
+ */
+uint32_t selectLod (const Mesh& mesh, float pixelsPerUnit, uint32_t current, float maxPixelError, float hysteresis);
+
+class MeshManager
+{
+private:
+	const DeviceContext *context = nullptr;
+	ThreadPool *pool = nullptr;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+
+	std::vector<Mesh> meshes;
+
+	void upload (Mesh& mesh, const MappedFile& cache);
+	MeshHandle add (Mesh& mesh, const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime);
+
+public:
+	void init (const DeviceContext& context, ThreadPool& pool);
+	void destroy ();
+
+	/* force imports the source again even when its cache is up to date */
+	MeshHandle load (const std::string& path, bool force = false);
+
+	/* source is built and cached as <name>.meshcache, loaded from there while its index count is the same */
+	MeshHandle generate (const std::string& name, ImportedMesh& source);
+
+	const Mesh& get (MeshHandle handle) const { return meshes[handle]; }
+	size_t count () const { return meshes.size(); }
+};
@@ -0,0 +1,317 @@
+#include "particles.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+/* ParticleSystem */
+
+bool ParticleSystem::init (const DeviceContext& deviceContext, PipelineFactory& pipelines, ThreadPool& threadPool,
+		const RenderTarget& target, uint32_t capacity, uint32_t emitPerFrame)
+{
+	context = &deviceContext;
+	factory = &pipelines;
+	pool = &threadPool;
+
+	VkShaderModule simulateShader = pipelines.loadShader("assets/shaders/particles_comp.spv");
+	VkShaderModule finalizeShader = pipelines.loadShader("assets/shaders/particles_finalize_comp.spv");
+	VkShaderModule vertexShader = pipelines.loadShader("assets/shaders/particles_vert.spv");
+	VkShaderModule fragmentShader = pipelines.loadShader("assets/shaders/particles_frag.spv");
+	if (simulateShader == VK_NULL_HANDLE || finalizeShader == VK_NULL_HANDLE || vertexShader == VK_NULL_HANDLE || fragmentShader == VK_NULL_HANDLE)
+		return false;
+
+	/* source, destination, counters : the vertex shader only reads the destination */
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | (i == 1 ? VK_SHADER_STAGE_VERTEX_BIT : 0);
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(context->device, &layoutInfo, context->allocator, &setLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ParticlePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(context->device, &pipelineLayoutInfo, context->allocator, &pipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle pipeline layout!");
+
+	/* points blended on top of the meshes, depth tested but not written */
+	states[0].bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+	states[0].addStage(VK_SHADER_STAGE_COMPUTE_BIT, simulateShader);
+	states[0].layout = pipelineLayout;
+
+	states[1].bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+	states[1].addStage(VK_SHADER_STAGE_COMPUTE_BIT, finalizeShader);
+	states[1].layout = pipelineLayout;
+
+	states[2].addStage(VK_SHADER_STAGE_VERTEX_BIT, vertexShader);
+	states[2].addStage(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader);
+	states[2].layout = pipelineLayout;
+	states[2].setTarget(target);
+	states[2].topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+	states[2].cullMode = VK_CULL_MODE_NONE;
+	states[2].depthTest = VK_TRUE;
+	states[2].depthWrite = VK_FALSE;
+	states[2].blend = VK_TRUE;
+
+	pipelinesFailed = false;
+	resolvePipelines(false);
+
+	for (uint32_t i = 0; i < 2; i++)
+		context->createBuffer(capacity * sizeof(Particle), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particleBuffers[i], particleMemory[i], MEMORY_CATEGORY_BUFFER);
+
+	/* small and read back every frame : host visible, indirect commands included */
+	context->createBuffer(sizeof(ParticleCounters), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, counterBuffer, counterMemory,
+			MEMORY_CATEGORY_BUFFER);
+
+	void *data;
+	vkMapMemory(context->device, counterMemory, 0, sizeof(ParticleCounters), 0, &data);
+	counters = static_cast<ParticleCounters*>(data);
+
+	/* the first frame only emits */
+	memset(counters, 0, sizeof(ParticleCounters));
+	counters->dispatchCommand.x = (emitPerFrame + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE;
+	counters->dispatchCommand.y = 1;
+	counters->dispatchCommand.z = 1;
+	counters->drawCommand.instanceCount = 1;
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 2 * static_cast<uint32_t>(bindings.size());
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = 2;
+
+	if (vkCreateDescriptorPool(context->device, &poolInfo, context->allocator, &descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create particle descriptor pool!");
+
+	VkDescriptorSetLayout setLayouts[2] = { setLayout, setLayout };
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 2;
+	allocInfo.pSetLayouts = setLayouts;
+
+	if (vkAllocateDescriptorSets(context->device, &allocInfo, sets) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate particle descriptor sets!");
+
+	/* set i reads buffer i and writes the other one */
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		VkDescriptorBufferInfo bufferInfos[3] = {};
+		bufferInfos[0].buffer = particleBuffers[i];
+		bufferInfos[0].range = VK_WHOLE_SIZE;
+		bufferInfos[1].buffer = particleBuffers[1 - i];
+		bufferInfos[1].range = VK_WHOLE_SIZE;
+		bufferInfos[2].buffer = counterBuffer;
+		bufferInfos[2].range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = sets[i];
+		write.dstBinding = 0;
+		write.descriptorCount = 3;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = bufferInfos;
+		vkUpdateDescriptorSets(context->device, 1, &write, 0, nullptr);
+	}
+
+	/* timestamps around the simulation, when the graphics queue has them */
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, families.data());
+
+	if (context->graphicsFamily < familyCount && families[context->graphicsFamily].timestampValidBits > 0)
+	{
+		VkQueryPoolCreateInfo queryInfo = {};
+		queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryInfo.queryCount = 2;
+
+		if (vkCreateQueryPool(context->device, &queryInfo, context->allocator, &queryPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create particle query pool!");
+	}
+
+	constants = {};
+	constants.emitCount = emitPerFrame;
+	constants.capacity = capacity;
+	return true;
+}
+
+void ParticleSystem::destroy ()
+{
+	if (context == nullptr)
+		return;
+
+	/* pipelines belong to the factory */
+	vkDestroyQueryPool(context->device, queryPool, context->allocator);
+	vkDestroyDescriptorPool(context->device, descriptorPool, context->allocator);
+	vkDestroyPipelineLayout(context->device, pipelineLayout, context->allocator);
+	vkDestroyDescriptorSetLayout(context->device, setLayout, context->allocator);
+
+	if (counterBuffer != VK_NULL_HANDLE)
+	{
+		context->destroyBuffer(counterBuffer, counterMemory);
+		for (uint32_t i = 0; i < 2; i++)
+			context->destroyBuffer(particleBuffers[i], particleMemory[i]);
+	}
+
+	simulatePipeline = finalizePipeline = drawPipeline = VK_NULL_HANDLE;
+	factory = nullptr;
+	pool = nullptr;
+	context = nullptr;
+}
+
+/* all three or none : a frame never simulates without drawing */
+bool ParticleSystem::resolvePipelines (bool block)
+{
+	VkPipeline resolved[3];
+	bool settled = true;
+	for (uint32_t i = 0; i < 3; i++)
+		if (block)
+			resolved[i] = factory->wait(states[i]);
+		else
+			settled = factory->request(states[i], *pool, resolved[i]) && settled;
+
+	if (!settled)
+		return false;
+
+	if (resolved[0] == VK_NULL_HANDLE || resolved[1] == VK_NULL_HANDLE || resolved[2] == VK_NULL_HANDLE)
+	{
+		std::cerr << "particles: pipelines could not be created, disabled" << std::endl;
+		pipelinesFailed = true;
+		return false;
+	}
+
+	simulatePipeline = resolved[0];
+	finalizePipeline = resolved[1];
+	drawPipeline = resolved[2];
+	return true;
+}
+
+bool ParticleSystem::ready (bool block)
+{
+	if (enabled())
+		return true;
+	if (factory == nullptr || pipelinesFailed)
+		return false;
+
+	return resolvePipelines(block);
+}
+
+void ParticleSystem::swapPipelines (PipelineFactory& pipelines)
+{
+	/* a reload replaces the pipelines the factory has : the ones still coming are waited for */
+	if (!enabled() && factory != nullptr && !pipelinesFailed)
+		resolvePipelines(true);
+
+	pipelines.swap(simulatePipeline);
+	pipelines.swap(finalizePipeline);
+	pipelines.swap(drawPipeline);
+}
+
+/* the previous frame is idle : its timestamps are final */
+void ParticleSystem::readStats ()
+{
+	if (!queryPending)
+		return;
+
+	uint64_t timestamps[2];
+	if (vkGetQueryPoolResults(context->device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	{
+		simulationMilliseconds += (timestamps[1] - timestamps[0]) * context->properties.limits.timestampPeriod * 1e-6;
+		timedFrames++;
+	}
+
+	queryPending = false;
+}
+
+void ParticleSystem::simulate (VkCommandBuffer commandBuffer, float deltaTime, float time, const glm::vec3& emitter)
+{
+	if (!enabled())
+		return;
+
+	readStats();
+
+	/* what this frame moves : the survivors of the last one and the new ones */
+	uint32_t alive = std::min(counters->aliveCount, constants.capacity);
+	simulatedParticles += alive + std::min(constants.emitCount, constants.capacity - alive);
+	frames++;
+
+	constants.emitter = glm::vec4(emitter, 1.5f);
+	constants.time = glm::vec4(deltaTime, time, 0.0f, 0.0f);
+	constants.seed = static_cast<uint32_t>(frames * 0x9E3779B9u);
+
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+	}
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &sets[source], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, simulatePipeline);
+	vkCmdDispatchIndirect(commandBuffer, counterBuffer, offsetof(ParticleCounters, dispatchCommand));
+
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, finalizePipeline);
+	vkCmdDispatch(commandBuffer, 1, 1, 1);
+
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, queryPool, 1);
+		queryPending = true;
+	}
+
+	/* compute to draw : the indirect commands, the particles for the vertex shader, the counters for the host */
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+			VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT);
+}
+
+void ParticleSystem::draw (VkCommandBuffer commandBuffer, CommandState& state, const glm::mat4& viewProjection)
+{
+	if (!enabled())
+		return;
+
+	constants.viewProjection = viewProjection;
+
+	state.bindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipeline);
+	state.bindDescriptorSet(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, sets[source]);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+	vkCmdDrawIndirect(commandBuffer, counterBuffer, offsetof(ParticleCounters, drawCommand), 1, sizeof(VkDrawIndirectCommand));
+
+	/* this frame's output is the next one's source */
+	source = 1 - source;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "device.h"
+#include "pipeline.h"
+#include "draw_queue.h"
+
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+/* workgroup size of particles.comp */
+const uint32_t PARTICLE_GROUP_SIZE = 256;
+
+/* particles.glsl */
+struct Particle
+{
+	glm::vec4 position;			/* xyz, remaining life in seconds */
+	glm::vec4 velocity;			/* xyz, lifetime in seconds */
+};
+
+struct ParticlePushConstants
+{
+	glm::mat4 viewProjection;
+	glm::vec4 emitter;			/* position, spread */
+	glm::vec4 time;				/* delta time, time */
+	uint32_t emitCount;
+	uint32_t capacity;
+	uint32_t seed;
+	uint32_t padding;
+};
+
+/* counters of particles.comp, and the indirect commands particles_finalize.comp derives from them */
+struct ParticleCounters
+{
+	uint32_t aliveCount;
+	uint32_t nextCount;
+	uint32_t padding[2];
+	VkDispatchIndirectCommand dispatchCommand;
+	uint32_t dispatchPadding;
+	VkDrawIndirectCommand drawCommand;
+};
+
+/*
+ * GPU particle fountain. Every frame particles.comp moves the live particles
+ * of one buffer, adds the emitted ones and compacts the survivors into the
+ * other buffer, then particles_finalize.comp turns the survivor count into the
+ * next simulation's dispatch and this frame's point draw. The CPU never knows
+ * the count in time : both are indirect.
+ *
+ * simulate records outside the render pass, draw inside. The simulation is
+ * timed with timestamps when the queue supports them.
+ *
+ * The pipelines are not needed for the first frame : init() only requests
+ * them from the factory, ready() picks them up once the pool created them.
+ * Until then the fountain is simply not there.
+ */
+
+class ParticleSystem
+{
+private:
+	const DeviceContext *context = nullptr;
+
+	VkBuffer particleBuffers[2];
+	VkDeviceMemory particleMemory[2];
+	VkBuffer counterBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory counterMemory = VK_NULL_HANDLE;
+	ParticleCounters *counters = nullptr;
+
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet sets[2];
+	VkPipeline simulatePipeline = VK_NULL_HANDLE;
+	VkPipeline finalizePipeline = VK_NULL_HANDLE;
+	VkPipeline drawPipeline = VK_NULL_HANDLE;
+
+	/* simulate, finalize, draw : requested at init, resolved by ready() */
+	PipelineState states[3];
+	PipelineFactory *factory = nullptr;
+	ThreadPool *pool = nullptr;
+	bool pipelinesFailed = false;
+
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	bool queryPending = false;
+
+	ParticlePushConstants constants;
+	uint32_t source = 0;
+
+	uint64_t frames = 0;
+	uint64_t simulatedParticles = 0;
+	double simulationMilliseconds = 0.0;
+	uint64_t timedFrames = 0;
+
+	void readStats ();
+	bool resolvePipelines (bool block);
+
+public:
+	/* false when the shaders are not compiled, the pipelines are created on pool */
+	bool init (const DeviceContext& context, PipelineFactory& pipelines, ThreadPool& pool, const RenderTarget& target,
+			uint32_t capacity, uint32_t emitPerFrame);
+	void destroy ();
+
+	/* shader hot reload, between two frames */
+	void swapPipelines (PipelineFactory& pipelines);
+
+	/*
+	 * Once a frame, drawing thread : true once the pipelines are there,
+	 * simulate and draw do nothing before. block waits for them, for runs
+	 * that must draw the same frames every time.
+	 */
+	bool ready (bool block = false);
+	bool enabled () const { return simulatePipeline != VK_NULL_HANDLE; }
+
+	void simulate (VkCommandBuffer commandBuffer, float deltaTime, float time, const glm::vec3& emitter);
+	void draw (VkCommandBuffer commandBuffer, CommandState& state, const glm::mat4& viewProjection);
+
+	/* per frame averages of the frames simulated so far */
+	double averageParticles () const { return frames > 0 ? (double) simulatedParticles / frames : 0.0; }
+	double averageMilliseconds () const { return timedFrames > 0 ? simulationMilliseconds / timedFrames : 0.0; }
+	uint32_t capacity () const { return constants.capacity; }
+};
@@ -0,0 +1,703 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+static_assert(sizeof(PipelineState) == (PIPELINE_MAX_STAGES + 2) * 8 + 96 * 4,
+		"PipelineState is hashed as bytes, it must not have padding");
+
+/* Static functions */
+
+/* VkPipelineCacheHeaderVersionOne, written by this device and driver */
+static bool cacheMatches (const std::vector<char>& data, const VkPhysicalDeviceProperties& properties)
+{
+	const size_t headerSize = 16 + VK_UUID_SIZE;
+	if (data.size() < headerSize)
+		return false;
+
+	uint32_t header[4];
+	memcpy(header, data.data(), sizeof(header));
+
+	return header[0] >= headerSize && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		header[2] == properties.vendorID && header[3] == properties.deviceID &&
+		memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static bool readSpirv (const std::string& path, std::vector<uint32_t>& code)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	/* SPIR-V is read as words */
+	code.assign(((size_t) file.tellg() + 3) / 4, 0);
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(code.data()), code.size() * 4);
+
+	return !code.empty();
+}
+
+/* the sub states a VkGraphicsPipelineCreateInfo points to, kept alive until the call */
+struct GraphicsCreateInfo
+{
+	VkPipelineShaderStageCreateInfo stages[PIPELINE_MAX_STAGES];
+	VkPipelineVertexInputStateCreateInfo vertexInput;
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+	VkPipelineViewportStateCreateInfo viewport;
+	VkPipelineRasterizationStateCreateInfo rasterizer;
+	VkPipelineMultisampleStateCreateInfo multisampling;
+	VkPipelineDepthStencilStateCreateInfo depthStencil;
+	VkPipelineColorBlendAttachmentState blendAttachment;
+	VkPipelineColorBlendStateCreateInfo blending;
+	VkPipelineDynamicStateCreateInfo dynamic;
+#ifdef VK_KHR_dynamic_rendering
+	VkPipelineRenderingCreateInfoKHR rendering;
+#endif
+};
+
+static const VkDynamicState dynamicStates[] = {
+	VK_DYNAMIC_STATE_VIEWPORT,
+	VK_DYNAMIC_STATE_SCISSOR
+};
+
+static void fillStages (const PipelineState& state, VkPipelineShaderStageCreateInfo *stages)
+{
+	for (uint32_t i = 0; i < state.stageCount; i++)
+	{
+		stages[i] = {};
+		stages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stages[i].stage = state.stages[i];
+		stages[i].module = state.modules[i];
+		stages[i].pName = "main";
+	}
+}
+
+static void fillGraphics (const PipelineState& state, GraphicsCreateInfo& storage, VkGraphicsPipelineCreateInfo& info)
+{
+	fillStages(state, storage.stages);
+
+	storage.vertexInput = {};
+	storage.vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	storage.vertexInput.vertexBindingDescriptionCount = state.bindingCount;
+	storage.vertexInput.pVertexBindingDescriptions = state.bindings;
+	storage.vertexInput.vertexAttributeDescriptionCount = state.attributeCount;
+	storage.vertexInput.pVertexAttributeDescriptions = state.attributes;
+
+	storage.inputAssembly = {};
+	storage.inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	storage.inputAssembly.topology = state.topology;
+	storage.inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	/* viewport and scissor are dynamic, only the counts matter */
+	storage.viewport = {};
+	storage.viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	storage.viewport.viewportCount = 1;
+	storage.viewport.scissorCount = 1;
+
+	storage.rasterizer = {};
+	storage.rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	storage.rasterizer.polygonMode = state.polygonMode;
+	storage.rasterizer.lineWidth = 1.0f;
+	storage.rasterizer.cullMode = state.cullMode;
+	storage.rasterizer.frontFace = state.frontFace;
+
+	storage.multisampling = {};
+	storage.multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	storage.multisampling.rasterizationSamples = state.samples;
+	storage.multisampling.minSampleShading = 1.0f;
+
+	storage.depthStencil = {};
+	storage.depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	storage.depthStencil.depthTestEnable = state.depthTest;
+	storage.depthStencil.depthWriteEnable = state.depthWrite;
+	storage.depthStencil.depthCompareOp = state.depthCompare;
+
+	storage.blendAttachment = {};
+	storage.blendAttachment.colorWriteMask = state.colorWriteMask;
+	storage.blendAttachment.blendEnable = state.blend;
+	storage.blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	storage.blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	storage.blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+	storage.blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	storage.blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	storage.blendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	storage.blending = {};
+	storage.blending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	storage.blending.logicOp = VK_LOGIC_OP_COPY;
+	storage.blending.attachmentCount = 1;
+	storage.blending.pAttachments = &storage.blendAttachment;
+
+	storage.dynamic = {};
+	storage.dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	storage.dynamic.dynamicStateCount = static_cast<uint32_t>(sizeof(dynamicStates) / sizeof(dynamicStates[0]));
+	storage.dynamic.pDynamicStates = dynamicStates;
+
+	/* mesh shading pipelines have no vertex input */
+	bool vertexInput = state.stages[0] == VK_SHADER_STAGE_VERTEX_BIT;
+
+	info = {};
+	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	info.stageCount = state.stageCount;
+	info.pStages = storage.stages;
+	info.pVertexInputState = vertexInput ? &storage.vertexInput : nullptr;
+	info.pInputAssemblyState = vertexInput ? &storage.inputAssembly : nullptr;
+	info.pViewportState = &storage.viewport;
+	info.pRasterizationState = &storage.rasterizer;
+	info.pMultisampleState = &storage.multisampling;
+	info.pDepthStencilState = &storage.depthStencil;
+	info.pColorBlendState = &storage.blending;
+	info.pDynamicState = &storage.dynamic;
+	info.layout = state.layout;
+	info.renderPass = state.renderPass;
+	info.subpass = state.subpass;
+	info.basePipelineHandle = VK_NULL_HANDLE;
+	info.basePipelineIndex = -1;
+
+#ifdef VK_KHR_dynamic_rendering
+	/* no render pass : the attachment formats stand for it, depth without stencil */
+	if (state.renderPass == VK_NULL_HANDLE)
+	{
+		storage.rendering = {};
+		storage.rendering.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+		storage.rendering.colorAttachmentCount = 1;
+		storage.rendering.pColorAttachmentFormats = &state.colorFormat;
+		storage.rendering.depthAttachmentFormat = state.depthFormat;
+		storage.rendering.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+		info.pNext = &storage.rendering;
+	}
+#endif
+}
+
+/* PipelineState */
+
+PipelineState::PipelineState ()
+{
+	memset(this, 0, sizeof(*this));
+
+	bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	polygonMode = VK_POLYGON_MODE_FILL;
+	cullMode = VK_CULL_MODE_BACK_BIT;
+	frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	samples = VK_SAMPLE_COUNT_1_BIT;
+	depthCompare = VK_COMPARE_OP_LESS;
+	colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+}
+
+void PipelineState::setTarget (const RenderTarget& target)
+{
+	renderPass = target.renderPass;
+	colorFormat = target.colorFormat;
+	depthFormat = target.depthFormat;
+	samples = target.samples;
+}
+
+void PipelineState::addStage (VkShaderStageFlagBits stage, VkShaderModule module)
+{
+	if (stageCount == PIPELINE_MAX_STAGES)
+		throw std::runtime_error("too many pipeline stages!");
+
+	stages[stageCount] = stage;
+	modules[stageCount] = module;
+	stageCount++;
+}
+
+void PipelineState::addBinding (uint32_t binding, uint32_t stride, VkVertexInputRate inputRate)
+{
+	if (bindingCount == PIPELINE_MAX_BINDINGS)
+		throw std::runtime_error("too many vertex bindings!");
+
+	bindings[bindingCount].binding = binding;
+	bindings[bindingCount].stride = stride;
+	bindings[bindingCount].inputRate = inputRate;
+	bindingCount++;
+}
+
+void PipelineState::addAttribute (uint32_t location, uint32_t binding, VkFormat format, uint32_t offset)
+{
+	if (attributeCount == PIPELINE_MAX_ATTRIBUTES)
+		throw std::runtime_error("too many vertex attributes!");
+
+	attributes[attributeCount].location = location;
+	attributes[attributeCount].binding = binding;
+	attributes[attributeCount].format = format;
+	attributes[attributeCount].offset = offset;
+	attributeCount++;
+}
+
+bool PipelineState::operator== (const PipelineState& other) const
+{
+	return memcmp(this, &other, sizeof(*this)) == 0;
+}
+
+/* FNV-1a, 8 bytes at a time */
+size_t PipelineStateHash::operator() (const PipelineState& state) const
+{
+	uint64_t words[sizeof(PipelineState) / 8];
+	memcpy(words, &state, sizeof(words));
+
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (uint64_t word : words)
+	{
+		hash ^= word;
+		hash *= 0x100000001B3ull;
+	}
+
+	return (size_t) (hash ^ (hash >> 32));
+}
+
+/* PipelineFactory */
+
+void PipelineFactory::init (const DeviceContext& deviceContext, const std::string& path)
+{
+	context = &deviceContext;
+	cachePath = path;
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+	std::vector<char> data;
+	if (!cachePath.empty())
+	{
+		std::ifstream file(cachePath, std::ios::ate | std::ios::binary);
+		if (file.is_open())
+		{
+			data.resize((size_t) file.tellg());
+			file.seekg(0);
+			file.read(data.data(), data.size());
+		}
+	}
+
+	/* another driver or device : drivers are meant to ignore the data, some do not */
+	if (cacheMatches(data, context->properties))
+	{
+		cacheInfo.initialDataSize = data.size();
+		cacheInfo.pInitialData = data.data();
+	}
+
+	if (vkCreatePipelineCache(context->device, &cacheInfo, context->allocator, &cache) != VK_SUCCESS)
+		throw std::runtime_error("failed to create pipeline cache!");
+}
+
+void PipelineFactory::destroy ()
+{
+	if (context == nullptr)
+		return;
+
+	for (auto& pipeline : pipelines)
+		vkDestroyPipeline(context->device, pipeline.second.pipeline, context->allocator);
+	for (auto& shader : shaders)
+		vkDestroyShaderModule(context->device, shader.second, context->allocator);
+
+	/* a reload nobody swapped in */
+	for (const Replacement& replacement : replacements)
+		vkDestroyPipeline(context->device, replacement.pipeline, context->allocator);
+	for (const ShaderSwap& swap : shaderSwaps)
+		vkDestroyShaderModule(context->device, swap.module, context->allocator);
+
+	if (!cachePath.empty())
+		saveCache();
+	vkDestroyPipelineCache(context->device, cache, context->allocator);
+
+	pipelines.clear();
+	shaders.clear();
+	replacements.clear();
+	shaderSwaps.clear();
+	replacementsReady = false;
+	cache = VK_NULL_HANDLE;
+	context = nullptr;
+}
+
+/* written aside then renamed : a crash while saving leaves the previous cache */
+void PipelineFactory::saveCache ()
+{
+	size_t size = 0;
+	if (vkGetPipelineCacheData(context->device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+		return;
+
+	std::vector<char> data(size);
+	if (vkGetPipelineCacheData(context->device, cache, &size, data.data()) != VK_SUCCESS)
+		return;
+
+	std::string temporary = cachePath + ".tmp";
+	std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+	file.write(data.data(), size);
+	file.close();
+
+	if (!file || std::rename(temporary.c_str(), cachePath.c_str()) != 0)
+		std::remove(temporary.c_str());
+}
+
+VkShaderModule PipelineFactory::loadShader (const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto found = shaders.find(path);
+	if (found != shaders.end())
+		return found->second;
+
+	std::vector<uint32_t> code;
+	if (!readSpirv(path, code))
+		return VK_NULL_HANDLE;
+
+	VkShaderModule module;
+	if (createModule(code, module) != VK_SUCCESS)
+		throw std::runtime_error("failed to create shader module!");
+
+	shaders[path] = module;
+	return module;
+}
+
+VkResult PipelineFactory::createModule (const std::vector<uint32_t>& code, VkShaderModule& module)
+{
+	VkShaderModuleCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size() * 4;
+	createInfo.pCode = code.data();
+
+	return vkCreateShaderModule(context->device, &createInfo, context->allocator, &module);
+}
+
+VkResult PipelineFactory::createGroup (const PipelineState *const *states, size_t count, VkPipeline *output)
+{
+	createCalls++;
+
+	/* the first pipeline is the parent, the others only differ in state a driver can share */
+	VkPipelineCreateFlags parentFlags = count > 1 ? VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT : 0;
+	VkPipelineCreateFlags childFlags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+
+	if (states[0]->bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE)
+	{
+		VkComputePipelineCreateInfo infos[PIPELINE_BATCH_SIZE];
+		for (size_t i = 0; i < count; i++)
+		{
+			infos[i] = {};
+			infos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+			infos[i].flags = i == 0 ? parentFlags : childFlags;
+			fillStages(*states[i], &infos[i].stage);
+			infos[i].layout = states[i]->layout;
+			infos[i].basePipelineHandle = VK_NULL_HANDLE;
+			infos[i].basePipelineIndex = i == 0 ? -1 : 0;
+		}
+
+		derivedPipelines += static_cast<uint32_t>(count - 1);
+		return vkCreateComputePipelines(context->device, cache, static_cast<uint32_t>(count), infos, context->allocator, output);
+	}
+
+	GraphicsCreateInfo storage[PIPELINE_BATCH_SIZE];
+	VkGraphicsPipelineCreateInfo infos[PIPELINE_BATCH_SIZE];
+	for (size_t i = 0; i < count; i++)
+	{
+		fillGraphics(*states[i], storage[i], infos[i]);
+		infos[i].flags = i == 0 ? parentFlags : childFlags;
+		infos[i].basePipelineIndex = i == 0 ? -1 : 0;
+	}
+
+	derivedPipelines += static_cast<uint32_t>(count - 1);
+	return vkCreateGraphicsPipelines(context->device, cache, static_cast<uint32_t>(count), infos, context->allocator, output);
+}
+
+void PipelineFactory::publish (const PipelineState& state, VkPipeline pipeline)
+{
+	if (pipeline == VK_NULL_HANDLE)
+		pipelines.erase(state);
+	else
+	{
+		Entry& entry = pipelines[state];
+		entry.pipeline = pipeline;
+		entry.ready = true;
+	}
+}
+
+/* VK_NULL_HANDLE when the creating thread failed */
+VkPipeline PipelineFactory::waitFor (std::unique_lock<std::mutex>& lock, const PipelineState& state)
+{
+	for (;;)
+	{
+		auto found = pipelines.find(state);
+		if (found == pipelines.end())
+			return VK_NULL_HANDLE;
+		if (found->second.ready)
+			return found->second.pipeline;
+
+		created.wait(lock);
+	}
+}
+
+VkPipeline PipelineFactory::get (const PipelineState& state)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	auto found = pipelines.find(state);
+	if (found != pipelines.end())
+	{
+		VkPipeline pipeline = waitFor(lock, state);
+		if (pipeline == VK_NULL_HANDLE)
+			throw std::runtime_error("failed to create pipeline!");
+		return pipeline;
+	}
+
+	Entry pending = { VK_NULL_HANDLE, false };
+	pipelines[state] = pending;
+	lock.unlock();
+
+	const PipelineState *states[] = { &state };
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	if (createGroup(states, 1, &pipeline) != VK_SUCCESS)
+		pipeline = VK_NULL_HANDLE;
+
+	lock.lock();
+	publish(state, pipeline);
+	created.notify_all();
+
+	if (pipeline == VK_NULL_HANDLE)
+		throw std::runtime_error("failed to create pipeline!");
+
+	return pipeline;
+}
+
+void PipelineFactory::createBatch (const std::vector<PipelineState>& states, ThreadPool& pool, VkPipeline *output)
+{
+	/* claim the states nobody has created or is creating yet */
+	std::vector<const PipelineState*> missing;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (const PipelineState& state : states)
+			if (pipelines.find(state) == pipelines.end())
+			{
+				Entry pending = { VK_NULL_HANDLE, false };
+				pipelines[state] = pending;
+				missing.push_back(&state);
+			}
+	}
+
+	/* compute apart from graphics, then by shaders : neighbours make good parents */
+	std::sort(missing.begin(), missing.end(), [] (const PipelineState *a, const PipelineState *b) {
+		if (a->bindPoint != b->bindPoint)
+			return a->bindPoint < b->bindPoint;
+		return memcmp(a->modules, b->modules, sizeof(a->modules)) < 0;
+	});
+
+	/* batches never mix bind points */
+	std::vector<size_t> batchStarts;
+	for (size_t i = 0; i < missing.size(); i++)
+		if (batchStarts.empty() || i - batchStarts.back() == PIPELINE_BATCH_SIZE || missing[i]->bindPoint != missing[i - 1]->bindPoint)
+			batchStarts.push_back(i);
+	batchStarts.push_back(missing.size());
+
+	std::vector<VkPipeline> results(missing.size(), VK_NULL_HANDLE);
+	pool.parallelFor(batchStarts.size() - 1, 1, [&] (size_t first, size_t last) {
+		for (size_t batch = first; batch < last; batch++)
+		{
+			size_t begin = batchStarts[batch];
+			size_t count = batchStarts[batch + 1] - begin;
+
+			if (createGroup(&missing[begin], count, &results[begin]) != VK_SUCCESS)
+				for (size_t i = begin; i < begin + count; i++)
+				{
+					if (results[i] != VK_NULL_HANDLE)
+						vkDestroyPipeline(context->device, results[i], context->allocator);
+					results[i] = VK_NULL_HANDLE;
+				}
+		}
+	});
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (size_t i = 0; i < missing.size(); i++)
+		publish(*missing[i], results[i]);
+	created.notify_all();
+
+	/* states claimed by other threads are waited for */
+	bool failed = false;
+	for (size_t i = 0; i < states.size(); i++)
+	{
+		output[i] = waitFor(lock, states[i]);
+		failed = failed || output[i] == VK_NULL_HANDLE;
+	}
+
+	if (failed)
+		throw std::runtime_error("failed to create pipelines!");
+}
+
+bool PipelineFactory::request (const PipelineState& state, ThreadPool& pool, VkPipeline& pipeline)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = pipelines.find(state);
+		if (found != pipelines.end())
+		{
+			pipeline = found->second.pipeline;
+			return found->second.ready;
+		}
+
+		Entry pending = { VK_NULL_HANDLE, false };
+		pipelines[state] = pending;
+	}
+
+	/* the task has its own copy of the state, the caller's may be gone by then */
+	pool.submit([this, state] () {
+		const PipelineState *states[] = { &state };
+		VkPipeline result = VK_NULL_HANDLE;
+		if (createGroup(states, 1, &result) != VK_SUCCESS)
+		{
+			result = VK_NULL_HANDLE;
+			std::cerr << "failed to create deferred pipeline!" << std::endl;
+		}
+
+		/* a failure stays in the table : asking again every frame would not help */
+		std::lock_guard<std::mutex> lock(mutex);
+		Entry& entry = pipelines[state];
+		entry.pipeline = result;
+		entry.ready = true;
+		created.notify_all();
+	});
+
+	pipeline = VK_NULL_HANDLE;
+	return false;
+}
+
+VkPipeline PipelineFactory::wait (const PipelineState& state)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	return waitFor(lock, state);
+}
+
+size_t PipelineFactory::size ()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pipelines.size();
+}
+
+/* Hot reload */
+
+bool PipelineFactory::reload (const std::vector<std::string>& paths, uint32_t& rebuilt)
+{
+	rebuilt = 0;
+
+	/* only the shaders some pipeline was created with */
+	std::vector<ShaderSwap> swaps;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (replacementsReady)
+			return false;
+
+		for (const std::string& path : paths)
+		{
+			auto found = shaders.find(path);
+			if (found != shaders.end())
+				swaps.push_back({path, VK_NULL_HANDLE, found->second});
+		}
+	}
+
+	bool ok = true;
+	std::vector<uint32_t> code;
+	for (ShaderSwap& swap : swaps)
+		ok = ok && readSpirv(swap.path, code) && createModule(code, swap.module) == VK_SUCCESS;
+
+	std::vector<Replacement> recreated;
+	if (ok)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		/* deferred pipelines still being created with the old modules : they are replaced too */
+		created.wait(lock, [&] {
+			for (const auto& pipeline : pipelines)
+				if (!pipeline.second.ready)
+					for (uint32_t i = 0; i < pipeline.first.stageCount; i++)
+						for (const ShaderSwap& swap : swaps)
+							if (pipeline.first.modules[i] == swap.previous)
+								return false;
+			return true;
+		});
+
+		for (const auto& pipeline : pipelines)
+		{
+			/* pending ones do not use the shaders, failed ones have nothing to replace */
+			if (!pipeline.second.ready || pipeline.second.pipeline == VK_NULL_HANDLE)
+				continue;
+
+			Replacement replacement = {pipeline.first, pipeline.first, VK_NULL_HANDLE, pipeline.second.pipeline};
+			bool uses = false;
+			for (uint32_t i = 0; i < replacement.state.stageCount; i++)
+				for (const ShaderSwap& swap : swaps)
+					if (replacement.state.modules[i] == swap.previous)
+					{
+						replacement.state.modules[i] = swap.module;
+						uses = true;
+					}
+
+			if (uses)
+				recreated.push_back(replacement);
+		}
+	}
+
+	/* one at a time, no derivatives : they are few, and the old ones stay in use meanwhile */
+	for (Replacement& replacement : recreated)
+	{
+		const PipelineState *states[] = { &replacement.state };
+		ok = ok && createGroup(states, 1, &replacement.pipeline) == VK_SUCCESS;
+	}
+
+	if (!ok)
+	{
+		for (const Replacement& replacement : recreated)
+			if (replacement.pipeline != VK_NULL_HANDLE)
+				vkDestroyPipeline(context->device, replacement.pipeline, context->allocator);
+		for (const ShaderSwap& swap : swaps)
+			if (swap.module != VK_NULL_HANDLE)
+				vkDestroyShaderModule(context->device, swap.module, context->allocator);
+		return false;
+	}
+
+	rebuilt = static_cast<uint32_t>(recreated.size());
+
+	std::lock_guard<std::mutex> lock(mutex);
+	replacements.swap(recreated);
+	shaderSwaps.swap(swaps);
+	replacementsReady = !shaderSwaps.empty();
+	return true;
+}
+
+void PipelineFactory::swap (VkPipeline& handle)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (const Replacement& replacement : replacements)
+		if (replacement.previous == handle)
+		{
+			handle = replacement.pipeline;
+			return;
+		}
+}
+
+void PipelineFactory::commitReplacements (std::vector<VkPipeline>& retired)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (const Replacement& replacement : replacements)
+	{
+		pipelines.erase(replacement.previousState);
+		Entry entry = { replacement.pipeline, true };
+		pipelines[replacement.state] = entry;
+		retired.push_back(replacement.previous);
+	}
+
+	/* pipelines do not need their modules once created */
+	for (const ShaderSwap& swap : shaderSwaps)
+	{
+		shaders[swap.path] = swap.module;
+		vkDestroyShaderModule(context->device, swap.previous, context->allocator);
+	}
+
+	replacements.clear();
+	shaderSwaps.clear();
+	replacementsReady = false;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "device.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const uint32_t PIPELINE_MAX_STAGES = 3;
+const uint32_t PIPELINE_MAX_BINDINGS = 4;
+const uint32_t PIPELINE_MAX_ATTRIBUTES = 16;
+
+/* create infos per vkCreate*Pipelines call : the first one is the parent the others derive from */
+const uint32_t PIPELINE_BATCH_SIZE = 16;
+
+/* what graphics pipelines draw into : a render pass, or with dynamic rendering no render pass and the formats alone */
+struct RenderTarget
+{
+	VkRenderPass renderPass;
+	VkFormat colorFormat;
+	VkFormat depthFormat;
+	VkSampleCountFlagBits samples;
+};
+
+/*
+ * Everything that defines a pipeline, by value. The constructor zero fills it
+ * and it has no padding, so it is hashed and compared as bytes. Shader modules
+ * come from PipelineFactory::loadShader and live as long as the factory. A
+ * compute pipeline only uses its stage and layout.
+ *
+ * Viewport and scissor are always dynamic.
+ */
+struct PipelineState
+{
+	VkShaderModule modules[PIPELINE_MAX_STAGES];
+	VkPipelineLayout layout;
+	VkRenderPass renderPass;
+	VkFormat colorFormat;		/* dynamic rendering, when there is no render pass */
+	VkFormat depthFormat;
+
+	VkPipelineBindPoint bindPoint;
+	uint32_t stageCount;
+	VkShaderStageFlagBits stages[PIPELINE_MAX_STAGES];
+	uint32_t subpass;
+
+	uint32_t bindingCount;
+	VkVertexInputBindingDescription bindings[PIPELINE_MAX_BINDINGS];
+	uint32_t attributeCount;
+	VkVertexInputAttributeDescription attributes[PIPELINE_MAX_ATTRIBUTES];
+
+	VkPrimitiveTopology topology;
+	VkPolygonMode polygonMode;
+	VkCullModeFlags cullMode;
+	VkFrontFace frontFace;
+	VkSampleCountFlagBits samples;
+	VkBool32 depthTest;
+	VkBool32 depthWrite;
+	VkCompareOp depthCompare;
+	VkBool32 blend;				/* premultiplied alpha */
+	VkColorComponentFlags colorWriteMask;
+
+	PipelineState ();
+
+	void setTarget (const RenderTarget& target);
+	void addStage (VkShaderStageFlagBits stage, VkShaderModule module);
+	void addBinding (uint32_t binding, uint32_t stride, VkVertexInputRate inputRate);
+	void addAttribute (uint32_t location, uint32_t binding, VkFormat format, uint32_t offset);
+
+	bool operator== (const PipelineState& other) const;
+};
+
+struct PipelineStateHash
+{
+	size_t operator() (const PipelineState& state) const;
+};
+
+/*
+ * Creates and owns pipelines, keyed by their state. Lookups and creations are
+ * safe from any thread : a state another thread is already creating is waited
+ * for, never created twice. createBatch groups the missing states by shaders,
+ * creates each group with one call as a parent and its derivatives, and runs
+ * the groups on the thread pool. All calls share one VkPipelineCache.
+ *
+ * request() is the deferred path : the state is created by a task on the
+ * pool and the caller asks again later, a frame that does not have it yet
+ * goes without. A state that failed there stays failed.
+ *
+ * The cache is read from a file at init() and written back at destroy() when
+ * given one : on a warm start the driver mostly finds what it compiled before.
+ *
+ * Hot reload : reload() takes rebuilt SPIR-V files and recreates every
+ * pipeline using them aside, on the calling thread. The holders of the old
+ * handles swap() them at a frame boundary, then commitReplacements() hands
+ * the old pipelines over for retirement. A failed module or pipeline leaves
+ * everything as it was.
+ */
+
+class PipelineFactory
+{
+private:
+	struct Entry
+	{
+		VkPipeline pipeline;
+		bool ready;
+	};
+
+	struct Replacement
+	{
+		PipelineState state;
+		PipelineState previousState;
+		VkPipeline pipeline;
+		VkPipeline previous;
+	};
+
+	struct ShaderSwap
+	{
+		std::string path;
+		VkShaderModule module;
+		VkShaderModule previous;
+	};
+
+	const DeviceContext *context = nullptr;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string cachePath;
+
+	std::mutex mutex;
+	std::condition_variable created;
+	std::unordered_map<PipelineState, Entry, PipelineStateHash> pipelines;
+	std::unordered_map<std::string, VkShaderModule> shaders;
+
+	std::atomic<uint32_t> createCalls;
+	std::atomic<uint32_t> derivedPipelines;
+
+	std::vector<Replacement> replacements;
+	std::vector<ShaderSwap> shaderSwaps;
+	std::atomic<bool> replacementsReady;
+
+	/* one vkCreate*Pipelines call, every state has the same bind point */
+	VkResult createGroup (const PipelineState *const *states, size_t count, VkPipeline *output);
+	void publish (const PipelineState& state, VkPipeline pipeline);
+	VkPipeline waitFor (std::unique_lock<std::mutex>& lock, const PipelineState& state);
+	VkResult createModule (const std::vector<uint32_t>& code, VkShaderModule& module);
+	void saveCache ();
+
+public:
+	PipelineFactory () : createCalls(0), derivedPipelines(0), replacementsReady(false) {}
+
+	/* path : the cache file, none when empty */
+	void init (const DeviceContext& context, const std::string& cachePath = std::string());
+	void destroy ();
+
+	/* SPIR-V file to a module owned by the factory, VK_NULL_HANDLE when the file is missing */
+	VkShaderModule loadShader (const std::string& path);
+
+	/* cached, or created on the calling thread */
+	VkPipeline get (const PipelineState& state);
+
+	/* output[i] for states[i], the missing ones created PIPELINE_BATCH_SIZE per call over the pool */
+	void createBatch (const std::vector<PipelineState>& states, ThreadPool& pool, VkPipeline *output);
+
+	/*
+	 * Never blocks : false while the state is being created, started on the
+	 * pool by the first call. Once true, pipeline is the result, VK_NULL_HANDLE
+	 * when it failed. The pool is waited for before destroy().
+	 */
+	bool request (const PipelineState& state, ThreadPool& pool, VkPipeline& pipeline);
+
+	/* blocks until a requested state is created, VK_NULL_HANDLE when it failed or was never asked for */
+	VkPipeline wait (const PipelineState& state);
+
+	/*
+	 * Any thread but the drawing one, one reload at a time : the pipelines
+	 * that use one of the SPIR-V paths loaded so far, recreated with the new
+	 * code. False when they could not be, rebuilt is how many were.
+	 */
+	bool reload (const std::vector<std::string>& paths, uint32_t& rebuilt);
+
+	/* frame boundary, drawing thread : a reload is waiting to be swapped in */
+	bool hasReplacements () const { return replacementsReady.load(); }
+
+	/* handle becomes its replacement, when it has one */
+	void swap (VkPipeline& handle);
+
+	/* after every holder swapped : the replaced pipelines go to retired, to destroy once unused */
+	void commitReplacements (std::vector<VkPipeline>& retired);
+
+	size_t size ();
+	uint32_t calls () const { return createCalls.load(); }
+	uint32_t derived () const { return derivedPipelines.load(); }
+};
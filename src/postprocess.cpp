@@ -0,0 +1,505 @@
+#include "postprocess.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+/* the hardware encodes on write : the shaders must not */
+static bool isSrgbFormat (VkFormat format)
+{
+	return format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_A8B8G8R8_SRGB_PACK32;
+}
+
+/* PostProcess */
+
+void PostProcess::init (const DeviceContext& deviceContext, DeletionQueue& queue, const PostSettings& postSettings)
+{
+	context = &deviceContext;
+	deletionQueue = &queue;
+	settings = postSettings;
+	settings.bloomLevels = std::max(1u, std::min(settings.bloomLevels, POST_MAX_BLOOM_LEVELS));
+	storageWithoutFormat = context->enabledFeatures.shaderStorageImageWriteWithoutFormat == VK_TRUE;
+
+	/* the particles blend into it and the bloom filters it : B10G11R11 is half the size when it can do both */
+	const VkFormatFeatureFlags hdrFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT |
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT;
+	hdrFormat = context->formatSupports(VK_FORMAT_B10G11R11_UFLOAT_PACK32, hdrFeatures) ?
+			VK_FORMAT_B10G11R11_UFLOAT_PACK32 : VK_FORMAT_R16G16B16A16_SFLOAT;
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = (float) POST_MAX_BLOOM_LEVELS;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+
+	if (vkCreateSampler(context->device, &samplerInfo, context->allocator, &sampler) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post processing sampler!");
+
+	/* the scene, the bloom pyramid, the image the pass writes */
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = i < 2 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(context->device, &layoutInfo, context->allocator, &setLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post processing descriptor set layout!");
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PostPushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(context->device, &pipelineLayoutInfo, context->allocator, &pipelineLayout) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post processing pipeline layout!");
+
+	/* timestamps between the passes, when the graphics queue has them */
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, families.data());
+
+	if (context->graphicsFamily < familyCount && families[context->graphicsFamily].timestampValidBits > 0)
+	{
+		VkQueryPoolCreateInfo queryInfo = {};
+		queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryInfo.queryCount = POST_TIMESTAMP_COUNT;
+
+		if (vkCreateQueryPool(context->device, &queryInfo, context->allocator, &queryPool) != VK_SUCCESS)
+			throw std::runtime_error("failed to create post processing query pool!");
+	}
+
+	memset(passMilliseconds, 0, sizeof(passMilliseconds));
+}
+
+void PostProcess::destroy ()
+{
+	if (context == nullptr)
+		return;
+
+	/* images, views and the descriptor pool go to the deletion queue, flushed by the caller */
+	levelSets.clear();
+	outputSets.clear();
+	descriptorPool.reset();
+	bloomLevelViews.clear();
+	ldrView.reset();
+	ldrImage.reset();
+	ldrMemory.reset();
+	bloomView.reset();
+	bloomImage.reset();
+	bloomMemory.reset();
+	hdrView.reset();
+	hdrImage.reset();
+	hdrMemory.reset();
+
+	/* pipelines belong to the factory */
+	vkDestroyQueryPool(context->device, queryPool, context->allocator);
+	vkDestroyPipelineLayout(context->device, pipelineLayout, context->allocator);
+	vkDestroyDescriptorSetLayout(context->device, setLayout, context->allocator);
+	vkDestroySampler(context->device, sampler, context->allocator);
+
+	downPipeline = upPipeline = compositePipeline = VK_NULL_HANDLE;
+	context = nullptr;
+}
+
+void PostProcess::createPipelines (PipelineFactory& pipelines)
+{
+	VkShaderModule shaders[3] =
+	{
+		pipelines.loadShader("assets/shaders/bloom_down_comp.spv"),
+		pipelines.loadShader("assets/shaders/bloom_up_comp.spv"),
+		pipelines.loadShader("assets/shaders/composite_comp.spv")
+	};
+
+	for (VkShaderModule shader : shaders)
+		if (shader == VK_NULL_HANDLE)
+			return;
+
+	VkPipeline created[3];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		PipelineState state;
+		state.bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+		state.addStage(VK_SHADER_STAGE_COMPUTE_BIT, shaders[i]);
+		state.layout = pipelineLayout;
+		created[i] = pipelines.get(state);
+	}
+
+	downPipeline = created[0];
+	upPipeline = created[1];
+	compositePipeline = created[2];
+}
+
+void PostProcess::swapPipelines (PipelineFactory& pipelines)
+{
+	pipelines.swap(downPipeline);
+	pipelines.swap(upPipeline);
+	pipelines.swap(compositePipeline);
+}
+
+void PostProcess::resize (VkExtent2D size, const std::vector<VkImage>& images, const std::vector<VkImageView>& swapChainViews,
+		VkFormat swapChainFormat, VkImageUsageFlags swapChainUsage)
+{
+	extent = size;
+	swapChainImages = images;
+
+	/* composite.comp writes without a format : the swap chain formats have no GLSL qualifier */
+	bool compute = compositePipeline != VK_NULL_HANDLE && storageWithoutFormat;
+	bool blit = (swapChainUsage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) && context->formatSupports(swapChainFormat, VK_FORMAT_FEATURE_BLIT_DST_BIT);
+
+	if (compute && (swapChainUsage & VK_IMAGE_USAGE_STORAGE_BIT) && context->formatSupports(swapChainFormat, VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+		outputPath = POST_PATH_COMPUTE;
+	else if (compute && blit)
+		outputPath = POST_PATH_COMPUTE_BLIT;
+	else if (blit)
+		outputPath = POST_PATH_BLIT;
+	else
+		throw std::runtime_error("failed to find a way to write the swap chain images!");
+
+	/* an sRGB swap chain encodes itself, through the blit for the intermediate */
+	bool encode = !isSrgbFormat(swapChainFormat);
+	ldrFormat = encode ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R16G16B16A16_SFLOAT;
+	outputFlags = (encode ? POST_FLAG_ENCODE_SRGB : 0) | (settings.fxaa ? POST_FLAG_FXAA : 0);
+
+	/* half resolution down to 1x1 at most */
+	uint32_t width = std::max(extent.width / 2, 1u);
+	uint32_t height = std::max(extent.height / 2, 1u);
+	bloomLevels = 0;
+	while (bloomLevels < settings.bloomLevels)
+	{
+		bloomExtents[bloomLevels++] = {width, height};
+		if (width == 1 && height == 1)
+			break;
+
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+
+	createTargets();
+	createDescriptorSets(swapChainViews);
+}
+
+void PostProcess::createTargets ()
+{
+	VkImage image;
+	VkDeviceMemory memory;
+
+	context->createImage(extent.width, extent.height, hdrFormat,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory, 1, VK_SAMPLE_COUNT_1_BIT, MEMORY_CATEGORY_RENDER_TARGET);
+	hdrImage = Unique<VkImage>(*deletionQueue, image);
+	hdrMemory = Unique<VkDeviceMemory>(*deletionQueue, memory);
+	hdrView = Unique<VkImageView>(*deletionQueue, context->createImageView(image, hdrFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1));
+
+	bloomLevelViews.clear();
+	if (outputPath == POST_PATH_BLIT)
+	{
+		bloomView.reset();
+		bloomImage.reset();
+		bloomMemory.reset();
+	}
+	else
+	{
+		/* every level written as a storage image, and sampled by the next pass */
+		const VkFormat bloomFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+		context->createImage(bloomExtents[0].width, bloomExtents[0].height, bloomFormat,
+				VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory, bloomLevels,
+				VK_SAMPLE_COUNT_1_BIT, MEMORY_CATEGORY_RENDER_TARGET);
+		bloomImage = Unique<VkImage>(*deletionQueue, image);
+		bloomMemory = Unique<VkDeviceMemory>(*deletionQueue, memory);
+		bloomView = Unique<VkImageView>(*deletionQueue, context->createImageView(image, bloomFormat, VK_IMAGE_ASPECT_COLOR_BIT, bloomLevels));
+
+		for (uint32_t i = 0; i < bloomLevels; i++)
+			bloomLevelViews.push_back(Unique<VkImageView>(*deletionQueue,
+					context->createImageView(image, bloomFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1, i)));
+	}
+
+	if (outputPath == POST_PATH_COMPUTE_BLIT)
+	{
+		context->createImage(extent.width, extent.height, ldrFormat, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory, 1, VK_SAMPLE_COUNT_1_BIT, MEMORY_CATEGORY_RENDER_TARGET);
+		ldrImage = Unique<VkImage>(*deletionQueue, image);
+		ldrMemory = Unique<VkDeviceMemory>(*deletionQueue, memory);
+		ldrView = Unique<VkImageView>(*deletionQueue, context->createImageView(image, ldrFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1));
+	}
+	else
+	{
+		ldrView.reset();
+		ldrImage.reset();
+		ldrMemory.reset();
+	}
+}
+
+void PostProcess::createDescriptorSets (const std::vector<VkImageView>& swapChainViews)
+{
+	levelSets.clear();
+	outputSets.clear();
+	descriptorPool.reset();
+
+	if (outputPath == POST_PATH_BLIT)
+		return;
+
+	std::vector<VkImageView> targets;
+	for (uint32_t i = 0; i < bloomLevels; i++)
+		targets.push_back(bloomLevelViews[i]);
+
+	if (outputPath == POST_PATH_COMPUTE)
+		targets.insert(targets.end(), swapChainViews.begin(), swapChainViews.end());
+	else
+		targets.push_back(ldrView);
+
+	uint32_t setCount = static_cast<uint32_t>(targets.size());
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = 2 * setCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = setCount;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = setCount;
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(context->device, &poolInfo, context->allocator, &pool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create post processing descriptor pool!");
+
+	descriptorPool = Unique<VkDescriptorPool>(*deletionQueue, pool);
+
+	std::vector<VkDescriptorSetLayout> setLayouts(setCount, setLayout);
+	std::vector<VkDescriptorSet> sets(setCount);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = pool;
+	allocInfo.descriptorSetCount = setCount;
+	allocInfo.pSetLayouts = setLayouts.data();
+
+	if (vkAllocateDescriptorSets(context->device, &allocInfo, sets.data()) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate post processing descriptor sets!");
+
+	/* storage images and the pyramid stay in GENERAL, the scene is left readable by the render pass */
+	for (uint32_t i = 0; i < setCount; i++)
+	{
+		VkDescriptorImageInfo imageInfos[3] = {};
+		imageInfos[0].sampler = sampler;
+		imageInfos[0].imageView = hdrView;
+		imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[1].sampler = sampler;
+		imageInfos[1].imageView = bloomView;
+		imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageInfos[2].imageView = targets[i];
+		imageInfos[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet writes[3] = {};
+		for (uint32_t binding = 0; binding < 3; binding++)
+		{
+			writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[binding].dstSet = sets[i];
+			writes[binding].dstBinding = binding;
+			writes[binding].descriptorCount = 1;
+			writes[binding].descriptorType = binding < 2 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[binding].pImageInfo = &imageInfos[binding];
+		}
+		vkUpdateDescriptorSets(context->device, 3, writes, 0, nullptr);
+	}
+
+	levelSets.assign(sets.begin(), sets.begin() + bloomLevels);
+	outputSets.assign(sets.begin() + bloomLevels, sets.end());
+}
+
+/* the previous frame is idle : its timestamps are final */
+void PostProcess::readStats ()
+{
+	if (!queryPending)
+		return;
+
+	uint64_t timestamps[POST_TIMESTAMP_COUNT];
+	if (vkGetQueryPoolResults(context->device, queryPool, 0, POST_TIMESTAMP_COUNT, sizeof(timestamps), timestamps, sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	{
+		/* a pass is the interval that ends at its timestamp */
+		for (uint32_t i = 1; i < POST_TIMESTAMP_COUNT; i++)
+			passMilliseconds[i] += (timestamps[i] - timestamps[i - 1]) * context->properties.limits.timestampPeriod * 1e-6;
+		timedFrames++;
+	}
+
+	queryPending = false;
+}
+
+void PostProcess::dispatch (VkCommandBuffer commandBuffer, VkDescriptorSet set, const PostPushConstants& constants,
+		VkExtent2D size, uint32_t groupSize)
+{
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, (size.width + groupSize - 1) / groupSize, (size.height + groupSize - 1) / groupSize, 1);
+}
+
+void PostProcess::copyToSwapChain (VkCommandBuffer commandBuffer, VkImage source, VkExtent2D sourceExtent, VkImageLayout sourceLayout,
+		VkAccessFlags sourceAccess, VkPipelineStageFlags sourceStage, uint32_t imageIndex)
+{
+	VkImage target = swapChainImages[imageIndex];
+
+	imageBarrier(commandBuffer, source, 0, 1, sourceLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			sourceAccess, VK_ACCESS_TRANSFER_READ_BIT, sourceStage, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	imageBarrier(commandBuffer, target, 0, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	/* same size : a copy with format conversion, smaller : a bilinear upscale */
+	bool scaled = sourceExtent.width != extent.width || sourceExtent.height != extent.height;
+
+	VkImageBlit region = {};
+	region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.srcSubresource.layerCount = 1;
+	region.srcOffsets[1] = {(int32_t) sourceExtent.width, (int32_t) sourceExtent.height, 1};
+	region.dstSubresource = region.srcSubresource;
+	region.dstOffsets[1] = {(int32_t) extent.width, (int32_t) extent.height, 1};
+
+	vkCmdBlitImage(commandBuffer, source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &region, scaled ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
+
+	imageBarrier(commandBuffer, target, 0, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+/* the settings every pass reads, the texel sizes and flags are set per dispatch */
+PostPushConstants PostProcess::pushConstants (VkExtent2D sceneExtent) const
+{
+	PostPushConstants constants = {};
+	constants.threshold = settings.bloomThreshold;
+	constants.intensity = settings.bloomIntensity / bloomLevels;
+	constants.exposure = settings.exposure;
+	constants.sceneScale = glm::vec2((float) sceneExtent.width / extent.width, (float) sceneExtent.height / extent.height);
+	return constants;
+}
+
+void PostProcess::recordBloom (VkCommandBuffer commandBuffer, VkExtent2D sceneExtent)
+{
+	readStats();
+
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, queryPool, 0, POST_TIMESTAMP_COUNT);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, queryPool, POST_TIMESTAMP_START);
+	}
+
+	if (outputPath == POST_PATH_BLIT)
+	{
+		/* the passes that did not run take no time */
+		if (queryPool != VK_NULL_HANDLE)
+			for (uint32_t i = POST_TIMESTAMP_BLOOM_DOWN; i <= POST_TIMESTAMP_BLOOM_UP; i++)
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, queryPool, i);
+		return;
+	}
+
+	PostPushConstants constants = pushConstants(sceneExtent);
+
+	/* rewritten every frame : the previous contents are dropped */
+	imageBarrier(commandBuffer, bloomImage, 0, bloomLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+			0, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downPipeline);
+	for (uint32_t i = 0; i < bloomLevels; i++)
+	{
+		VkExtent2D source = i == 0 ? extent : bloomExtents[i - 1];
+		constants.texelSize = glm::vec4(1.0f / bloomExtents[i].width, 1.0f / bloomExtents[i].height,
+				1.0f / source.width, 1.0f / source.height);
+		constants.sourceLevel = i == 0 ? 0 : i - 1;
+		constants.flags = i == 0 ? POST_FLAG_PREFILTER : 0;
+
+		dispatch(commandBuffer, levelSets[i], constants, bloomExtents[i], POST_GROUP_SIZE);
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	if (queryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, queryPool, POST_TIMESTAMP_BLOOM_DOWN);
+
+	/* level 1 last : composite.comp adds it to level 0 itself */
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, upPipeline);
+	for (uint32_t i = bloomLevels - 1; i > 1; i--)
+	{
+		uint32_t target = i - 1;
+		constants.texelSize = glm::vec4(1.0f / bloomExtents[target].width, 1.0f / bloomExtents[target].height,
+				1.0f / bloomExtents[i].width, 1.0f / bloomExtents[i].height);
+		constants.sourceLevel = i;
+		constants.flags = 0;
+
+		dispatch(commandBuffer, levelSets[target], constants, bloomExtents[target], POST_GROUP_SIZE);
+		memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
+
+	if (queryPool != VK_NULL_HANDLE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, queryPool, POST_TIMESTAMP_BLOOM_UP);
+}
+
+void PostProcess::recordOutput (VkCommandBuffer commandBuffer, uint32_t imageIndex, VkExtent2D sceneExtent)
+{
+	if (outputPath == POST_PATH_BLIT)
+	{
+		if (queryPool != VK_NULL_HANDLE)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, queryPool, POST_TIMESTAMP_COMPOSITE);
+
+		copyToSwapChain(commandBuffer, hdrImage, sceneExtent, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, imageIndex);
+	}
+	else
+	{
+		PostPushConstants constants = pushConstants(sceneExtent);
+
+		/* the swap chain image waited for its semaphore at the compute stage */
+		VkImage output = outputPath == POST_PATH_COMPUTE ? swapChainImages[imageIndex] : ldrImage.get();
+		imageBarrier(commandBuffer, output, 0, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+				0, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+		bool upsample = bloomLevels > 1;
+		constants.texelSize = glm::vec4(1.0f / extent.width, 1.0f / extent.height,
+				upsample ? 1.0f / bloomExtents[1].width : 0.0f, upsample ? 1.0f / bloomExtents[1].height : 0.0f);
+		constants.sourceLevel = 1;
+		constants.flags = outputFlags | (upsample ? POST_FLAG_BLOOM_UPSAMPLE : 0);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compositePipeline);
+		dispatch(commandBuffer, outputSets[outputPath == POST_PATH_COMPUTE ? imageIndex : 0], constants, extent, POST_TILE_SIZE);
+
+		if (queryPool != VK_NULL_HANDLE)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, queryPool, POST_TIMESTAMP_COMPOSITE);
+
+		if (outputPath == POST_PATH_COMPUTE)
+			imageBarrier(commandBuffer, output, 0, 1, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+					VK_ACCESS_SHADER_WRITE_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+		else
+			copyToSwapChain(commandBuffer, output, extent, VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_SHADER_WRITE_BIT,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, imageIndex);
+	}
+
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, POST_TIMESTAMP_COPY);
+		queryPending = true;
+	}
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "device.h"
+#include "lifetime.h"
+#include "pipeline.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include <algorithm>
+#include <vector>
+
+/* post.glsl */
+const uint32_t POST_GROUP_SIZE = 8;
+const uint32_t POST_TILE_SIZE = 16;
+const uint32_t POST_MAX_BLOOM_LEVELS = 8;
+
+enum PostFlags
+{
+	POST_FLAG_PREFILTER = 1,
+	POST_FLAG_ENCODE_SRGB = 2,
+	POST_FLAG_FXAA = 4,
+	POST_FLAG_BLOOM_UPSAMPLE = 8
+};
+
+struct PostPushConstants
+{
+	glm::vec4 texelSize;		/* 1 / target size, 1 / source size */
+	float threshold;
+	float intensity;
+	float exposure;
+	uint32_t sourceLevel;
+	uint32_t flags;
+	uint32_t padding;
+	glm::vec2 sceneScale;		/* the part of the HDR image the scene was drawn into */
+};
+
+struct PostSettings
+{
+	float exposure;
+	float bloomThreshold;
+	float bloomIntensity;
+	uint32_t bloomLevels;
+	bool fxaa;
+};
+
+/* how the HDR image reaches the swap chain */
+enum PostPath
+{
+	POST_PATH_COMPUTE,			/* the composite pass writes the swap chain image */
+	POST_PATH_COMPUTE_BLIT,		/* it writes an intermediate, blitted to the swap chain image */
+	POST_PATH_BLIT				/* no compute : the HDR image is blitted, clamped, without post processing */
+};
+
+/* timestamps of a frame, the passes are the intervals between them */
+enum PostTimestamp
+{
+	POST_TIMESTAMP_START,
+	POST_TIMESTAMP_BLOOM_DOWN,
+	POST_TIMESTAMP_BLOOM_UP,
+	POST_TIMESTAMP_COMPOSITE,
+	POST_TIMESTAMP_COPY,
+	POST_TIMESTAMP_COUNT
+};
+
+/*
+ * The HDR color target the render pass draws into, and the compute passes
+ * that turn it into the swap chain image : the bloom pyramid is built down
+ * from the scene (bloom_down.comp, the first level thresholded) and added back
+ * up (bloom_up.comp), then composite.comp does the last upsample, exposure,
+ * tonemap, FXAA and sRGB encode in one dispatch.
+ *
+ * With dynamic resolution the scene only covers part of the HDR image : the
+ * first bloom level and the composite read that part, bilinearly filtered,
+ * and the blit path stretches it.
+ *
+ * The render pass leaves the HDR image in SHADER_READ_ONLY_OPTIMAL.
+ * recordBloom() goes after the render pass and does not touch the swap chain
+ * image. recordOutput() follows it and leaves that image ready to present.
+ * Targets and descriptor sets follow the swap chain through resize(), the old
+ * ones retired to the deletion queue.
+ */
+
+class PostProcess
+{
+private:
+	const DeviceContext *context = nullptr;
+	DeletionQueue *deletionQueue = nullptr;
+	PostSettings settings;
+
+	VkFormat hdrFormat = VK_FORMAT_UNDEFINED;
+	VkFormat ldrFormat = VK_FORMAT_UNDEFINED;
+	bool storageWithoutFormat = false;
+
+	VkSampler sampler = VK_NULL_HANDLE;
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline downPipeline = VK_NULL_HANDLE;
+	VkPipeline upPipeline = VK_NULL_HANDLE;
+	VkPipeline compositePipeline = VK_NULL_HANDLE;
+
+	PostPath outputPath = POST_PATH_BLIT;
+	VkExtent2D extent = {0, 0};
+	uint32_t bloomLevels = 0;
+	VkExtent2D bloomExtents[POST_MAX_BLOOM_LEVELS];
+	uint32_t outputFlags = 0;
+
+	Unique<VkImage> hdrImage;
+	Unique<VkDeviceMemory> hdrMemory;
+	Unique<VkImageView> hdrView;
+	Unique<VkImage> bloomImage;
+	Unique<VkDeviceMemory> bloomMemory;
+	Unique<VkImageView> bloomView;
+	std::vector<Unique<VkImageView>> bloomLevelViews;
+	Unique<VkImage> ldrImage;
+	Unique<VkDeviceMemory> ldrMemory;
+	Unique<VkImageView> ldrView;
+
+	/* not owned */
+	std::vector<VkImage> swapChainImages;
+
+	/* a set per bloom level, then the composite sets : one per swap chain image, or one for the intermediate */
+	Unique<VkDescriptorPool> descriptorPool;
+	std::vector<VkDescriptorSet> levelSets;
+	std::vector<VkDescriptorSet> outputSets;
+
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	bool queryPending = false;
+	double passMilliseconds[POST_TIMESTAMP_COUNT];
+	uint64_t timedFrames = 0;
+
+	void createTargets ();
+	void createDescriptorSets (const std::vector<VkImageView>& swapChainViews);
+	void dispatch (VkCommandBuffer commandBuffer, VkDescriptorSet set, const PostPushConstants& constants, VkExtent2D size, uint32_t groupSize);
+	void copyToSwapChain (VkCommandBuffer commandBuffer, VkImage source, VkExtent2D sourceExtent, VkImageLayout sourceLayout,
+			VkAccessFlags sourceAccess, VkPipelineStageFlags sourceStage, uint32_t imageIndex);
+	void readStats ();
+	PostPushConstants pushConstants (VkExtent2D sceneExtent) const;
+
+public:
+	/* picks the HDR format : needed by the render pass, before anything else */
+	void init (const DeviceContext& context, DeletionQueue& deletionQueue, const PostSettings& settings);
+	void destroy ();
+
+	/* the compute path only when the shaders are compiled */
+	void createPipelines (PipelineFactory& pipelines);
+
+	/* shader hot reload, between two frames */
+	void swapPipelines (PipelineFactory& pipelines);
+
+	/* usage is what the swap chain images were created with : it picks the path */
+	void resize (VkExtent2D extent, const std::vector<VkImage>& swapChainImages, const std::vector<VkImageView>& swapChainViews,
+			VkFormat swapChainFormat, VkImageUsageFlags swapChainUsage);
+
+	/* the scene covers sceneExtent from the top left of the HDR image : it is upscaled from there */
+	void recordBloom (VkCommandBuffer commandBuffer, VkExtent2D sceneExtent);
+	void recordOutput (VkCommandBuffer commandBuffer, uint32_t imageIndex, VkExtent2D sceneExtent);
+
+	VkFormat format () const { return hdrFormat; }
+	VkImage image () const { return hdrImage; }
+	VkImageView view () const { return hdrView; }
+	PostPath path () const { return outputPath; }
+
+	/* dispatches per frame : every level down, every level but the first two up, the composite */
+	uint32_t dispatches () const { return outputPath == POST_PATH_BLIT ? 0 : bloomLevels + std::max(bloomLevels, 2u) - 2 + 1; }
+
+	/* the average GPU time of a pass of the frames recorded so far, 0 when it did not run */
+	double averageMilliseconds (PostTimestamp pass) const { return timedFrames > 0 ? passMilliseconds[pass] / timedFrames : 0.0; }
+	bool timed () const { return timedFrames > 0; }
+};
@@ -0,0 +1,448 @@
+#include "readback.h"
+#include "allocator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Static functions */
+
+/*
+ * One row of 8 bit BGRA or RGBA texels to RGBA with an opaque alpha : the
+ * swap chain alpha means nothing once presented. With swapRedBlue the bytes 0
+ * and 2 of every texel trade places, four texels at a time with SSE2.
+ */
+static void convertRow (const uint8_t *source, uint8_t *destination, uint32_t count, bool swapRedBlue)
+{
+	uint32_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+	const __m128i green = _mm_set1_epi32(0x0000FF00);
+	const __m128i low = _mm_set1_epi32(0x000000FF);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+
+		if (swapRedBlue)
+			texels = _mm_or_si128(_mm_or_si128(_mm_and_si128(texels, green), _mm_and_si128(_mm_srli_epi32(texels, 16), low)),
+					_mm_slli_epi32(_mm_and_si128(texels, low), 16));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_or_si128(texels, alpha));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		const uint8_t *texel = source + i * 4;
+		uint8_t *out = destination + i * 4;
+		out[0] = swapRedBlue ? texel[2] : texel[0];
+		out[1] = texel[1];
+		out[2] = swapRedBlue ? texel[0] : texel[2];
+		out[3] = 0xFF;
+	}
+}
+
+struct CrcTable
+{
+	uint32_t entries[256];
+
+	CrcTable ()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+				crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+			entries[i] = crc;
+		}
+	}
+};
+
+static uint32_t crc32 (const uint8_t *data, size_t size)
+{
+	static const CrcTable table;
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = 0; i < size; i++)
+		crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static uint32_t adler32 (const uint8_t *data, size_t size)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+
+	/* 5552 bytes at most between the reductions : b stays below 2^32 */
+	while (size > 0)
+	{
+		size_t count = std::min<size_t>(size, 5552);
+		size -= count;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			a += *data++;
+			b += a;
+		}
+
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return (b << 16) | a;
+}
+
+static void putBigEndian (std::vector<uint8_t>& out, uint32_t value)
+{
+	uint8_t bytes[4] = {static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8),
+		static_cast<uint8_t>(value)};
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+static void beginChunk (std::vector<uint8_t>& out, uint32_t length, const char *type)
+{
+	putBigEndian(out, length);
+	out.insert(out.end(), type, type + 4);
+}
+
+/* the CRC covers the type and the data */
+static void endChunk (std::vector<uint8_t>& out, size_t chunkStart)
+{
+	putBigEndian(out, crc32(out.data() + chunkStart + 4, out.size() - chunkStart - 4));
+}
+
+/* the size of a zlib stream of stored blocks : a header, 5 bytes per block of at most 65535, the adler32 */
+static size_t storedSize (size_t size)
+{
+	return 2 + std::max<size_t>((size + 65534) / 65535, 1) * 5 + size + 4;
+}
+
+/*
+ * An RGBA8 PNG of the filtered scanlines (a 0 filter byte, then the row). The
+ * deflate stream is made of stored blocks : encoding is a copy and two
+ * checksums, the files are as large as the raw pixels.
+ */
+static void encodePng (const std::vector<uint8_t>& scanlines, uint32_t width, uint32_t height, std::vector<uint8_t>& out)
+{
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	out.clear();
+	out.insert(out.end(), signature, signature + 8);
+
+	size_t chunkStart = out.size();
+	beginChunk(out, 13, "IHDR");
+	putBigEndian(out, width);
+	putBigEndian(out, height);
+	uint8_t header[5] = {8, 6, 0, 0, 0};		/* 8 bits, RGBA, deflate, adaptive filtering, not interlaced */
+	out.insert(out.end(), header, header + 5);
+	endChunk(out, chunkStart);
+
+	chunkStart = out.size();
+	beginChunk(out, static_cast<uint32_t>(storedSize(scanlines.size())), "IDAT");
+	out.push_back(0x78);
+	out.push_back(0x01);
+
+	size_t offset = 0;
+	do
+	{
+		size_t count = std::min<size_t>(scanlines.size() - offset, 65535);
+		bool last = offset + count == scanlines.size();
+		uint8_t block[5] = {static_cast<uint8_t>(last ? 1 : 0), static_cast<uint8_t>(count), static_cast<uint8_t>(count >> 8),
+			static_cast<uint8_t>(~count), static_cast<uint8_t>(~count >> 8)};
+		out.insert(out.end(), block, block + 5);
+		out.insert(out.end(), scanlines.begin() + offset, scanlines.begin() + offset + count);
+		offset += count;
+	}
+	while (offset < scanlines.size());
+
+	putBigEndian(out, adler32(scanlines.data(), scanlines.size()));
+	endChunk(out, chunkStart);
+
+	chunkStart = out.size();
+	beginChunk(out, 0, "IEND");
+	endChunk(out, chunkStart);
+}
+
+/* FrameReadback */
+
+void FrameReadback::init (const DeviceContext& deviceContext, DeletionQueue& queueOfRetired, const std::string& path,
+		ReadbackFormat format, uint32_t frameInterval, uint32_t count)
+{
+	context = &deviceContext;
+	deletionQueue = &queueOfRetired;
+	directory = path;
+	fileFormat = format;
+	interval = std::max(frameInterval, 1u);
+	slotCount = std::min(std::max(count, 1u), READBACK_MAX_SLOTS);
+
+	if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+		throw std::runtime_error("failed to create readback directory " + directory + "!");
+
+	for (uint32_t i = 0; i < slotCount; i++)
+	{
+		slots[i].state = SLOT_FREE;
+		slots[i].frame = 0;
+	}
+	queue.reserve(slotCount);
+
+	running = true;
+	worker = std::thread(&FrameReadback::workerLoop, this);
+}
+
+void FrameReadback::destroy ()
+{
+	if (!running)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	condition.notify_all();
+
+	if (worker.joinable())
+		worker.join();
+
+	mapped = nullptr;
+	buffer.reset();
+	memory.reset();
+}
+
+void FrameReadback::waitIdle ()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return queue.empty() && !busy; });
+}
+
+bool FrameReadback::resize (VkExtent2D newExtent, VkFormat swapChainFormat, VkImageUsageFlags swapChainUsage)
+{
+	if (!running)
+		return false;
+
+	/* the worker is done with the old buffer : the copy in flight, if any, is lost with it */
+	waitIdle();
+	for (uint32_t i = 0; i < slotCount; i++)
+		if (slots[i].state.exchange(SLOT_FREE) == SLOT_COPYING)
+			droppedFrames++;
+
+	mapped = nullptr;
+	buffer.reset();
+	memory.reset();
+
+	switch (swapChainFormat)
+	{
+		case VK_FORMAT_B8G8R8A8_UNORM:
+		case VK_FORMAT_B8G8R8A8_SRGB:
+			swapRedBlue = true;
+			supported = true;
+			break;
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+			swapRedBlue = false;
+			supported = true;
+			break;
+		default:
+			supported = false;
+	}
+
+	supported = supported && (swapChainUsage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+	if (!supported)
+		return false;
+
+	extent = newExtent;
+
+	VkDeviceSize atom = std::max<VkDeviceSize>(context->properties.limits.nonCoherentAtomSize, 4);
+	VkDeviceSize frameBytes = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+	slotStride = (frameBytes + atom - 1) / atom * atom;
+
+	/* cached : the worker reads every byte, uncached reads of write combined memory are slow */
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	if (!context->hasMemoryType(~0u, properties))
+		properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	VkBuffer newBuffer;
+	VkDeviceMemory newMemory;
+	context->createBuffer(slotStride * slotCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties, newBuffer, newMemory,
+			MEMORY_CATEGORY_STAGING);
+	buffer = Unique<VkBuffer>(*deletionQueue, newBuffer);
+	memory = Unique<VkDeviceMemory>(*deletionQueue, newMemory);
+
+	void *data;
+	vkMapMemory(context->device, memory, 0, VK_WHOLE_SIZE, 0, &data);
+	mapped = static_cast<const uint8_t*>(data);
+
+	/* the worker is idle : its buffers can grow here rather than on the first frame */
+	size_t rowBytes = static_cast<size_t>(extent.width) * 4 + (fileFormat == READBACK_PNG ? 1 : 0);
+	pixels.resize(rowBytes * extent.height);
+	if (fileFormat == READBACK_PNG)
+		encoded.reserve(storedSize(pixels.size()) + 64);
+
+	return true;
+}
+
+void FrameReadback::record (VkCommandBuffer commandBuffer, VkImage image, uint64_t frame)
+{
+	if (!active() || frame % interval != 0)
+		return;
+
+	requestedFrames++;
+
+	uint32_t index = slotCount;
+	for (uint32_t i = 0; i < slotCount && index == slotCount; i++)
+		if (slots[i].state == SLOT_FREE)
+			index = i;
+
+	/* the worker is behind : skip the frame rather than wait for it */
+	if (index == slotCount)
+	{
+		droppedFrames++;
+		return;
+	}
+
+	slots[index].frame = frame;
+	slots[index].state = SLOT_COPYING;
+
+	/* chained to the post processing barrier, which left the image in PRESENT_SRC_KHR at the bottom of the pipe */
+	imageBarrier(commandBuffer, image, 0, 1, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			0, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = index * slotStride;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = {extent.width, extent.height, 1};
+	vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+	imageBarrier(commandBuffer, image, 0, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			0, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+}
+
+void FrameReadback::collect ()
+{
+	if (!active())
+		return;
+
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (uint32_t i = 0; i < slotCount; i++)
+		{
+			if (slots[i].state != SLOT_COPYING)
+				continue;
+
+			slots[i].state = SLOT_QUEUED;
+			queue.push_back(i);
+			queued = true;
+		}
+	}
+
+	if (queued)
+		condition.notify_one();
+}
+
+void FrameReadback::flush ()
+{
+	collect();
+	waitIdle();
+}
+
+/* Worker thread */
+
+void FrameReadback::workerLoop ()
+{
+	/* encodes behind the frames : not part of any of them */
+	untrackHeapAllocations();
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		condition.wait(lock, [this] { return !running || !queue.empty(); });
+
+		if (!running)
+			return;
+
+		uint32_t index = queue.front();
+		queue.erase(queue.begin());
+		busy = true;
+
+		lock.unlock();
+		process(index);
+		lock.lock();
+
+		busy = false;
+		if (queue.empty())
+			idle.notify_all();
+	}
+}
+
+void FrameReadback::process (uint32_t index)
+{
+	Slot& slot = slots[index];
+
+	VkMappedMemoryRange range = {};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = memory;
+	range.offset = index * slotStride;
+	range.size = slotStride;
+	vkInvalidateMappedMemoryRanges(context->device, 1, &range);
+
+	auto start = std::chrono::steady_clock::now();
+
+	const uint8_t *source = mapped + index * slotStride;
+	size_t sourceRow = static_cast<size_t>(extent.width) * 4;
+	size_t filter = fileFormat == READBACK_PNG ? 1 : 0;
+
+	for (uint32_t y = 0; y < extent.height; y++)
+	{
+		uint8_t *row = pixels.data() + y * (sourceRow + filter);
+		if (filter)
+			row[0] = 0;
+		convertRow(source + y * sourceRow, row + filter, extent.width, swapRedBlue);
+	}
+
+	/* the pixels are out : the slot can take the next copy while this one is encoded */
+	uint64_t frame = slot.frame;
+	slot.state = SLOT_FREE;
+
+	auto converted = std::chrono::steady_clock::now();
+	convertMilliseconds += std::chrono::duration<double, std::milli>(converted - start).count();
+
+	/* raw files carry their size in the name, nothing else does */
+	char name[64];
+	if (fileFormat == READBACK_PNG)
+		snprintf(name, sizeof(name), "/frame_%06llu.png", static_cast<unsigned long long>(frame));
+	else
+		snprintf(name, sizeof(name), "/frame_%06llu_%ux%u.rgba", static_cast<unsigned long long>(frame), extent.width, extent.height);
+
+	const std::vector<uint8_t>& output = fileFormat == READBACK_PNG ? encoded : pixels;
+	if (fileFormat == READBACK_PNG)
+		encodePng(pixels, extent.width, extent.height, encoded);
+
+	std::ofstream file(directory + name, std::ios::binary);
+	if (!file.write(reinterpret_cast<const char*>(output.data()), output.size()))
+	{
+		std::cerr << "failed to write " << directory << name << std::endl;
+		return;
+	}
+
+	encodeMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - converted).count();
+	writtenFrames++;
+	writtenBytes += output.size();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "device.h"
+#include "lifetime.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const uint32_t READBACK_MAX_SLOTS = 8;
+
+enum ReadbackFormat
+{
+	READBACK_PNG,				/* RGBA8, stored deflate blocks : no compression, no dependency */
+	READBACK_RAW				/* RGBA8 rows, tightly packed, nothing else */
+};
+
+/*
+ * Asynchronous copy of the presented frames to files. record() goes after the
+ * post processing : it copies the swap chain image into a slot of a ring of
+ * host cached buffers. Once the frame fence says the copy is done, collect()
+ * hands the slot to a worker thread, which swizzles the pixels to RGBA8 (SSE2
+ * where available) and encodes them.
+ *
+ * Neither side waits for the other : a frame that finds no free slot, the
+ * worker being behind, is not read back and counted as dropped. record() and
+ * collect() come from the render thread and do not allocate.
+ */
+
+class FrameReadback
+{
+private:
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_COPYING,			/* recorded in the frame in flight */
+		SLOT_QUEUED				/* copied, the worker owns it */
+	};
+
+	struct Slot
+	{
+		std::atomic<uint32_t> state;
+		uint64_t frame;
+	};
+
+	const DeviceContext *context = nullptr;
+	DeletionQueue *deletionQueue = nullptr;
+	std::string directory;
+	ReadbackFormat fileFormat = READBACK_PNG;
+	uint32_t interval = 1;
+
+	VkExtent2D extent = {0, 0};
+	bool swapRedBlue = false;
+	bool supported = false;
+
+	/* every slot in one buffer, slotStride apart to keep the invalidated ranges apart */
+	Unique<VkBuffer> buffer;
+	Unique<VkDeviceMemory> memory;
+	const uint8_t *mapped = nullptr;
+	VkDeviceSize slotStride = 0;
+	Slot slots[READBACK_MAX_SLOTS];
+	uint32_t slotCount = 0;
+
+	/* worker : the queued slot indices, in frame order */
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::condition_variable idle;
+	std::vector<uint32_t> queue;
+	bool busy = false;
+	bool running = false;
+
+	/* worker side, reused from frame to frame */
+	std::vector<uint8_t> pixels;
+	std::vector<uint8_t> encoded;
+
+	std::atomic<uint64_t> requestedFrames;
+	std::atomic<uint64_t> droppedFrames;
+	std::atomic<uint64_t> writtenFrames;
+	std::atomic<uint64_t> writtenBytes;
+	double convertMilliseconds = 0.0;
+	double encodeMilliseconds = 0.0;
+
+	void workerLoop ();
+	void process (uint32_t index);
+	void waitIdle ();
+
+public:
+	FrameReadback () : requestedFrames(0), droppedFrames(0), writtenFrames(0), writtenBytes(0) {}
+
+	/* every interval-th frame goes to directory, slotCount at most READBACK_MAX_SLOTS */
+	void init (const DeviceContext& context, DeletionQueue& deletionQueue, const std::string& directory, ReadbackFormat format,
+			uint32_t interval, uint32_t slotCount);
+	void destroy ();
+
+	/* after the swap chain was (re)created : false when its format or usage cannot be read back */
+	bool resize (VkExtent2D extent, VkFormat swapChainFormat, VkImageUsageFlags swapChainUsage);
+
+	/* after the post processing : the image is in PRESENT_SRC_KHR and is left there */
+	void record (VkCommandBuffer commandBuffer, VkImage image, uint64_t frame);
+
+	/* after the frame fence : the copies recorded so far are done */
+	void collect ();
+
+	/* the device is idle : hands the last copies over and waits until the worker wrote them */
+	void flush ();
+
+	bool enabled () const { return running; }
+	bool active () const { return running && supported; }
+
+	uint64_t requested () const { return requestedFrames; }
+	uint64_t dropped () const { return droppedFrames; }
+	uint64_t written () const { return writtenFrames; }
+	uint64_t bytes () const { return writtenBytes; }
+
+	/* worker times, per frame written : read after flush() */
+	double averageConvertMilliseconds () const { return writtenFrames > 0 ? convertMilliseconds / writtenFrames : 0.0; }
+	double averageEncodeMilliseconds () const { return writtenFrames > 0 ? encodeMilliseconds / writtenFrames : 0.0; }
+};
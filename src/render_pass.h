@@ -0,0 +1,42 @@
+#pragma once
+
+#include "device.h"
+
+#include <vector>
+
+/*
+ * The scene render passes, keyed by their attachments : one color target,
+ * cleared and left in SHADER_READ_ONLY_OPTIMAL for the post processing, and a
+ * transient depth buffer. Multisampled, the color is resolved into a third
+ * attachment and never stored.
+ *
+ * A render pass only depends on formats and sample count, not on the images :
+ * a new swap chain or new targets of the same signature get the same one.
+ */
+
+class RenderPassCache
+{
+private:
+	struct Entry
+	{
+		VkFormat colorFormat;
+		VkFormat depthFormat;
+		VkSampleCountFlagBits samples;
+		VkRenderPass renderPass;
+	};
+
+	const DeviceContext *context = nullptr;
+	std::vector<Entry> entries;
+	uint32_t requests = 0;
+
+	VkRenderPass create (VkFormat colorFormat, VkFormat depthFormat, VkSampleCountFlagBits samples);
+
+public:
+	void init (const DeviceContext& context);
+	void destroy ();
+
+	VkRenderPass get (VkFormat colorFormat, VkFormat depthFormat, VkSampleCountFlagBits samples);
+
+	size_t size () const { return entries.size(); }
+	uint32_t hits () const { return requests - static_cast<uint32_t>(entries.size()); }
+};
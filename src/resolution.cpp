@@ -0,0 +1,129 @@
+#include "resolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+/* ResolutionController */
+
+void ResolutionController::init (const DeviceContext& deviceContext, double target, float lowest, float highest)
+{
+	context = &deviceContext;
+	targetMilliseconds = target;
+	/* the targets are the size of the swap chain : no supersampling */
+	maxScale = std::min(highest, 1.0f);
+	minScale = std::min(lowest, maxScale);
+	currentScale = maxScale;
+	lowestScale = maxScale;
+
+	/* the scene and bloom passes, when the graphics queue has timestamps */
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(context->physicalDevice, &familyCount, families.data());
+
+	if (context->graphicsFamily >= familyCount || families[context->graphicsFamily].timestampValidBits == 0)
+		return;
+
+	uint32_t validBits = families[context->graphicsFamily].timestampValidBits;
+	timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	VkQueryPoolCreateInfo queryInfo = {};
+	queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryInfo.queryCount = 2;
+
+	if (vkCreateQueryPool(context->device, &queryInfo, context->allocator, &queryPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create resolution query pool!");
+}
+
+void ResolutionController::destroy ()
+{
+	if (context == nullptr)
+		return;
+
+	vkDestroyQueryPool(context->device, queryPool, context->allocator);
+	queryPool = VK_NULL_HANDLE;
+	queryPending = false;
+	context = nullptr;
+}
+
+void ResolutionController::begin (VkCommandBuffer commandBuffer)
+{
+	if (queryPool == VK_NULL_HANDLE)
+		return;
+
+	/* at the compute stage : after the culling and particle dispatches, and after the acquire semaphore the submit waits on there */
+	vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, queryPool, 0);
+}
+
+void ResolutionController::end (VkCommandBuffer commandBuffer)
+{
+	if (queryPool == VK_NULL_HANDLE)
+		return;
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+	queryPending = true;
+}
+
+void ResolutionController::update ()
+{
+	if (!queryPending)
+		return;
+	queryPending = false;
+
+	uint64_t timestamps[2];
+	if (vkGetQueryPoolResults(context->device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+
+	/* only the valid bits count, and the counter may wrap between the two */
+	uint64_t ticks = ((timestamps[1] & timestampMask) - (timestamps[0] & timestampMask)) & timestampMask;
+	double milliseconds = ticks * context->properties.limits.timestampPeriod * 1e-6;
+	smoothedMilliseconds = timedFrames == 0 ? milliseconds : smoothedMilliseconds + (milliseconds - smoothedMilliseconds) * RESOLUTION_SMOOTHING;
+
+	float scale = currentScale;
+	timedFrames++;
+	totalMilliseconds += milliseconds;
+	totalScale += scale;
+	overBudgetFrames += milliseconds > targetMilliseconds ? 1 : 0;
+	currentMilliseconds = smoothedMilliseconds;
+
+	if (settleFrames > 0)
+	{
+		settleFrames--;
+		return;
+	}
+
+	/* down as soon as the budget is exceeded, up only with some margin : no back and forth around it */
+	bool over = smoothedMilliseconds > targetMilliseconds;
+	bool under = smoothedMilliseconds < targetMilliseconds * RESOLUTION_HEADROOM;
+	if (!over && !under)
+		return;
+
+	float ideal = scale * static_cast<float>(std::sqrt(targetMilliseconds * RESOLUTION_HEADROOM / std::max(smoothedMilliseconds, 1e-3)));
+	float next = std::max(scale - RESOLUTION_MAX_STEP, std::min(ideal, scale + RESOLUTION_MAX_STEP));
+	next = std::max(minScale, std::min(std::round(next / RESOLUTION_QUANTUM) * RESOLUTION_QUANTUM, maxScale));
+
+	if (next == scale)
+		return;
+
+	currentScale = next;
+	lowestScale = std::min(lowestScale, next);
+	settleFrames = RESOLUTION_SETTLE_FRAMES;
+	changeCount++;
+}
+
+VkExtent2D ResolutionController::extent (VkExtent2D full) const
+{
+	float scale = currentScale;
+	if (scale >= 1.0f)
+		return full;
+
+	VkExtent2D scaled;
+	scaled.width = std::max(1u, std::min(static_cast<uint32_t>(full.width * scale + 0.5f), full.width));
+	scaled.height = std::max(1u, std::min(static_cast<uint32_t>(full.height * scale + 0.5f), full.height));
+	return scaled;
+}
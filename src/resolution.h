@@ -0,0 +1,88 @@
+#pragma once
+
+#include "device.h"
+
+#include <atomic>
+#include <cstdint>
+
+/* weight of the last frame in the smoothed GPU time */
+const double RESOLUTION_SMOOTHING = 0.1;
+/* largest change of the scale in one step, and the steps it is rounded to */
+const float RESOLUTION_MAX_STEP = 0.05f;
+const float RESOLUTION_QUANTUM = 1.0f / 40.0f;
+/* the scale only grows back once the frames are that far under the budget */
+const double RESOLUTION_HEADROOM = 0.85;
+/* frames after a change before the next one : the times measured lag behind it */
+const uint32_t RESOLUTION_SETTLE_FRAMES = 8;
+
+/*
+ * Dynamic resolution. begin() and end() put timestamps around the scene and
+ * the bloom passes : the work the scale changes. Nothing between them waits
+ * for the swap chain, so a frame held back by acquire or present under FIFO
+ * does not read as GPU time. Once the frame fence says the timestamps are
+ * final, update() smooths the GPU time and moves the scale toward the budget.
+ * The GPU time goes roughly with the pixels drawn, so the scale is corrected
+ * by the square root of the ratio, a few steps at a time.
+ *
+ * The scene is drawn into the top left of its full size targets, extent() of
+ * them : a new scale does not reallocate anything. The post processing
+ * samples that part and upscales it to the swap chain.
+ *
+ * Without a budget, or without timestamps on the graphics queue, the scale
+ * stays at 1. Everything but the atomics belongs to the render thread.
+ */
+
+class ResolutionController
+{
+private:
+	const DeviceContext *context = nullptr;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	uint64_t timestampMask = 0;
+	bool queryPending = false;
+
+	double targetMilliseconds = 0.0;
+	float minScale = 1.0f;
+	float maxScale = 1.0f;
+	uint32_t settleFrames = 0;
+	double smoothedMilliseconds = 0.0;
+
+	/* read by the main thread to log them */
+	std::atomic<float> currentScale;
+	std::atomic<double> currentMilliseconds;
+
+	uint64_t timedFrames = 0;
+	uint64_t overBudgetFrames = 0;
+	uint32_t changeCount = 0;
+	double totalMilliseconds = 0.0;
+	double totalScale = 0.0;
+	float lowestScale = 1.0f;
+
+public:
+	ResolutionController () : currentScale(1.0f), currentMilliseconds(0.0) {}
+
+	/* the scale moves between minScale and maxScale to keep the GPU under targetMilliseconds */
+	void init (const DeviceContext& context, double targetMilliseconds, float minScale, float maxScale);
+	void destroy ();
+
+	/* begin() before the scene, end() after the bloom : both outside a render pass */
+	void begin (VkCommandBuffer commandBuffer);
+	void end (VkCommandBuffer commandBuffer);
+
+	/* after the frame fence : reads the last frame's time and picks the next scale */
+	void update ();
+
+	/* the part of a target of that size the scene is drawn into */
+	VkExtent2D extent (VkExtent2D full) const;
+
+	bool enabled () const { return queryPool != VK_NULL_HANDLE; }
+	float scale () const { return currentScale; }
+	double milliseconds () const { return currentMilliseconds; }
+	double budget () const { return targetMilliseconds; }
+
+	uint64_t frames () const { return timedFrames; }
+	uint64_t framesOverBudget () const { return overBudgetFrames; }
+	uint32_t changes () const { return changeCount; }
+	float lowest () const { return lowestScale; }
+	double averageMilliseconds () const { return timedFrames > 0 ? totalMilliseconds / timedFrames : 0.0; }
+	double averageScale () const { return timedFrames > 0 ? totalScale / timedFrames : 1.0; }
+};
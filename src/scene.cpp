@@ -0,0 +1,398 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define SCENE_SSE 1
+#endif
+
+
+/* nodes per parallelFor chunk are SCENE_BLOCK * SCENE_UPDATE_GRAIN */
+static const size_t SCENE_BLOCK = 4;
+static const size_t SCENE_UPDATE_GRAIN = 1024;
+
+/* Static functions */
+
+/* column major out = a * b, out may not alias */
+static inline void multiply (const float *a, const float *b, float *out)
+{
+#ifdef SCENE_SSE
+	__m128 a0 = _mm_loadu_ps(a);
+	__m128 a1 = _mm_loadu_ps(a + 4);
+	__m128 a2 = _mm_loadu_ps(a + 8);
+	__m128 a3 = _mm_loadu_ps(a + 12);
+
+	for (int j = 0; j < 4; j++)
+	{
+		__m128 column = _mm_mul_ps(a0, _mm_set1_ps(b[j * 4]));
+		column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(b[j * 4 + 1])));
+		column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(b[j * 4 + 2])));
+		column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(b[j * 4 + 3])));
+		_mm_storeu_ps(out + j * 4, column);
+	}
+#else
+	for (int j = 0; j < 4; j++)
+		for (int i = 0; i < 4; i++)
+			out[j * 4 + i] = a[i] * b[j * 4] + a[4 + i] * b[j * 4 + 1] + a[8 + i] * b[j * 4 + 2] + a[12 + i] * b[j * 4 + 3];
+#endif
+}
+
+/* translation * rotation * uniform scale, column major */
+static inline void composeLocal (float x, float y, float z, float w, float s, float px, float py, float pz, float *out)
+{
+	float xx = x * x, yy = y * y, zz = z * z;
+	float xy = x * y, xz = x * z, yz = y * z;
+	float wx = w * x, wy = w * y, wz = w * z;
+
+	out[0] = (1.0f - 2.0f * (yy + zz)) * s;
+	out[1] = 2.0f * (xy + wz) * s;
+	out[2] = 2.0f * (xz - wy) * s;
+	out[3] = 0.0f;
+
+	out[4] = 2.0f * (xy - wz) * s;
+	out[5] = (1.0f - 2.0f * (xx + zz)) * s;
+	out[6] = 2.0f * (yz + wx) * s;
+	out[7] = 0.0f;
+
+	out[8] = 2.0f * (xz + wy) * s;
+	out[9] = 2.0f * (yz - wx) * s;
+	out[10] = (1.0f - 2.0f * (xx + yy)) * s;
+	out[11] = 0.0f;
+
+	out[12] = px;
+	out[13] = py;
+	out[14] = pz;
+	out[15] = 1.0f;
+}
+
+template <typename T>
+static void permute (std::vector<T>& values, const std::vector<uint32_t>& order)
+{
+	std::vector<T> sorted(values.size());
+	for (size_t i = 0; i < order.size(); i++)
+		sorted[i] = values[order[i]];
+	values.swap(sorted);
+}
+
+/* Scene */
+
+NodeHandle Scene::create (NodeHandle parent)
+{
+	uint32_t parentIndex = parent == NO_NODE ? NO_NODE : indices[parent];
+	uint32_t depth = parent == NO_NODE ? 0 : depths[parentIndex] + 1;
+
+	structureDirty = true;
+
+	NodeHandle handle = static_cast<NodeHandle>(indices.size());
+	indices.push_back(static_cast<uint32_t>(parents.size()));
+
+	parents.push_back(parentIndex);
+	depths.push_back(depth);
+	handles.push_back(handle);
+	positionX.push_back(0.0f);
+	positionY.push_back(0.0f);
+	positionZ.push_back(0.0f);
+	rotationX.push_back(0.0f);
+	rotationY.push_back(0.0f);
+	rotationZ.push_back(0.0f);
+	rotationW.push_back(1.0f);
+	scales.push_back(1.0f);
+	boundsX.push_back(0.0f);
+	boundsY.push_back(0.0f);
+	boundsZ.push_back(0.0f);
+	boundsRadius.push_back(0.0f);
+	instances.push_back(NO_INSTANCE);
+	localDirty.push_back(1);
+	worldDirty.push_back(1);
+	pendingWrites.push_back(0);
+
+	worlds.push_back(glm::mat4(1.0f));
+	worldBoundsX.push_back(0.0f);
+	worldBoundsY.push_back(0.0f);
+	worldBoundsZ.push_back(0.0f);
+	worldBoundsRadius.push_back(0.0f);
+
+	return handle;
+}
+
+void Scene::setPosition (NodeHandle node, const glm::vec3& position)
+{
+	uint32_t index = indices[node];
+	positionX[index] = position.x;
+	positionY[index] = position.y;
+	positionZ[index] = position.z;
+	localDirty[index] = 1;
+}
+
+void Scene::setRotation (NodeHandle node, const glm::vec3& axis, float angle)
+{
+	float length = std::sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+	float s = length > 0.0f ? std::sin(angle * 0.5f) / length : 0.0f;
+
+	uint32_t index = indices[node];
+	rotationX[index] = axis.x * s;
+	rotationY[index] = axis.y * s;
+	rotationZ[index] = axis.z * s;
+	rotationW[index] = length > 0.0f ? std::cos(angle * 0.5f) : 1.0f;
+	localDirty[index] = 1;
+}
+
+void Scene::setScale (NodeHandle node, float scale)
+{
+	uint32_t index = indices[node];
+	scales[index] = scale;
+	localDirty[index] = 1;
+}
+
+void Scene::setBounds (NodeHandle node, const glm::vec3& center, float radius)
+{
+	uint32_t index = indices[node];
+	boundsX[index] = center.x;
+	boundsY[index] = center.y;
+	boundsZ[index] = center.z;
+	boundsRadius[index] = radius;
+	localDirty[index] = 1;
+}
+
+void Scene::setInstance (NodeHandle node, uint32_t instance)
+{
+	uint32_t index = indices[node];
+	instances[index] = instance;
+	pendingWrites[index] = instance != NO_INSTANCE ? static_cast<uint8_t>(instanceFrames) : 0;
+}
+
+/* stable counting sort by depth, then the level ranges */
+void Scene::sortByDepth ()
+{
+	if (!std::is_sorted(depths.begin(), depths.end()))
+	{
+		uint32_t maxDepth = *std::max_element(depths.begin(), depths.end());
+
+		std::vector<uint32_t> starts(maxDepth + 2, 0);
+		for (uint32_t depth : depths)
+			starts[depth + 1]++;
+		for (size_t d = 1; d < starts.size(); d++)
+			starts[d] += starts[d - 1];
+
+		std::vector<uint32_t> order(depths.size());
+		for (uint32_t i = 0; i < depths.size(); i++)
+			order[starts[depths[i]]++] = i;
+
+		std::vector<uint32_t> remap(order.size());
+		for (uint32_t i = 0; i < order.size(); i++)
+			remap[order[i]] = i;
+
+		permute(parents, order);
+		for (uint32_t& parent : parents)
+			if (parent != NO_NODE)
+				parent = remap[parent];
+
+		permute(depths, order);
+		permute(handles, order);
+		permute(positionX, order);
+		permute(positionY, order);
+		permute(positionZ, order);
+		permute(rotationX, order);
+		permute(rotationY, order);
+		permute(rotationZ, order);
+		permute(rotationW, order);
+		permute(scales, order);
+		permute(boundsX, order);
+		permute(boundsY, order);
+		permute(boundsZ, order);
+		permute(boundsRadius, order);
+		permute(instances, order);
+		permute(localDirty, order);
+		permute(worldDirty, order);
+		permute(pendingWrites, order);
+		permute(worlds, order);
+		permute(worldBoundsX, order);
+		permute(worldBoundsY, order);
+		permute(worldBoundsZ, order);
+		permute(worldBoundsRadius, order);
+
+		for (uint32_t i = 0; i < handles.size(); i++)
+			indices[handles[i]] = i;
+	}
+
+	levelStarts.clear();
+	for (uint32_t i = 0; i < depths.size(); i++)
+		while (levelStarts.size() <= depths[i])
+			levelStarts.push_back(i);
+	levelStarts.push_back(static_cast<uint32_t>(depths.size()));
+
+	structureDirty = false;
+}
+
+/* [begin, end) lies in one level : every parent is already up to date */
+void Scene::updateBlock (size_t begin, size_t end, glm::mat4 *output)
+{
+	size_t updated = 0;
+
+	for (size_t i = begin; i < end; i += SCENE_BLOCK)
+	{
+		size_t count = std::min(SCENE_BLOCK, end - i);
+
+		bool anyDirty = false;
+		bool anyPending = false;
+		for (size_t k = 0; k < count; k++)
+		{
+			uint32_t parent = parents[i + k];
+			uint8_t dirty = localDirty[i + k] | (parent != NO_NODE ? worldDirty[parent] : 0);
+			worldDirty[i + k] = dirty;
+			anyDirty = anyDirty || dirty;
+			anyPending = anyPending || pendingWrites[i + k] != 0;
+		}
+
+		if (anyDirty)
+		{
+			float local[SCENE_BLOCK][16];
+
+#ifdef SCENE_SSE
+			if (count == SCENE_BLOCK)
+			{
+				/* the same quaternion to matrix expansion as composeLocal, one lane per node */
+				__m128 x = _mm_loadu_ps(&rotationX[i]);
+				__m128 y = _mm_loadu_ps(&rotationY[i]);
+				__m128 z = _mm_loadu_ps(&rotationZ[i]);
+				__m128 w = _mm_loadu_ps(&rotationW[i]);
+				__m128 s = _mm_loadu_ps(&scales[i]);
+				__m128 s2 = _mm_add_ps(s, s);
+
+				__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+				__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+				__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+				__m128 column0[4] = {
+					_mm_sub_ps(s, _mm_mul_ps(s2, _mm_add_ps(yy, zz))),
+					_mm_mul_ps(s2, _mm_add_ps(xy, wz)),
+					_mm_mul_ps(s2, _mm_sub_ps(xz, wy)),
+					_mm_setzero_ps()
+				};
+				__m128 column1[4] = {
+					_mm_mul_ps(s2, _mm_sub_ps(xy, wz)),
+					_mm_sub_ps(s, _mm_mul_ps(s2, _mm_add_ps(xx, zz))),
+					_mm_mul_ps(s2, _mm_add_ps(yz, wx)),
+					_mm_setzero_ps()
+				};
+				__m128 column2[4] = {
+					_mm_mul_ps(s2, _mm_add_ps(xz, wy)),
+					_mm_mul_ps(s2, _mm_sub_ps(yz, wx)),
+					_mm_sub_ps(s, _mm_mul_ps(s2, _mm_add_ps(xx, yy))),
+					_mm_setzero_ps()
+				};
+				__m128 column3[4] = {
+					_mm_loadu_ps(&positionX[i]),
+					_mm_loadu_ps(&positionY[i]),
+					_mm_loadu_ps(&positionZ[i]),
+					_mm_set1_ps(1.0f)
+				};
+
+				/* lanes are nodes : transposing gives one column per node */
+				_MM_TRANSPOSE4_PS(column0[0], column0[1], column0[2], column0[3]);
+				_MM_TRANSPOSE4_PS(column1[0], column1[1], column1[2], column1[3]);
+				_MM_TRANSPOSE4_PS(column2[0], column2[1], column2[2], column2[3]);
+				_MM_TRANSPOSE4_PS(column3[0], column3[1], column3[2], column3[3]);
+
+				for (size_t k = 0; k < SCENE_BLOCK; k++)
+				{
+					_mm_storeu_ps(&local[k][0], column0[k]);
+					_mm_storeu_ps(&local[k][4], column1[k]);
+					_mm_storeu_ps(&local[k][8], column2[k]);
+					_mm_storeu_ps(&local[k][12], column3[k]);
+				}
+			}
+			else
+#endif
+			for (size_t k = 0; k < count; k++)
+				composeLocal(rotationX[i + k], rotationY[i + k], rotationZ[i + k], rotationW[i + k], scales[i + k],
+						positionX[i + k], positionY[i + k], positionZ[i + k], local[k]);
+
+			for (size_t k = 0; k < count; k++)
+			{
+				size_t node = i + k;
+				if (!worldDirty[node])
+					continue;
+
+				float *world = reinterpret_cast<float*>(&worlds[node]);
+				uint32_t parent = parents[node];
+				if (parent != NO_NODE)
+					multiply(reinterpret_cast<const float*>(&worlds[parent]), local[k], world);
+				else
+					memcpy(world, local[k], sizeof(local[k]));
+
+				float cx = boundsX[node], cy = boundsY[node], cz = boundsZ[node];
+				worldBoundsX[node] = world[0] * cx + world[4] * cy + world[8] * cz + world[12];
+				worldBoundsY[node] = world[1] * cx + world[5] * cy + world[9] * cz + world[13];
+				worldBoundsZ[node] = world[2] * cx + world[6] * cy + world[10] * cz + world[14];
+
+				float scale = std::max(world[0] * world[0] + world[1] * world[1] + world[2] * world[2],
+						std::max(world[4] * world[4] + world[5] * world[5] + world[6] * world[6],
+						world[8] * world[8] + world[9] * world[9] + world[10] * world[10]));
+				worldBoundsRadius[node] = boundsRadius[node] * std::sqrt(scale);
+
+				localDirty[node] = 0;
+				if (instances[node] != NO_INSTANCE)
+					pendingWrites[node] = static_cast<uint8_t>(instanceFrames);
+				anyPending = anyPending || instances[node] != NO_INSTANCE;
+				updated++;
+			}
+		}
+
+		if (!anyPending || output == nullptr)
+			continue;
+
+		for (size_t k = 0; k < count; k++)
+		{
+			size_t node = i + k;
+			if (pendingWrites[node] == 0)
+				continue;
+
+			memcpy(&output[instances[node]], &worlds[node], sizeof(glm::mat4));
+			pendingWrites[node]--;
+		}
+	}
+
+	updatedNodes.fetch_add(updated, std::memory_order_relaxed);
+}
+
+void Scene::update (ThreadPool& pool, glm::mat4 *output)
+{
+	if (structureDirty)
+		sortByDepth();
+
+	updatedNodes.store(0, std::memory_order_relaxed);
+
+	for (size_t level = 0; level + 1 < levelStarts.size(); level++)
+	{
+		size_t begin = levelStarts[level];
+		size_t end = levelStarts[level + 1];
+		size_t blocks = (end - begin + SCENE_BLOCK - 1) / SCENE_BLOCK;
+
+		pool.parallelFor(blocks, SCENE_UPDATE_GRAIN / SCENE_BLOCK, [&] (size_t first, size_t last) {
+			updateBlock(begin + first * SCENE_BLOCK, std::min(end, begin + last * SCENE_BLOCK), output);
+		});
+	}
+}
+
+glm::vec3 Scene::worldCenter (NodeHandle node) const
+{
+	uint32_t index = indices[node];
+	return glm::vec3(worldBoundsX[index], worldBoundsY[index], worldBoundsZ[index]);
+}
+
+glm::vec3 Scene::toLocal (NodeHandle node, const glm::vec3& point) const
+{
+	const float *world = reinterpret_cast<const float*>(&worlds[indices[node]]);
+
+	/* the inverse of rotation * scale is its transpose over scale squared */
+	float dx = point.x - world[12], dy = point.y - world[13], dz = point.z - world[14];
+	float scale2 = world[0] * world[0] + world[1] * world[1] + world[2] * world[2];
+
+	return glm::vec3(world[0] * dx + world[1] * dy + world[2] * dz,
+			world[4] * dx + world[5] * dy + world[6] * dz,
+			world[8] * dx + world[9] * dy + world[10] * dz) / scale2;
+}
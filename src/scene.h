@@ -0,0 +1,91 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+typedef uint32_t NodeHandle;
+
+const NodeHandle NO_NODE = ~0u;
+const uint32_t NO_INSTANCE = ~0u;
+
+/*
+ * Transform hierarchy stored as structure of arrays. Nodes are kept sorted by
+ * depth, so every level is a contiguous range and parents always come before
+ * their children : update walks the levels in order and runs each one in
+ * parallel. Local transforms are composed 4 nodes at a time with SSE, only for
+ * the dirty subtrees.
+ *
+ * A node with an instance index writes its world matrix to instances[index] of
+ * the buffer given to update. With instanceFrames per-frame buffers cycled by
+ * the caller, a changed matrix is written to the next instanceFrames buffers so
+ * every one of them catches up.
+ *
+ * Handles are stable, the storage order is not. Scale is uniform, nodes are
+ * never removed.
+ */
+
+class Scene
+{
+private:
+	/* per node, in storage (depth) order */
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> depths;
+	std::vector<NodeHandle> handles;
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	std::vector<float> scales;
+	std::vector<float> boundsX, boundsY, boundsZ, boundsRadius;
+	std::vector<uint32_t> instances;
+	std::vector<uint8_t> localDirty;
+	std::vector<uint8_t> worldDirty;
+	std::vector<uint8_t> pendingWrites;
+
+	std::vector<glm::mat4> worlds;
+	std::vector<float> worldBoundsX, worldBoundsY, worldBoundsZ, worldBoundsRadius;
+
+	/* handle -> storage index */
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> levelStarts;
+	bool structureDirty = false;
+
+	uint32_t instanceFrames = 1;
+	std::atomic<size_t> updatedNodes;
+
+	void sortByDepth ();
+	void updateBlock (size_t begin, size_t end, glm::mat4 *output);
+
+public:
+	Scene () : updatedNodes(0) {}
+
+	void setInstanceFrames (uint32_t frames) { instanceFrames = frames; }
+
+	NodeHandle create (NodeHandle parent);
+
+	void setPosition (NodeHandle node, const glm::vec3& position);
+	void setRotation (NodeHandle node, const glm::vec3& axis, float angle);
+	void setScale (NodeHandle node, float scale);
+	void setBounds (NodeHandle node, const glm::vec3& center, float radius);
+	void setInstance (NodeHandle node, uint32_t instance);
+
+	/* world matrices and bounds of dirty subtrees, then pending instance writes */
+	void update (ThreadPool& pool, glm::mat4 *instances);
+
+	const glm::mat4& world (NodeHandle node) const { return worlds[indices[node]]; }
+	glm::vec3 worldCenter (NodeHandle node) const;
+	float worldRadius (NodeHandle node) const { return worldBoundsRadius[indices[node]]; }
+
+	/* world transform recomputed by the last update */
+	bool changed (NodeHandle node) const { return worldDirty[indices[node]] != 0; }
+
+	/* point in world space to the node space, for rotation / uniform scale transforms */
+	glm::vec3 toLocal (NodeHandle node, const glm::vec3& point) const;
+
+	size_t size () const { return parents.size(); }
+	size_t levelCount () const { return levelStarts.empty() ? 0 : levelStarts.size() - 1; }
+	size_t lastUpdatedNodes () const { return updatedNodes.load(std::memory_order_relaxed); }
+};
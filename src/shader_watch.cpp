@@ -0,0 +1,248 @@
+#include "shader_watch.h"
+#include "allocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/* Static functions */
+
+static bool endsWith (const std::string& text, const std::string& suffix)
+{
+	return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/* ShaderWatcher */
+
+bool ShaderWatcher::start (PipelineFactory& pipelineFactory, const std::string& shaderDirectory, const std::string& script)
+{
+#ifdef __linux__
+	if (running)
+		return true;
+
+	factory = &pipelineFactory;
+	directory = shaderDirectory;
+	parseScript(directory + "/" + script);
+
+	if (commands.empty())
+	{
+		std::cerr << "shader reload: no glslangValidator command in " << directory << "/" << script << std::endl;
+		return false;
+	}
+
+	/* close-write and moved-to : a file saved in place or renamed over the old one */
+	descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (descriptor < 0 || inotify_add_watch(descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		std::cerr << "shader reload: cannot watch " << directory << std::endl;
+		if (descriptor >= 0)
+			close(descriptor);
+		descriptor = -1;
+		return false;
+	}
+
+	running = true;
+	worker = std::thread(&ShaderWatcher::watchLoop, this);
+	return true;
+#else
+	(void) pipelineFactory;
+	(void) shaderDirectory;
+	(void) script;
+	return false;
+#endif
+}
+
+void ShaderWatcher::stop ()
+{
+	if (!running)
+		return;
+
+	running = false;
+	if (worker.joinable())
+		worker.join();
+
+#ifdef __linux__
+	close(descriptor);
+#endif
+	descriptor = -1;
+}
+
+/*
+ * One command per "glslangValidator ... source [-o output]" line. Without -o
+ * the compiler names the output after the stage : main.vert gives vert.spv.
+ */
+void ShaderWatcher::parseScript (const std::string& script)
+{
+	std::ifstream file(script);
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		std::istringstream tokens(line);
+		std::string token;
+		if (!(tokens >> token) || token != "glslangValidator")
+			continue;
+
+		Command command;
+		command.arguments = token;
+
+		while (tokens >> token)
+		{
+			if (token == "-o")
+			{
+				tokens >> command.output;
+				continue;
+			}
+
+			command.arguments += " " + token;
+			if (token == "--target-env" && tokens >> token)
+				command.arguments += " " + token;
+			else if (token[0] != '-')
+				command.source = token;
+		}
+
+		if (command.source.empty())
+			continue;
+
+		if (command.output.empty())
+			command.output = command.source.substr(command.source.rfind('.') + 1) + ".spv";
+
+		commands.push_back(command);
+	}
+}
+
+/* the source itself, or a file it includes, a few levels deep */
+bool ShaderWatcher::dependsOn (const std::string& source, const std::string& name, uint32_t depth) const
+{
+	if (source == name)
+		return true;
+	if (depth == 0)
+		return false;
+
+	std::ifstream file(directory + "/" + source);
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		size_t include = line.find("#include \"");
+		if (include == std::string::npos)
+			continue;
+
+		size_t begin = include + 10;
+		size_t end = line.find('"', begin);
+		if (end != std::string::npos && dependsOn(line.substr(begin, end - begin), name, depth - 1))
+			return true;
+	}
+
+	return false;
+}
+
+/* Watcher thread */
+
+void ShaderWatcher::watchLoop ()
+{
+	untrackHeapAllocations();
+
+#ifdef __linux__
+	std::vector<std::string> changed;
+	alignas(inotify_event) char buffer[4096];
+
+	pollfd watch = {};
+	watch.fd = descriptor;
+	watch.events = POLLIN;
+
+	while (running)
+	{
+		int ready = poll(&watch, 1, changed.empty() ? SHADER_WATCH_POLL_MILLISECONDS : SHADER_WATCH_DEBOUNCE_MILLISECONDS);
+
+		if (ready > 0)
+		{
+			ssize_t length;
+			while ((length = read(descriptor, buffer, sizeof(buffer))) > 0)
+				for (char *event = buffer; event < buffer + length; event += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(event)->len)
+				{
+					const inotify_event *notification = reinterpret_cast<const inotify_event*>(event);
+					if (notification->len == 0)
+						continue;
+
+					/* our own outputs, and editor backups */
+					std::string name = notification->name;
+					if (endsWith(name, ".spv") || endsWith(name, ".tmp") || endsWith(name, "~") || name[0] == '.')
+						continue;
+
+					if (std::find(changed.begin(), changed.end(), name) == changed.end())
+						changed.push_back(name);
+				}
+			continue;
+		}
+
+		/* quiet for a while, and the previous reload was swapped in */
+		if (ready == 0 && !changed.empty() && !factory->hasReplacements())
+		{
+			rebuild(changed);
+			changed.clear();
+		}
+	}
+#endif
+}
+
+void ShaderWatcher::rebuild (const std::vector<std::string>& changed)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> outputs;
+	for (const Command& command : commands)
+	{
+		bool affected = false;
+		for (const std::string& name : changed)
+			affected = affected || dependsOn(command.source, name, 4);
+		if (!affected)
+			continue;
+
+		/* the old SPIR-V stays until the new one is whole */
+		std::string temporary = directory + "/" + command.output + ".tmp";
+		std::string path = directory + "/" + command.output;
+		std::string line = "cd '" + directory + "' && " + command.arguments + " -o '" + command.output + ".tmp'";
+
+		if (std::system(line.c_str()) != 0 || std::rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			std::cerr << "shader reload: " << command.source << " did not compile, " << command.output << " kept" << std::endl;
+			std::remove(temporary.c_str());
+			compileFailureCount++;
+			continue;
+		}
+
+		outputs.push_back(path);
+	}
+
+	if (outputs.empty())
+		return;
+
+	auto compiled = std::chrono::steady_clock::now();
+
+	uint32_t rebuilt;
+	if (!factory->reload(outputs, rebuilt))
+	{
+		std::cerr << "shader reload: pipelines could not be created, the previous ones are kept" << std::endl;
+		pipelineFailureCount++;
+		return;
+	}
+
+	auto created = std::chrono::steady_clock::now();
+	compileMilliseconds += std::chrono::duration<double, std::milli>(compiled - start).count();
+	pipelineMilliseconds += std::chrono::duration<double, std::milli>(created - compiled).count();
+	rebuiltCount += rebuilt;
+	reloadCount++;
+
+	std::cout << "shader reload: " << outputs.size() << " shaders, " << rebuilt << " pipelines" << std::endl;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "pipeline.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* quiet time after the last change before compiling : editors write in several steps */
+const int SHADER_WATCH_DEBOUNCE_MILLISECONDS = 100;
+/* how often the watcher looks at running when nothing changes */
+const int SHADER_WATCH_POLL_MILLISECONDS = 250;
+
+/*
+ * Shader hot reload. The watcher thread reads the glslangValidator lines of
+ * the compile script once, then waits for inotify events on the shader
+ * directory. A changed source, or a file one includes, is compiled again with
+ * the same command into a temporary file, renamed over the SPIR-V on success.
+ * PipelineFactory::reload() then recreates the pipelines using it, still on
+ * the watcher thread; the render thread swaps them in at a frame boundary.
+ *
+ * A shader that does not compile, or a pipeline that cannot be created, is
+ * reported and the running one kept. Linux only : elsewhere start() says no.
+ */
+
+class ShaderWatcher
+{
+private:
+	struct Command
+	{
+		std::string arguments;		/* the script line without its output */
+		std::string source;
+		std::string output;
+	};
+
+	PipelineFactory *factory = nullptr;
+	std::string directory;
+	std::vector<Command> commands;
+
+	int descriptor = -1;
+	std::thread worker;
+	std::atomic<bool> running;
+
+	std::atomic<uint32_t> reloadCount;
+	std::atomic<uint32_t> compileFailureCount;
+	std::atomic<uint32_t> pipelineFailureCount;
+	std::atomic<uint32_t> rebuiltCount;
+	double compileMilliseconds = 0.0;
+	double pipelineMilliseconds = 0.0;
+
+	void parseScript (const std::string& script);
+	bool dependsOn (const std::string& source, const std::string& name, uint32_t depth) const;
+	void watchLoop ();
+	void rebuild (const std::vector<std::string>& changed);
+
+public:
+	ShaderWatcher () : running(false), reloadCount(0), compileFailureCount(0), pipelineFailureCount(0), rebuiltCount(0) {}
+	~ShaderWatcher () { stop(); }
+
+	/* directory holds the sources, the SPIR-V and script : false when nothing can be watched */
+	bool start (PipelineFactory& factory, const std::string& directory, const std::string& script);
+	void stop ();
+
+	bool active () const { return running; }
+
+	uint32_t reloads () const { return reloadCount; }
+	uint32_t compileFailures () const { return compileFailureCount; }
+	uint32_t pipelineFailures () const { return pipelineFailureCount; }
+	uint32_t rebuiltPipelines () const { return rebuiltCount; }
+
+	/* per reload : read after stop() */
+	double averageCompileMilliseconds () const { return reloadCount > 0 ? compileMilliseconds / reloadCount : 0.0; }
+	double averagePipelineMilliseconds () const { return reloadCount > 0 ? pipelineMilliseconds / reloadCount : 0.0; }
+};
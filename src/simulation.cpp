@@ -0,0 +1,114 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+/* Simulation */
+
+void Simulation::init (uint32_t tickRate, size_t rows)
+{
+	tickSeconds = 1.0 / tickRate;
+	rowCount = rows;
+
+	/* every copy between snapshots reuses these */
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		snapshots.slot(i).previous.rowHeights.resize(rowCount);
+		snapshots.slot(i).current.rowHeights.resize(rowCount);
+	}
+	last.rowHeights.resize(rowCount);
+}
+
+void Simulation::evaluate (uint64_t tick, SimulationState& state) const
+{
+	state.tick = tick;
+	state.time = tick * tickSeconds;
+
+	/* the camera flies back and forth over the instance grid */
+	state.cameraTravel = 0.5f - 0.5f * std::cos((float) state.time * 0.2f);
+
+	/* every other row bobs, the rest of the scene stays clean */
+	state.rowHeights.resize(rowCount);
+	for (size_t row = 0; row < rowCount; row++)
+		state.rowHeights[row] = row % 2 == 1 ? std::sin((float) state.time + row) * 0.25f : 0.0f;
+}
+
+void Simulation::interpolate (const FrameSnapshot& snapshot, float alpha, SimulationState& state)
+{
+	const SimulationState& previous = snapshot.previous;
+	const SimulationState& current = snapshot.current;
+
+	state.tick = current.tick;
+	state.time = previous.time + (current.time - previous.time) * alpha;
+	state.cameraTravel = previous.cameraTravel + (current.cameraTravel - previous.cameraTravel) * alpha;
+
+	state.rowHeights.resize(current.rowHeights.size());
+	for (size_t row = 0; row < current.rowHeights.size(); row++)
+		state.rowHeights[row] = previous.rowHeights[row] + (current.rowHeights[row] - previous.rowHeights[row]) * alpha;
+}
+
+void Simulation::start (double now)
+{
+	startTime = now;
+	evaluate(0, last);
+
+	FrameSnapshot& snapshot = snapshots.writeSlot();
+	snapshot.previous = last;
+	snapshot.current = last;
+	snapshot.due = startTime;
+	snapshots.publish();
+
+	nextTick = 1;
+}
+
+void Simulation::tick (uint64_t index)
+{
+	auto begin = std::chrono::steady_clock::now();
+
+	FrameSnapshot& snapshot = snapshots.writeSlot();
+	snapshot.previous = last;
+	evaluate(index, last);
+	snapshot.current = last;
+	snapshot.due = startTime + index * tickSeconds;
+
+	if (spikeInterval != 0 && index % spikeInterval == 0)
+		while (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() < spikeMilliseconds);
+
+	snapshots.publish();
+
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	totalTickMilliseconds += milliseconds;
+	peakTickMilliseconds = std::max(peakTickMilliseconds, milliseconds);
+	ticks++;
+}
+
+double Simulation::advance (double now, uint32_t maxTicks)
+{
+	double elapsed = now - startTime;
+	uint64_t due = elapsed > 0.0 ? static_cast<uint64_t>(elapsed / tickSeconds) : 0;
+
+	for (uint32_t i = 0; i < maxTicks && nextTick <= due; i++)
+		tick(nextTick++);
+
+	/* too far behind to catch up : the simulation clock slips instead of spiralling */
+	if (nextTick <= due)
+	{
+		uint64_t skipped = due - nextTick + 1;
+		droppedTicks += skipped;
+		startTime += skipped * tickSeconds;
+	}
+
+	return startTime + nextTick * tickSeconds;
+}
+
+const FrameSnapshot& Simulation::latest (bool& fresh)
+{
+	fresh = snapshots.acquire();
+	return snapshots.readSlot();
+}
+
+float Simulation::alpha (const FrameSnapshot& snapshot, double now) const
+{
+	return static_cast<float>(std::min(std::max((now - snapshot.due) / tickSeconds, 0.0), 1.0));
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "triple_buffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* the animated state of the scene at a point in time */
+struct SimulationState
+{
+	uint64_t tick;
+	double time;				/* seconds since the simulation started */
+	float cameraTravel;			/* 0 over the grid, 1 at the far end of the flight */
+	std::vector<float> rowHeights;	/* per mesh row, in grid spacings */
+};
+
+/* the last two ticks : a frame shows a point between them */
+struct FrameSnapshot
+{
+	SimulationState previous;
+	SimulationState current;
+	double due;					/* wall clock time the current tick was due at */
+};
+
+/*
+ * The scene logic at a fixed tick rate, on its own thread, handing snapshots
+ * to the render thread through a triple buffer. A tick is a pure function of
+ * its index : a replay evaluates the ticks a capture recorded instead of
+ * running the thread.
+ *
+ * The renderer draws between the two ticks of the newest snapshot, one tick
+ * behind the simulation : a late tick holds the picture on the last one, the
+ * render thread never waits for the simulation.
+ */
+
+class Simulation
+{
+private:
+	double tickSeconds = 1.0;
+	size_t rowCount = 0;
+	double startTime = 0.0;
+	uint64_t nextTick = 0;
+
+	/* optional stall every spikeInterval ticks, to check the render thread does not feel it */
+	double spikeMilliseconds = 0.0;
+	uint32_t spikeInterval = 0;
+
+	TripleBuffer<FrameSnapshot> snapshots;
+	SimulationState last;
+
+	uint64_t ticks = 0;
+	uint64_t droppedTicks = 0;
+	double totalTickMilliseconds = 0.0;
+	double peakTickMilliseconds = 0.0;
+
+	void tick (uint64_t index);
+
+public:
+	void init (uint32_t tickRate, size_t rowCount);
+	void setSpike (double milliseconds, uint32_t interval) { spikeMilliseconds = milliseconds; spikeInterval = interval; }
+
+	/* the state of a tick, from nothing but its index */
+	void evaluate (uint64_t tick, SimulationState& state) const;
+	static void interpolate (const FrameSnapshot& snapshot, float alpha, SimulationState& state);
+
+	/* simulation thread : publishes tick 0 at now */
+	void start (double now);
+
+	/* runs the ticks due by now, at most maxTicks of them, later ones are dropped. The time the next one is due */
+	double advance (double now, uint32_t maxTicks);
+
+	/* render thread : the newest snapshot, and where now falls between its ticks */
+	const FrameSnapshot& latest (bool& fresh);
+	float alpha (const FrameSnapshot& snapshot, double now) const;
+
+	double tickLength () const { return tickSeconds; }
+	uint64_t tickCount () const { return ticks; }
+	uint64_t dropped () const { return droppedTicks; }
+	double averageTickMilliseconds () const { return ticks > 0 ? totalTickMilliseconds / ticks : 0.0; }
+	double peakMilliseconds () const { return peakTickMilliseconds; }
+};
@@ -0,0 +1,195 @@
+#include "startup.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+/* StartupSchedule */
+
+uint32_t StartupSchedule::add (const std::string& name, std::function<void ()> function, const std::vector<uint32_t>& dependencies,
+		bool mainThread)
+{
+	uint32_t index = static_cast<uint32_t>(steps.size());
+
+	/* only earlier steps : the graph cannot have a cycle */
+	for (uint32_t dependency : dependencies)
+		if (dependency >= index)
+			throw std::runtime_error("startup step " + name + " depends on a later step!");
+
+	Step step;
+	step.name = name;
+	step.function = function;
+	step.dependencies = dependencies;
+	step.waiting = static_cast<uint32_t>(dependencies.size());
+	step.chain = 1;
+	step.mainThread = mainThread;
+	step.start = step.end = 0.0;
+	step.thread = 0;
+	steps.push_back(step);
+
+	for (uint32_t dependency : dependencies)
+		steps[dependency].dependents.push_back(index);
+
+	return index;
+}
+
+void StartupSchedule::run (unsigned threads, std::chrono::steady_clock::time_point startTime)
+{
+	origin = startTime;
+	threadCount = std::max(threads, 1u);
+
+	/* dependents come later : backwards, every chain below a step is known before it */
+	for (size_t i = steps.size(); i-- > 0;)
+		for (uint32_t dependent : steps[i].dependents)
+			steps[i].chain = std::max(steps[i].chain, steps[dependent].chain + 1);
+
+	remaining = steps.size();
+	for (uint32_t i = 0; i < steps.size(); i++)
+		if (steps[i].waiting == 0)
+			ready.push_back(i);
+
+	std::vector<std::thread> helpers;
+	for (uint32_t i = 1; i < threadCount; i++)
+		helpers.push_back(std::thread(&StartupSchedule::work, this, i));
+
+	work(0);
+
+	for (std::thread& helper : helpers)
+		helper.join();
+
+	if (failure)
+		std::rethrow_exception(failure);
+}
+
+/* the ready step with the longest chain this thread may run */
+bool StartupSchedule::pick (uint32_t thread, uint32_t& index)
+{
+	size_t best = ready.size();
+	for (size_t i = 0; i < ready.size(); i++)
+	{
+		const Step& step = steps[ready[i]];
+		if (step.mainThread && thread != 0)
+			continue;
+		if (best == ready.size() || step.chain > steps[ready[best]].chain)
+			best = i;
+	}
+
+	if (best == ready.size())
+		return false;
+
+	index = ready[best];
+	ready.erase(ready.begin() + best);
+	return true;
+}
+
+void StartupSchedule::work (uint32_t thread)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;)
+	{
+		uint32_t index = 0;
+		changed.wait(lock, [&] { return remaining == 0 || failure || pick(thread, index); });
+		if (remaining == 0 || failure)
+			return;
+
+		Step& step = steps[index];
+		lock.unlock();
+
+		std::exception_ptr error;
+		auto start = std::chrono::steady_clock::now();
+		try
+		{
+			step.function();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		lock.lock();
+		step.start = since(start);
+		step.end = since(end);
+		step.thread = thread;
+		remaining--;
+
+		if (error && !failure)
+			failure = error;
+
+		for (uint32_t dependent : step.dependents)
+			if (--steps[dependent].waiting == 0)
+				ready.push_back(dependent);
+
+		changed.notify_all();
+	}
+}
+
+double StartupSchedule::since (std::chrono::steady_clock::time_point time) const
+{
+	return std::chrono::duration<double, std::milli>(time - origin).count();
+}
+
+double StartupSchedule::milliseconds () const
+{
+	double end = 0.0;
+	for (const Step& step : steps)
+		end = std::max(end, step.end);
+	return end;
+}
+
+/* Report */
+
+void StartupSchedule::writeTrace (std::ostream& out, double firstFrame) const
+{
+	/* complete events in microseconds, one row per thread */
+	out << "{\"traceEvents\":[" << std::endl;
+
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+		const Step& step = steps[i];
+		out << "{\"name\":\"" << step.name << "\",\"cat\":\"startup\",\"ph\":\"X\",\"pid\":1,\"tid\":" << step.thread
+			<< ",\"ts\":" << step.start * 1000.0 << ",\"dur\":" << (step.end - step.start) * 1000.0 << "}";
+		out << (i + 1 < steps.size() || firstFrame > 0.0 ? "," : "") << std::endl;
+	}
+
+	if (firstFrame > 0.0)
+		out << "{\"name\":\"first frame\",\"cat\":\"startup\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":"
+			<< firstFrame * 1000.0 << "}" << std::endl;
+
+	out << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+}
+
+void StartupSchedule::print (std::ostream& out) const
+{
+	if (steps.empty())
+		return;
+
+	double busy = 0.0;
+	for (const Step& step : steps)
+		busy += step.end - step.start;
+
+	/* back from the last step to finish, through the dependency that finished last each time */
+	std::vector<uint32_t> path;
+	uint32_t last = 0;
+	for (uint32_t i = 0; i < steps.size(); i++)
+		if (steps[i].end > steps[last].end)
+			last = i;
+
+	for (bool more = true; more;)
+	{
+		path.push_back(last);
+		more = !steps[last].dependencies.empty();
+		uint32_t next = more ? steps[last].dependencies[0] : 0;
+		for (uint32_t dependency : steps[last].dependencies)
+			if (steps[dependency].end > steps[next].end)
+				next = dependency;
+		last = next;
+	}
+
+	out << "startup: " << steps.size() << " steps on " << threadCount << " threads, " << milliseconds() << " ms ("
+		<< busy << " ms of work), critical path :";
+	for (size_t i = path.size(); i-- > 0;)
+		out << " " << steps[path[i]].name << " " << steps[path[i]].end - steps[path[i]].start << " ms" << (i > 0 ? "," : "");
+	out << std::endl;
+}
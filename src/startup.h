@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Startup as a graph of steps. add() takes a step and the earlier steps it
+ * needs; run() starts every step whose dependencies are done on the first
+ * free thread, the longest chain of dependents first : the steps the first
+ * frame waits on the longest never queue behind ones that could run later.
+ * The calling thread takes part, and alone runs the steps marked mainThread
+ * (window system calls).
+ *
+ * Steps are timed from the origin given to run() : writeTrace() saves them
+ * as a Chrome trace (chrome://tracing, Perfetto), print() sums them up with
+ * the critical path. The first exception stops the scheduling, run() throws
+ * it again once the steps already running are done.
+ */
+
+class StartupSchedule
+{
+private:
+	struct Step
+	{
+		std::string name;
+		std::function<void ()> function;
+		std::vector<uint32_t> dependencies;
+		std::vector<uint32_t> dependents;
+		uint32_t waiting;
+		uint32_t chain;				/* steps on the longest path from here to the end */
+		bool mainThread;
+
+		double start;
+		double end;
+		uint32_t thread;
+	};
+
+	std::vector<Step> steps;
+	std::chrono::steady_clock::time_point origin;
+	unsigned threadCount = 0;
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<uint32_t> ready;
+	size_t remaining = 0;
+	std::exception_ptr failure;
+
+	bool pick (uint32_t thread, uint32_t& index);
+	void work (uint32_t thread);
+	double since (std::chrono::steady_clock::time_point time) const;
+
+public:
+	/* the index of the step, to name it as a dependency of later ones */
+	uint32_t add (const std::string& name, std::function<void ()> function, const std::vector<uint32_t>& dependencies,
+			bool mainThread = false);
+
+	/* blocks until every step ran, on the caller and threads - 1 more */
+	void run (unsigned threads, std::chrono::steady_clock::time_point origin);
+
+	/* milliseconds from the origin, when every step was done */
+	double milliseconds () const;
+
+	/* firstFrame : milliseconds from the origin, marked on the timeline when positive */
+	void writeTrace (std::ostream& out, double firstFrame) const;
+	void print (std::ostream& out) const;
+};
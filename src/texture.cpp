@@ -0,0 +1,861 @@
+#include "texture.h"
+#include "allocator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+static const uint32_t NO_SLOT = ~0u;
+static const uint32_t MAX_MIP_LEVELS = 16;
+
+static const uint8_t KTX2_IDENTIFIER[12] = {
+	0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+
+/* Static functions */
+
+static bool isBlockCompressed (VkFormat format)
+{
+	return (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK) ||
+		(format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK);
+}
+
+static bool compressionEnabled (const DeviceContext& context, VkFormat format)
+{
+	if (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK)
+		return context.enabledFeatures.textureCompressionBC == VK_TRUE;
+
+	if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK)
+		return context.enabledFeatures.textureCompressionASTC_LDR == VK_TRUE;
+
+	return true;
+}
+
+/* texel block of the formats a KTX2 file may hold here : 1 x 1 for the uncompressed ones, false for the others */
+static bool formatBlock (VkFormat format, uint32_t& blockWidth, uint32_t& blockHeight, uint32_t& blockBytes)
+{
+	blockWidth = 1;
+	blockHeight = 1;
+
+	switch (format)
+	{
+		case VK_FORMAT_R8_UNORM: case VK_FORMAT_R8_SRGB:
+			blockBytes = 1;
+			return true;
+		case VK_FORMAT_R8G8_UNORM: case VK_FORMAT_R8G8_SRGB: case VK_FORMAT_R5G6B5_UNORM_PACK16: case VK_FORMAT_B5G6R5_UNORM_PACK16:
+		case VK_FORMAT_R16_UNORM: case VK_FORMAT_R16_UINT: case VK_FORMAT_R16_SFLOAT:
+			blockBytes = 2;
+			return true;
+		case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB: case VK_FORMAT_R8G8B8A8_SNORM: case VK_FORMAT_R8G8B8A8_UINT:
+		case VK_FORMAT_R8G8B8A8_SINT: case VK_FORMAT_B8G8R8A8_UNORM: case VK_FORMAT_B8G8R8A8_SRGB: case VK_FORMAT_B8G8R8A8_SNORM:
+		case VK_FORMAT_A8B8G8R8_UNORM_PACK32: case VK_FORMAT_A8B8G8R8_SRGB_PACK32: case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+		case VK_FORMAT_A2B10G10R10_UINT_PACK32: case VK_FORMAT_A2R10G10B10_UNORM_PACK32: case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+		case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32: case VK_FORMAT_R16G16_UNORM: case VK_FORMAT_R16G16_SNORM: case VK_FORMAT_R16G16_SFLOAT:
+		case VK_FORMAT_R32_UINT: case VK_FORMAT_R32_SINT: case VK_FORMAT_R32_SFLOAT:
+			blockBytes = 4;
+			return true;
+		case VK_FORMAT_R16G16B16A16_UNORM: case VK_FORMAT_R16G16B16A16_SNORM: case VK_FORMAT_R16G16B16A16_UINT:
+		case VK_FORMAT_R16G16B16A16_SINT: case VK_FORMAT_R16G16B16A16_SFLOAT: case VK_FORMAT_R32G32_UINT: case VK_FORMAT_R32G32_SFLOAT:
+			blockBytes = 8;
+			return true;
+		case VK_FORMAT_R32G32B32_SFLOAT:
+			blockBytes = 12;
+			return true;
+		case VK_FORMAT_R32G32B32A32_UINT: case VK_FORMAT_R32G32B32A32_SFLOAT:
+			blockBytes = 16;
+			return true;
+		default:
+			break;
+	}
+
+	/* every BC and ASTC block is 4 x 4 texels or more, 8 bytes for BC1 and BC4, 16 for the rest */
+	blockWidth = 4;
+	blockHeight = 4;
+
+	switch (format)
+	{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK: case VK_FORMAT_BC1_RGB_SRGB_BLOCK: case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: case VK_FORMAT_BC4_UNORM_BLOCK: case VK_FORMAT_BC4_SNORM_BLOCK:
+			blockBytes = 8;
+			return true;
+		case VK_FORMAT_BC2_UNORM_BLOCK: case VK_FORMAT_BC2_SRGB_BLOCK: case VK_FORMAT_BC3_UNORM_BLOCK: case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC5_UNORM_BLOCK: case VK_FORMAT_BC5_SNORM_BLOCK: case VK_FORMAT_BC6H_UFLOAT_BLOCK: case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK: case VK_FORMAT_BC7_SRGB_BLOCK:
+		case VK_FORMAT_ASTC_4x4_UNORM_BLOCK: case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+			break;
+		case VK_FORMAT_ASTC_5x4_UNORM_BLOCK: case VK_FORMAT_ASTC_5x4_SRGB_BLOCK:
+			blockWidth = 5;
+			break;
+		case VK_FORMAT_ASTC_5x5_UNORM_BLOCK: case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+			blockWidth = blockHeight = 5;
+			break;
+		case VK_FORMAT_ASTC_6x5_UNORM_BLOCK: case VK_FORMAT_ASTC_6x5_SRGB_BLOCK:
+			blockWidth = 6; blockHeight = 5;
+			break;
+		case VK_FORMAT_ASTC_6x6_UNORM_BLOCK: case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+			blockWidth = blockHeight = 6;
+			break;
+		case VK_FORMAT_ASTC_8x5_UNORM_BLOCK: case VK_FORMAT_ASTC_8x5_SRGB_BLOCK:
+			blockWidth = 8; blockHeight = 5;
+			break;
+		case VK_FORMAT_ASTC_8x6_UNORM_BLOCK: case VK_FORMAT_ASTC_8x6_SRGB_BLOCK:
+			blockWidth = 8; blockHeight = 6;
+			break;
+		case VK_FORMAT_ASTC_8x8_UNORM_BLOCK: case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+			blockWidth = blockHeight = 8;
+			break;
+		case VK_FORMAT_ASTC_10x5_UNORM_BLOCK: case VK_FORMAT_ASTC_10x5_SRGB_BLOCK:
+			blockWidth = 10; blockHeight = 5;
+			break;
+		case VK_FORMAT_ASTC_10x6_UNORM_BLOCK: case VK_FORMAT_ASTC_10x6_SRGB_BLOCK:
+			blockWidth = 10; blockHeight = 6;
+			break;
+		case VK_FORMAT_ASTC_10x8_UNORM_BLOCK: case VK_FORMAT_ASTC_10x8_SRGB_BLOCK:
+			blockWidth = 10; blockHeight = 8;
+			break;
+		case VK_FORMAT_ASTC_10x10_UNORM_BLOCK: case VK_FORMAT_ASTC_10x10_SRGB_BLOCK:
+			blockWidth = blockHeight = 10;
+			break;
+		case VK_FORMAT_ASTC_12x10_UNORM_BLOCK: case VK_FORMAT_ASTC_12x10_SRGB_BLOCK:
+			blockWidth = 12; blockHeight = 10;
+			break;
+		case VK_FORMAT_ASTC_12x12_UNORM_BLOCK: case VK_FORMAT_ASTC_12x12_SRGB_BLOCK:
+			blockWidth = blockHeight = 12;
+			break;
+		default:
+			return false;
+	}
+
+	blockBytes = 16;
+	return true;
+}
+
+static uint32_t fullMipChain (uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+		levels++;
+
+	return std::min(levels, MAX_MIP_LEVELS);
+}
+
+template <typename T>
+static T readValue (const char *data)
+{
+	T value;
+	memcpy(&value, data, sizeof(T));
+	return value;
+}
+
+/* Ktx2File */
+
+Ktx2File Ktx2File::open (const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file.is_open())
+		throw std::runtime_error("failed to open texture file!");
+
+	char header[80];
+	if (!file.read(header, sizeof(header)) || memcmp(header, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		throw std::runtime_error("invalid KTX2 header!");
+
+	Ktx2File ktx;
+	ktx.path = path;
+	ktx.format = static_cast<VkFormat>(readValue<uint32_t>(header + 12));
+	ktx.width = readValue<uint32_t>(header + 20);
+	ktx.height = readValue<uint32_t>(header + 24);
+
+	uint32_t depth = readValue<uint32_t>(header + 28);
+	uint32_t layerCount = readValue<uint32_t>(header + 32);
+	uint32_t faceCount = readValue<uint32_t>(header + 36);
+	uint32_t levelCount = std::max(readValue<uint32_t>(header + 40), 1u);
+	uint32_t supercompression = readValue<uint32_t>(header + 44);
+
+	if (ktx.format == VK_FORMAT_UNDEFINED || supercompression != 0)
+		throw std::runtime_error("unsupported KTX2 payload (basis / supercompressed)!");
+
+	if (depth > 1 || layerCount > 1 || faceCount != 1 || ktx.width == 0 || ktx.height == 0)
+		throw std::runtime_error("only 2D KTX2 textures are supported!");
+
+	if (levelCount > MAX_MIP_LEVELS)
+		throw std::runtime_error("too many KTX2 mip levels!");
+
+	uint32_t blockWidth, blockHeight, blockBytes;
+	if (!formatBlock(ktx.format, blockWidth, blockHeight, blockBytes))
+		throw std::runtime_error("unsupported KTX2 format!");
+
+	ktx.levels.resize(levelCount);
+	for (Ktx2Level& level : ktx.levels)
+	{
+		char entry[24];
+		if (!file.read(entry, sizeof(entry)))
+			throw std::runtime_error("truncated KTX2 level index!");
+
+		level.byteOffset = readValue<uint64_t>(entry);
+		level.byteLength = readValue<uint64_t>(entry + 8);
+		level.uncompressedByteLength = readValue<uint64_t>(entry + 16);
+	}
+
+	/* levels are streamed long after this : a truncated or overlapping index fails now, not at every read */
+	uint64_t indexEnd = sizeof(header) + 24 * (uint64_t) levelCount;
+	file.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t) file.tellg();
+
+	for (size_t i = 0; i < ktx.levels.size(); i++)
+	{
+		const Ktx2Level& level = ktx.levels[i];
+
+		/* the upload copies a whole level extent out of the staging slot : exactly that many bytes, no fewer */
+		uint64_t blocksX = (std::max(ktx.width >> i, 1u) + blockWidth - 1) / blockWidth;
+		uint64_t blocksY = (std::max(ktx.height >> i, 1u) + blockHeight - 1) / blockHeight;
+
+		if (level.byteLength != blocksX * blocksY * blockBytes || level.uncompressedByteLength != level.byteLength)
+			throw std::runtime_error("invalid KTX2 level length!");
+
+		if (level.byteOffset < indexEnd || level.byteOffset > fileSize || level.byteLength > fileSize - level.byteOffset)
+			throw std::runtime_error("KTX2 level outside the file!");
+
+		for (size_t j = 0; j < i; j++)
+			if (level.byteOffset < ktx.levels[j].byteOffset + ktx.levels[j].byteLength &&
+					ktx.levels[j].byteOffset < level.byteOffset + level.byteLength)
+				throw std::runtime_error("overlapping KTX2 levels!");
+	}
+
+	return ktx;
+}
+
+/* TextureManager */
+
+void TextureManager::init (const DeviceContext& context, VkDeviceSize budget, VkDeviceSize slotSize, uint32_t slotCount, uint32_t maxTextures)
+{
+	this->context = &context;
+	this->budget = budget;
+	this->slotSize = slotSize;
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = context.graphicsFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	if (vkCreateCommandPool(context.device, &poolInfo, context.allocator, &commandPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture command pool!");
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.anisotropyEnable = context.enabledFeatures.samplerAnisotropy;
+	samplerInfo.maxAnisotropy = context.enabledFeatures.samplerAnisotropy ? 8.0f : 1.0f;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = (float) MAX_MIP_LEVELS;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+
+	if (vkCreateSampler(context.device, &samplerInfo, context.allocator, &sampler) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture sampler!");
+
+	context.createBuffer(slotSize * slotCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory,
+			MEMORY_CATEGORY_STAGING);
+
+	void *data;
+	vkMapMemory(context.device, stagingMemory, 0, slotSize * slotCount, 0, &data);
+	stagingData = static_cast<char*>(data);
+
+	/* everything touched from update() is sized up front so streaming never reallocates */
+	textures.reserve(maxTextures);
+	freeSlots.reserve(slotCount);
+	for (uint32_t i = 0; i < slotCount; i++)
+		freeSlots.push_back(slotCount - 1 - i);
+
+	uploads.reserve(slotCount * 2);
+	frameEvents.reserve(slotCount * 2);
+	pendingReads.reserve(slotCount);
+	completedReads.reserve(slotCount);
+	completedSwap.reserve(slotCount);
+
+	createDefaultTexture();
+
+	running = true;
+	worker = std::thread(&TextureManager::streamLoop, this);
+}
+
+void TextureManager::destroy ()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	condition.notify_all();
+
+	if (worker.joinable())
+		worker.join();
+
+	retireUploads(true);
+
+	for (Texture& texture : textures)
+	{
+		if (texture.image == VK_NULL_HANDLE) continue;
+
+		vkDestroyImageView(context->device, texture.view, context->allocator);
+		vkDestroyImage(context->device, texture.image, context->allocator);
+		context->freeMemory(texture.memory);
+	}
+	textures.clear();
+
+	vkUnmapMemory(context->device, stagingMemory);
+	context->destroyBuffer(stagingBuffer, stagingMemory);
+
+	vkDestroyImageView(context->device, defaultView, context->allocator);
+	context->destroyImage(defaultImage, defaultMemory);
+
+	vkDestroySampler(context->device, sampler, context->allocator);
+	vkDestroyCommandPool(context->device, commandPool, context->allocator);
+}
+
+void TextureManager::createDefaultTexture ()
+{
+	context->createImage(1, 1, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, defaultImage, defaultMemory, 1, VK_SAMPLE_COUNT_1_BIT, MEMORY_CATEGORY_TEXTURE);
+	defaultView = context->createImageView(defaultImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+	VkCommandBufferAllocateInfo commandInfo = {};
+	commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandInfo.commandPool = commandPool;
+	commandInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(context->device, &commandInfo, &commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate texture command buffer!");
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	imageBarrier(commandBuffer, defaultImage, 0, 1,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	VkClearColorValue white = {{1.0f, 1.0f, 1.0f, 1.0f}};
+	VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+	vkCmdClearColorImage(commandBuffer, defaultImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &white, 1, &range);
+
+	imageBarrier(commandBuffer, defaultImage, 0, 1,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	if (context->submitAndWait(submitInfo) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit default texture!");
+
+	vkFreeCommandBuffers(context->device, commandPool, 1, &commandBuffer);
+}
+
+TextureHandle TextureManager::load (const std::string& path)
+{
+	if (textures.size() == textures.capacity())
+		throw std::runtime_error("too many textures!");
+
+	Texture texture;
+	texture.source = Ktx2File::open(path);
+
+	VkFormat format = texture.source.format;
+
+	if (!compressionEnabled(*context, format) ||
+			!context->formatSupports(format, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+		throw std::runtime_error("texture format not supported by the device!");
+
+	/* a lone level gets its chain generated on the GPU, when the format can be blitted */
+	texture.generateMipmaps = texture.source.levels.size() == 1 && !isBlockCompressed(format) &&
+		context->formatSupports(format, VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+				VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+
+	texture.mipLevels = texture.generateMipmaps
+		? fullMipChain(texture.source.width, texture.source.height)
+		: static_cast<uint32_t>(texture.source.levels.size());
+	texture.residentLevel = texture.mipLevels;
+
+	for (const Ktx2Level& level : texture.source.levels)
+		if (level.byteLength > slotSize)
+			throw std::runtime_error("texture level does not fit in a staging slot!");
+
+	textures.push_back(texture);
+
+	return static_cast<TextureHandle>(textures.size() - 1);
+}
+
+void TextureManager::touch (TextureHandle handle, uint64_t frame)
+{
+	textures[handle].lastUsedFrame = frame;
+}
+
+void TextureManager::update (uint64_t frame)
+{
+	frameEvents.clear();
+	retireUploads(false);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		completedSwap.swap(completedReads);
+	}
+
+	for (const StreamRequest& request : completedSwap)
+	{
+		Texture& texture = textures[request.texture];
+
+		if (!request.ok)
+		{
+			/* the file will not read better next frame */
+			texture.busy = false;
+			texture.failed = true;
+			failedReads++;
+			committedBytes -= request.estimate;
+			freeSlots.push_back(request.slot);
+			continue;
+		}
+
+		submitUpload(request.texture, request.level, request.slot, request.estimate);
+	}
+	completedSwap.clear();
+
+	/* over the budget with only textures in use left, those drop their finest level too */
+	while ((int64_t) residentBytes + committedBytes > (int64_t) budget && (evictOne(frame) || evictOne(frame + 1)))
+		budgetEvictions++;
+
+	scheduleStreaming();
+}
+
+/* Streaming thread */
+
+void TextureManager::streamLoop ()
+{
+	/* reads and decodes on its own schedule : not part of any frame */
+	untrackHeapAllocations();
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		condition.wait(lock, [this] { return !running || !pendingReads.empty(); });
+
+		if (!running)
+			return;
+
+		StreamRequest request = pendingReads.front();
+		pendingReads.erase(pendingReads.begin());
+
+		lock.unlock();
+		readLevel(request);
+		lock.lock();
+
+		completedReads.push_back(request);
+	}
+}
+
+void TextureManager::readLevel (StreamRequest& request)
+{
+	/* only the immutable source description is read here, textures never reallocates */
+	const Ktx2File& source = textures[request.texture].source;
+	const Ktx2Level& level = source.levels[request.level];
+
+	std::ifstream file(source.path, std::ios::binary);
+	file.seekg(level.byteOffset);
+
+	request.ok = file.read(stagingData + request.slot * slotSize, level.byteLength).good();
+
+	if (!request.ok)
+		std::cerr << "failed to stream " << source.path << " level " << request.level << std::endl;
+}
+
+/* GPU side */
+
+VkExtent3D TextureManager::levelExtent (const Texture& texture, uint32_t level) const
+{
+	VkExtent3D extent;
+	extent.width = std::max(texture.source.width >> level, 1u);
+	extent.height = std::max(texture.source.height >> level, 1u);
+	extent.depth = 1;
+
+	return extent;
+}
+
+VkDeviceSize TextureManager::levelBytes (const Texture& texture, uint32_t level) const
+{
+	if (texture.generateMipmaps)
+		return texture.source.levels[0].byteLength * 4 / 3;
+
+	return texture.source.levels[level].byteLength;
+}
+
+bool TextureManager::submitUpload (TextureHandle handle, uint32_t newResidentLevel, uint32_t slot, int64_t estimate)
+{
+	Texture& texture = textures[handle];
+
+	uint32_t levelCount = texture.mipLevels - newResidentLevel;
+	VkExtent3D extent = levelExtent(texture, newResidentLevel);
+
+	Upload upload = {};
+	upload.texture = handle;
+	upload.slot = slot;
+	upload.residentLevel = newResidentLevel;
+	upload.estimate = estimate;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent = extent;
+	imageInfo.mipLevels = levelCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = texture.source.format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateImage(context->device, &imageInfo, context->allocator, &upload.image) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(context->device, upload.image, &memRequirements);
+
+	VkResult result = context->allocateMemory(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_CATEGORY_TEXTURE, upload.memory);
+
+	/* the heap is full, whatever the budget said : keep what is resident, and never ask for more */
+	if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY)
+	{
+		vkDestroyImage(context->device, upload.image, context->allocator);
+
+		/* free to stream again, or to be evicted, once the budget has room */
+		texture.busy = false;
+		committedBytes -= estimate;
+		if (slot != NO_SLOT)
+			freeSlots.push_back(slot);
+
+		ceiling = residentBytes;
+		budget = std::min(budget, ceiling);
+		failedUploads++;
+		return false;
+	}
+	else if (result != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate texture memory!");
+
+	vkBindImageMemory(context->device, upload.image, upload.memory, 0);
+	upload.bytes = memRequirements.size;
+
+	VkCommandBufferAllocateInfo commandInfo = {};
+	commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandInfo.commandPool = commandPool;
+	commandInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandInfo.commandBufferCount = 1;
+
+	if (vkAllocateCommandBuffers(context->device, &commandInfo, &upload.commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate texture command buffer!");
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	if (vkCreateFence(context->device, &fenceInfo, context->allocator, &upload.fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture fence!");
+
+	VkCommandBuffer commandBuffer = upload.commandBuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	imageBarrier(commandBuffer, upload.image, 0, levelCount,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	bool regenerate = slot != NO_SLOT && texture.generateMipmaps;
+
+	/* carry over the levels both images have in common */
+	if (texture.image != VK_NULL_HANDLE && !regenerate)
+	{
+		uint32_t oldLevelCount = texture.mipLevels - texture.residentLevel;
+		uint32_t firstShared = std::max(texture.residentLevel, newResidentLevel);
+
+		VkImageCopy regions[MAX_MIP_LEVELS];
+		uint32_t regionCount = 0;
+
+		for (uint32_t level = firstShared; level < texture.mipLevels; level++)
+		{
+			VkImageCopy& region = regions[regionCount++];
+			region = {};
+			region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.srcSubresource.mipLevel = level - texture.residentLevel;
+			region.srcSubresource.layerCount = 1;
+			region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.dstSubresource.mipLevel = level - newResidentLevel;
+			region.dstSubresource.layerCount = 1;
+			region.extent = levelExtent(texture, level);
+		}
+
+		imageBarrier(commandBuffer, texture.image, 0, oldLevelCount,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		vkCmdCopyImage(commandBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions);
+
+		/* the old image stays the sampled one until the fence signals */
+		imageBarrier(commandBuffer, texture.image, 0, oldLevelCount,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	if (slot != NO_SLOT)
+	{
+		VkBufferImageCopy region = {};
+		region.bufferOffset = slot * slotSize;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = {0, 0, 0};
+		region.imageExtent = extent;
+
+		vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+
+	if (regenerate)
+	{
+		for (uint32_t level = 1; level < levelCount; level++)
+		{
+			imageBarrier(commandBuffer, upload.image, level - 1, 1,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+			VkExtent3D srcExtent = levelExtent(texture, level - 1);
+			VkExtent3D dstExtent = levelExtent(texture, level);
+
+			VkImageBlit blit = {};
+			blit.srcOffsets[0] = {0, 0, 0};
+			blit.srcOffsets[1] = {(int32_t) srcExtent.width, (int32_t) srcExtent.height, 1};
+			blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.srcSubresource.mipLevel = level - 1;
+			blit.srcSubresource.layerCount = 1;
+			blit.dstOffsets[0] = {0, 0, 0};
+			blit.dstOffsets[1] = {(int32_t) dstExtent.width, (int32_t) dstExtent.height, 1};
+			blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			blit.dstSubresource.mipLevel = level;
+			blit.dstSubresource.layerCount = 1;
+
+			vkCmdBlitImage(commandBuffer, upload.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					upload.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+		}
+
+		if (levelCount > 1)
+			imageBarrier(commandBuffer, upload.image, 0, levelCount - 1,
+					VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+					VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+					VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+		imageBarrier(commandBuffer, upload.image, levelCount - 1, 1,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+	else
+	{
+		imageBarrier(commandBuffer, upload.image, 0, levelCount,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to record texture upload!");
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	if (context->submit(submitInfo, upload.fence) != VK_SUCCESS)
+		throw std::runtime_error("failed to submit texture upload!");
+
+	texture.busy = true;
+	uploads.push_back(upload);
+
+	TextureUploadEvent event = { handle, newResidentLevel, upload.bytes };
+	frameEvents.push_back(event);
+	return true;
+}
+
+void TextureManager::retireUploads (bool wait)
+{
+	for (size_t i = 0; i < uploads.size();)
+	{
+		Upload& upload = uploads[i];
+
+		VkResult status = wait
+			? vkWaitForFences(context->device, 1, &upload.fence, VK_TRUE, std::numeric_limits<uint64_t>::max())
+			: vkGetFenceStatus(context->device, upload.fence);
+
+		if (status != VK_SUCCESS)
+		{
+			i++;
+			continue;
+		}
+
+		Texture& texture = textures[upload.texture];
+
+		if (texture.image != VK_NULL_HANDLE)
+		{
+			vkDestroyImageView(context->device, texture.view, context->allocator);
+			vkDestroyImage(context->device, texture.image, context->allocator);
+			context->freeMemory(texture.memory);
+		}
+
+		texture.image = upload.image;
+		texture.memory = upload.memory;
+		texture.residentLevel = upload.residentLevel;
+		texture.view = context->createImageView(texture.image, texture.source.format, VK_IMAGE_ASPECT_COLOR_BIT,
+				texture.mipLevels - texture.residentLevel);
+		texture.version++;
+		texture.busy = false;
+
+		residentBytes = residentBytes + upload.bytes - texture.residentBytes;
+		texture.residentBytes = upload.bytes;
+		committedBytes -= upload.estimate;
+
+		if (upload.slot != NO_SLOT)
+			freeSlots.push_back(upload.slot);
+
+		vkFreeCommandBuffers(context->device, commandPool, 1, &upload.commandBuffer);
+		vkDestroyFence(context->device, upload.fence, context->allocator);
+
+		uploads[i] = uploads.back();
+		uploads.pop_back();
+	}
+}
+
+bool TextureManager::evictOne (uint64_t olderThan)
+{
+	if (uploads.size() == uploads.capacity())
+		return false;
+
+	TextureHandle victim = INVALID_TEXTURE;
+
+	for (TextureHandle i = 0; i < textures.size(); i++)
+	{
+		const Texture& texture = textures[i];
+
+		if (texture.busy || texture.residentLevel + 1 >= texture.mipLevels || texture.lastUsedFrame >= olderThan)
+			continue;
+
+		if (victim == INVALID_TEXTURE || texture.lastUsedFrame < textures[victim].lastUsedFrame)
+			victim = i;
+	}
+
+	if (victim == INVALID_TEXTURE)
+		return false;
+
+	Texture& texture = textures[victim];
+	int64_t estimate = -(int64_t) (texture.generateMipmaps
+			? texture.residentBytes * 3 / 4
+			: levelBytes(texture, texture.residentLevel));
+
+	committedBytes += estimate;
+	return submitUpload(victim, texture.residentLevel + 1, NO_SLOT, estimate);
+}
+
+void TextureManager::scheduleStreaming ()
+{
+	bool requested = false;
+
+	while (!freeSlots.empty())
+	{
+		/* textures with nothing resident come first, then the most recently used, coarsest first */
+		TextureHandle best = INVALID_TEXTURE;
+
+		for (TextureHandle i = 0; i < textures.size(); i++)
+		{
+			const Texture& texture = textures[i];
+
+			if (texture.busy || texture.failed || texture.residentLevel == 0)
+				continue;
+
+			if (best == INVALID_TEXTURE)
+			{
+				best = i;
+				continue;
+			}
+
+			const Texture& current = textures[best];
+			bool empty = texture.residentLevel == texture.mipLevels;
+			bool currentEmpty = current.residentLevel == current.mipLevels;
+
+			if (empty != currentEmpty)
+			{
+				if (empty) best = i;
+			}
+			else if (texture.lastUsedFrame != current.lastUsedFrame)
+			{
+				if (texture.lastUsedFrame > current.lastUsedFrame) best = i;
+			}
+			else if (texture.residentLevel > current.residentLevel)
+				best = i;
+		}
+
+		if (best == INVALID_TEXTURE)
+			break;
+
+		Texture& texture = textures[best];
+		uint32_t level = texture.generateMipmaps ? 0 : texture.residentLevel - 1;
+		int64_t estimate = (int64_t) levelBytes(texture, level);
+
+		/* the mip tail is always allowed in, finer levels have to fit the budget */
+		if (texture.residentLevel < texture.mipLevels)
+		{
+			while ((int64_t) residentBytes + committedBytes + estimate > (int64_t) budget && evictOne(texture.lastUsedFrame));
+
+			if ((int64_t) residentBytes + committedBytes + estimate > (int64_t) budget)
+				break;
+		}
+
+		StreamRequest request;
+		request.texture = best;
+		request.level = level;
+		request.slot = freeSlots.back();
+		request.estimate = estimate;
+		request.ok = false;
+		freeSlots.pop_back();
+
+		texture.busy = true;
+		committedBytes += estimate;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingReads.push_back(request);
+		requested = true;
+	}
+
+	if (requested)
+		condition.notify_one();
+}
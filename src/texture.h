@@ -0,0 +1,166 @@
+#pragma once
+
+#include "device.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+typedef uint32_t TextureHandle;
+
+const TextureHandle INVALID_TEXTURE = ~0u;
+
+/* KTX2 container (uncompressed payload only, no BasisLZ / zstd supercompression) */
+
+struct Ktx2Level
+{
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+struct Ktx2File
+{
+	std::string path;
+	VkFormat format;
+	uint32_t width;
+	uint32_t height;
+	std::vector<Ktx2Level> levels;
+
+	static Ktx2File open (const std::string& path);
+};
+
+/* an upload submitted by update(), for the frame capture */
+struct TextureUploadEvent
+{
+	TextureHandle texture;
+	uint32_t residentLevel;
+	VkDeviceSize bytes;
+};
+
+/*
+ * A texture only keeps its coarsest mips resident : image mip 0 is source level
+ * residentLevel, and the chain is grown (streamed in) or shrunk (evicted) by
+ * re-creating the image and copying the levels that survive.
+ */
+
+struct Texture
+{
+	Ktx2File source;
+	uint32_t mipLevels;
+	bool generateMipmaps;
+
+	VkImage image = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	VkDeviceSize residentBytes = 0;
+	uint32_t residentLevel;
+	uint32_t version = 0;
+
+	bool busy = false;
+	bool failed = false;		/* a level could not be read : kept at what is resident, never streamed again */
+	uint64_t lastUsedFrame = 0;
+};
+
+class TextureManager
+{
+private:
+	struct StreamRequest
+	{
+		TextureHandle texture;
+		uint32_t level;
+		uint32_t slot;
+		int64_t estimate;
+		bool ok;
+	};
+
+	/* a GPU copy in flight : the new image replaces the texture's one when the fence signals */
+	struct Upload
+	{
+		TextureHandle texture;
+		uint32_t slot;
+		uint32_t residentLevel;
+		VkImage image;
+		VkDeviceMemory memory;
+		VkDeviceSize bytes;
+		int64_t estimate;
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+	};
+
+	const DeviceContext *context = nullptr;
+	VkDeviceSize budget = 0;
+	VkDeviceSize ceiling = ~VkDeviceSize(0);	/* lowered for good by a failed allocation */
+	uint64_t budgetEvictions = 0;
+	uint64_t failedUploads = 0;
+	uint64_t failedReads = 0;
+	VkDeviceSize slotSize = 0;
+
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkSampler sampler = VK_NULL_HANDLE;
+	VkImage defaultImage = VK_NULL_HANDLE;
+	VkDeviceMemory defaultMemory = VK_NULL_HANDLE;
+	VkImageView defaultView = VK_NULL_HANDLE;
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+	char *stagingData = nullptr;
+
+	std::vector<Texture> textures;
+	std::vector<uint32_t> freeSlots;
+	std::vector<Upload> uploads;
+	std::vector<TextureUploadEvent> frameEvents;
+	VkDeviceSize residentBytes = 0;
+	int64_t committedBytes = 0;
+
+	/* streaming thread : reads level payloads straight into the staging slots */
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<StreamRequest> pendingReads;
+	std::vector<StreamRequest> completedReads;
+	std::vector<StreamRequest> completedSwap;
+	bool running = false;
+
+	void streamLoop ();
+	void readLevel (StreamRequest& request);
+
+	/* false when the memory could not be allocated : nothing changed */
+	bool submitUpload (TextureHandle handle, uint32_t newResidentLevel, uint32_t slot, int64_t estimate);
+	void retireUploads (bool wait);
+	bool evictOne (uint64_t olderThan);
+	void scheduleStreaming ();
+	void createDefaultTexture ();
+
+	VkDeviceSize levelBytes (const Texture& texture, uint32_t level) const;
+	VkExtent3D levelExtent (const Texture& texture, uint32_t level) const;
+
+public:
+	void init (const DeviceContext& context, VkDeviceSize budget, VkDeviceSize slotSize, uint32_t slotCount, uint32_t maxTextures);
+	void destroy ();
+
+	TextureHandle load (const std::string& path);
+
+	void touch (TextureHandle handle, uint64_t frame);
+	void update (uint64_t frame);
+
+	/* the uploads the last update() submitted, streamed in or evicted, in submission order */
+	const std::vector<TextureUploadEvent>& frameUploads () const { return frameEvents; }
+
+	const Texture& get (TextureHandle handle) const { return textures[handle]; }
+	size_t count () const { return textures.size(); }
+	VkSampler getSampler () const { return sampler; }
+
+	/* 1x1 opaque white, for materials whose texture is not resident */
+	VkImageView getDefaultView () const { return defaultView; }
+	VkDeviceSize getResidentBytes () const { return residentBytes; }
+	VkDeviceSize getBudget () const { return budget; }
+
+	/* the next update() evicts down to it, and streams up to it */
+	void setBudget (VkDeviceSize bytes) { budget = std::min(bytes, ceiling); }
+	uint64_t getBudgetEvictions () const { return budgetEvictions; }
+	uint64_t getFailedUploads () const { return failedUploads; }
+	uint64_t getFailedReads () const { return failedReads; }
+};
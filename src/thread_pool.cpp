@@ -0,0 +1,144 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+
+ThreadPool::ThreadPool (unsigned threadCount)
+	: activeTasks(0), job(nullptr), jobGeneration(0), stopping(false)
+{
+	/* the caller of parallelFor works too, so one thread less */
+	unsigned workerCount = threadCount > 1 ? threadCount - 1 : 0;
+
+	for (unsigned i = 0; i < workerCount; i++)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool ()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::workerLoop ()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	uint64_t seenGeneration = 0;
+
+	while (true)
+	{
+		wake.wait(lock, [&] {
+			return stopping || (job != nullptr && jobGeneration != seenGeneration) || !tasks.empty();
+		});
+
+		if (job != nullptr && jobGeneration != seenGeneration)
+		{
+			seenGeneration = jobGeneration;
+
+			Job *current = job;
+			current->active++;
+
+			lock.unlock();
+			runJob(*current);
+			lock.lock();
+
+			if (--current->active == 0)
+				finished.notify_all();
+			continue;
+		}
+
+		if (!tasks.empty())
+		{
+			std::function<void ()> task = std::move(tasks.front());
+			tasks.pop_front();
+			activeTasks++;
+
+			lock.unlock();
+			task();
+			lock.lock();
+
+			activeTasks--;
+			if (tasks.empty() && activeTasks == 0)
+				finished.notify_all();
+			continue;
+		}
+
+		if (stopping)
+			return;
+	}
+}
+
+void ThreadPool::runJob (Job& job)
+{
+	while (true)
+	{
+		size_t begin = job.next.fetch_add(job.grain, std::memory_order_relaxed);
+		if (begin >= job.count)
+			return;
+
+		job.function(job.context, begin, std::min(begin + job.grain, job.count));
+	}
+}
+
+void ThreadPool::run (size_t count, size_t grain, RangeFunction function, void *context)
+{
+	if (count == 0)
+		return;
+
+	grain = std::max<size_t>(grain, 1);
+
+	if (workers.empty() || count <= grain)
+	{
+		function(context, 0, count);
+		return;
+	}
+
+	std::lock_guard<std::mutex> serialize(jobMutex);
+
+	Job current;
+	current.function = function;
+	current.context = context;
+	current.count = count;
+	current.grain = grain;
+	current.next.store(0, std::memory_order_relaxed);
+	current.active = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &current;
+		jobGeneration++;
+	}
+	wake.notify_all();
+
+	runJob(current);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	job = nullptr;
+	finished.wait(lock, [&] { return current.active == 0; });
+}
+
+void ThreadPool::submit (std::function<void ()> task)
+{
+	if (workers.empty())
+	{
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::wait ()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&] { return tasks.empty() && activeTasks == 0; });
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of worker threads. parallelFor splits [0, count) in chunks of grain
+ * items and blocks until every chunk ran, the calling thread takes part. It does
+ * not allocate, so it can be used from drawFrame. submit queues fire and forget
+ * tasks, wait blocks until the queue drains.
+ */
+
+class ThreadPool
+{
+private:
+	typedef void (*RangeFunction) (void *context, size_t begin, size_t end);
+
+	struct Job
+	{
+		RangeFunction function;
+		void *context;
+		size_t count;
+		size_t grain;
+		std::atomic<size_t> next;
+		size_t active;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::mutex jobMutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+
+	std::deque<std::function<void ()>> tasks;
+	size_t activeTasks;
+	Job *job;
+	uint64_t jobGeneration;
+	bool stopping;
+
+	void workerLoop ();
+	static void runJob (Job& job);
+	void run (size_t count, size_t grain, RangeFunction function, void *context);
+
+public:
+	explicit ThreadPool (unsigned threadCount = std::thread::hardware_concurrency());
+	~ThreadPool ();
+
+	ThreadPool (const ThreadPool&) = delete;
+	ThreadPool& operator= (const ThreadPool&) = delete;
+
+	/* worker threads plus the caller */
+	unsigned concurrency () const { return static_cast<unsigned>(workers.size()) + 1; }
+
+	template <typename Body>
+	void parallelFor (size_t count, size_t grain, const Body& body)
+	{
+		run(count, grain, [] (void *context, size_t begin, size_t end) {
+			(*static_cast<const Body*>(context))(begin, end);
+		}, const_cast<Body*>(&body));
+	}
+
+	void submit (std::function<void ()> task);
+	void wait ();
+};
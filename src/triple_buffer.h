@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Lock free single producer, single consumer handoff of the latest value.
+ * The writer fills its slot and publishes it, the reader takes the newest
+ * published slot : neither ever waits for the other, a value the reader was
+ * too slow to take is replaced by the next one.
+ *
+ * Three slots : one the writer owns, one the reader owns, and the middle one,
+ * swapped atomically with either side. The slots are constructed once, a T
+ * that owns storage keeps it, so copying into a slot does not allocate.
+ */
+
+template <typename T>
+class TripleBuffer
+{
+private:
+	/* middle slot index in the low bits, FRESH while the reader has not taken it */
+	static const uint32_t FRESH = 4;
+	static const uint32_t INDEX = 3;
+
+	T slots[3];
+	std::atomic<uint32_t> middle;
+	uint32_t back;				/* writer */
+	uint32_t front;				/* reader */
+
+public:
+	TripleBuffer () : middle(2), back(0), front(1) {}
+
+	/* before the threads start : to size every slot */
+	T& slot (uint32_t index) { return slots[index]; }
+
+	/* writer */
+	T& writeSlot () { return slots[back]; }
+
+	void publish ()
+	{
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	/* reader : true when a newer value was taken, readSlot() is the newest either way */
+	bool acquire ()
+	{
+		if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+			return false;
+
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	const T& readSlot () const { return slots[front]; }
+};